@@ -1015,6 +1015,274 @@ void mainSort ( UInt32* ptr,
 #undef CLEARMASK
 
 
+/*---------------------------------------------*/
+/*--- Degenerate-block detection and        ---*/
+/*--- linear-time (SA-IS) rotation sorting  ---*/
+/*---------------------------------------------*/
+
+/*---------------------------------------------*/
+/* Estimates how much of the work budget mainSort
+   would burn on this block, without sorting it.
+   The cost of mainSort is dominated by long repeats:
+   a stretch of L bytes that repeats at distance p
+   costs roughly L*L / (2*p) units of work for short
+   periods, and the quadrant caching caps the
+   effective p at a couple of thousand bytes.  The
+   stretches are found in a single pass, using
+   ftab [0 .. 65535] as a table of the last position
+   of each two-byte context.
+
+   Returns True if the estimate exceeds budget, ie.
+   if mainSort would most likely give up anyway.
+*/
+#define DEGEN_MIN_RUN     64
+#define DEGEN_MAX_PERIOD  2048
+
+static
+Bool isDegenerate ( UChar*  block,
+                    UInt32* ftab,
+                    Int32   nblock,
+                    Int32   budget,
+                    Int32   verb )
+{
+   Int32  i, j, p, run;
+   double work;
+
+   for (i = 0; i < 65536; i++) ftab[i] = 0;
+
+   p = run = 0;
+   work = 0.0;
+   for (i = 1; i <= nblock; i++) {
+      if (i < nblock && p > 0 && block[i] == block[i-p]) {
+         run++;
+      } else {
+         if (run >= DEGEN_MIN_RUN)
+            work += (double)run * (double)run
+                    / (2.0 * (p < DEGEN_MAX_PERIOD ? p : DEGEN_MAX_PERIOD));
+         if (work > (double)budget) break;
+         run = 0;
+         if (i == nblock) break;
+         j = (block[i-1] << 8) | block[i];
+         p = i - (Int32)ftab[j];
+      }
+      ftab[(block[i-1] << 8) | block[i]] = i;
+   }
+
+   if (verb >= 3)
+      VPrintf2 ( "      estimated %.0f work, budget %d\n",
+                 work, budget );
+   return work > (double)budget;
+}
+
+#undef DEGEN_MIN_RUN
+#undef DEGEN_MAX_PERIOD
+
+
+/*---------------------------------------------*/
+/* The rotations of block [0 .. nblock-1] sort in
+   the same order as the first nblock suffixes of
+   the doubled block  block ++ block ++ $, where $
+   is a sentinel smaller than any byte.  So they can
+   be sorted in linear time, however repetitive the
+   block is, by building the suffix array of the
+   doubled block with SA-IS (Nong, Zhang and Chan,
+   "Linear Suffix Array Construction by Almost Pure
+   Induced-Sorting", 2009).
+
+   Level 0 reads the doubled block straight out of
+   s8 [0 .. nb-1] (characters are byte values + 1,
+   the sentinel is 0); the recursive levels work on
+   the reduced string of names, which sais keeps in
+   the top of SA.  Apart from SA itself only n/8
+   bytes of type bits and K+1 bucket counters are
+   needed.
+
+   Equal rotations only exist when the whole block
+   repeats with a period dividing nblock.  They come
+   out in descending index order (the shorter suffix
+   of the doubled block sorts first), whereas mainSort
+   and fallbackSort leave them in whatever order their
+   quicksorts produce.  Equal rotations have equal
+   last characters, so the BWT is unchanged, but
+   origPtr can differ: for such blocks the compressed
+   stream is not byte-identical to the other sorts'
+   output, although any rotation equal to rotation 0
+   decodes to the same block.
+*/
+#define SAIS_CHR(i)                                  \
+   (s8 != NULL                                       \
+      ? ((i) == n-1 ? 0                              \
+                    : (Int32)s8[(i) < nb ? (i) : (i)-nb] + 1) \
+      : s[i])
+#define SAIS_TGET(i)                                 \
+   ((t[(i) >> 3] >> ((i) & 7)) & 1)
+#define SAIS_TSET(i,b)                               \
+   t[(i) >> 3] = (b) ? (UChar)(t[(i) >> 3] | (1 << ((i) & 7)))  \
+                     : (UChar)(t[(i) >> 3] & ~(1 << ((i) & 7)))
+#define SAIS_ISLMS(i)                                \
+   ((i) > 0 && SAIS_TGET(i) && !SAIS_TGET((i)-1))
+
+/*---------------------------------------------*/
+static
+void saisBuckets ( UChar* s8, Int32 nb, Int32* s, Int32 n,
+                   Int32* bkt, Int32 K, Bool end )
+{
+   Int32 i, sum;
+
+   for (i = 0; i <= K; i++) bkt[i] = 0;
+   for (i = 0; i < n; i++) bkt[SAIS_CHR(i)]++;
+   for (i = 0, sum = 0; i <= K; i++) {
+      sum += bkt[i];
+      bkt[i] = end ? sum : sum - bkt[i];
+   }
+}
+
+/*---------------------------------------------*/
+static
+void saisInduce ( UChar* t, Int32* SA,
+                  UChar* s8, Int32 nb, Int32* s, Int32 n,
+                  Int32* bkt, Int32 K )
+{
+   Int32 i, j;
+
+   saisBuckets ( s8, nb, s, n, bkt, K, False );
+   for (i = 0; i < n; i++) {
+      j = SA[i] - 1;
+      if (j >= 0 && !SAIS_TGET(j)) SA[bkt[SAIS_CHR(j)]++] = j;
+   }
+   saisBuckets ( s8, nb, s, n, bkt, K, True );
+   for (i = n-1; i >= 0; i--) {
+      j = SA[i] - 1;
+      if (j >= 0 && SAIS_TGET(j)) SA[--bkt[SAIS_CHR(j)]] = j;
+   }
+}
+
+/*---------------------------------------------*/
+static
+Bool sais ( bz_stream* strm,
+            UChar* s8, Int32 nb, Int32* s,
+            Int32* SA, Int32 n, Int32 K )
+{
+   UChar* t;
+   Int32* bkt;
+   Int32* s1;
+   Int32  i, j, d, n1, name, prev, pos;
+   Bool   diff;
+
+   if (n == 1) { SA[0] = 0; return True; }
+
+   t   = BZALLOC( n / 8 + 1 );
+   bkt = BZALLOC( (K + 1) * sizeof(Int32) );
+   if (t == NULL || bkt == NULL) {
+      if (t   != NULL) BZFREE(t);
+      if (bkt != NULL) BZFREE(bkt);
+      return False;
+   }
+
+   /*-- classify the suffixes: S-type 1, L-type 0 --*/
+   SAIS_TSET(n-1, 1);
+   SAIS_TSET(n-2, 0);
+   for (i = n-3; i >= 0; i--)
+      SAIS_TSET(i, (SAIS_CHR(i) < SAIS_CHR(i+1) ||
+                    (SAIS_CHR(i) == SAIS_CHR(i+1) && SAIS_TGET(i+1))));
+
+   /*-- stage 1: induce-sort the LMS substrings --*/
+   saisBuckets ( s8, nb, s, n, bkt, K, True );
+   for (i = 0; i < n; i++) SA[i] = -1;
+   for (i = 1; i < n; i++)
+      if (SAIS_ISLMS(i)) SA[--bkt[SAIS_CHR(i)]] = i;
+   saisInduce ( t, SA, s8, nb, s, n, bkt, K );
+
+   /*-- compact the sorted LMS substrings into SA [0 .. n1-1] --*/
+   for (i = 0, n1 = 0; i < n; i++)
+      if (SAIS_ISLMS(SA[i])) SA[n1++] = SA[i];
+
+   /*-- name them, storing the names by position in SA [n1 ..] --*/
+   for (i = n1; i < n; i++) SA[i] = -1;
+   for (i = 0, name = 0, prev = -1; i < n1; i++) {
+      pos = SA[i];
+      diff = False;
+      for (d = 0; d < n; d++) {
+         if (prev == -1 ||
+             SAIS_CHR(pos+d) != SAIS_CHR(prev+d) ||
+             SAIS_TGET(pos+d) != SAIS_TGET(prev+d)) {
+            diff = True;
+            break;
+         }
+         if (d > 0 && (SAIS_ISLMS(pos+d) || SAIS_ISLMS(prev+d)))
+            break;
+      }
+      if (diff) { name++; prev = pos; }
+      SA[n1 + pos/2] = name - 1;
+   }
+   for (i = n-1, j = n-1; i >= n1; i--)
+      if (SA[i] >= 0) SA[j--] = SA[i];
+
+   /*-- stage 2: sort the reduced string, recursing if the
+        names are not unique --*/
+   s1 = SA + n - n1;
+   if (name < n1) {
+      if (!sais ( strm, NULL, 0, s1, SA, n1, name-1 )) {
+         BZFREE(bkt);
+         BZFREE(t);
+         return False;
+      }
+   } else {
+      for (i = 0; i < n1; i++) SA[s1[i]] = i;
+   }
+
+   /*-- stage 3: induce the full suffix array from it --*/
+   saisBuckets ( s8, nb, s, n, bkt, K, True );
+   for (i = 1, j = 0; i < n; i++)
+      if (SAIS_ISLMS(i)) s1[j++] = i;
+   for (i = 0; i < n1; i++) SA[i] = s1[SA[i]];
+   for (i = n1; i < n; i++) SA[i] = -1;
+   for (i = n1-1; i >= 0; i--) {
+      j = SA[i];
+      SA[i] = -1;
+      SA[--bkt[SAIS_CHR(j)]] = j;
+   }
+   saisInduce ( t, SA, s8, nb, s, n, bkt, K );
+
+   BZFREE(bkt);
+   BZFREE(t);
+   return True;
+}
+
+#undef SAIS_CHR
+#undef SAIS_TGET
+#undef SAIS_TSET
+#undef SAIS_ISLMS
+
+/*---------------------------------------------*/
+/* Sorts the rotations into ptr [0 .. nblock-1] via
+   the suffix array of the doubled block.  Needs
+   (2*nblock + 1) * 4 bytes of extra memory, about
+   7MB for a 900k block; returns False if that can't
+   be had, so the caller can use fallbackSort.
+*/
+static
+Bool inducedSort ( EState* s )
+{
+   bz_stream* strm = s->strm;
+   Int32  nblock   = s->nblock;
+   Int32  n        = 2 * nblock + 1;
+   Int32* SA;
+   Int32  i, j;
+
+   SA = BZALLOC( n * sizeof(Int32) );
+   if (SA == NULL) return False;
+   if (!sais ( strm, s->block, nblock, NULL, SA, n, 256 )) {
+      BZFREE(SA);
+      return False;
+   }
+   for (i = 0, j = 0; i < n; i++)
+      if (SA[i] < nblock) s->ptr[j++] = (UInt32)SA[i];
+   BZFREE(SA);
+   return True;
+}
+
+
 /*---------------------------------------------*/
 /* Pre:
       nblock > 0
@@ -1065,16 +1333,30 @@ void BZ2_blockSort ( EState* s )
       budgetInit = nblock * ((wfact-1) / 3);
       budget = budgetInit;
 
-      mainSort ( ptr, block, quadrant, ftab, nblock, verb, &budget );
-      if (verb >= 3) 
-         VPrintf3 ( "      %d work, %d block, ratio %5.2f\n",
-                    budgetInit - budget,
-                    nblock, 
-                    (float)(budgetInit - budget) /
-                    (float)(nblock==0 ? 1 : nblock) ); 
-      if (budget < 0) {
+      /* Blocks that mainSort would give up on anyway (long
+         runs, short periods) go straight to the linear-time
+         sort, instead of wasting the whole budget first.
+      */
+      if (isDegenerate ( block, ftab, nblock, budgetInit, verb )) {
+         if (verb >= 2) 
+            VPrintf0 ( "    degenerate block; using induced"
+                       " sorting algorithm\n" );
+         budget = -1;
+      } else {
+         mainSort ( ptr, block, quadrant, ftab, nblock, verb, &budget );
+         if (verb >= 3) 
+            VPrintf3 ( "      %d work, %d block, ratio %5.2f\n",
+                       budgetInit - budget,
+                       nblock, 
+                       (float)(budgetInit - budget) /
+                       (float)(nblock==0 ? 1 : nblock) ); 
+         if (budget < 0 && verb >= 2) 
+            VPrintf0 ( "    too repetitive; using induced"
+                       " sorting algorithm\n" );
+      }
+      if (budget < 0 && !inducedSort ( s )) {
          if (verb >= 2) 
-            VPrintf0 ( "    too repetitive; using fallback"
+            VPrintf0 ( "    out of memory; using fallback"
                        " sorting algorithm\n" );
          fallbackSort ( s->arr1, s->arr2, ftab, nblock, verb );
       }
@@ -0,0 +1,140 @@
+#include "bsdiff_simd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <time.h>
+#endif
+
+//------------------------------------------------------------------------------
+
+// 向量化内核的benchmark：每个CPU支持的实现级别分别在对齐和不对齐的buffer上测速，
+// 同时与逐字节的参考实现核对结果
+
+static double nowSeconds(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+static const char* levelName(int level)
+{
+    switch (level) {
+    case BSDIFF_SIMD_NONE: return "generic";
+    case BSDIFF_SIMD_SSE2: return "sse2";
+    case BSDIFF_SIMD_AVX2: return "avx2";
+    case BSDIFF_SIMD_NEON: return "neon";
+    default:               return "?";
+    }
+}
+
+static unsigned randState = 12345;
+
+static unsigned char randByte(void)
+{
+    randState = randState * 1103515245 + 12345;
+    return (unsigned char)(randState >> 16);
+}
+
+// 在dst/src偏移offset处测size字节的bsdiff_AddBytes，返回MB/s；结果不对时返回-1
+static double benchAdd(unsigned char *dst, unsigned char *src, unsigned char *ref, size_t size,
+                       size_t offset, int rounds)
+{
+    double start, elapsed;
+    size_t i;
+    int r;
+
+    for (i = 0; i < size; ++i) {
+        dst[offset + i] = randByte();
+        src[offset + i] = randByte();
+        ref[i] = (unsigned char)(dst[offset + i] + src[offset + i]);
+    }
+    bsdiff_AddBytes(dst + offset, src + offset, size);
+    if (memcmp(dst + offset, ref, size) != 0)
+        return -1;
+
+    start = nowSeconds();
+    for (r = 0; r < rounds; ++r)
+        bsdiff_AddBytes(dst + offset, src + offset, size);
+    elapsed = nowSeconds() - start;
+    return elapsed > 0 ? (double)size * rounds / elapsed / (1024 * 1024) : 0;
+}
+
+// 测bsdiff_ZeroLen扫描size字节全0数据的速度（最后一个字节非0），返回MB/s；结果不对时返回-1
+static double benchZero(unsigned char *buf, size_t size, size_t offset, int rounds)
+{
+    double start, elapsed;
+    size_t sum = 0;
+    int r;
+
+    memset(buf + offset, 0, size);
+    buf[offset + size - 1] = 1;
+    if (bsdiff_ZeroLen(buf + offset, size) != size - 1)
+        return -1;
+
+    start = nowSeconds();
+    for (r = 0; r < rounds; ++r)
+        sum += bsdiff_ZeroLen(buf + offset, size);
+    elapsed = nowSeconds() - start;
+    if (sum != (size_t)rounds * (size - 1))
+        return -1;
+    return elapsed > 0 ? (double)size * rounds / elapsed / (1024 * 1024) : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    // 64KB在L2内，16MB接近打补丁时的window在内存中的情况
+    static const size_t sizes[] = { 64 * 1024, 16 * 1024 * 1024 };
+    static const size_t offsets[] = { 0, 1, 3 };
+    size_t total = 16 * 1024 * 1024 + 64, s, o;
+    unsigned char *dst, *src, *ref;
+    double addSpeed, zeroSpeed;
+    int level, rounds, ok = 1;
+
+    (void)argc;
+    (void)argv;
+
+    dst = (unsigned char*)malloc(total);
+    src = (unsigned char*)malloc(total);
+    ref = (unsigned char*)malloc(total);
+    if (!dst || !src || !ref) {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    printf("%-8s %10s %7s %14s %14s\n", "level", "size", "offset", "add MB/s", "zero MB/s");
+    for (level = BSDIFF_SIMD_NONE; level <= BSDIFF_SIMD_NEON; ++level) {
+        if (!bsdiff_SimdSetLevel(level))
+            continue;
+        for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            // 每项大约处理1GB数据
+            rounds = (int)((size_t)1024 * 1024 * 1024 / sizes[s]);
+            for (o = 0; o < sizeof(offsets) / sizeof(offsets[0]); ++o) {
+                addSpeed = benchAdd(dst, src, ref, sizes[s], offsets[o], rounds);
+                zeroSpeed = benchZero(dst, sizes[s], offsets[o], rounds);
+                if (addSpeed < 0 || zeroSpeed < 0)
+                    ok = 0;
+                printf("%-8s %10u %7u %14.0f %14.0f%s\n", levelName(level), (unsigned)sizes[s],
+                       (unsigned)offsets[o], addSpeed, zeroSpeed,
+                       addSpeed < 0 || zeroSpeed < 0 ? "  MISMATCH" : "");
+            }
+        }
+    }
+
+    free(dst);
+    free(src);
+    free(ref);
+    return ok ? 0 : 1;
+}
+
+//------------------------------------------------------------------------------
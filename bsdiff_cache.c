@@ -0,0 +1,171 @@
+#include "bsdiff_diff.h"
+#include "bsdiff_misc.h"
+#include "bsdiff_hash.h"
+#include "bsdiff_filter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+
+/* 按内容寻址的patch缓存：cacheDir中的文件名就是内容的hash（16位十六进制）
+    <XXH64(old)>-<XXH64(new)>-<key>.patch   --> 生成过的patch，key为影响patch的选项以及两个文件长度的hash
+    <XXH64(old)>-<filter>.index             --> 按filter过滤后的old的后缀数组索引（见bsdiff_index.h）
+   两种文件都是先写临时文件再改名，多个进程可以同时使用同一个cacheDir。
+   缓存不会自动清理，其中的任何文件都可以随时删除 */
+
+#define CACHE_VERSION  3    // patch的格式或者生成的内容变化时增加，使以前缓存的patch失效
+
+// 影响生成的patch的选项；线程数、索引文件、映射和bzip2的工作量系数只影响速度，不在其中。
+// maxMemory > 0时窗口的大小与后缀数组算法有关，这一项也要算进去
+static unsigned long long optionsKey(const bsdiff_diff_options *options, bsdiff_off_t oldSize, bsdiff_off_t newSize)
+{
+    bsdiff_off_t fields[17];
+    unsigned char buf[sizeof(fields) / sizeof(fields[0]) * 8];
+    int n = 0, i;
+
+    fields[n++] = CACHE_VERSION;
+    fields[n++] = oldSize;
+    fields[n++] = newSize;
+    fields[n++] = options->ctrlCodec;
+    fields[n++] = options->diffCodec;
+    fields[n++] = options->extraCodec;
+    fields[n++] = options->compressLevel;
+    fields[n++] = (bsdiff_off_t)options->frameSize;
+    fields[n++] = options->zeroRuns != 0;
+    fields[n++] = options->stream != 0;
+    fields[n++] = options->scanChunks > 1 ? options->scanChunks : 1;
+    fields[n++] = (bsdiff_off_t)options->maxMemory;
+    fields[n++] = options->filter;
+    fields[n++] = options->matcher;
+    fields[n++] = options->inplace ? 1 + (bsdiff_off_t)options->inplaceScratch : 0;
+    fields[n++] = options->checksum != 0;
+    fields[n++] = options->maxMemory ? options->saAlgorithm : 0;
+    for (i = 0; i < n; ++i)
+        bsdiff_WriteOffset(fields[i], buf + i * 8);
+    return bsdiff_Xxh64(buf, (size_t)n * 8, 0);
+}
+
+int bsdiff_diff_cached(const char *oldFile, const char *newFile, const char *patchFile, const char *cacheDir,
+                       const bsdiff_diff_options *options, int *hit, char error[64])
+{
+    int retCode = 0;
+    FILE *fp = NULL;
+    bsdiff_filedata oldData, newData;
+    bsdiff_diff_options cacheOptions;
+    unsigned long long oldHash, newHash;
+    char *patchPath = NULL, *indexPath = NULL, *tempPath = NULL;
+    size_t len;
+    double readStart, readSeconds;
+    int filter, haveTemp = 0;
+
+    if (options)
+        cacheOptions = *options;
+    else
+        bsdiff_diff_options_init(&cacheOptions);
+    if (hit)
+        *hit = 0;
+
+    memset(&oldData, 0, sizeof(oldData));
+    memset(&newData, 0, sizeof(newData));
+
+    // 映射（或读入）两个文件并计算hash，命中时这就是全部的工作；时间都算在READ中
+    readStart = bsdiff_Now();
+    if (!bsdiff_LoadFile(oldFile, cacheOptions.useMapping, &oldData, "oldFile", error))
+        goto MyExit;
+    if (!bsdiff_LoadFile(newFile, cacheOptions.useMapping, &newData, "newFile", error))
+        goto MyExit;
+    oldHash = bsdiff_Xxh64(oldData.data, (size_t)oldData.size, 0);
+    newHash = bsdiff_Xxh64(newData.data, (size_t)newData.size, 0);
+    readSeconds = bsdiff_Now() - readStart;
+
+    len = strlen(cacheDir) + 80;
+    if (!(patchPath = (char*)malloc(len)) || !(indexPath = (char*)malloc(len)) ||
+        !(tempPath = (char*)malloc(len))) {
+        bsdiff_SetError(error, "Out of memory");
+        goto MyExit;
+    }
+    sprintf(patchPath, "%s%c%016llx-%016llx-%016llx.patch", cacheDir, BSDIFF_PATH_SEP, oldHash, newHash,
+            optionsKey(&cacheOptions, oldData.size, newData.size));
+    sprintf(tempPath, "%s.%d.tmp", patchPath, bsdiff_GetProcessId());
+    if (!bsdiff_MakeDir(cacheDir)) {
+        bsdiff_SetError(error, "Can't create cacheDir");
+        goto MyExit;
+    }
+
+    // 命中：直接复制缓存的patch
+    if ((fp = fopen(patchPath, "rb")) != NULL) {
+        fclose(fp);
+        fp = NULL;
+        if (!bsdiff_CopyFile(patchPath, patchFile)) {
+            bsdiff_SetError(error, "Can't write patchFile");
+            goto MyExit;
+        }
+        if (cacheOptions.stats) {
+            memset(cacheOptions.stats, 0, sizeof(bsdiff_stats));
+            cacheOptions.stats->phases[BSDIFF_PHASE_READ].seconds = readSeconds;
+            cacheOptions.stats->phases[BSDIFF_PHASE_READ].bytes = oldData.size + newData.size;
+            cacheOptions.stats->seconds = readSeconds;
+        }
+        if (hit)
+            *hit = 1;
+        retCode = 1;
+        goto MyExit;
+    }
+
+    // 未命中：没有指定索引文件时使用缓存中old的索引，同一个old的下一次diff（只有newFile变了）不用再排序。
+    // 索引的是过滤后的old，所以按实际使用的过滤器（与diff中的选择相同）分别存放
+    filter = cacheOptions.filter == BSDIFF_FILTER_AUTO ?
+             (cacheOptions.inplace ? BSDIFF_FILTER_NONE : bsdiff_FilterDetect(newData.data, (size_t)newData.size)) :
+             cacheOptions.filter;
+    if (!cacheOptions.indexFile && cacheOptions.matcher == BSDIFF_MATCH_SUFFIX) {
+        sprintf(indexPath, "%s%c%016llx-%d.index", cacheDir, BSDIFF_PATH_SEP, oldHash, filter);
+        cacheOptions.indexFile = indexPath;
+    }
+
+    // patch先写到cacheDir中的临时文件，完整以后改名放进缓存，再复制成patchFile
+    if (!(fp = fopen(tempPath, "wb"))) {
+        bsdiff_SetError(error, "Can't write cacheDir");
+        goto MyExit;
+    }
+    haveTemp = 1;
+    if (!bsdiff_diff_mem(oldData.data, (size_t)oldData.size, newData.data, (size_t)newData.size,
+                         bsdiff_FileSink, fp, NULL, &cacheOptions, error))
+        goto MyExit;
+    if (cacheOptions.stats) {
+        cacheOptions.stats->phases[BSDIFF_PHASE_READ].seconds += readSeconds;
+        cacheOptions.stats->phases[BSDIFF_PHASE_READ].bytes += oldData.size + newData.size;
+        cacheOptions.stats->seconds += readSeconds;
+    }
+    if (fclose(fp)) {
+        fp = NULL;
+        bsdiff_SetError(error, "Can't write cacheDir");
+        goto MyExit;
+    }
+    fp = NULL;
+    if (!bsdiff_RenameFile(tempPath, patchPath)) {
+        bsdiff_SetError(error, "Can't write cacheDir");
+        goto MyExit;
+    }
+    haveTemp = 0;
+    if (!bsdiff_CopyFile(patchPath, patchFile)) {
+        bsdiff_SetError(error, "Can't write patchFile");
+        goto MyExit;
+    }
+
+    retCode = 1;
+
+MyExit:
+    if (fp)
+        fclose(fp);
+    if (haveTemp)
+        remove(tempPath);
+    free(patchPath);
+    free(indexPath);
+    free(tempPath);
+    bsdiff_FreeFile(&oldData);
+    bsdiff_FreeFile(&newData);
+    return retCode;
+}
+
+//------------------------------------------------------------------------------
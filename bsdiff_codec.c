@@ -0,0 +1,597 @@
+#include "bsdiff_codec.h"
+#include <string.h>
+#include "bzlib.h"
+#ifdef BSDIFF_WITH_ZSTD
+  #include <zstd.h>
+#endif
+#ifdef BSDIFF_WITH_LZMA
+  #include <lzma.h>
+#endif
+#ifdef BSDIFF_WITH_BROTLI
+  #include <brotli/encode.h>
+  #include <brotli/decode.h>
+#endif
+
+#define MIN_SIZE(x,y) (((x)<(y)) ? (x) : (y))
+
+//------------------------------------------------------------------------------
+
+// 每个codec的编解码实现。encRun的finish为0时只消耗输入（输出可能留在压缩器内部），
+// 为1时表示这是最后的输入，要一直推进到流结束；encInit的size小于0表示总长度未知
+typedef struct codecImpl {
+    const char *name;
+    int defaultLevel;
+    void* (*encInit)(int level, int workFactor, bsdiff_off_t size, const bsdiff_allocator *allocator);
+    int (*encRun)(void *state, const unsigned char **in, size_t *inLen, unsigned char **out, size_t *outLen,
+                  int finish);
+    void (*encEnd)(void *state, const bsdiff_allocator *allocator);
+    void* (*decInit)(int small, const bsdiff_allocator *allocator);
+    int (*decRun)(void *state, const unsigned char **in, size_t *inLen, unsigned char **out, size_t *outLen);
+    void (*decEnd)(void *state, const bsdiff_allocator *allocator);
+} codecImpl;
+
+//------------------------------------------------------------------------------
+
+// bz_stream的avail_in/avail_out是unsigned int，每次最多给1GB
+static unsigned int bzChunk(size_t len)
+{
+    return len < 0x40000000 ? (unsigned int)len : 0x40000000;
+}
+
+static bz_stream* bzCreate(const bsdiff_allocator *allocator)
+{
+    bz_stream *strm = (bz_stream*)bsdiff_Alloc(allocator, sizeof(bz_stream));
+
+    if (strm) {
+        memset(strm, 0, sizeof(bz_stream));
+        strm->bzalloc = bsdiff_BzAlloc;
+        strm->bzfree = bsdiff_BzFree;
+        strm->opaque = (void*)allocator;
+    }
+    return strm;
+}
+
+// 调用一次compress（compress为1时是BZ_RUN，为2时是BZ_FINISH）或decompress并推进两边的指针
+static int bzStep(bz_stream *strm, int compress, const unsigned char **in, size_t *inLen,
+                  unsigned char **out, size_t *outLen)
+{
+    unsigned int n = bzChunk(*inLen), m = bzChunk(*outLen);
+    int ret;
+
+    strm->next_in = (char*)*in;
+    strm->avail_in = n;
+    strm->next_out = (char*)*out;
+    strm->avail_out = m;
+    // 剩余的输入都交给bzip2以后才能进入BZ_FINISH
+    if (compress)
+        ret = BZ2_bzCompress(strm, compress == 2 && *inLen <= n ? BZ_FINISH : BZ_RUN);
+    else
+        ret = BZ2_bzDecompress(strm);
+    *in += n - strm->avail_in;
+    *inLen -= n - strm->avail_in;
+    *out += m - strm->avail_out;
+    *outLen -= m - strm->avail_out;
+
+    if (ret == BZ_STREAM_END)
+        return BSDIFF_CODEC_END;
+    if (ret == BZ_OK || ret == BZ_RUN_OK || ret == BZ_FINISH_OK)
+        return BSDIFF_CODEC_OK;
+    return BSDIFF_CODEC_ERROR;
+}
+
+static void* bzEncInit(int level, int workFactor, bsdiff_off_t size, const bsdiff_allocator *allocator)
+{
+    bz_stream *strm = bzCreate(allocator);
+
+    (void)size;
+    if (strm && BZ2_bzCompressInit(strm, level, 0, workFactor) != BZ_OK) {
+        bsdiff_Free(allocator, strm);
+        strm = NULL;
+    }
+    return strm;
+}
+
+static int bzEncRun(void *state, const unsigned char **in, size_t *inLen, unsigned char **out, size_t *outLen,
+                    int finish)
+{
+    return bzStep((bz_stream*)state, finish ? 2 : 1, in, inLen, out, outLen);
+}
+
+static void bzEncEnd(void *state, const bsdiff_allocator *allocator)
+{
+    BZ2_bzCompressEnd((bz_stream*)state);
+    bsdiff_Free(allocator, state);
+}
+
+static void* bzDecInit(int small, const bsdiff_allocator *allocator)
+{
+    bz_stream *strm = bzCreate(allocator);
+
+    if (strm && BZ2_bzDecompressInit(strm, 0, small ? 1 : 0) != BZ_OK) {
+        bsdiff_Free(allocator, strm);
+        strm = NULL;
+    }
+    return strm;
+}
+
+static int bzDecRun(void *state, const unsigned char **in, size_t *inLen, unsigned char **out, size_t *outLen)
+{
+    return bzStep((bz_stream*)state, 0, in, inLen, out, outLen);
+}
+
+static void bzDecEnd(void *state, const bsdiff_allocator *allocator)
+{
+    BZ2_bzDecompressEnd((bz_stream*)state);
+    bsdiff_Free(allocator, state);
+}
+
+//------------------------------------------------------------------------------
+
+#ifdef BSDIFF_WITH_ZSTD
+
+// zstd的自定义分配器只在ZSTD_STATIC_LINKING_ONLY的实验性API中提供，这里的上下文总是用malloc分配
+
+static void* zstdEncInit(int level, int workFactor, bsdiff_off_t size, const bsdiff_allocator *allocator)
+{
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+
+    (void)workFactor;
+    (void)allocator;
+    if (cctx && (ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level)) ||
+                 ZSTD_isError(ZSTD_CCtx_setPledgedSrcSize(cctx, size < 0 ? ZSTD_CONTENTSIZE_UNKNOWN : 
+                                                                           (unsigned long long)size)))) {
+        ZSTD_freeCCtx(cctx);
+        cctx = NULL;
+    }
+    return cctx;
+}
+
+static int zstdEncRun(void *state, const unsigned char **in, size_t *inLen, unsigned char **out, size_t *outLen,
+                      int finish)
+{
+    ZSTD_inBuffer input;
+    ZSTD_outBuffer output;
+    size_t ret;
+
+    input.src = *in;
+    input.size = *inLen;
+    input.pos = 0;
+    output.dst = *out;
+    output.size = *outLen;
+    output.pos = 0;
+    ret = ZSTD_compressStream2((ZSTD_CCtx*)state, &output, &input, finish ? ZSTD_e_end : ZSTD_e_continue);
+    *in += input.pos;
+    *inLen -= input.pos;
+    *out += output.pos;
+    *outLen -= output.pos;
+
+    if (ZSTD_isError(ret))
+        return BSDIFF_CODEC_ERROR;
+    return finish && ret == 0 ? BSDIFF_CODEC_END : BSDIFF_CODEC_OK;
+}
+
+static void zstdEncEnd(void *state, const bsdiff_allocator *allocator)
+{
+    (void)allocator;
+    ZSTD_freeCCtx((ZSTD_CCtx*)state);
+}
+
+static void* zstdDecInit(int small, const bsdiff_allocator *allocator)
+{
+    (void)small;
+    (void)allocator;
+    return ZSTD_createDCtx();
+}
+
+static int zstdDecRun(void *state, const unsigned char **in, size_t *inLen, unsigned char **out, size_t *outLen)
+{
+    ZSTD_inBuffer input;
+    ZSTD_outBuffer output;
+    size_t ret;
+
+    input.src = *in;
+    input.size = *inLen;
+    input.pos = 0;
+    output.dst = *out;
+    output.size = *outLen;
+    output.pos = 0;
+    ret = ZSTD_decompressStream((ZSTD_DCtx*)state, &output, &input);
+    *in += input.pos;
+    *inLen -= input.pos;
+    *out += output.pos;
+    *outLen -= output.pos;
+
+    // 返回0表示一个frame已经完整解码并全部输出
+    if (ZSTD_isError(ret))
+        return BSDIFF_CODEC_ERROR;
+    return ret == 0 ? BSDIFF_CODEC_END : BSDIFF_CODEC_OK;
+}
+
+static void zstdDecEnd(void *state, const bsdiff_allocator *allocator)
+{
+    (void)allocator;
+    ZSTD_freeDCtx((ZSTD_DCtx*)state);
+}
+
+#endif  // BSDIFF_WITH_ZSTD
+
+//------------------------------------------------------------------------------
+
+#ifdef BSDIFF_WITH_LZMA
+
+typedef struct lzmaState {
+    lzma_stream strm;
+    lzma_allocator allocator;
+} lzmaState;
+
+static void* lzmaAlloc(void *opaque, size_t nmemb, size_t size)
+{
+    return bsdiff_Alloc((const bsdiff_allocator*)opaque, nmemb * size);
+}
+
+static void lzmaFree(void *opaque, void *ptr)
+{
+    bsdiff_Free((const bsdiff_allocator*)opaque, ptr);
+}
+
+static lzmaState* lzmaCreate(const bsdiff_allocator *allocator)
+{
+    lzmaState *s = (lzmaState*)bsdiff_Alloc(allocator, sizeof(lzmaState));
+    lzma_stream init = LZMA_STREAM_INIT;
+
+    if (s) {
+        memset(s, 0, sizeof(lzmaState));
+        s->strm = init;
+        s->allocator.alloc = lzmaAlloc;
+        s->allocator.free = lzmaFree;
+        s->allocator.opaque = (void*)allocator;
+        s->strm.allocator = &s->allocator;
+    }
+    return s;
+}
+
+static int lzmaStep(lzmaState *s, lzma_action action, const unsigned char **in, size_t *inLen,
+                    unsigned char **out, size_t *outLen)
+{
+    lzma_ret ret;
+
+    s->strm.next_in = *in;
+    s->strm.avail_in = *inLen;
+    s->strm.next_out = *out;
+    s->strm.avail_out = *outLen;
+    ret = lzma_code(&s->strm, action);
+    *in += *inLen - s->strm.avail_in;
+    *inLen = s->strm.avail_in;
+    *out += *outLen - s->strm.avail_out;
+    *outLen = s->strm.avail_out;
+
+    if (ret == LZMA_STREAM_END)
+        return BSDIFF_CODEC_END;
+    return ret == LZMA_OK ? BSDIFF_CODEC_OK : BSDIFF_CODEC_ERROR;
+}
+
+static void* lzmaEncInit(int level, int workFactor, bsdiff_off_t size, const bsdiff_allocator *allocator)
+{
+    lzmaState *s = lzmaCreate(allocator);
+
+    (void)workFactor;
+    (void)size;
+    if (s && lzma_easy_encoder(&s->strm, (uint32_t)level, LZMA_CHECK_CRC32) != LZMA_OK) {
+        lzma_end(&s->strm);
+        bsdiff_Free(allocator, s);
+        s = NULL;
+    }
+    return s;
+}
+
+static int lzmaEncRun(void *state, const unsigned char **in, size_t *inLen, unsigned char **out, size_t *outLen,
+                      int finish)
+{
+    return lzmaStep((lzmaState*)state, finish ? LZMA_FINISH : LZMA_RUN, in, inLen, out, outLen);
+}
+
+static void* lzmaDecInit(int small, const bsdiff_allocator *allocator)
+{
+    lzmaState *s = lzmaCreate(allocator);
+
+    (void)small;
+    if (s && lzma_stream_decoder(&s->strm, UINT64_MAX, 0) != LZMA_OK) {
+        lzma_end(&s->strm);
+        bsdiff_Free(allocator, s);
+        s = NULL;
+    }
+    return s;
+}
+
+static int lzmaDecRun(void *state, const unsigned char **in, size_t *inLen, unsigned char **out, size_t *outLen)
+{
+    return lzmaStep((lzmaState*)state, LZMA_RUN, in, inLen, out, outLen);
+}
+
+static void lzmaEnd(void *state, const bsdiff_allocator *allocator)
+{
+    lzma_end(&((lzmaState*)state)->strm);
+    bsdiff_Free(allocator, state);
+}
+
+#endif  // BSDIFF_WITH_LZMA
+
+//------------------------------------------------------------------------------
+
+#ifdef BSDIFF_WITH_BROTLI
+
+static void* brotliAlloc(void *opaque, size_t size)
+{
+    return bsdiff_Alloc((const bsdiff_allocator*)opaque, size);
+}
+
+static void brotliFree(void *opaque, void *ptr)
+{
+    bsdiff_Free((const bsdiff_allocator*)opaque, ptr);
+}
+
+static void* brotliEncInit(int level, int workFactor, bsdiff_off_t size, const bsdiff_allocator *allocator)
+{
+    BrotliEncoderState *s = BrotliEncoderCreateInstance(brotliAlloc, brotliFree, (void*)allocator);
+
+    (void)workFactor;
+    if (s && (!BrotliEncoderSetParameter(s, BROTLI_PARAM_QUALITY, (uint32_t)level) ||
+              !BrotliEncoderSetParameter(s, BROTLI_PARAM_SIZE_HINT, 
+                                         size < 0 ? 0 : size < 0x40000000 ? (uint32_t)size : 0x40000000))) {
+        BrotliEncoderDestroyInstance(s);
+        s = NULL;
+    }
+    return s;
+}
+
+static int brotliEncRun(void *state, const unsigned char **in, size_t *inLen, unsigned char **out, size_t *outLen,
+                        int finish)
+{
+    BrotliEncoderState *s = (BrotliEncoderState*)state;
+
+    if (!BrotliEncoderCompressStream(s, finish ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS, 
+                                     inLen, in, outLen, out, NULL))
+        return BSDIFF_CODEC_ERROR;
+    return finish && BrotliEncoderIsFinished(s) ? BSDIFF_CODEC_END : BSDIFF_CODEC_OK;
+}
+
+static void brotliEncEnd(void *state, const bsdiff_allocator *allocator)
+{
+    (void)allocator;
+    BrotliEncoderDestroyInstance((BrotliEncoderState*)state);
+}
+
+static void* brotliDecInit(int small, const bsdiff_allocator *allocator)
+{
+    (void)small;
+    return BrotliDecoderCreateInstance(brotliAlloc, brotliFree, (void*)allocator);
+}
+
+static int brotliDecRun(void *state, const unsigned char **in, size_t *inLen, unsigned char **out, size_t *outLen)
+{
+    switch (BrotliDecoderDecompressStream((BrotliDecoderState*)state, inLen, in, outLen, out, NULL)) {
+    case BROTLI_DECODER_RESULT_SUCCESS:
+        return BSDIFF_CODEC_END;
+    case BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT:
+    case BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT:
+        return BSDIFF_CODEC_OK;
+    default:
+        return BSDIFF_CODEC_ERROR;
+    }
+}
+
+static void brotliDecEnd(void *state, const bsdiff_allocator *allocator)
+{
+    (void)allocator;
+    BrotliDecoderDestroyInstance((BrotliDecoderState*)state);
+}
+
+#endif  // BSDIFF_WITH_BROTLI
+
+//------------------------------------------------------------------------------
+
+// 按BSDIFF_CODEC_xxx的顺序排列，没有编译进来的codec只有名字
+static const codecImpl codecTable[BSDIFF_CODEC_COUNT] = {
+    { "bzip2", 9, bzEncInit, bzEncRun, bzEncEnd, bzDecInit, bzDecRun, bzDecEnd },
+#ifdef BSDIFF_WITH_ZSTD
+    { "zstd", 19, zstdEncInit, zstdEncRun, zstdEncEnd, zstdDecInit, zstdDecRun, zstdDecEnd },
+#else
+    { "zstd", 0, NULL, NULL, NULL, NULL, NULL, NULL },
+#endif
+#ifdef BSDIFF_WITH_LZMA
+    { "lzma", 6, lzmaEncInit, lzmaEncRun, lzmaEnd, lzmaDecInit, lzmaDecRun, lzmaEnd },
+#else
+    { "lzma", 0, NULL, NULL, NULL, NULL, NULL, NULL },
+#endif
+#ifdef BSDIFF_WITH_BROTLI
+    { "brotli", 11, brotliEncInit, brotliEncRun, brotliEncEnd, brotliDecInit, brotliDecRun, brotliDecEnd },
+#else
+    { "brotli", 0, NULL, NULL, NULL, NULL, NULL, NULL },
+#endif
+};
+
+static const codecImpl* findImpl(int codec)
+{
+    if (codec < 0 || codec >= BSDIFF_CODEC_COUNT || !codecTable[codec].encInit)
+        return NULL;
+    return &codecTable[codec];
+}
+
+int bsdiff_CodecAvailable(int codec)
+{
+    return findImpl(codec) != NULL;
+}
+
+const char* bsdiff_CodecName(int codec)
+{
+    if (codec < 0 || codec >= BSDIFF_CODEC_COUNT)
+        return NULL;
+    return codecTable[codec].name;
+}
+
+int bsdiff_CodecFind(const char *name)
+{
+    int i;
+
+    // xz是lzma的别名（输出的就是xz格式）
+    if (strcmp(name, "xz") == 0)
+        return BSDIFF_CODEC_LZMA;
+    for (i = 0; i < BSDIFF_CODEC_COUNT; ++i) {
+        if (strcmp(name, codecTable[i].name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// 保证out中至少还有1字节的空间：压缩后的数据一般远小于原始数据，先按原始尺寸的1/8分配，不够时再加倍
+static int encoderReserve(bsdiff_encoder *enc)
+{
+    unsigned char *newBuf;
+
+    if (enc->used < enc->capacity)
+        return 1;
+    if (!(newBuf = (unsigned char*)bsdiff_Alloc(enc->allocator, enc->capacity * 2)))
+        return 0;
+    memcpy(newBuf, enc->out, enc->used);
+    bsdiff_Free(enc->allocator, enc->out);
+    enc->out = newBuf;
+    enc->capacity *= 2;
+    return 1;
+}
+
+// 把len字节交给压缩器；finish为0时直到输入全部消耗，为1时直到流结束
+static int encoderRun(bsdiff_encoder *enc, const unsigned char *in, size_t inLen, int finish)
+{
+    const codecImpl *impl = (const codecImpl*)enc->impl;
+    unsigned char *next;
+    size_t avail;
+    int ret;
+
+    while (finish || inLen > 0) {
+        if (!encoderReserve(enc))
+            return 0;
+        next = enc->out + enc->used;
+        avail = enc->capacity - enc->used;
+        ret = impl->encRun(enc->state, &in, &inLen, &next, &avail, finish);
+        enc->used = (size_t)(next - enc->out);
+        if (ret == BSDIFF_CODEC_END)
+            return 1;
+        if (ret != BSDIFF_CODEC_OK)
+            return 0;
+    }
+    return 1;
+}
+
+int bsdiff_EncoderInit(bsdiff_encoder *enc, int codec, int level, int workFactor, bsdiff_off_t sizeHint,
+                       const bsdiff_allocator *allocator)
+{
+    const codecImpl *impl = findImpl(codec);
+
+    memset(enc, 0, sizeof(bsdiff_encoder));
+    enc->allocator = allocator;
+    enc->capacity = (size_t)((sizeHint > 0 ? sizeHint : BSDIFF_ENCODER_CHUNK) / 8) + 4096;
+    if (!impl || !(enc->out = (unsigned char*)bsdiff_Alloc(allocator, enc->capacity)))
+        return 0;
+    if (!(enc->state = impl->encInit(level > 0 ? level : impl->defaultLevel, workFactor, sizeHint, allocator))) {
+        bsdiff_Free(allocator, enc->out);
+        enc->out = NULL;
+        return 0;
+    }
+    enc->impl = impl;
+    return 1;
+}
+
+int bsdiff_EncoderWrite(bsdiff_encoder *enc, const unsigned char *data, size_t len)
+{
+    size_t n;
+
+    // 先补满上次剩下的一段
+    if (enc->staged) {
+        n = MIN_SIZE(len, BSDIFF_ENCODER_CHUNK - enc->staged);
+        memcpy(enc->stage + enc->staged, data, n);
+        enc->staged += n;
+        data += n;
+        len -= n;
+        if (enc->staged < BSDIFF_ENCODER_CHUNK)
+            return 1;
+        enc->staged = 0;
+        if (!encoderRun(enc, enc->stage, BSDIFF_ENCODER_CHUNK, 0))
+            return 0;
+    }
+
+    // 整段的直接交给压缩器，不足一段的留到下次
+    for (; len >= BSDIFF_ENCODER_CHUNK; data += BSDIFF_ENCODER_CHUNK, len -= BSDIFF_ENCODER_CHUNK) {
+        if (!encoderRun(enc, data, BSDIFF_ENCODER_CHUNK, 0))
+            return 0;
+    }
+    if (len) {
+        if (!enc->stage && !(enc->stage = (unsigned char*)bsdiff_Alloc(enc->allocator, BSDIFF_ENCODER_CHUNK)))
+            return 0;
+        memcpy(enc->stage, data, len);
+        enc->staged = len;
+    }
+    return 1;
+}
+
+int bsdiff_EncoderFinish(bsdiff_encoder *enc, unsigned char **out, bsdiff_off_t *outLen)
+{
+    *out = NULL;
+    if (!encoderRun(enc, enc->stage, enc->staged, 1))
+        return 0;
+    *out = enc->out;
+    *outLen = (bsdiff_off_t)enc->used;
+    enc->out = NULL;
+    return 1;
+}
+
+void bsdiff_EncoderEnd(bsdiff_encoder *enc)
+{
+    if (enc->impl)
+        ((const codecImpl*)enc->impl)->encEnd(enc->state, enc->allocator);
+    bsdiff_Free(enc->allocator, enc->out);
+    bsdiff_Free(enc->allocator, enc->stage);
+    memset(enc, 0, sizeof(bsdiff_encoder));
+}
+
+int bsdiff_Compress(int codec, int level, int workFactor, const unsigned char *data, bsdiff_off_t len,
+                    const bsdiff_allocator *allocator, unsigned char **out, bsdiff_off_t *outLen)
+{
+    bsdiff_encoder enc;
+    int ok;
+
+    *out = NULL;
+    ok = bsdiff_EncoderInit(&enc, codec, level, workFactor, len, allocator) &&
+         bsdiff_EncoderWrite(&enc, data, (size_t)len) &&
+         bsdiff_EncoderFinish(&enc, out, outLen);
+    bsdiff_EncoderEnd(&enc);
+    return ok;
+}
+
+//------------------------------------------------------------------------------
+
+int bsdiff_DecoderInit(bsdiff_decoder *dec, int codec, int small, const bsdiff_allocator *allocator)
+{
+    const codecImpl *impl = findImpl(codec);
+
+    memset(dec, 0, sizeof(bsdiff_decoder));
+    if (!impl || !(dec->state = impl->decInit(small, allocator)))
+        return 0;
+    dec->impl = impl;
+    dec->allocator = allocator;
+    return 1;
+}
+
+int bsdiff_DecoderRun(bsdiff_decoder *dec, const unsigned char **in, size_t *inLen,
+                      unsigned char **out, size_t *outLen)
+{
+    return ((const codecImpl*)dec->impl)->decRun(dec->state, in, inLen, out, outLen);
+}
+
+void bsdiff_DecoderEnd(bsdiff_decoder *dec)
+{
+    if (dec->impl)
+        ((const codecImpl*)dec->impl)->decEnd(dec->state, dec->allocator);
+    memset(dec, 0, sizeof(bsdiff_decoder));
+}
+
+//------------------------------------------------------------------------------
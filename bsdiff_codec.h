@@ -0,0 +1,118 @@
+#ifndef __BSDIFF_CODEC_H__
+#define __BSDIFF_CODEC_H__
+
+#include <stddef.h>
+#include "bsdiff_misc.h"
+
+//------------------------------------------------------------------------------
+
+// 编解码一步的返回值
+#define BSDIFF_CODEC_OK     0   // 有进展，继续调用
+#define BSDIFF_CODEC_END    1   // 流已结束
+#define BSDIFF_CODEC_ERROR  2   // 数据损坏或内存不足
+
+// codec是否编译进来了
+int bsdiff_CodecAvailable(
+    int codec
+    );
+
+// codec的名字（"bzip2"、"zstd"、"lzma"、"brotli"），codec无效时返回NULL
+const char* bsdiff_CodecName(
+    int codec
+    );
+
+// 按名字查找codec，找不到时返回-1
+int bsdiff_CodecFind(
+    const char *name
+    );
+
+// 把len字节的data压缩成codec的一个完整的流，结果放在*out中（从allocator分配，由调用者释放）
+// level为0时使用codec的默认级别；workFactor只对bzip2有效（见bsdiff_diff_options），0表示默认值
+int bsdiff_Compress(
+    int codec,
+    int level,
+    int workFactor,
+    const unsigned char *data,
+    bsdiff_off_t len,
+    const bsdiff_allocator *allocator,
+    unsigned char **out,
+    bsdiff_off_t *outLen
+    );
+
+// 流式编码器输入的分段长度
+#define BSDIFF_ENCODER_CHUNK  (1024 * 1024)
+
+// 流式编码器：数据可以分多次交给bsdiff_EncoderWrite，压缩结果累积在内存中。输入总是凑满
+// BSDIFF_ENCODER_CHUNK字节才交给压缩器，所以压缩结果只取决于数据本身，与每次写入多少无关，
+// 和bsdiff_Compress一次压缩同样的数据完全相同
+typedef struct bsdiff_encoder {
+    const void *impl;
+    void *state;
+    const bsdiff_allocator *allocator;
+    unsigned char *out;         // 已经输出的压缩数据
+    size_t used, capacity;
+    unsigned char *stage;       // 还不满一段的输入
+    size_t staged;
+} bsdiff_encoder;
+
+// sizeHint为数据的总长度，小于0表示未知（zstd会把它记录在帧头中，给出时必须准确）
+int bsdiff_EncoderInit(
+    bsdiff_encoder *enc,
+    int codec,
+    int level,
+    int workFactor,
+    bsdiff_off_t sizeHint,
+    const bsdiff_allocator *allocator
+    );
+
+int bsdiff_EncoderWrite(
+    bsdiff_encoder *enc,
+    const unsigned char *data,
+    size_t len
+    );
+
+// 结束流，取得压缩结果（从allocator分配，由调用者释放）；之后仍然要调用bsdiff_EncoderEnd
+int bsdiff_EncoderFinish(
+    bsdiff_encoder *enc,
+    unsigned char **out,
+    bsdiff_off_t *outLen
+    );
+
+void bsdiff_EncoderEnd(
+    bsdiff_encoder *enc
+    );
+
+//------------------------------------------------------------------------------
+
+// 流式解码器，由bsdiff_DecoderRun一步步推进
+typedef struct bsdiff_decoder {
+    const void *impl;
+    void *state;
+    const bsdiff_allocator *allocator;
+} bsdiff_decoder;
+
+// small非0时尽量使用省内存的解压方式（目前只对bzip2有效）
+int bsdiff_DecoderInit(
+    bsdiff_decoder *dec,
+    int codec,
+    int small,
+    const bsdiff_allocator *allocator
+    );
+
+// 从*in消耗最多*inLen字节，向*out输出最多*outLen字节，两边都按实际处理的字节数推进
+// 返回BSDIFF_CODEC_xxx
+int bsdiff_DecoderRun(
+    bsdiff_decoder *dec,
+    const unsigned char **in,
+    size_t *inLen,
+    unsigned char **out,
+    size_t *outLen
+    );
+
+void bsdiff_DecoderEnd(
+    bsdiff_decoder *dec
+    );
+
+//------------------------------------------------------------------------------
+
+#endif // !__BSDIFF_CODEC_H__
@@ -0,0 +1,795 @@
+#include "bsdiff_diff.h"
+#include "bsdiff_patch.h"
+#include "bsdiff_misc.h"
+#include "bsdiff_thread.h"
+#include "bsdiff_codec.h"
+#include "bsdiff_filter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+  #include <psapi.h>
+#else
+  #include <sys/resource.h>
+#endif
+
+//------------------------------------------------------------------------------
+
+/* diff/patch的benchmark：在一组固定的语料上逐项测量各阶段的耗时、峰值内存和patch的压缩比，
+   结果以JSON数组输出，便于比较不同的后缀数组算法和codec，以及发现回归。
+   语料由固定的种子生成，第一次运行时写到语料目录中，以后直接复用：
+     text    1MB的文本，少量行被修改、插入、删除
+     exe     16MB的模拟机器码，中间插入了新的函数，后面所有的相对call/jmp目标和绝对地址表都随之变化
+             （-X x86时可以看到可执行文件过滤器的效果）
+     blob    8MB的压缩数据（随机字节），前40%相同，后面完全不同
+     sparse  64MB的磁盘镜像，大部分是0，少量4KB的数据页被修改、增加、清空
+     large   N GB的镜像（-g N，默认不生成），数据页的比例更高
+   -a hash用k-gram hash索引代替后缀数组（BSDIFF_MATCH_HASH），sort阶段为构建hash表的时间，
+   可以与后缀数组比较速度和patch大小。
+   每一项的阶段：read为读入old/new，diff为完整的bsdiff_diff_mem，patch为bsdiff_patch_mem；之后核对patch的结果。
+   diffPhases/patchPhases为库的bsdiff_stats中各阶段（sort、scan、diff、extra、apply等）的耗时和字节数。
+   peakAlloc为库通过allocator分配的内存的峰值（zstd/brotli的内部状态不经过allocator，不在其中）；
+   peakRss为进程的峰值RSS，Linux上每一项开始前清零，其它系统上是到目前为止整个进程的峰值 */
+
+// -a中k-gram hash匹配引擎的编号，与BSDIFF_SA_xxx不重复
+#define ALG_HASH  3
+
+typedef struct benchCase {
+    const char *name;
+    char oldFile[512];
+    char newFile[512];
+} benchCase;
+
+#define MAX_CASES  32
+
+// 把进程的峰值RSS清零（只有Linux支持）
+static void resetPeakRss(void)
+{
+#ifdef __linux__
+    FILE *fp = fopen("/proc/self/clear_refs", "w");
+    if (fp) {
+        fputs("5", fp);
+        fclose(fp);
+    }
+#endif
+}
+
+static unsigned long long peakRss(void)
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return pmc.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage ru;
+  #ifdef __linux__
+    char line[128];
+    unsigned long long kb = 0;
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (fp) {
+        while (fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "VmHWM: %llu kB", &kb) == 1)
+                break;
+        }
+        fclose(fp);
+        if (kb)
+            return kb * 1024;
+    }
+  #endif
+    if (getrusage(RUSAGE_SELF, &ru))
+        return 0;
+  #ifdef __APPLE__
+    return (unsigned long long)ru.ru_maxrss;
+  #else
+    return (unsigned long long)ru.ru_maxrss * 1024;
+  #endif
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+// 统计峰值的allocator，每个块前面记录它的尺寸
+#define ALLOC_HEADER  16
+
+typedef struct countingAllocator {
+    bsdiff_allocator base;
+    bsdiff_mutex mutex;
+    unsigned long long current, peak;
+} countingAllocator;
+
+static void* countingAlloc(void *opaque, size_t size)
+{
+    countingAllocator *a = (countingAllocator*)opaque;
+    unsigned char *block = (unsigned char*)malloc(size + ALLOC_HEADER);
+
+    if (!block)
+        return NULL;
+    *(size_t*)block = size;
+    bsdiff_MutexLock(&a->mutex);
+    a->current += size;
+    if (a->current > a->peak)
+        a->peak = a->current;
+    bsdiff_MutexUnlock(&a->mutex);
+    return block + ALLOC_HEADER;
+}
+
+static void countingFree(void *opaque, void *ptr)
+{
+    countingAllocator *a = (countingAllocator*)opaque;
+    unsigned char *block = (unsigned char*)ptr - ALLOC_HEADER;
+
+    bsdiff_MutexLock(&a->mutex);
+    a->current -= *(size_t*)block;
+    bsdiff_MutexUnlock(&a->mutex);
+    free(block);
+}
+
+static void countingInit(countingAllocator *a)
+{
+    a->base.alloc = countingAlloc;
+    a->base.free = countingFree;
+    a->base.opaque = a;
+    bsdiff_MutexInit(&a->mutex);
+    a->current = a->peak = 0;
+}
+
+//------------------------------------------------------------------------------
+
+// 输出到一块可增长的内存
+typedef struct memSink {
+    unsigned char *data;
+    size_t size, capacity;
+} memSink;
+
+static int memSinkWrite(void *opaque, const void *data, size_t len)
+{
+    memSink *s = (memSink*)opaque;
+    unsigned char *p;
+    size_t capacity;
+
+    if (s->size + len > s->capacity) {
+        capacity = s->capacity ? s->capacity : 65536;
+        while (capacity < s->size + len)
+            capacity *= 2;
+        if (!(p = (unsigned char*)realloc(s->data, capacity)))
+            return 0;
+        s->data = p;
+        s->capacity = capacity;
+    }
+    memcpy(s->data + s->size, data, len);
+    s->size += len;
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+
+// 语料生成：xorshift64*，同样的种子总是生成同样的字节
+static unsigned long long rngNext(unsigned long long *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 0x2545F4914F6CDD1Dull;
+}
+
+static unsigned int rngBelow(unsigned long long *s, unsigned int n)
+{
+    return (unsigned int)((rngNext(s) >> 32) % n);
+}
+
+static int writeAll(const char *path, const unsigned char *data, size_t len)
+{
+    FILE *fp = fopen(path, "wb");
+    int ok;
+
+    if (!fp)
+        return 0;
+    ok = bsdiff_WriteFile(fp, data, len);
+    return fclose(fp) == 0 && ok;
+}
+
+static int fileExists(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp)
+        return 0;
+    fclose(fp);
+    return 1;
+}
+
+// 文本：每行由词表中的若干个词组成；new中约1%的行被修改、插入或删除
+static int genText(const char *oldFile, const char *newFile)
+{
+    static const char *words[] = {
+        "the", "patch", "old", "new", "file", "buffer", "offset", "length", "control", "block",
+        "suffix", "array", "match", "scan", "window", "thread", "compress", "extra", "diff", "header",
+        "return", "error", "size_t", "static", "int", "if", "for", "while", "struct", "const"
+    };
+    const size_t size = 1024 * 1024;
+    unsigned char *old = NULL, *out = NULL;
+    unsigned long long seed = 1, edit = 2;
+    size_t oldLen = 0, newLen = 0, lineStart, lineLen, w;
+    int ok = 0;
+
+    if (!(old = (unsigned char*)malloc(size + 256)) || !(out = (unsigned char*)malloc(size * 2)))
+        goto MyExit;
+    while (oldLen < size) {
+        for (w = 4 + rngBelow(&seed, 10); w > 0; --w) {
+            const char *word = words[rngBelow(&seed, sizeof(words) / sizeof(words[0]))];
+            memcpy(old + oldLen, word, strlen(word));
+            oldLen += strlen(word);
+            old[oldLen++] = w > 1 ? ' ' : '\n';
+        }
+    }
+
+    for (lineStart = 0; lineStart < oldLen; lineStart += lineLen) {
+        for (lineLen = 0; lineStart + lineLen < oldLen && old[lineStart + lineLen] != '\n'; ++lineLen)
+            ;
+        ++lineLen;
+        switch (rngBelow(&edit, 300)) {
+        case 0:                         // 删除这一行
+            break;
+        case 1:                         // 修改一个字符
+            memcpy(out + newLen, old + lineStart, lineLen);
+            if (lineLen > 1)
+                out[newLen + rngBelow(&edit, (unsigned int)lineLen - 1)] ^= 0x20;
+            newLen += lineLen;
+            break;
+        case 2:                         // 在前面插入一行，再复制这一行
+            memcpy(out + newLen, "inserted line for benchmark\n", 28);
+            newLen += 28;
+            /* fall through */
+        default:
+            memcpy(out + newLen, old + lineStart, lineLen);
+            newLen += lineLen;
+            break;
+        }
+    }
+    ok = writeAll(oldFile, old, oldLen) && writeAll(newFile, out, newLen);
+
+MyExit:
+    free(old);
+    free(out);
+    return ok;
+}
+
+// 模拟的机器码：函数体由普通指令字节和call/jmp rel32组成，rel32指向其它函数的起点；
+// 文件末尾是一张函数地址表（绝对地址，相当于需要重定位的指针）。
+// new在中间插入了一些新函数，并修改了少量函数，插入点之后的所有函数地址都变了
+#define EXE_FUNCS   60000
+#define EXE_BASE    0x00400000u
+
+static unsigned int funcLength(unsigned int f)
+{
+    unsigned long long s = 0x9E3779B97F4A7C15ull * (f + 1);
+    return 64 + rngBelow(&s, 448);
+}
+
+static size_t emitFunction(unsigned char *buf, unsigned int f, unsigned int variant, size_t addr,
+                           const size_t *funcAddr, unsigned int numFuncs)
+{
+    unsigned long long s = 0x9E3779B97F4A7C15ull * (f + 1) + variant;
+    unsigned int len = funcLength(f), i = 0, target;
+    unsigned int rel;
+
+    while (i < len) {
+        if (i + 5 <= len && rngBelow(&s, 12) == 0) {
+            target = rngBelow(&s, numFuncs);
+            rel = (unsigned int)(funcAddr[target] - (addr + i + 5));
+            buf[i] = rngBelow(&s, 4) ? 0xE8 : 0xE9;
+            buf[i + 1] = (unsigned char)rel;
+            buf[i + 2] = (unsigned char)(rel >> 8);
+            buf[i + 3] = (unsigned char)(rel >> 16);
+            buf[i + 4] = (unsigned char)(rel >> 24);
+            i += 5;
+        } else {
+            // 常见的操作码字节出现得更频繁
+            static const unsigned char common[] = { 0x48, 0x89, 0x8B, 0x83, 0x0F, 0x85, 0x74, 0x75, 0xC3, 0x00 };
+            buf[i++] = rngBelow(&s, 2) ? common[rngBelow(&s, sizeof(common))] : (unsigned char)rngNext(&s);
+        }
+    }
+    return len;
+}
+
+// order为函数在文件中的排列顺序（函数编号），variants为各函数使用的变体
+static unsigned char* buildExe(const unsigned int *order, unsigned int count, const unsigned int *variants,
+                               unsigned int numFuncs, size_t *outLen)
+{
+    size_t *funcAddr, codeLen = 0, pos = 0;
+    unsigned char *buf;
+    unsigned int i, a;
+
+    if (!(funcAddr = (size_t*)calloc(numFuncs, sizeof(size_t))))
+        return NULL;
+    for (i = 0; i < count; ++i) {
+        funcAddr[order[i]] = EXE_BASE + codeLen;
+        codeLen += funcLength(order[i]);
+    }
+    if ((buf = (unsigned char*)malloc(codeLen + (size_t)count * 4)) != NULL) {
+        for (i = 0; i < count; ++i)
+            pos += emitFunction(buf + pos, order[i], variants[order[i]], EXE_BASE + pos, funcAddr, numFuncs);
+        for (i = 0; i < count; ++i) {
+            a = (unsigned int)funcAddr[order[i]];
+            buf[pos++] = (unsigned char)a;
+            buf[pos++] = (unsigned char)(a >> 8);
+            buf[pos++] = (unsigned char)(a >> 16);
+            buf[pos++] = (unsigned char)(a >> 24);
+        }
+        *outLen = pos;
+    }
+    free(funcAddr);
+    return buf;
+}
+
+static int genExe(const char *oldFile, const char *newFile)
+{
+    const unsigned int inserted = 400, numFuncs = EXE_FUNCS + inserted;
+    unsigned int *order = NULL, *variants = NULL, i, n = 0;
+    unsigned char *old = NULL, *out = NULL;
+    unsigned long long s = 3;
+    size_t oldLen, newLen;
+    int ok = 0;
+
+    order = (unsigned int*)malloc(numFuncs * sizeof(unsigned int));
+    variants = (unsigned int*)calloc(numFuncs, sizeof(unsigned int));
+    if (!order || !variants)
+        goto MyExit;
+
+    for (i = 0; i < EXE_FUNCS; ++i)
+        order[i] = i;
+    if (!(old = buildExe(order, EXE_FUNCS, variants, numFuncs, &oldLen)))
+        goto MyExit;
+
+    // 在三分之一处插入新函数，并修改约1%的函数
+    for (i = 0; i < EXE_FUNCS; ++i) {
+        if (i == EXE_FUNCS / 3) {
+            unsigned int k;
+            for (k = 0; k < inserted; ++k)
+                order[n++] = EXE_FUNCS + k;
+        }
+        order[n++] = i;
+        if (rngBelow(&s, 100) == 0)
+            variants[i] = 1;
+    }
+    if (!(out = buildExe(order, n, variants, numFuncs, &newLen)))
+        goto MyExit;
+    ok = writeAll(oldFile, old, oldLen) && writeAll(newFile, out, newLen);
+
+MyExit:
+    free(order);
+    free(variants);
+    free(old);
+    free(out);
+    return ok;
+}
+
+// 压缩数据：随机字节，new的前40%与old相同
+static int genBlob(const char *oldFile, const char *newFile)
+{
+    const size_t size = 8 * 1024 * 1024, same = size * 2 / 5;
+    unsigned char *buf;
+    unsigned long long s = 4;
+    size_t i;
+    int ok = 0;
+
+    if (!(buf = (unsigned char*)malloc(size)))
+        return 0;
+    for (i = 0; i < size; ++i)
+        buf[i] = (unsigned char)(rngNext(&s) >> 56);
+    if (writeAll(oldFile, buf, size)) {
+        for (i = same; i < size; ++i)
+            buf[i] = (unsigned char)(rngNext(&s) >> 56);
+        ok = writeAll(newFile, buf, size);
+    }
+    free(buf);
+    return ok;
+}
+
+// 镜像：按4KB的页逐页生成，不需要把整个文件放在内存中。
+// 每页由页号决定的种子决定是否有数据（比例为percent%），new中有1%的数据页被修改，
+// 另有0.5%的页新增数据或被清空
+#define PAGE_SIZE  4096
+
+static void fillPage(unsigned char *page, unsigned long long seed)
+{
+    size_t i;
+    unsigned long long v;
+
+    // 一半是可压缩的短重复模式，一半是随机字节
+    if (seed & 1) {
+        for (i = 0; i < PAGE_SIZE; i += 8) {
+            v = rngNext(&seed);
+            memcpy(page + i, &v, 8);
+        }
+    } else {
+        for (i = 0; i < PAGE_SIZE; ++i)
+            page[i] = (unsigned char)("bsdiff benchmark sparse image data"[(i + seed) % 34]);
+    }
+}
+
+static int genImage(const char *oldFile, const char *newFile, unsigned long long size, unsigned int percent)
+{
+    static unsigned char zero[PAGE_SIZE], page[PAGE_SIZE];
+    FILE *fpOld = NULL, *fpNew = NULL;
+    unsigned long long p, numPages = size / PAGE_SIZE, s;
+    unsigned int r;
+    int hasOld, ok = 0;
+
+    fpOld = fopen(oldFile, "wb");
+    fpNew = fopen(newFile, "wb");
+    if (!fpOld || !fpNew)
+        goto MyExit;
+
+    for (p = 0; p < numPages; ++p) {
+        s = 0x9E3779B97F4A7C15ull * (p + 1);
+        hasOld = rngBelow(&s, 100) < percent;
+        r = rngBelow(&s, 1000);
+
+        if (hasOld)
+            fillPage(page, s);
+        if (!bsdiff_WriteFile(fpOld, hasOld ? page : zero, PAGE_SIZE))
+            goto MyExit;
+
+        if (r < 10 && hasOld) {
+            page[rngBelow(&s, PAGE_SIZE)] ^= 0xFF;          // 修改
+        } else if (r < 15) {
+            hasOld = !hasOld;                               // 新增或清空
+            if (hasOld)
+                fillPage(page, s + 1);
+        }
+        if (!bsdiff_WriteFile(fpNew, hasOld ? page : zero, PAGE_SIZE))
+            goto MyExit;
+    }
+    ok = 1;
+
+MyExit:
+    if (fpOld && fclose(fpOld))
+        ok = 0;
+    if (fpNew && fclose(fpNew))
+        ok = 0;
+    return ok;
+}
+
+//------------------------------------------------------------------------------
+
+typedef struct benchConfig {
+    const char *corpusDir;
+    int largeGB;
+    int numThreads;
+    int algorithms[4];          // BSDIFF_SA_xxx或ALG_HASH
+    int numAlgorithms;
+    int codecs[BSDIFF_CODEC_COUNT];
+    int numCodecs;
+    int filter;                 // BSDIFF_FILTER_xxx，用于所有的项
+    const char *only;           // 只运行名字为这个的一项
+} benchConfig;
+
+static const char* algorithmName(int algorithm)
+{
+    switch (algorithm) {
+    case BSDIFF_SA_SAIS:     return "sais";
+    case BSDIFF_SA_QSUFSORT: return "qsufsort";
+    case ALG_HASH:           return "hash";
+    default:                 return "auto";
+    }
+}
+
+// 生成（或复用）语料，返回项数
+static int prepareCorpus(const benchConfig *config, benchCase *cases)
+{
+    static const char *names[] = { "text", "exe", "blob", "sparse", "large" };
+    static char largeName[32];
+    int i, n = 0, ok;
+
+    bsdiff_MakeDir(config->corpusDir);
+    sprintf(largeName, "large-%dg", config->largeGB);
+
+    for (i = 0; i < 5; ++i) {
+        if (i == 4 && config->largeGB <= 0)
+            break;
+        cases[n].name = i == 4 ? largeName : names[i];
+        if (config->only && strcmp(config->only, names[i]) != 0)
+            continue;
+        if (strlen(config->corpusDir) + strlen(cases[n].name) + 8 > sizeof(cases[n].oldFile))
+            return -1;
+        sprintf(cases[n].oldFile, "%s%c%s.old", config->corpusDir, BSDIFF_PATH_SEP, cases[n].name);
+        sprintf(cases[n].newFile, "%s%c%s.new", config->corpusDir, BSDIFF_PATH_SEP, cases[n].name);
+        if (fileExists(cases[n].oldFile) && fileExists(cases[n].newFile)) {
+            ++n;
+            continue;
+        }
+
+        fprintf(stderr, "generating %s ...\n", cases[n].oldFile);
+        switch (i) {
+        case 0:  ok = genText(cases[n].oldFile, cases[n].newFile); break;
+        case 1:  ok = genExe(cases[n].oldFile, cases[n].newFile); break;
+        case 2:  ok = genBlob(cases[n].oldFile, cases[n].newFile); break;
+        case 3:  ok = genImage(cases[n].oldFile, cases[n].newFile, 64ull << 20, 5); break;
+        default: ok = genImage(cases[n].oldFile, cases[n].newFile, (unsigned long long)config->largeGB << 30, 25); break;
+        }
+        if (!ok) {
+            fprintf(stderr, "can't generate %s\n", cases[n].oldFile);
+            remove(cases[n].oldFile);
+            remove(cases[n].newFile);
+            return -1;
+        }
+        ++n;
+    }
+    return n;
+}
+
+// 输出stats中有耗时或有数据的阶段：{"sort": {"seconds": s, "bytes": n}, ...}
+static void jsonPhases(FILE *out, const bsdiff_stats *stats)
+{
+    int i, n = 0;
+
+    fputc('{', out);
+    for (i = 0; i < BSDIFF_PHASE_COUNT; ++i) {
+        if (stats->phases[i].seconds <= 0 && stats->phases[i].bytes == 0)
+            continue;
+        fprintf(out, "%s\"%s\": {\"seconds\": %.4f, \"bytes\": %llu}", n++ ? ", " : "",
+                bsdiff_PhaseName(i), stats->phases[i].seconds, stats->phases[i].bytes);
+    }
+    fputc('}', out);
+}
+
+static void jsonString(FILE *out, const char *str)
+{
+    fputc('"', out);
+    for (; *str; ++str) {
+        if (*str == '"' || *str == '\\')
+            fputc('\\', out);
+        fputc(*str, out);
+    }
+    fputc('"', out);
+}
+
+// 运行一项，结果作为一个JSON对象输出；返回0表示出错（或patch的结果不对）
+static int runCase(const benchCase *c, const benchConfig *config, int algorithm, int codec, FILE *out, int first)
+{
+    bsdiff_diff_options diffOptions;
+    bsdiff_patch_options patchOptions;
+    bsdiff_filedata oldData, newData;
+    countingAllocator diffAlloc, patchAlloc;
+    memSink patch, result;
+    bsdiff_stats diffStats, patchStats;
+    double t, tRead = 0, tDiff = 0, tPatch = 0;
+    char error[64] = "";
+    int ok = 0;
+
+    memset(&oldData, 0, sizeof(oldData));
+    memset(&newData, 0, sizeof(newData));
+    memset(&patch, 0, sizeof(patch));
+    memset(&result, 0, sizeof(result));
+    memset(&diffStats, 0, sizeof(diffStats));
+    memset(&patchStats, 0, sizeof(patchStats));
+    countingInit(&diffAlloc);
+    countingInit(&patchAlloc);
+    resetPeakRss();
+
+    bsdiff_diff_options_init(&diffOptions);
+    if (algorithm == ALG_HASH)
+        diffOptions.matcher = BSDIFF_MATCH_HASH;
+    else
+        diffOptions.saAlgorithm = algorithm;
+    diffOptions.numThreads = config->numThreads;
+    diffOptions.ctrlCodec = diffOptions.diffCodec = diffOptions.extraCodec = codec;
+    diffOptions.stats = &diffStats;
+    diffOptions.filter = config->filter;
+    bsdiff_patch_options_init(&patchOptions);
+    patchOptions.numThreads = config->numThreads;
+    patchOptions.stats = &patchStats;
+
+    t = bsdiff_Now();
+    if (!bsdiff_LoadFile(c->oldFile, 1, &oldData, "oldFile", error) ||
+        !bsdiff_LoadFile(c->newFile, 1, &newData, "newFile", error))
+        goto MyExit;
+    tRead = bsdiff_Now() - t;
+
+    t = bsdiff_Now();
+    if (!bsdiff_diff_mem(oldData.data, (size_t)oldData.size, newData.data, (size_t)newData.size,
+                         memSinkWrite, &patch, &diffAlloc.base, &diffOptions, error))
+        goto MyExit;
+    tDiff = bsdiff_Now() - t;
+
+    t = bsdiff_Now();
+    if (!bsdiff_patch_mem(oldData.data, (size_t)oldData.size, patch.data, patch.size,
+                          memSinkWrite, &result, &patchAlloc.base, &patchOptions, error))
+        goto MyExit;
+    tPatch = bsdiff_Now() - t;
+
+    if (result.size != (size_t)newData.size || memcmp(result.data, newData.data, result.size) != 0) {
+        bsdiff_SetError(error, "Patch result mismatch");
+        goto MyExit;
+    }
+    ok = 1;
+
+MyExit:
+    fprintf(out, "%s\n  {\"name\": ", first ? "" : ",");
+    jsonString(out, c->name);
+    fprintf(out, ", \"saAlgorithm\": \"%s\", \"codec\": \"%s\", \"filter\": \"%s\", \"threads\": %d,\n",
+            algorithmName(algorithm), bsdiff_CodecName(codec), bsdiff_FilterName(config->filter), 
+            config->numThreads > 1 ? config->numThreads : 1);
+    fprintf(out, "   \"oldSize\": %lld, \"newSize\": %lld, \"patchSize\": %llu, \"ratio\": %.6f,\n",
+            oldData.size, newData.size, (unsigned long long)patch.size,
+            newData.size > 0 ? (double)patch.size / (double)newData.size : 0.0);
+    fprintf(out, "   \"seconds\": {\"read\": %.4f, \"diff\": %.4f, \"patch\": %.4f},\n",
+            tRead, tDiff, tPatch);
+    fprintf(out, "   \"diffPhases\": ");
+    jsonPhases(out, &diffStats);
+    fprintf(out, ",\n   \"patchPhases\": ");
+    jsonPhases(out, &patchStats);
+    fprintf(out, ",\n   \"numCtrls\": %llu,\n", diffStats.numCtrls);
+    fprintf(out, "   \"peakAlloc\": {\"diff\": %llu, \"patch\": %llu}, \"peakRss\": %llu,\n",
+            diffAlloc.peak, patchAlloc.peak, peakRss());
+    fprintf(out, "   \"ok\": %s, \"error\": ", ok ? "true" : "false");
+    jsonString(out, error);
+    fprintf(out, "}");
+    fflush(out);
+
+    fprintf(stderr, "%-10s %-8s %-7s %8.3fs sort %8.3fs diff %8.3fs patch  ratio %.4f%s%s\n",
+            c->name, algorithmName(algorithm), bsdiff_CodecName(codec),
+            diffStats.phases[BSDIFF_PHASE_SORT].seconds, tDiff, tPatch,
+            newData.size > 0 ? (double)patch.size / (double)newData.size : 0.0,
+            ok ? "" : "  FAILED: ", error);
+
+    free(patch.data);
+    free(result.data);
+    bsdiff_FreeFile(&oldData);
+    bsdiff_FreeFile(&newData);
+    bsdiff_MutexDestroy(&diffAlloc.mutex);
+    bsdiff_MutexDestroy(&patchAlloc.mutex);
+    return ok;
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [options] [oldFile newFile]...\n", prog);
+    printf("options:\n");
+    printf("  -d dir                 corpus directory, generated on first use (default: bench_corpus)\n");
+    printf("  -g N                   also run an N GB image (default: 0, skipped)\n");
+    printf("  -c name                run only this corpus entry (text, exe, blob, sparse, large)\n");
+    printf("  -a alg[,alg...]        match finders: auto, sais, qsufsort, hash (default: auto)\n");
+    printf("  -z codec[,codec...]    codecs to compare (default: bzip2)\n");
+    printf("  -j N                   number of worker threads (default: 1)\n");
+    printf("  -X auto|x86|arm|arm64  executable filter for every entry (default: none)\n");
+    printf("  -o file                write the JSON results to file (default: stdout)\n");
+    printf("extra oldFile/newFile pairs are run after the corpus\n");
+}
+
+// 解析逗号分隔的名字列表，find返回-1表示不认识
+static int parseList(const char *arg, int *values, int maxValues, int (*find)(const char*))
+{
+    char name[16];
+    size_t len;
+    int n = 0;
+
+    for (;;) {
+        len = strcspn(arg, ",");
+        if (n == maxValues || len == 0 || len >= sizeof(name))
+            return 0;
+        memcpy(name, arg, len);
+        name[len] = '\0';
+        if ((values[n++] = find(name)) < 0)
+            return 0;
+        if (!arg[len])
+            return n;
+        arg += len + 1;
+    }
+}
+
+static int findAlgorithm(const char *name)
+{
+    if (strcmp(name, "auto") == 0)
+        return BSDIFF_SA_AUTO;
+    if (strcmp(name, "sais") == 0)
+        return BSDIFF_SA_SAIS;
+    if (strcmp(name, "qsufsort") == 0)
+        return BSDIFF_SA_QSUFSORT;
+    if (strcmp(name, "hash") == 0)
+        return ALG_HASH;
+    return -1;
+}
+
+static int findCodec(const char *name)
+{
+    int codec = bsdiff_CodecFind(name);
+    return codec >= 0 && bsdiff_CodecAvailable(codec) ? codec : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    benchConfig config;
+    benchCase cases[MAX_CASES];
+    const char *outFile = NULL;
+    FILE *out = stdout;
+    int numCases, i, a, z, first = 1, ok = 1;
+
+    memset(&config, 0, sizeof(config));
+    config.corpusDir = "bench_corpus";
+    config.numThreads = 1;
+    config.algorithms[0] = BSDIFF_SA_AUTO;
+    config.numAlgorithms = 1;
+    config.codecs[0] = BSDIFF_CODEC_BZIP2;
+    config.numCodecs = 1;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            config.corpusDir = argv[++i];
+        } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            config.largeGB = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            config.only = argv[++i];
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            if (!(config.numAlgorithms = parseList(argv[++i], config.algorithms, 4, findAlgorithm))) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-z") == 0 && i + 1 < argc) {
+            if (!(config.numCodecs = parseList(argv[++i], config.codecs, BSDIFF_CODEC_COUNT, findCodec))) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            config.numThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-X") == 0 && i + 1 < argc) {
+            ++i;
+            if (strcmp(argv[i], "auto") == 0) {
+                config.filter = BSDIFF_FILTER_AUTO;
+            } else if ((config.filter = bsdiff_FilterFind(argv[i])) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outFile = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ((argc - i) % 2 != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // -c large表示运行large-Ng
+    if (config.only && strcmp(config.only, "large") == 0 && config.largeGB <= 0) {
+        fprintf(stderr, "-c large requires -g N\n");
+        return 1;
+    }
+    if ((numCases = prepareCorpus(&config, cases)) < 0)
+        return 1;
+    for (; i + 1 < argc && numCases < MAX_CASES; i += 2) {
+        if (strlen(argv[i]) >= sizeof(cases[0].oldFile) || strlen(argv[i + 1]) >= sizeof(cases[0].newFile))
+            continue;
+        cases[numCases].name = argv[i + 1];
+        strcpy(cases[numCases].oldFile, argv[i]);
+        strcpy(cases[numCases].newFile, argv[i + 1]);
+        ++numCases;
+    }
+
+    if (outFile && !(out = fopen(outFile, "w"))) {
+        fprintf(stderr, "can't open %s\n", outFile);
+        return 1;
+    }
+    fprintf(out, "[");
+    for (i = 0; i < numCases; ++i) {
+        for (a = 0; a < config.numAlgorithms; ++a) {
+            for (z = 0; z < config.numCodecs; ++z) {
+                if (!runCase(&cases[i], &config, config.algorithms[a], config.codecs[z], out, first))
+                    ok = 0;
+                first = 0;
+            }
+        }
+    }
+    fprintf(out, "\n]\n");
+    if (out != stdout)
+        fclose(out);
+    return ok ? 0 : 1;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,152 @@
+#include "bsdiff_ctx.h"
+#include "bsdiff_misc.h"
+#include "bsdiff_thread.h"
+#include <stdlib.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+
+/* arena：内存块按尺寸分级（2的幂以及它的1.5倍）。释放的块挂到对应级别的空闲链表上，下一次同一级别的分配直接取用；
+   空闲链表为空时从当前的chunk上切一块新的，放不下时再向系统申请一个chunk（大块单独占一个chunk）。
+   每个块前面有BLOCK_HEADER字节记录它的级别，返回的地址与malloc返回的地址有同样的对齐。
+   块的尺寸最多向上取整25%，大块中没有用到的尾部不会被访问，一般也不会占用物理内存 */
+
+#define MIN_CLASS     12                    // 最小的块64字节（含头部）
+#define NUM_CLASSES   (sizeof(size_t) * 16 - 1)
+
+// 第cls级的块的尺寸：偶数级为2^(cls/2)，奇数级为它的1.5倍
+#define CLASS_SIZE(cls)  (((size_t)2 + ((cls) & 1)) << ((cls) / 2 - 1))
+#define CHUNK_SIZE    (4 * 1024 * 1024)
+#define BLOCK_HEADER  16
+
+typedef struct arenaChunk {
+    struct arenaChunk *next;
+    size_t size, used;                      // 数据区的大小和已经切出去的字节数
+} arenaChunk;
+
+// 数据区紧跟在chunk头之后，从BLOCK_HEADER的整数倍处开始
+#define CHUNK_HEADER       (((sizeof(arenaChunk) + BLOCK_HEADER - 1) / BLOCK_HEADER) * BLOCK_HEADER)
+#define CHUNK_DATA(chunk)  ((unsigned char*)(chunk) + CHUNK_HEADER)
+
+struct bsdiff_ctx {
+    bsdiff_pool *pool;
+    bsdiff_allocator allocator;             // opaque指向ctx本身
+    bsdiff_mutex mutex;                     // 线程池中的任务也会分配内存
+    arenaChunk *chunks;                     // 第一个是当前正在切分的chunk
+    void *freeLists[NUM_CLASSES];           // 空闲块的前sizeof(void*)字节指向下一个空闲块
+    size_t reserved;
+};
+
+static void* arenaAlloc(void *opaque, size_t size)
+{
+    bsdiff_ctx *ctx = (bsdiff_ctx*)opaque;
+    arenaChunk *chunk;
+    unsigned char *block = NULL;
+    size_t cls, blockSize, chunkSize;
+
+    for (cls = MIN_CLASS; cls < NUM_CLASSES && CLASS_SIZE(cls) - BLOCK_HEADER < size; ++cls)
+        ;
+    if (cls == NUM_CLASSES)
+        return NULL;
+    blockSize = CLASS_SIZE(cls);
+
+    bsdiff_MutexLock(&ctx->mutex);
+    if (ctx->freeLists[cls]) {
+        block = (unsigned char*)ctx->freeLists[cls] - BLOCK_HEADER;
+        ctx->freeLists[cls] = *(void**)ctx->freeLists[cls];
+    } else {
+        chunk = ctx->chunks;
+        if (!chunk || chunk->size - chunk->used < blockSize) {
+            chunkSize = blockSize > CHUNK_SIZE ? blockSize : CHUNK_SIZE;
+            if ((chunk = (arenaChunk*)malloc(CHUNK_HEADER + chunkSize)) != NULL) {
+                chunk->size = chunkSize;
+                chunk->used = 0;
+                // 单独的大块不影响当前正在切分的chunk
+                if (chunkSize > CHUNK_SIZE && ctx->chunks) {
+                    chunk->next = ctx->chunks->next;
+                    ctx->chunks->next = chunk;
+                } else {
+                    chunk->next = ctx->chunks;
+                    ctx->chunks = chunk;
+                }
+                ctx->reserved += chunkSize;
+            }
+        }
+        if (chunk) {
+            block = CHUNK_DATA(chunk) + chunk->used;
+            chunk->used += blockSize;
+            *(size_t*)block = cls;
+        }
+    }
+    bsdiff_MutexUnlock(&ctx->mutex);
+
+    return block ? block + BLOCK_HEADER : NULL;
+}
+
+static void arenaFree(void *opaque, void *ptr)
+{
+    bsdiff_ctx *ctx = (bsdiff_ctx*)opaque;
+    size_t cls = *(size_t*)((unsigned char*)ptr - BLOCK_HEADER);
+
+    bsdiff_MutexLock(&ctx->mutex);
+    *(void**)ptr = ctx->freeLists[cls];
+    ctx->freeLists[cls] = ptr;
+    bsdiff_MutexUnlock(&ctx->mutex);
+}
+
+//------------------------------------------------------------------------------
+
+bsdiff_ctx* bsdiff_ctx_create(int numThreads)
+{
+    bsdiff_ctx *ctx;
+
+    if (!(ctx = (bsdiff_ctx*)calloc(1, sizeof(bsdiff_ctx))))
+        return NULL;
+    ctx->allocator.alloc = arenaAlloc;
+    ctx->allocator.free = arenaFree;
+    ctx->allocator.opaque = ctx;
+    bsdiff_MutexInit(&ctx->mutex);
+
+    // 线程池创建失败时退回单线程
+    ctx->pool = bsdiff_PoolCreate(numThreads);
+    return ctx;
+}
+
+void bsdiff_ctx_trim(bsdiff_ctx *ctx)
+{
+    arenaChunk *chunk;
+
+    while ((chunk = ctx->chunks) != NULL) {
+        ctx->chunks = chunk->next;
+        free(chunk);
+    }
+    memset(ctx->freeLists, 0, sizeof(ctx->freeLists));
+    ctx->reserved = 0;
+}
+
+void bsdiff_ctx_destroy(bsdiff_ctx *ctx)
+{
+    if (!ctx)
+        return;
+    bsdiff_PoolDestroy(ctx->pool);
+    bsdiff_ctx_trim(ctx);
+    bsdiff_MutexDestroy(&ctx->mutex);
+    free(ctx);
+}
+
+size_t bsdiff_ctx_reserved(bsdiff_ctx *ctx)
+{
+    return ctx->reserved;
+}
+
+const bsdiff_allocator* bsdiff_CtxAllocator(bsdiff_ctx *ctx)
+{
+    return &ctx->allocator;
+}
+
+bsdiff_pool* bsdiff_CtxPool(bsdiff_ctx *ctx)
+{
+    return ctx->pool;
+}
+
+//------------------------------------------------------------------------------
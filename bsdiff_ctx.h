@@ -0,0 +1,82 @@
+#ifndef __BSDIFF_CTX_H__
+#define __BSDIFF_CTX_H__
+
+#include <stddef.h>
+#include "bsdiff_types.h"
+#include "bsdiff_diff.h"
+#include "bsdiff_patch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 可以重复使用的diff/patch上下文，适合大量的小文件：ctx拥有一个线程池和一个内存池（arena），
+// 每次调用的全部内存（后缀数组、控制三元组、压缩/解压器的状态等）都从arena分配，释放后留在arena中
+// 供下一次调用复用，重复的调用不再反复向系统申请内存、重新触发缺页。
+// 同一个ctx不能被多个线程同时使用；不同的ctx之间互不影响
+typedef struct bsdiff_ctx bsdiff_ctx;
+
+// numThreads为ctx的线程池的线程数（<= 1表示单线程），options中的numThreads在ctx调用中不起作用
+// 失败（内存不足）时返回NULL
+bsdiff_ctx* bsdiff_ctx_create(
+    int numThreads
+    );
+
+void bsdiff_ctx_destroy(
+    bsdiff_ctx *ctx
+    );
+
+// 把arena中缓存的内存全部还给系统
+void bsdiff_ctx_trim(
+    bsdiff_ctx *ctx
+    );
+
+// arena当前从系统申请的内存总量（字节数）
+size_t bsdiff_ctx_reserved(
+    bsdiff_ctx *ctx
+    );
+
+// 同bsdiff_diff_mem，内存从ctx的arena分配
+int bsdiff_ctx_diff(
+    bsdiff_ctx *ctx,
+    const void *oldData,
+    size_t oldSize,
+    const void *newData,
+    size_t newSize,
+    bsdiff_write_fn write,
+    void *opaque,
+    const bsdiff_diff_options *options,
+    char error[64]
+    );
+
+// 同bsdiff_patch_mem，内存从ctx的arena分配
+int bsdiff_ctx_patch(
+    bsdiff_ctx *ctx,
+    const void *oldData,
+    size_t oldSize,
+    const void *patchData,
+    size_t patchSize,
+    bsdiff_write_fn write,
+    void *opaque,
+    const bsdiff_patch_options *options,
+    char error[64]
+    );
+
+//------------------------------------------------------------------------------
+
+// 以下供bsdiff_diff.c/bsdiff_patch.c使用
+
+const bsdiff_allocator* bsdiff_CtxAllocator(
+    bsdiff_ctx *ctx
+    );
+
+// 单线程时返回NULL
+struct bsdiff_pool* bsdiff_CtxPool(
+    bsdiff_ctx *ctx
+    );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !__BSDIFF_CTX_H__
@@ -1,424 +1,1489 @@
 #include "bsdiff_diff.h"
 #include "bsdiff_misc.h"
+#include "bsdiff_sa.h"
+#include "bsdiff_thread.h"
+#include "bsdiff_index.h"
+#include "bsdiff_hash.h"
+#include "bsdiff_simd.h"
+#include "bsdiff_codec.h"
+#include "bsdiff_pcompress.h"
+#include "bsdiff_format.h"
+#include "bsdiff_window.h"
+#include "bsdiff_filter.h"
+#include "bsdiff_kgram.h"
+#include "bsdiff_inplace.h"
+#include "bsdiff_ctx.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
-#include "bzlib.h"
-#ifdef _WIN32
-  #define WIN32_LEAN_AND_MEAN
-  #include <windows.h>
-#endif
 
 //------------------------------------------------------------------------------
 
 typedef unsigned char u_char;
 
-static void qsufsort(
-    off_t *I,
-    off_t *V,
-    u_char *old,
-    off_t oldsize
+#define MIN(x,y) (((x)<(y)) ? (x) : (y))
+
+// 一个控制三元组：从oldPos开始的diffLen字节做加法得到newPos开始的数据，
+// 随后是extraLen字节的extra数据，最后old的位置跳到nextOldPos
+typedef struct bsdiff_ctrl {
+    bsdiff_off_t newPos, oldPos;
+    bsdiff_off_t diffLen, extraLen;
+    bsdiff_off_t nextOldPos;
+} bsdiff_ctrl;
+
+// 匹配的同时每产生这么多个控制三元组（或者匹配过这么多字节的newFile）就通知一次调用线程
+#define PUBLISH_STEP  256
+#define PUBLISH_BYTES (1024 * 1024)
+
+// diff数据按这么长一段算出来再交给压缩器
+#define EMIT_CHUNK    (64 * 1024)
+
+// 窗口化匹配时窗口的最小长度，maxMemory连这么大的窗口都放不下时报错
+#define MIN_WINDOW    (64 * 1024)
+
+// 所有scanJob共享的状态，由mutex保护
+typedef struct scanShared {
+    bsdiff_mutex mutex;
+    bsdiff_cond cond;
+    int cancelled;              // 各段在下一次发布三元组时停止
+    bsdiff_monitor *monitor;    // 单线程时匹配就在调用线程中进行，由scanChunk报告进度；多线程时为NULL
+    bsdiff_off_t scanned;       // 已经匹配完的各段的总长度
+    bsdiff_off_t total;         // newSize
+} scanShared;
+
+// 在newFile的[newStart, newEnd)区间上做匹配
+typedef struct scanJob {
+    const bsdiff_sa32 *I32;     // 后缀数组，按元素宽度二者取一，另一个为NULL
+    const bsdiff_sa64 *I64;
+    const bsdiff_kgram *kgram;  // 非NULL时用k-gram hash索引代替后缀数组
+    const unsigned char *old;
+    bsdiff_off_t oldSize;
+    bsdiff_off_t oldBase;       // old在oldFile中的偏移（窗口化匹配时），三元组中的位置都相对于oldFile
+    const unsigned char *new;
+    bsdiff_off_t newStart, newEnd;
+    bsdiff_ctrl *ctrls;
+    size_t numCtrls, capacity;
+    const bsdiff_allocator *allocator;  // ctrls从这里分配
+    // 以下由shared->mutex保护：ctrls[0..published)可以被调用线程读取，ctrls的重新分配也在锁内进行
+    scanShared *shared;
+    size_t published;
+    int done;
+    int ok;
+} scanJob;
+
+static void scanTask(
+    void *arg
+    );
+
+static void scanChunk(
+    scanJob *job
     );
-static off_t search(
-    off_t *I, 
+
+static bsdiff_off_t search(
+    const bsdiff_sa32 *I32, 
+    const bsdiff_sa64 *I64, 
     u_char *old, 
-    off_t oldsize,
+    bsdiff_off_t oldsize,
     u_char *_new, 
-    off_t newsize, 
-    off_t st, 
-    off_t en, 
-    off_t *pos
+    bsdiff_off_t newsize, 
+    bsdiff_off_t st, 
+    bsdiff_off_t en, 
+    bsdiff_off_t *pos
     );
 
 //------------------------------------------------------------------------------
 
-int bsdiff_diff(const char *oldFile, const char *newFile, const char *patchFile, char error[64])
+void bsdiff_diff_options_init(bsdiff_diff_options *options)
 {
-    int retCode = 0;
-    FILE *fp = NULL;
-    BZFILE *bfp = NULL;
-    unsigned char *oldFileBuf = NULL, *newFileBuf = NULL;
-    off_t *I, *V;
-    unsigned char *diffBlock = NULL, *extraBlock = NULL;
-    int oldSize, newSize, diffBlockLen, extraBlockLen;
-    unsigned char header[32], ctrl[24];
-    int bzError;
-    off_t scan, pos, len, len2;
-    off_t lastscan, lastpos, lastoffset;
-    off_t oldscore, scsc;
-    off_t s, Sf, lenf, Sb, lenb;
-    off_t overlap, Ss, lens;
-    off_t i;
-
-    // 打开oldFile，将其内容读入oldFileBuf
-    if (!(fp = fopen(oldFile, "rb")) || !bsdiff_GetFileSize(fp, &oldSize)) {
-        bsdiff_SetError(error, "Can't open oldFile");
-        goto MyExit;
+    options->saAlgorithm = BSDIFF_SA_AUTO;
+    options->numThreads = 1;
+    options->indexFile = NULL;
+    options->scanChunks = 1;
+    options->useMapping = 1;
+    options->ctrlCodec = BSDIFF_CODEC_BZIP2;
+    options->diffCodec = BSDIFF_CODEC_BZIP2;
+    options->extraCodec = BSDIFF_CODEC_BZIP2;
+    options->compressLevel = 0;
+    options->workFactor = 0;
+    options->frameSize = 0;
+    options->zeroRuns = 0;
+    options->maxMemory = 0;
+    options->filter = BSDIFF_FILTER_NONE;
+    options->matcher = BSDIFF_MATCH_SUFFIX;
+    options->inplace = 0;
+    options->inplaceScratch = 0;
+    options->stream = 0;
+    options->checksum = 0;
+    options->stats = NULL;
+    options->progress = NULL;
+    options->progressOpaque = NULL;
+}
+
+// 分帧时的一帧
+typedef struct frameJob {
+    unsigned char *data;        // 原始数据，压缩完就释放
+    bsdiff_off_t len;
+    bsdiff_off_t key;           // 流式patch中的排列顺序：帧的第一个字节对应的newFile位置
+    bsdiff_pcompress *job;
+    unsigned char *out;
+    bsdiff_off_t outLen;
+} frameJob;
+
+// 一个block的流式写入：不分帧时只有一个边写边压缩的流，分帧时每凑满一帧就提交压缩。
+// 压缩结果留在内存中，直到写patch的时候；原始数据只缓存正在压缩的部分
+typedef struct blockWriter {
+    int codec, level, workFactor;
+    bsdiff_off_t frameSize;             // 0表示不分帧
+    bsdiff_pool *pool;
+    const bsdiff_allocator *allocator;
+    bsdiff_pcompress *stream;           // 不分帧时
+    unsigned char *frame;               // 分帧时正在凑的一帧
+    bsdiff_off_t frameLen;
+    bsdiff_off_t key, frameKey;         // 调用者设置key，正在凑的一帧开始时记下它
+    frameJob *frames;
+    size_t numFrames, capacity, numDone;    // frames[0..numDone)已经取得了压缩结果
+    int ok;
+    bsdiff_monitor *monitor;            // 非NULL时把调用线程花在压缩上的时间记到phase上
+    int phase;
+} blockWriter;
+
+// sizeHint见bsdiff_EncoderInit；w总是要用writerFinish或writerDestroy释放
+static void writerInit(blockWriter *w, bsdiff_pool *pool, int codec, int level, int workFactor,
+                       bsdiff_off_t frameSize, bsdiff_off_t sizeHint, const bsdiff_allocator *allocator)
+{
+    memset(w, 0, sizeof(blockWriter));
+    w->codec = codec;
+    w->level = level;
+    w->workFactor = workFactor;
+    w->frameSize = frameSize;
+    w->pool = pool;
+    w->allocator = allocator;
+    w->ok = frameSize > 0 || 
+            (w->stream = bsdiff_PCompressCreate(pool, codec, level, workFactor, sizeHint, allocator)) != NULL;
+}
+
+// 取得frames[numDone]的压缩结果
+static void collectFrame(blockWriter *w)
+{
+    frameJob *f = &w->frames[w->numDone++];
+
+    w->ok = bsdiff_PCompressFinish(f->job, &f->out, &f->outLen) && w->ok;
+    f->job = NULL;
+    bsdiff_Free(w->allocator, f->data);
+    f->data = NULL;
+}
+
+// 提交正在凑的一帧
+static int submitFrame(blockWriter *w)
+{
+    frameJob *frames;
+
+    if (w->numFrames == w->capacity) {
+        if (!(frames = (frameJob*)bsdiff_Alloc(w->allocator, (w->capacity + 16) * 2 * sizeof(frameJob))))
+            return w->ok = 0;
+        if (w->numFrames)
+            memcpy(frames, w->frames, w->numFrames * sizeof(frameJob));
+        bsdiff_Free(w->allocator, w->frames);
+        w->frames = frames;
+        w->capacity = (w->capacity + 16) * 2;
     }
-    if (!(oldFileBuf = (unsigned char*)malloc(oldSize + 1))) {
-        bsdiff_SetError(error, "Out of memory");
-        goto MyExit;
+    memset(&w->frames[w->numFrames], 0, sizeof(frameJob));
+    w->frames[w->numFrames].data = w->frame;
+    w->frames[w->numFrames].len = w->frameLen;
+    w->frames[w->numFrames].key = w->frameKey;
+    if (!(w->frames[w->numFrames].job = bsdiff_PCompressSubmit(w->pool, w->codec, w->level, w->workFactor, 
+                                                               w->frame, w->frameLen, w->allocator)))
+        return w->ok = 0;
+    ++w->numFrames;
+    w->frame = NULL;
+    w->frameLen = 0;
+
+    // 正在压缩的帧不超过线程数的两倍（单线程时上面已经压缩完了）
+    while (w->numFrames - w->numDone > (w->pool ? 2 * (size_t)bsdiff_PoolThreads(w->pool) : 0))
+        collectFrame(w);
+    return w->ok;
+}
+
+static int writerPutData(blockWriter *w, const unsigned char *p, size_t len);
+
+// 追加block的数据，与bsdiff_write_fn兼容，出错时返回0
+static int writerPut(void *opaque, const void *data, size_t len)
+{
+    blockWriter *w = (blockWriter*)opaque;
+    double start;
+    int ok;
+
+    if (!w->monitor)
+        return writerPutData(w, (const unsigned char*)data, len);
+    start = bsdiff_MonitorClock(w->monitor);
+    ok = writerPutData(w, (const unsigned char*)data, len);
+    bsdiff_MonitorAdd(w->monitor, w->phase, start, len);
+    return ok;
+}
+
+static int writerPutData(blockWriter *w, const unsigned char *p, size_t len)
+{
+    size_t n;
+
+    if (!w->ok)
+        return 0;
+    if (w->frameSize == 0)
+        return w->ok = bsdiff_PCompressWrite(w->stream, p, len);
+
+    while (len > 0) {
+        if (!w->frame && !(w->frame = (unsigned char*)bsdiff_Alloc(w->allocator, (size_t)w->frameSize)))
+            return w->ok = 0;
+        if (w->frameLen == 0)
+            w->frameKey = w->key;
+        n = (size_t)MIN((bsdiff_off_t)len, w->frameSize - w->frameLen);
+        memcpy(w->frame + w->frameLen, p, n);
+        w->frameLen += n;
+        p += n;
+        len -= n;
+        if (w->frameLen == w->frameSize && !submitFrame(w))
+            return 0;
     }
-    if (!bsdiff_ReadFile(fp, oldFileBuf, oldSize)) {
-        bsdiff_SetError(error, "Can't read oldFile");
-        goto MyExit;
+    return 1;
+}
+
+// 等待所有的压缩任务完成并释放w
+static void writerDestroy(blockWriter *w)
+{
+    unsigned char *out;
+    bsdiff_off_t outLen;
+    size_t i;
+
+    if (w->stream && bsdiff_PCompressFinish(w->stream, &out, &outLen))
+        bsdiff_Free(w->allocator, out);
+    while (w->numDone < w->numFrames)
+        collectFrame(w);
+    for (i = 0; i < w->numFrames; ++i)
+        bsdiff_Free(w->allocator, w->frames[i].out);
+    bsdiff_Free(w->allocator, w->frames);
+    bsdiff_Free(w->allocator, w->frame);
+    memset(w, 0, sizeof(blockWriter));
+}
+
+static int writerFinishData(blockWriter *w, unsigned char **out, bsdiff_off_t *outLen);
+
+// 分帧时提交最后不满的一帧，等所有的帧压缩完
+static int collectAll(blockWriter *w)
+{
+    if (w->frameLen && w->ok)
+        submitFrame(w);
+    while (w->numDone < w->numFrames)
+        collectFrame(w);
+    return w->ok;
+}
+
+// 取得block压缩后的数据并释放w，分帧时是帧索引加上各帧的数据（格式见bsdiff_format.h）
+static int writerFinish(blockWriter *w, unsigned char **out, bsdiff_off_t *outLen)
+{
+    bsdiff_monitor *monitor = w->monitor;
+    int phase = w->phase;
+    double start;
+    int ok;
+
+    if (!monitor)
+        return writerFinishData(w, out, outLen);
+    start = bsdiff_MonitorClock(monitor);
+    ok = writerFinishData(w, out, outLen);
+    bsdiff_MonitorAdd(monitor, phase, start, 0);
+    return ok;
+}
+
+static int writerFinishData(blockWriter *w, unsigned char **out, bsdiff_off_t *outLen)
+{
+    bsdiff_off_t size, pos;
+    size_t i;
+    int ok;
+
+    *out = NULL;
+    if (w->frameSize == 0) {
+        ok = bsdiff_PCompressFinish(w->stream, out, outLen) && w->ok;
+        w->stream = NULL;
+        writerDestroy(w);
+        return ok;
     }
-    fclose(fp);
-    fp = NULL;
 
-    // 分配两个buffer（I和V），其尺寸为(oldSize + 1) * sizeof(off_t)
-    I = (off_t*)malloc((oldSize + 1) * sizeof(off_t));
-    V = (off_t*)malloc((oldSize + 1) * sizeof(off_t));
-    if (!I || !V) {
-        bsdiff_SetError(error, "Out of memory");
-        goto MyExit;
+    ok = collectAll(w);
+    if (ok) {
+        size = 8 + 16 * (bsdiff_off_t)w->numFrames;
+        for (i = 0; i < w->numFrames; ++i)
+            size += w->frames[i].outLen;
+        if ((*out = (unsigned char*)bsdiff_Alloc(w->allocator, (size_t)size)) != NULL) {
+            bsdiff_WriteOffset((bsdiff_off_t)w->numFrames, *out);
+            pos = 8 + 16 * (bsdiff_off_t)w->numFrames;
+            for (i = 0; i < w->numFrames; ++i) {
+                bsdiff_WriteOffset(w->frames[i].outLen, *out + 8 + 16 * i);
+                bsdiff_WriteOffset(w->frames[i].len, *out + 16 + 16 * i);
+                memcpy(*out + pos, w->frames[i].out, (size_t)w->frames[i].outLen);
+                pos += w->frames[i].outLen;
+            }
+            *outLen = size;
+        } else {
+            ok = 0;
+        }
     }
+    writerDestroy(w);
+    return ok;
+}
 
-    // 执行qsufsort
-    qsufsort(I, V, oldFileBuf, oldSize);
+// 流式patch：等三个block的帧都压缩完，按key（打补丁时开始用到它的newFile位置）交错写出，
+// key相同时按ctrl、diff、extra的顺序；sizes返回各block的记录总长度。w都由调用者释放
+static int writeStream(blockWriter *w[3], bsdiff_write_fn write, void *opaque, bsdiff_off_t sizes[3])
+{
+    unsigned char head[BSDIFF_STREAM_RECORD];
+    size_t next[3] = { 0, 0, 0 };
+    const frameJob *f;
+    double start;
+    int b, k;
+
+    for (k = 0; k < 3; ++k) {
+        start = w[k]->monitor ? bsdiff_MonitorClock(w[k]->monitor) : 0;
+        if (!collectAll(w[k]))
+            return 0;
+        if (w[k]->monitor)
+            bsdiff_MonitorAdd(w[k]->monitor, w[k]->phase, start, 0);
+        sizes[k] = 0;
+    }
+    for (;;) {
+        b = -1;
+        for (k = 0; k < 3; ++k) {
+            if (next[k] < w[k]->numFrames && (b < 0 || w[k]->frames[next[k]].key < w[b]->frames[next[b]].key))
+                b = k;
+        }
+        if (b < 0)
+            return 1;
+        f = &w[b]->frames[next[b]++];
+        head[0] = (unsigned char)b;
+        bsdiff_WriteOffset(f->outLen, head + 1);
+        bsdiff_WriteOffset(f->len, head + 9);
+        if (!write(opaque, head, sizeof(head)) || !write(opaque, f->out, (size_t)f->outLen))
+            return 0;
+        sizes[b] += BSDIFF_STREAM_RECORD + f->outLen;
+    }
+}
 
-    // V现在不用了，可以释放掉了
-    free(V);
-    V = NULL;
+// 按顺序把控制三元组对应的diff/extra数据交给各自的block
+typedef struct emitter {
+    const unsigned char *old, *new;
+    blockWriter diff, extra;
+    bsdiff_zrle_writer *zrle;           // NULL表示不做零游程编码
+    bsdiff_off_t zrleKey;               // zrle中还没有输出的token开始的newFile位置
+    unsigned char *buf;                 // EMIT_CHUNK字节
+    bsdiff_monitor *monitor;            // 非NULL时按输出到的位置报告匹配的进度（多线程时）
+    bsdiff_xxh64 *oldHash;              // 非NULL时按命令的顺序计算加法命令读到的old的校验和
+    bsdiff_xxh64 *newHash;              // 非NULL时按命令的顺序计算newFile的校验和（就地patch）
+} emitter;
+
+static int emitCtrl(emitter *e, const bsdiff_ctrl *c)
+{
+    bsdiff_off_t i, k, n, pending;
+
+    if (e->oldHash)
+        bsdiff_Xxh64Update(e->oldHash, e->old + c->oldPos, (size_t)c->diffLen);
+    if (e->newHash)
+        bsdiff_Xxh64Update(e->newHash, e->new + c->newPos, (size_t)(c->diffLen + c->extraLen));
+    for (i = 0; i < c->diffLen; i += n) {
+        n = MIN(c->diffLen - i, EMIT_CHUNK);
+        for (k = 0; k < n; ++k)
+            e->buf[k] = e->new[c->newPos + i + k] - e->old[c->oldPos + i + k];
+        if (!e->zrle) {
+            e->diff.key = c->newPos + i;
+            if (!writerPut(&e->diff, e->buf, (size_t)n))
+                return 0;
+            continue;
+        }
 
-    // 打开newFile，将其内容读入newFileBuf
-    if (!(fp = fopen(newFile, "rb")) || !bsdiff_GetFileSize(fp, &newSize)) {
-        bsdiff_SetError(error, "Can't open newFile");
-        goto MyExit;
+        // 零游程编码的token（比如一长段0）要到结束时才输出，key用它开始的位置，而不是输出时的位置；
+        // 还没输出的数据不比这一段长时，它们都在这一段的末尾
+        e->diff.key = e->zrleKey;
+        if (!bsdiff_ZrleWriterPut(e->zrle, e->buf, (size_t)n))
+            return 0;
+        pending = e->zrle->zeros + (bsdiff_off_t)(e->zrle->literalLen + e->zrle->tail);
+        if (pending <= n)
+            e->zrleKey = c->newPos + i + n - pending;
+    }
+    e->extra.key = c->newPos + c->diffLen;
+    return writerPut(&e->extra, e->new + c->newPos + c->diffLen, (size_t)c->extraLen);
+}
+
+// 依次输出job产生的控制三元组，job还在匹配时等着它发布新的三元组；job出错时返回0
+static int emitJob(emitter *e, scanJob *job)
+{
+    bsdiff_ctrl batch[PUBLISH_STEP];
+    size_t emitted = 0, n, j;
+    int done;
+
+    for (;;) {
+        bsdiff_MutexLock(&job->shared->mutex);
+        while (job->published == emitted && !job->done)
+            bsdiff_CondWait(&job->shared->cond, &job->shared->mutex);
+        n = MIN(job->published - emitted, PUBLISH_STEP);
+        if (n > 0)
+            memcpy(batch, job->ctrls + emitted, n * sizeof(bsdiff_ctrl));
+        done = job->done && emitted + n == job->published;
+        bsdiff_MutexUnlock(&job->shared->mutex);
+
+        for (j = 0; j < n; ++j) {
+            if (!emitCtrl(e, &batch[j]))
+                return 0;
+        }
+        emitted += n;
+
+        // 取消时让还在匹配的各段也停下来
+        if (n > 0 && e->monitor &&
+            !bsdiff_MonitorReport(e->monitor, BSDIFF_PHASE_SCAN, 
+                                  batch[n - 1].newPos + batch[n - 1].diffLen + batch[n - 1].extraLen, 
+                                  job->shared->total)) {
+            bsdiff_MutexLock(&job->shared->mutex);
+            job->shared->cancelled = 1;
+            bsdiff_MutexUnlock(&job->shared->mutex);
+            return 0;
+        }
+        if (done)
+            return job->ok;
+    }
+}
+
+// 就地patch要等所有的三元组都产生以后才能排序输出，这里只等待job匹配完
+static int waitJob(scanJob *job)
+{
+    int ok;
+
+    bsdiff_MutexLock(&job->shared->mutex);
+    while (!job->done)
+        bsdiff_CondWait(&job->shared->cond, &job->shared->mutex);
+    ok = job->ok;
+    bsdiff_MutexUnlock(&job->shared->mutex);
+    return ok;
+}
+
+// 把所有job的控制三元组编码成ctrl block，每个占24字节；每段最后一个三元组的seek要落到下一段的起点上
+static int buildCtrlBlock(scanJob *jobs, int numChunks, const bsdiff_allocator *allocator, bsdiff_stats *stats,
+                          unsigned char **ctrlBlock, bsdiff_off_t *ctrlBlockLen, size_t *numCtrls)
+{
+    const bsdiff_ctrl *c;
+    size_t j;
+    int k;
+
+    *numCtrls = 0;
+    for (k = 0; k < numChunks; ++k) {
+        if (k + 1 < numChunks && jobs[k].numCtrls && jobs[k + 1].numCtrls)
+            jobs[k].ctrls[jobs[k].numCtrls - 1].nextOldPos = jobs[k + 1].ctrls[0].oldPos;
+        *numCtrls += jobs[k].numCtrls;
+    }
+    if (!(*ctrlBlock = (unsigned char*)bsdiff_Alloc(allocator, *numCtrls * 24 + 1)))
+        return 0;
+    *ctrlBlockLen = 0;
+    for (k = 0; k < numChunks; ++k) {
+        for (j = 0; j < jobs[k].numCtrls; ++j) {
+            c = &jobs[k].ctrls[j];
+            bsdiff_WriteOffset(c->diffLen, *ctrlBlock + *ctrlBlockLen);
+            bsdiff_WriteOffset(c->extraLen, *ctrlBlock + *ctrlBlockLen + 8);
+            bsdiff_WriteOffset(c->nextOldPos - (c->oldPos + c->diffLen), *ctrlBlock + *ctrlBlockLen + 16);
+            *ctrlBlockLen += 24;
+            if (stats) {
+                stats->diffBytes += c->diffLen;
+                stats->extraBytes += c->extraLen;
+            }
+        }
+    }
+    return 1;
+}
+
+// 就地patch的一条命令（格式见bsdiff_format.h），同时输出它的diff或extra数据，加法命令的diff按old的srcPos处计算；
+// ctrlBlock为NULL时只计数
+static int putInplaceCmd(emitter *e, unsigned char *ctrlBlock, bsdiff_off_t *ctrlBlockLen, bsdiff_off_t newPos, 
+                         bsdiff_off_t oldPos, bsdiff_off_t len, bsdiff_off_t srcPos)
+{
+    bsdiff_ctrl c;
+
+    if (ctrlBlock) {
+        bsdiff_WriteOffset(newPos, ctrlBlock + *ctrlBlockLen);
+        bsdiff_WriteOffset(oldPos, ctrlBlock + *ctrlBlockLen + 8);
+        bsdiff_WriteOffset(len, ctrlBlock + *ctrlBlockLen + 16);
+        memset(&c, 0, sizeof(c));
+        c.newPos = newPos;
+        c.oldPos = srcPos;
+        if (oldPos == -1)
+            c.extraLen = len;
+        else
+            c.diffLen = len;
+        if (newPos >= 0 && !emitCtrl(e, &c))
+            return 0;
+    }
+    *ctrlBlockLen += 24;
+    return 1;
+}
+
+// 从暂存区读的命令：reads非0时输出在所有命令之前把old复制到暂存区的命令，否则输出从暂存区读的加法命令
+static int putInplaceStashed(emitter *e, const bsdiff_inplace_cmd *cmds, size_t numCmds, const unsigned char *mode, 
+                             int reads, unsigned char *ctrlBlock, bsdiff_off_t *ctrlBlockLen)
+{
+    bsdiff_off_t offset = 0;
+    size_t i;
+
+    for (i = 0; i < numCmds; ++i) {
+        if (mode[i] != BSDIFF_INPLACE_STASHED)
+            continue;
+        if (!(reads ? putInplaceCmd(e, ctrlBlock, ctrlBlockLen, -1 - offset, cmds[i].oldPos, cmds[i].len, 0) :
+                      putInplaceCmd(e, ctrlBlock, ctrlBlockLen, cmds[i].newPos, -2 - offset, cmds[i].len, 
+                                    cmds[i].oldPos)))
+            return 0;
+        offset += cmds[i].len;
+    }
+    return 1;
+}
+
+// 按bsdiff_InplaceOrder排好的顺序输出从文件读的加法命令，其中写在自己读的范围之后并且重叠的命令切成
+// BSDIFF_INPLACE_PIECE的小段，从后往前输出
+static int putInplaceOrdered(emitter *e, const bsdiff_inplace_cmd *cmds, const size_t *order, size_t numOrdered,
+                             unsigned char *ctrlBlock, bsdiff_off_t *ctrlBlockLen)
+{
+    const bsdiff_inplace_cmd *c;
+    bsdiff_off_t piece, len;
+    size_t j;
+
+    for (j = 0; j < numOrdered; ++j) {
+        c = &cmds[order[j]];
+        if (c->oldPos < c->newPos && c->newPos < c->oldPos + c->len) {
+            for (piece = (c->len - 1) / BSDIFF_INPLACE_PIECE * BSDIFF_INPLACE_PIECE; piece >= 0; 
+                 piece -= BSDIFF_INPLACE_PIECE) {
+                len = MIN(c->len - piece, BSDIFF_INPLACE_PIECE);
+                if (!putInplaceCmd(e, ctrlBlock, ctrlBlockLen, c->newPos + piece, c->oldPos + piece, len, 
+                                   c->oldPos + piece))
+                    return 0;
+            }
+        } else if (!putInplaceCmd(e, ctrlBlock, ctrlBlockLen, c->newPos, c->oldPos, c->len, c->oldPos)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// extra命令：原来的extra数据，加上被改成extra的加法命令，按newPos的顺序，相邻的合并成一条
+static int putInplaceLiterals(emitter *e, scanJob *jobs, int numChunks, const unsigned char *mode, 
+                              unsigned char *ctrlBlock, bsdiff_off_t *ctrlBlockLen, bsdiff_stats *stats)
+{
+    const bsdiff_ctrl *c;
+    bsdiff_off_t start = 0, end = 0, runStart, runEnd;
+    size_t j, add = 0;
+    int k, lit;
+
+    for (k = 0; k < numChunks; ++k) {
+        for (j = 0; j < jobs[k].numCtrls; ++j) {
+            c = &jobs[k].ctrls[j];
+            lit = c->diffLen > 0 && mode[add++] == BSDIFF_INPLACE_LITERAL;
+            runStart = lit ? c->newPos : c->newPos + c->diffLen;
+            runEnd = c->newPos + c->diffLen + c->extraLen;
+            if (runEnd > runStart) {
+                if (runStart != end) {
+                    if (end > start && !putInplaceCmd(e, ctrlBlock, ctrlBlockLen, start, -1, end - start, 0))
+                        return 0;
+                    start = runStart;
+                }
+                end = runEnd;
+            }
+            if (ctrlBlock && stats) {
+                stats->diffBytes += lit ? 0 : c->diffLen;
+                stats->extraBytes += runEnd - runStart;
+            }
+        }
     }
-    if (!(newFileBuf = (unsigned char*)malloc(newSize + 1))) {
+    return end <= start || putInplaceCmd(e, ctrlBlock, ctrlBlockLen, start, -1, end - start, 0);
+}
+
+// 输出就地patch的全部命令：复制到暂存区的、从文件读的、从暂存区读的、extra
+static int putInplace(emitter *e, scanJob *jobs, int numChunks, const bsdiff_inplace_cmd *cmds, size_t numCmds,
+                      const size_t *order, size_t numOrdered, const unsigned char *mode, 
+                      unsigned char *ctrlBlock, bsdiff_off_t *ctrlBlockLen, bsdiff_stats *stats)
+{
+    return putInplaceStashed(e, cmds, numCmds, mode, 1, ctrlBlock, ctrlBlockLen) &&
+           putInplaceOrdered(e, cmds, order, numOrdered, ctrlBlock, ctrlBlockLen) &&
+           putInplaceStashed(e, cmds, numCmds, mode, 0, ctrlBlock, ctrlBlockLen) &&
+           putInplaceLiterals(e, jobs, numChunks, mode, ctrlBlock, ctrlBlockLen, stats);
+}
+
+// 就地patch：所有job都匹配完以后，把加法命令排好序（见bsdiff_inplace.h），依次输出ctrl block和diff/extra数据；
+// 实际用到的暂存区大小（按KB向上取整）通过*scratchSize返回
+static int emitInplace(emitter *e, scanJob *jobs, int numChunks, const bsdiff_diff_options *options, 
+                       const bsdiff_allocator *allocator, bsdiff_stats *stats, unsigned char **ctrlBlock, 
+                       bsdiff_off_t *ctrlBlockLen, size_t *numCtrls, bsdiff_off_t *scratchSize, char error[64])
+{
+    int retCode = 0;
+    bsdiff_inplace_cmd *cmds = NULL;
+    size_t *order = NULL;
+    unsigned char *mode = NULL;
+    size_t numCmds = 0, numOrdered, j;
+    int k;
+
+    for (k = 0; k < numChunks; ++k) {
+        for (j = 0; j < jobs[k].numCtrls; ++j)
+            numCmds += jobs[k].ctrls[j].diffLen > 0;
+    }
+    if (!(cmds = (bsdiff_inplace_cmd*)bsdiff_Alloc(allocator, (numCmds + 1) * sizeof(bsdiff_inplace_cmd))) ||
+        !(order = (size_t*)bsdiff_Alloc(allocator, (numCmds + 1) * sizeof(size_t))) ||
+        !(mode = (unsigned char*)bsdiff_Alloc(allocator, numCmds + 1))) {
         bsdiff_SetError(error, "Out of memory");
         goto MyExit;
     }
-    if (!bsdiff_ReadFile(fp, newFileBuf, newSize)) {
-        bsdiff_SetError(error, "Can't read newFile");
+    numCmds = 0;
+    for (k = 0; k < numChunks; ++k) {
+        for (j = 0; j < jobs[k].numCtrls; ++j) {
+            if (jobs[k].ctrls[j].diffLen > 0) {
+                cmds[numCmds].newPos = jobs[k].ctrls[j].newPos;
+                cmds[numCmds].oldPos = jobs[k].ctrls[j].oldPos;
+                cmds[numCmds].len = jobs[k].ctrls[j].diffLen;
+                ++numCmds;
+            }
+        }
+    }
+    if (!bsdiff_InplaceOrder(cmds, numCmds, (bsdiff_off_t)options->inplaceScratch, order, &numOrdered, mode, 
+                             allocator)) {
+        bsdiff_SetError(error, "Out of memory");
         goto MyExit;
     }
-    fclose(fp);
-    fp = NULL;
+    *scratchSize = 0;
+    for (j = 0; j < numCmds; ++j) {
+        if (mode[j] == BSDIFF_INPLACE_STASHED)
+            *scratchSize += cmds[j].len;
+    }
+    *scratchSize = (*scratchSize + 1023) & ~(bsdiff_off_t)1023;
 
-    // 分配两个buffer（diffBlock和extraBlock），其尺寸为(newSize + 1)
-    diffBlock = (unsigned char*)malloc(newSize + 1);
-    extraBlock = (unsigned char*)malloc(newSize + 1);
-    if (!diffBlock || !extraBlock) {
+    // 先计数，再输出
+    *ctrlBlockLen = 0;
+    putInplace(e, jobs, numChunks, cmds, numCmds, order, numOrdered, mode, NULL, ctrlBlockLen, NULL);
+    *numCtrls = (size_t)(*ctrlBlockLen / 24);
+    if (!(*ctrlBlock = (unsigned char*)bsdiff_Alloc(allocator, (size_t)*ctrlBlockLen + 1))) {
         bsdiff_SetError(error, "Out of memory");
         goto MyExit;
     }
+    *ctrlBlockLen = 0;
+    if (!putInplace(e, jobs, numChunks, cmds, numCmds, order, numOrdered, mode, *ctrlBlock, ctrlBlockLen, stats)) {
+        bsdiff_SetError(error, "Compress failed");
+        goto MyExit;
+    }
+    retCode = 1;
 
-    diffBlockLen = 0;
-    extraBlockLen = 0;
+MyExit:
+    bsdiff_Free(allocator, cmds);
+    bsdiff_Free(allocator, order);
+    bsdiff_Free(allocator, mode);
+    return retCode;
+}
 
-    // 创建（打开）patchFile
-    if (!(fp = fopen(patchFile, "wb"))) {
-        bsdiff_SetError(error, "Can't open patchFile");
-        goto MyExit;
+// 为old准备好后缀数组I：有可用的索引文件时直接映射，否则现场构建（并按需写出索引）
+// 构建出来的I放在*sortBuf中（从allocator分配，由调用者释放）；映射的索引由调用者bsdiff_UnmapFile
+// 后缀数组元素的宽度由oldSize决定（见bsdiff_SuffixEntrySize），通过*entrySize返回
+// 构建所需的内存超过options->maxMemory时什么也不做，*windowed置为1，由调用者改用窗口化匹配
+static int prepareIndex(const unsigned char *old, bsdiff_off_t oldSize, const bsdiff_diff_options *options, 
+                        bsdiff_pool *pool, const bsdiff_allocator *allocator, void **sortBuf,
+                        bsdiff_mapping *indexMap, const void **I, size_t *entrySize, int *windowed,
+                        char error[64])
+{
+    unsigned long long oldHash = 0;
+
+    // 除了old本身，还要放得下(oldSize + 1)个后缀数组元素
+    *entrySize = bsdiff_SuffixEntrySize(oldSize);
+    if ((unsigned long long)oldSize >= (size_t)-1 / *entrySize) {
+        bsdiff_SetError(error, "oldFile too large");
+        return 0;
     }
 
-    // 写出文件头（占位，后面还要更新）
-    memcpy(header, "BSDIFF40", 8);
-    bsdiff_WriteOffset(0, header + 8);
-    bsdiff_WriteOffset(0, header + 16);
-    bsdiff_WriteOffset(newSize, header + 24);
-    if (!bsdiff_WriteFile(fp, header, 32)) {
-        bsdiff_SetError(error, "Can't write patchFile");
-        goto MyExit;
+    // 索引文件中记录了oldFile的内容hash，不匹配的（过期的）索引不会被使用
+    if (options->indexFile) {
+        oldHash = bsdiff_Xxh64(old, (size_t)oldSize, 0);
+        if (bsdiff_IndexLoad(options->indexFile, oldSize, oldHash, *entrySize, indexMap, I))
+            return 1;
     }
 
-    // 紧跟着header的是BZ2(ctrl block)
-    if (!(bfp = BZ2_bzWriteOpen(&bzError, fp, 9, 0, 0))) {
-        bsdiff_SetError(error, "BZ2_bzWriteOpen failed");
-        goto MyExit;
+    *windowed = options->maxMemory > 0 && 
+                bsdiff_SuffixSortMemory(options->saAlgorithm, oldSize) > options->maxMemory;
+    if (*windowed)
+        return 1;
+
+    // 分配后缀数组I，其尺寸为(oldSize + 1) * entrySize，然后构建后缀数组
+    // （qsufsort后端还会在内部临时分配一个同样大小的V）
+    *sortBuf = bsdiff_Alloc(allocator, ((size_t)oldSize + 1) * *entrySize);
+    if (!*sortBuf || !bsdiff_SuffixSort(options->saAlgorithm, *sortBuf, *entrySize, old, oldSize, pool, allocator)) {
+        bsdiff_SetError(error, "Out of memory");
+        return 0;
     }
+    *I = *sortBuf;
 
-	scan=0;len=0;
-	lastscan=0;lastpos=0;lastoffset=0;
-	while(scan<newSize) {
-		oldscore=0;
+    if (options->indexFile && !bsdiff_IndexSave(options->indexFile, *I, *entrySize, oldSize, oldHash)) {
+        bsdiff_SetError(error, "Can't write indexFile");
+        return 0;
+    }
+    return 1;
+}
 
-		for(scsc=scan+=len;scan<newSize;scan++) {
-			len=search(I, oldFileBuf, oldSize, newFileBuf + scan, newSize - scan,
-					0, oldSize, &pos);
+int bsdiff_index_create(const char *oldFile, const char *indexFile, 
+                        const bsdiff_diff_options *options, char error[64])
+{
+    int retCode = 0;
+    bsdiff_diff_options indexOptions;
+    bsdiff_pool *pool;
+    bsdiff_mapping indexMap;
+    bsdiff_filedata oldData;
+    unsigned char *filtered = NULL;
+    void *sortBuf = NULL;
+    const void *I = NULL;
+    size_t entrySize;
+    int windowed, filter;
+
+    // 索引总是完整的后缀数组，不受maxMemory的限制
+    if (options)
+        indexOptions = *options;
+    else
+        bsdiff_diff_options_init(&indexOptions);
+    indexOptions.indexFile = indexFile;
+    indexOptions.maxMemory = 0;
+
+    memset(&indexMap, 0, sizeof(indexMap));
+    memset(&oldData, 0, sizeof(oldData));
+    pool = bsdiff_PoolCreate(indexOptions.numThreads);
+
+    // 映射（或读入）oldFile，然后构建后缀数组并写出索引；使用过滤器时索引的是过滤后的old
+    // （AUTO时按oldFile的文件头选择），与diff时实际匹配的数据相同
+    if (bsdiff_LoadFile(oldFile, indexOptions.useMapping, &oldData, "oldFile", error)) {
+        filter = indexOptions.filter == BSDIFF_FILTER_AUTO ? 
+                 bsdiff_FilterDetect(oldData.data, (size_t)oldData.size) : indexOptions.filter;
+        if (filter < 0 || filter >= BSDIFF_FILTER_COUNT) {
+            bsdiff_SetError(error, "Invalid filter");
+        } else if (filter == BSDIFF_FILTER_NONE) {
+            retCode = prepareIndex(oldData.data, oldData.size, &indexOptions, pool, NULL, 
+                                   &sortBuf, &indexMap, &I, &entrySize, &windowed, error);
+        } else if (!(filtered = (unsigned char*)malloc((size_t)oldData.size + 1))) {
+            bsdiff_SetError(error, "Out of memory");
+        } else {
+            memcpy(filtered, oldData.data, (size_t)oldData.size);
+            bsdiff_FilterApply(filter, filtered, (size_t)oldData.size, 1);
+            retCode = prepareIndex(filtered, oldData.size, &indexOptions, pool, NULL, 
+                                   &sortBuf, &indexMap, &I, &entrySize, &windowed, error);
+        }
+    }
 
-			for(;scsc<scan+len;scsc++)
-			if((scsc+lastoffset<oldSize) &&
-				(oldFileBuf[scsc+lastoffset] == newFileBuf[scsc]))
-				oldscore++;
+    bsdiff_UnmapFile(&indexMap);
+    free(filtered);
+    free(sortBuf);
+    bsdiff_FreeFile(&oldData);
+    bsdiff_PoolDestroy(pool);
+    return retCode;
+}
 
-			if(((len==oldscore) && (len!=0)) || 
-				(len>oldscore+8)) break;
+int bsdiff_diff(const char *oldFile, const char *newFile, const char *patchFile, char error[64])
+{
+    return bsdiff_diff_ex(oldFile, newFile, patchFile, NULL, error);
+}
 
-			if((scan+lastoffset<oldSize) &&
-				(oldFileBuf[scan+lastoffset] == newFileBuf[scan]))
-				oldscore--;
-		};
+int bsdiff_diff_ex(const char *oldFile, const char *newFile, const char *patchFile, 
+                   const bsdiff_diff_options *options, char error[64])
+{
+    int retCode = 0;
+    FILE *fp = NULL;
+    bsdiff_filedata oldData, newData;
+    bsdiff_diff_options defaultOptions;
+    double readStart, readSeconds;
 
-		if((len!=oldscore) || (scan==newSize)) {
-			s=0;Sf=0;lenf=0;
-			for(i=0;(lastscan+i<scan)&&(lastpos+i<oldSize);) {
-				if(oldFileBuf[lastpos+i]==newFileBuf[lastscan+i]) s++;
-				i++;
-				if(s*2-i>Sf*2-lenf) { Sf=s; lenf=i; };
-			};
+    if (!options) {
+        bsdiff_diff_options_init(&defaultOptions);
+        options = &defaultOptions;
+    }
 
-			lenb=0;
-			if(scan<newSize) {
-				s=0;Sb=0;
-				for(i=1;(scan>=lastscan+i)&&(pos>=i);i++) {
-					if(oldFileBuf[pos-i]==newFileBuf[scan-i]) s++;
-					if(s*2-i>Sb*2-lenb) { Sb=s; lenb=i; };
-				};
-			};
+    memset(&oldData, 0, sizeof(oldData));
+    memset(&newData, 0, sizeof(newData));
 
-			if(lastscan+lenf>scan-lenb) {
-				overlap=(lastscan+lenf)-(scan-lenb);
-				s=0;Ss=0;lens=0;
-				for(i=0;i<overlap;i++) {
-					if(newFileBuf[lastscan+lenf-overlap+i]==
-					   oldFileBuf[lastpos+lenf-overlap+i]) s++;
-					if(newFileBuf[scan-lenb+i]==
-					   oldFileBuf[pos-lenb+i]) s--;
-					if(s>Ss) { Ss=s; lens=i+1; };
-				};
+    // 映射（或读入）oldFile和newFile；读入的时间在diff结束以后才记到统计中（diff开始时会清零统计）
+    readStart = bsdiff_Now();
+    if (!bsdiff_LoadFile(oldFile, options->useMapping, &oldData, "oldFile", error))
+        goto MyExit;
+    if (!bsdiff_LoadFile(newFile, options->useMapping, &newData, "newFile", error))
+        goto MyExit;
+    readSeconds = bsdiff_Now() - readStart;
 
-				lenf+=lens-overlap;
-				lenb-=lens;
-			};
+    // 创建（打开）patchFile，patch直接从内存写到文件中
+    if (!(fp = fopen(patchFile, "wb"))) {
+        bsdiff_SetError(error, "Can't open patchFile");
+        goto MyExit;
+    }
+    if (!bsdiff_diff_mem(oldData.data, (size_t)oldData.size, newData.data, (size_t)newData.size,
+                         bsdiff_FileSink, fp, NULL, options, error))
+        goto MyExit;
+    if (options->stats) {
+        options->stats->phases[BSDIFF_PHASE_READ].seconds += readSeconds;
+        options->stats->phases[BSDIFF_PHASE_READ].bytes += oldData.size + newData.size;
+        options->stats->seconds += readSeconds;
+    }
+    if (fclose(fp)) {
+        fp = NULL;
+        bsdiff_SetError(error, "Can't write patchFile");
+        goto MyExit;
+    }
+    fp = NULL;
 
-			for(i=0;i<lenf;i++)
-				diffBlock[diffBlockLen+i]=newFileBuf[lastscan+i]-oldFileBuf[lastpos+i];
-			for(i=0;i<(scan-lenb)-(lastscan+lenf);i++)
-				extraBlock[extraBlockLen+i]=newFileBuf[lastscan+lenf+i];
+    retCode = 1;
 
-			diffBlockLen+=lenf;
-			extraBlockLen+=(scan-lenb)-(lastscan+lenf);
+MyExit:
+    if (fp)
+        fclose(fp);
+    bsdiff_FreeFile(&oldData);
+    bsdiff_FreeFile(&newData);
+    return retCode;
+}
 
-			// 写出一组ctrl data
-			bsdiff_WriteOffset(lenf, ctrl);
-			bsdiff_WriteOffset((scan-lenb)-(lastscan+lenf), ctrl + 8);
-			bsdiff_WriteOffset((pos-lenb)-(lastpos+lenf), ctrl + 16);
-			BZ2_bzWrite(&bzError, bfp, ctrl, 24);
-			if (bzError != BZ_OK) { 
-				bsdiff_SetError(error, "BZ2_bzWrite failed");
-				goto MyExit;
-			}
+// 在options->maxMemory之内能够构建后缀数组的最长窗口
+static bsdiff_off_t maxWindowSize(const bsdiff_diff_options *options, bsdiff_off_t oldSize)
+{
+    bsdiff_off_t lo = 0, hi = oldSize, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo + 1) / 2;
+        if (bsdiff_SuffixSortMemory(options->saAlgorithm, mid) <= options->maxMemory)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
 
-			lastscan=scan-lenb;
-			lastpos=pos-lenb;
-			lastoffset=pos-scan;
-		};
-	};
-    BZ2_bzWriteClose(&bzError, bfp, 0, NULL, NULL);
-    if (bzError != BZ_OK) {
-        bsdiff_SetError(error, "BZ2_bzWriteClose failed");
-        goto MyExit;
+// 窗口化匹配：依次为每个用到的窗口构建后缀数组（都放在sortBuf中），然后在线程池上匹配选中它的各段
+// 排序的时间记在SORT阶段；每个窗口匹配完报告一次进度，被取消时返回0
+static int scanWindows(const bsdiff_window_plan *plan, scanJob *jobs, const unsigned char *old, 
+                       bsdiff_off_t oldSize, int algorithm, void *sortBuf, size_t entrySize, 
+                       bsdiff_pool *pool, const bsdiff_allocator *allocator, bsdiff_monitor *monitor)
+{
+    bsdiff_off_t start, len;
+    double clock;
+    int w, k, used;
+
+    for (w = 0; w < plan->numWindows; ++w) {
+        for (used = 0, k = 0; k < plan->numRegions && !used; ++k)
+            used = plan->regionWindow[k] == w;
+        if (!used)
+            continue;
+
+        bsdiff_WindowRange(plan, oldSize, w, &start, &len);
+        clock = bsdiff_MonitorClock(monitor);
+        if (!bsdiff_SuffixSort(algorithm, sortBuf, entrySize, old + start, len, pool, allocator))
+            return 0;
+        bsdiff_MonitorAdd(monitor, BSDIFF_PHASE_SORT, clock, len);
+        for (k = 0; k < plan->numRegions; ++k) {
+            if (plan->regionWindow[k] != w)
+                continue;
+            jobs[k].I32 = entrySize == sizeof(bsdiff_sa32) ? (const bsdiff_sa32*)sortBuf : NULL;
+            jobs[k].I64 = entrySize == sizeof(bsdiff_sa32) ? NULL : (const bsdiff_sa64*)sortBuf;
+            jobs[k].old = old + start;
+            jobs[k].oldSize = len;
+            jobs[k].oldBase = start;
+            bsdiff_PoolSubmit(pool, scanTask, &jobs[k]);
+        }
+
+        // 下一个窗口要重用sortBuf
+        bsdiff_PoolWait(pool);
+        if (!bsdiff_MonitorReport(monitor, BSDIFF_PHASE_SCAN, jobs[0].shared->scanned, jobs[0].shared->total))
+            return 0;
     }
-    bfp = NULL;
+    return 1;
+}
 
-    // 取得BZ2(ctrl block)的长度，填回到header中去
-    if ((len = ftell(fp)) == -1) {
-        bsdiff_SetError(error, "ftell failed");
+// bsdiff_diff_mem和bsdiff_ctx_diff的实现，匹配和压缩使用调用者的线程池（单线程时为NULL）
+static int diffCore(const unsigned char *oldFileBuf, size_t oldSize, const unsigned char *newFileBuf, 
+                    size_t newSize, bsdiff_write_fn write, void *opaque, const bsdiff_allocator *allocator, 
+                    bsdiff_pool *pool, const bsdiff_diff_options *options, char error[64])
+{
+    int retCode = 0;
+    bsdiff_mapping indexMap;
+    void *sortBuf = NULL;
+    const void *I = NULL;
+    size_t entrySize;
+    int windowed = 0;
+    bsdiff_window_plan plan;
+    bsdiff_off_t windowSize;
+    unsigned char *ctrlBlock = NULL;
+    unsigned char *ctrlZ = NULL, *diffZ = NULL, *extraZ = NULL;
+    emitter emit;
+    blockWriter ctrlWriter;
+    scanShared shared;
+    bsdiff_monitor monitor;
+    bsdiff_stats *stats = options->stats;
+    double clock, overlapped = 0;
+    bsdiff_off_t frameSize;
+    int ok;
+    bsdiff_off_t ctrlBlockLen;
+    bsdiff_off_t ctrlZLen, diffZLen, extraZLen;
+    bsdiff_header header;
+    unsigned char headerBuf[BSDIFF_HEADER_MAX];
+    int filter;
+    unsigned char *filteredOld = NULL, *filteredNew = NULL;
+    bsdiff_kgram kgram;
+    scanJob *jobs = NULL;
+    int numChunks = 0, k;
+    size_t numCtrls;
+    bsdiff_off_t scratchSize = 0;
+    blockWriter *streamWriters[3];
+    bsdiff_off_t sizes[3], i, newPos;
+    bsdiff_xxh64 oldHash, newHash;
+    unsigned long long newChecksum = 0;
+
+    memset(&indexMap, 0, sizeof(indexMap));
+    memset(&plan, 0, sizeof(plan));
+    memset(&emit, 0, sizeof(emit));
+    memset(&ctrlWriter, 0, sizeof(ctrlWriter));
+    memset(&shared, 0, sizeof(shared));
+    memset(&kgram, 0, sizeof(kgram));
+    bsdiff_MutexInit(&shared.mutex);
+    bsdiff_CondInit(&shared.cond);
+    bsdiff_MonitorInit(&monitor, stats, options->progress, options->progressOpaque);
+
+    if (!bsdiff_CodecAvailable(options->ctrlCodec) || !bsdiff_CodecAvailable(options->diffCodec) ||
+        !bsdiff_CodecAvailable(options->extraCodec)) {
+        bsdiff_SetError(error, "Unsupported codec");
+        goto MyExit;
+    }
+    if (options->workFactor < 0 || options->workFactor > 250) {
+        bsdiff_SetError(error, "Invalid work factor");
+        goto MyExit;
+    }
+    if (options->matcher != BSDIFF_MATCH_SUFFIX && options->matcher != BSDIFF_MATCH_HASH) {
+        bsdiff_SetError(error, "Invalid matcher");
+        goto MyExit;
+    }
+    if ((bsdiff_off_t)options->inplaceScratch > BSDIFF_INPLACE_SCRATCH_MAX) {
+        bsdiff_SetError(error, "Invalid scratch size");
+        goto MyExit;
+    }
+    if (options->stream && options->inplace) {
+        bsdiff_SetError(error, "In-place patch can't be streamed");
         goto MyExit;
     }
-    bsdiff_WriteOffset(len-32, header + 8);
 
-    // 写BZ2(diff block)
-    if ((bfp = BZ2_bzWriteOpen(&bzError, fp, 9, 0, 0)) == NULL) {
-        bsdiff_SetError(error, "BZ2_bzWriteOpen failed");
+    // 可执行文件过滤：在过滤后的副本上匹配，后面的步骤都不知道过滤的存在
+    // 就地打补丁时newFile不经过内存，不能反过滤，AUTO总是不过滤
+    filter = options->filter == BSDIFF_FILTER_AUTO ? 
+             (options->inplace ? BSDIFF_FILTER_NONE : bsdiff_FilterDetect(newFileBuf, newSize)) : options->filter;
+    if (filter < 0 || filter >= BSDIFF_FILTER_COUNT || (options->inplace && filter != BSDIFF_FILTER_NONE)) {
+        bsdiff_SetError(error, "Invalid filter");
         goto MyExit;
     }
-    BZ2_bzWrite(&bzError, bfp, diffBlock, diffBlockLen);
-    if (bzError != BZ_OK) {
-        bsdiff_SetError(error, "BZ2_bzWriteClose failed");
+    // 校验和：old按命令的顺序在输出时计算；newFile一般就是整个（过滤之前的）newFile，
+    // 就地patch中命令不按newFile的顺序执行，也在输出时计算
+    if (options->checksum) {
+        bsdiff_Xxh64Init(&oldHash, 0);
+        emit.oldHash = &oldHash;
+        if (options->inplace) {
+            bsdiff_Xxh64Init(&newHash, 0);
+            emit.newHash = &newHash;
+        } else {
+            newChecksum = bsdiff_Xxh64(newFileBuf, newSize, 0);
+        }
+    }
+    if (filter != BSDIFF_FILTER_NONE) {
+        if (!(filteredOld = (unsigned char*)bsdiff_Alloc(allocator, oldSize + 1)) ||
+            !(filteredNew = (unsigned char*)bsdiff_Alloc(allocator, newSize + 1))) {
+            bsdiff_SetError(error, "Out of memory");
+            goto MyExit;
+        }
+        memcpy(filteredOld, oldFileBuf, oldSize);
+        memcpy(filteredNew, newFileBuf, newSize);
+        bsdiff_FilterApply(filter, filteredOld, oldSize, 1);
+        bsdiff_FilterApply(filter, filteredNew, newSize, 1);
+        oldFileBuf = filteredOld;
+        newFileBuf = filteredNew;
+    }
+    emit.old = oldFileBuf;
+    emit.new = newFileBuf;
+
+    // 构建k-gram hash索引，或者构建（从索引文件映射）后缀数组；两者的时间都记在SORT中
+    clock = bsdiff_MonitorClock(&monitor);
+    if (!bsdiff_MonitorReport(&monitor, BSDIFF_PHASE_SORT, 0, oldSize)) {
+        bsdiff_SetError(error, "Cancelled");
         goto MyExit;
     }
-    BZ2_bzWriteClose(&bzError, bfp, 0, NULL, NULL);
-    if (bzError != BZ_OK) {
-        bsdiff_SetError(error, "BZ2_bzWriteClose failed");
+    if (options->matcher == BSDIFF_MATCH_HASH) {
+        entrySize = sizeof(bsdiff_sa32);
+        if (!bsdiff_KgramBuild(&kgram, oldFileBuf, (bsdiff_off_t)oldSize, allocator)) {
+            bsdiff_SetError(error, "Out of memory");
+            goto MyExit;
+        }
+    } else if (!prepareIndex(oldFileBuf, (bsdiff_off_t)oldSize, options, pool, allocator, 
+                             &sortBuf, &indexMap, &I, &entrySize, &windowed, error)) {
         goto MyExit;
     }
-    bfp = NULL;
+    if (!windowed) {
+        bsdiff_MonitorAdd(&monitor, BSDIFF_PHASE_SORT, clock, oldSize);
+        if (!bsdiff_MonitorReport(&monitor, BSDIFF_PHASE_SORT, oldSize, oldSize)) {
+            bsdiff_SetError(error, "Cancelled");
+            goto MyExit;
+        }
+    }
 
-    // 取得BZ2(diff block)的长度，填回到header中去
-    if ((len2 = ftell(fp)) == -1) {
-        bsdiff_SetError(error, "ftell failed");
+    // 超出maxMemory时改用窗口化匹配：选出每段newFile所用的窗口，sortBuf按窗口的长度分配，各个窗口轮流使用
+    if (windowed) {
+        if ((windowSize = maxWindowSize(options, (bsdiff_off_t)oldSize)) < MIN_WINDOW) {
+            bsdiff_SetError(error, "maxMemory too small");
+            goto MyExit;
+        }
+        entrySize = bsdiff_SuffixEntrySize(windowSize);
+        if (!bsdiff_WindowPlan(oldFileBuf, (bsdiff_off_t)oldSize, newFileBuf, (bsdiff_off_t)newSize, 
+                               windowSize, allocator, &plan) ||
+            !(sortBuf = bsdiff_Alloc(allocator, ((size_t)windowSize + 1) * entrySize))) {
+            bsdiff_SetError(error, "Out of memory");
+            goto MyExit;
+        }
+        // 投票选窗口的时间也算在SORT中，各窗口的排序在scanWindows中计时
+        bsdiff_MonitorAdd(&monitor, BSDIFF_PHASE_SORT, clock, 0);
+    }
+
+    // 把newFile切成numChunks段，各段独立地在后缀数组上做匹配，生成各自的控制三元组
+    // （窗口化匹配时就是计划中的各段）
+    numChunks = options->scanChunks > 1 ? options->scanChunks : 1;
+    if ((size_t)numChunks > newSize)
+        numChunks = newSize > 0 ? (int)newSize : 1;
+    if (windowed)
+        numChunks = plan.numRegions;
+    if (!(jobs = (scanJob*)bsdiff_Alloc(allocator, numChunks * sizeof(scanJob)))) {
+        numChunks = 0;
+        bsdiff_SetError(error, "Out of memory");
+        goto MyExit;
+    }
+    memset(jobs, 0, numChunks * sizeof(scanJob));
+    for (k = 0; k < numChunks; ++k) {
+        jobs[k].I32 = entrySize == sizeof(bsdiff_sa32) ? (const bsdiff_sa32*)I : NULL;
+        jobs[k].I64 = entrySize == sizeof(bsdiff_sa32) ? NULL : (const bsdiff_sa64*)I;
+        jobs[k].kgram = kgram.slots ? &kgram : NULL;
+        jobs[k].old = oldFileBuf;
+        jobs[k].oldSize = (bsdiff_off_t)oldSize;
+        jobs[k].new = newFileBuf;
+        if (windowed)
+            jobs[k].newStart = plan.regionStart[k];
+        else
+            jobs[k].newStart = ((bsdiff_off_t)newSize / numChunks) * k + MIN(k, (bsdiff_off_t)newSize % numChunks);
+        jobs[k].allocator = allocator;
+        jobs[k].shared = &shared;
+        if (k > 0)
+            jobs[k - 1].newEnd = jobs[k].newStart;
+    }
+    jobs[numChunks - 1].newEnd = (bsdiff_off_t)newSize;
+    shared.total = (bsdiff_off_t)newSize;
+
+    // diff/extra数据边匹配边交给压缩器：多线程时各段在线程池上匹配，调用线程按顺序输出已经产生的
+    // 三元组，压缩与匹配同时进行；单线程时各段依次匹配完再输出。两个block都不需要newSize大小的buffer，
+    // 总长度事先不知道，所以流式压缩时都不给出sizeHint
+    frameSize = (bsdiff_off_t)MIN(options->frameSize, (size_t)BSDIFF_FRAME_MAX);
+    if (options->stream && frameSize == 0)
+        frameSize = BSDIFF_STREAM_FRAME;
+    writerInit(&emit.diff, pool, options->diffCodec, options->compressLevel, options->workFactor,
+               frameSize, -1, allocator);
+    writerInit(&emit.extra, pool, options->extraCodec, options->compressLevel, options->workFactor,
+               frameSize, -1, allocator);
+    emit.buf = (unsigned char*)bsdiff_Alloc(allocator, EMIT_CHUNK);
+    if (options->zeroRuns && (emit.zrle = (bsdiff_zrle_writer*)bsdiff_Alloc(allocator, sizeof(bsdiff_zrle_writer))))
+        bsdiff_ZrleWriterInit(emit.zrle, writerPut, &emit.diff);
+    if (!emit.diff.ok || !emit.extra.ok || !emit.buf || (options->zeroRuns && !emit.zrle)) {
+        bsdiff_SetError(error, "Out of memory");
         goto MyExit;
     }
-    bsdiff_WriteOffset(len2 - len, header + 16);
 
-    // 写BZ2(extra block)
-    if ((bfp = BZ2_bzWriteOpen(&bzError, fp, 9, 0, 0)) == NULL) {
-        bsdiff_SetError(error, "BZ2_bzWriteOpen failed");
+    // 进度：单线程时由scanChunk在匹配的同时报告，多线程时由调用线程按输出到的位置报告，
+    // 窗口化匹配时每个窗口匹配完报告一次。统计：流式压缩和窗口排序的时间从匹配中扣除
+    if (stats) {
+        emit.diff.monitor = emit.extra.monitor = &monitor;
+        emit.diff.phase = BSDIFF_PHASE_DIFF;
+        emit.extra.phase = BSDIFF_PHASE_EXTRA;
+        overlapped = stats->phases[BSDIFF_PHASE_SORT].seconds;
+    }
+    shared.monitor = pool ? NULL : &monitor;
+    emit.monitor = pool && !windowed ? &monitor : NULL;
+    clock = bsdiff_MonitorClock(&monitor);
+
+    // 窗口化匹配时各个窗口依次匹配完，再按顺序输出
+    if (windowed) {
+        if (!scanWindows(&plan, jobs, oldFileBuf, (bsdiff_off_t)oldSize, options->saAlgorithm, 
+                         sortBuf, entrySize, pool, allocator, &monitor)) {
+            if (monitor.cancelled) {
+                bsdiff_SetError(error, "Cancelled");
+                goto MyExit;
+            }
+            bsdiff_SetError(error, "Out of memory");
+            goto MyExit;
+        }
+    } else {
+        for (k = 0; k < numChunks && !monitor.cancelled; ++k)
+            bsdiff_PoolSubmit(pool, scanTask, &jobs[k]);
+        if (monitor.cancelled) {
+            bsdiff_SetError(error, "Cancelled");
+            goto MyExit;
+        }
+    }
+    for (k = 0; k < numChunks; ++k) {
+        if (options->inplace ? !waitJob(&jobs[k]) : !emitJob(&emit, &jobs[k])) {
+            if (monitor.cancelled) {
+                bsdiff_SetError(error, "Cancelled");
+                goto MyExit;
+            }
+            bsdiff_SetError(error, jobs[k].ok ? "Compress failed" : "Out of memory");
+            goto MyExit;
+        }
+    }
+
+    // 控制三元组编码成ctrl block；就地patch这时才排序并输出diff/extra数据
+    if (options->inplace) {
+        if (!emitInplace(&emit, jobs, numChunks, options, allocator, stats, &ctrlBlock, &ctrlBlockLen, &numCtrls, 
+                         &scratchSize, error))
+            goto MyExit;
+    } else if (!buildCtrlBlock(jobs, numChunks, allocator, stats, &ctrlBlock, &ctrlBlockLen, &numCtrls)) {
+        bsdiff_SetError(error, "Out of memory");
         goto MyExit;
     }
-    BZ2_bzWrite(&bzError, bfp, extraBlock, extraBlockLen);
-    if (bzError != BZ_OK) {
-        bsdiff_SetError(error, "BZ2_bzWriteClose failed");
+    emit.diff.key = emit.zrleKey;
+    if (emit.zrle && !bsdiff_ZrleWriterFinish(emit.zrle)) {
+        bsdiff_SetError(error, "Compress failed");
         goto MyExit;
     }
-    BZ2_bzWriteClose(&bzError, bfp, 0, NULL, NULL);
-    if (bzError != BZ_OK) {
-        bsdiff_SetError(error, "BZ2_bzWriteClose failed");
+    bsdiff_PoolWait(pool);
+    if (stats) {
+        overlapped = stats->phases[BSDIFF_PHASE_SORT].seconds - overlapped +
+                     stats->phases[BSDIFF_PHASE_DIFF].seconds + stats->phases[BSDIFF_PHASE_EXTRA].seconds;
+        bsdiff_MonitorAdd(&monitor, BSDIFF_PHASE_SCAN, clock + overlapped, newSize);
+    }
+    if (!bsdiff_MonitorReport(&monitor, BSDIFF_PHASE_SCAN, newSize, newSize)) {
+        bsdiff_SetError(error, "Cancelled");
         goto MyExit;
     }
-    bfp = NULL;
 
-    // Seek to the beginning, write the header, and close the file
-    if (fseek(fp, 0, SEEK_SET) || fwrite(header, 32, 1, fp) != 1 || fclose(fp)) {
-        bsdiff_SetError(error, "failed to update header");
+    // 三个block分别压缩成独立的流（或者分帧），各自使用options指定的codec；
+    // bzip2的block（帧）在多线程时还会再切成小block并行压缩（结果与单线程完全相同）
+    clock = bsdiff_MonitorClock(&monitor);
+    writerInit(&ctrlWriter, pool, options->ctrlCodec, options->compressLevel, options->workFactor,
+               frameSize, ctrlBlockLen, allocator);
+    if (options->stream) {
+        // 流式patch中每个三元组的key是它开始的newFile位置
+        for (newPos = 0, i = 0; i < ctrlBlockLen; i += 24) {
+            ctrlWriter.key = newPos;
+            writerPut(&ctrlWriter, ctrlBlock + i, 24);
+            newPos += bsdiff_ReadOffset(ctrlBlock + i) + bsdiff_ReadOffset(ctrlBlock + i + 8);
+        }
+        ok = ctrlWriter.ok;
+    } else {
+        writerPut(&ctrlWriter, ctrlBlock, (size_t)ctrlBlockLen);
+        ok = writerFinish(&ctrlWriter, &ctrlZ, &ctrlZLen);
+    }
+    bsdiff_MonitorAdd(&monitor, BSDIFF_PHASE_CTRL, clock, ctrlBlockLen);
+    if (!bsdiff_MonitorReport(&monitor, BSDIFF_PHASE_CTRL, ctrlBlockLen, ctrlBlockLen)) {
+        bsdiff_SetError(error, "Cancelled");
+        goto MyExit;
+    }
+    if (!options->stream) {
+        ok = writerFinish(&emit.diff, &diffZ, &diffZLen) && ok;
+        ok = writerFinish(&emit.extra, &extraZ, &extraZLen) && ok;
+    }
+    if (!ok) {
+        bsdiff_SetError(error, "Compress failed");
         goto MyExit;
     }
-    fp = NULL;
+
+    // 文件头记录了前两个压缩block的长度（流式patch为0）、newFile的长度，以及（BSDIFF41时）各block的codec
+    memset(&header, 0, sizeof(header));
+    header.ctrlLen = options->stream ? 0 : ctrlZLen;
+    header.diffLen = options->stream ? 0 : diffZLen;
+    header.newSize = (bsdiff_off_t)newSize;
+    header.ctrlCodec = options->ctrlCodec;
+    header.diffCodec = options->diffCodec;
+    header.extraCodec = options->extraCodec;
+    header.flags = (options->stream ? BSDIFF_FLAG_STREAM : frameSize > 0 ? BSDIFF_FLAG_FRAMED : 0) | 
+                   (options->zeroRuns ? BSDIFF_FLAG_ZRLE : 0) | (options->inplace ? BSDIFF_FLAG_INPLACE : 0) |
+                   (options->checksum ? BSDIFF_FLAG_CHECKSUM : 0);
+    header.filter = filter;
+    header.scratchSize = scratchSize;
+    if (options->checksum) {
+        header.oldHash = bsdiff_Xxh64Final(&oldHash);
+        header.newHash = options->inplace ? bsdiff_Xxh64Final(&newHash) : newChecksum;
+    }
+    header.size = bsdiff_HeaderWrite(&header, headerBuf);
+
+    clock = bsdiff_MonitorClock(&monitor);
+    if (options->stream) {
+        streamWriters[0] = &ctrlWriter;
+        streamWriters[1] = &emit.diff;
+        streamWriters[2] = &emit.extra;
+        if (!write(opaque, headerBuf, (size_t)header.size)) {
+            bsdiff_SetError(error, "Can't write patchFile");
+            goto MyExit;
+        }
+        if (!writeStream(streamWriters, write, opaque, sizes)) {
+            bsdiff_SetError(error, ctrlWriter.ok && emit.diff.ok && emit.extra.ok ? "Can't write patchFile" :
+                                                                                  "Compress failed");
+            goto MyExit;
+        }
+        ctrlZLen = sizes[0];
+        diffZLen = sizes[1];
+        extraZLen = sizes[2];
+    } else if (!write(opaque, headerBuf, (size_t)header.size) || 
+               !write(opaque, ctrlZ, (size_t)ctrlZLen) ||
+               !write(opaque, diffZ, (size_t)diffZLen) ||
+               !write(opaque, extraZ, (size_t)extraZLen)) {
+        bsdiff_SetError(error, "Can't write patchFile");
+        goto MyExit;
+    }
+    bsdiff_MonitorAdd(&monitor, BSDIFF_PHASE_WRITE, clock, header.size + ctrlZLen + diffZLen + extraZLen);
+    if (stats) {
+        stats->numCtrls = numCtrls;
+        stats->ctrlSize = ctrlZLen;
+        stats->diffSize = diffZLen;
+        stats->extraSize = extraZLen;
+    }
 
     retCode = 1;
 
 MyExit:
-    free(oldFileBuf);
-    free(newFileBuf);
-    free(I);
-    free(V);
-    free(diffBlock);
-    free(extraBlock);
-    if (fp)
-        fclose(fp);
+    // 出错时可能还有匹配和压缩任务在执行
+    bsdiff_PoolWait(pool);
+    writerDestroy(&emit.diff);
+    writerDestroy(&emit.extra);
+    writerDestroy(&ctrlWriter);
+    bsdiff_Free(allocator, emit.zrle);
+    bsdiff_Free(allocator, emit.buf);
+    bsdiff_Free(allocator, sortBuf);
+    bsdiff_KgramFree(&kgram, allocator);
+    bsdiff_UnmapFile(&indexMap);
+    bsdiff_WindowPlanFree(&plan, allocator);
+    bsdiff_Free(allocator, ctrlBlock);
+    bsdiff_Free(allocator, ctrlZ);
+    bsdiff_Free(allocator, diffZ);
+    bsdiff_Free(allocator, extraZ);
+    bsdiff_Free(allocator, filteredOld);
+    bsdiff_Free(allocator, filteredNew);
+    if (jobs) {
+        for (k = 0; k < numChunks; ++k)
+            bsdiff_Free(allocator, jobs[k].ctrls);
+        bsdiff_Free(allocator, jobs);
+    }
+    bsdiff_CondDestroy(&shared.cond);
+    bsdiff_MutexDestroy(&shared.mutex);
+    bsdiff_MonitorFinish(&monitor);
+    return retCode;
+}
+
+int bsdiff_diff_mem(const void *oldData, size_t oldSize, const void *newData, size_t newSize, 
+                    bsdiff_write_fn write, void *opaque, const bsdiff_allocator *allocator, 
+                    const bsdiff_diff_options *options, char error[64])
+{
+    bsdiff_diff_options defaultOptions;
+    bsdiff_pool *pool;
+    int retCode;
+
+    if (!options) {
+        bsdiff_diff_options_init(&defaultOptions);
+        options = &defaultOptions;
+    }
+
+    // 创建线程池（单线程时pool为NULL）
+    pool = bsdiff_PoolCreate(options->numThreads);
+    retCode = diffCore((const unsigned char*)oldData, oldSize, (const unsigned char*)newData, newSize, 
+                       write, opaque, allocator, pool, options, error);
+    bsdiff_PoolDestroy(pool);
     return retCode;
 }
 
+int bsdiff_ctx_diff(bsdiff_ctx *ctx, const void *oldData, size_t oldSize, const void *newData, size_t newSize, 
+                    bsdiff_write_fn write, void *opaque, const bsdiff_diff_options *options, char error[64])
+{
+    bsdiff_diff_options defaultOptions;
+
+    if (!options) {
+        bsdiff_diff_options_init(&defaultOptions);
+        options = &defaultOptions;
+    }
+    return diffCore((const unsigned char*)oldData, oldSize, (const unsigned char*)newData, newSize, 
+                    write, opaque, bsdiff_CtxAllocator(ctx), bsdiff_CtxPool(ctx), options, error);
+}
+
 //------------------------------------------------------------------------------
 
-static void split(off_t *I, off_t *V, off_t start, off_t len, off_t h)
+static void scanTask(void *arg)
 {
-	off_t i,j,k,x,tmp,jj,kk;
+    scanJob *job = (scanJob*)arg;
 
-	if(len<16) {
-		for(k=start;k<start+len;k+=j) {
-			j=1;x=V[I[k]+h];
-			for(i=1;k+i<start+len;i++) {
-				if(V[I[k+i]+h]<x) {
-					x=V[I[k+i]+h];
-					j=0;
-				};
-				if(V[I[k+i]+h]==x) {
-					tmp=I[k+j];I[k+j]=I[k+i];I[k+i]=tmp;
-					j++;
-				};
-			};
-			for(i=0;i<j;i++) V[I[k+i]]=k+j-1;
-			if(j==1) I[k]=-1;
-		};
-		return;
-	};
+    scanChunk(job);
 
-	x=V[I[start+len/2]+h];
-	jj=0;kk=0;
-	for(i=start;i<start+len;i++) {
-		if(V[I[i]+h]<x) jj++;
-		if(V[I[i]+h]==x) kk++;
-	};
-	jj+=start;kk+=jj;
-
-	i=start;j=0;k=0;
-	while(i<jj) {
-		if(V[I[i]+h]<x) {
-			i++;
-		} else if(V[I[i]+h]==x) {
-			tmp=I[i];I[i]=I[jj+j];I[jj+j]=tmp;
-			j++;
-		} else {
-			tmp=I[i];I[i]=I[kk+k];I[kk+k]=tmp;
-			k++;
-		};
-	};
+    bsdiff_MutexLock(&job->shared->mutex);
+    job->published = job->numCtrls;
+    job->done = 1;
+    job->shared->scanned += job->newEnd - job->newStart;
+    bsdiff_CondBroadcast(&job->shared->cond);
+    bsdiff_MutexUnlock(&job->shared->mutex);
+}
 
-	while(jj+j<kk) {
-		if(V[I[jj+j]+h]==x) {
-			j++;
-		} else {
-			tmp=I[jj+j];I[jj+j]=I[kk+k];I[kk+k]=tmp;
-			k++;
+static void scanChunk(scanJob *job)
+{
+	const bsdiff_sa32 *I32=job->I32;
+	const bsdiff_sa64 *I64=job->I64;
+	u_char *old=(u_char*)job->old, *_new=(u_char*)job->new;
+	bsdiff_off_t oldsize=job->oldSize, newEnd=job->newEnd;
+	bsdiff_ctrl *ctrls, *c;
+	size_t capacity;
+	bsdiff_off_t scan, pos, len;
+	bsdiff_off_t lastscan, lastpos, lastoffset;
+	bsdiff_off_t oldscore, scsc;
+	bsdiff_off_t s, Sf, lenf, Sb, lenb;
+	bsdiff_off_t overlap, Ss, lens;
+	bsdiff_off_t i, reported;
+	int stop;
+
+	scan=job->newStart;len=0;reported=job->newStart;
+	lastscan=job->newStart;lastpos=MIN(job->newStart,oldsize);lastoffset=lastpos-lastscan;
+	// 打补丁时old从0开始；窗口化匹配时newFile开头所在的窗口不一定从0开始，这时第一个三元组不能做加法
+	if(job->newStart==0&&job->oldBase>0) lastpos=-job->oldBase;
+	while(scan<newEnd) {
+		oldscore=0;
+
+		for(scsc=scan+=len;scan<newEnd;scan++) {
+			if(job->kgram)
+				len=bsdiff_KgramSearch(job->kgram, old, oldsize, _new + scan, newEnd - scan,
+						scan + lastoffset, &pos);
+			else
+				len=search(I32, I64, old, oldsize, _new + scan, newEnd - scan,
+						0, oldsize, &pos);
+
+			for(;scsc<scan+len;scsc++)
+			if((scsc+lastoffset<oldsize) &&
+				(old[scsc+lastoffset] == _new[scsc]))
+				oldscore++;
+
+			if(((len==oldscore) && (len!=0)) || 
+				(len>oldscore+8)) break;
+
+			if((scan+lastoffset<oldsize) &&
+				(old[scan+lastoffset] == _new[scan]))
+				oldscore--;
 		};
-	};
 
-	if(jj>start) split(I,V,start,jj-start,h);
+		if((len!=oldscore) || (scan==newEnd)) {
+			s=0;Sf=0;lenf=0;
+			for(i=0;(lastpos>=0)&&(lastscan+i<scan)&&(lastpos+i<oldsize);) {
+				if(old[lastpos+i]==_new[lastscan+i]) s++;
+				i++;
+				if(s*2-i>Sf*2-lenf) { Sf=s; lenf=i; };
+			};
 
-	for(i=0;i<kk-jj;i++) V[I[jj+i]]=kk-1;
-	if(jj==kk-1) I[jj]=-1;
+			lenb=0;
+			if(scan<newEnd) {
+				s=0;Sb=0;
+				for(i=1;(scan>=lastscan+i)&&(pos>=i);i++) {
+					if(old[pos-i]==_new[scan-i]) s++;
+					if(s*2-i>Sb*2-lenb) { Sb=s; lenb=i; };
+				};
+			};
 
-	if(start+len>kk) split(I,V,kk,start+len-kk,h);
-}
+			if(lastscan+lenf>scan-lenb) {
+				overlap=(lastscan+lenf)-(scan-lenb);
+				s=0;Ss=0;lens=0;
+				for(i=0;i<overlap;i++) {
+					if(_new[lastscan+lenf-overlap+i]==
+					   old[lastpos+lenf-overlap+i]) s++;
+					if(_new[scan-lenb+i]==
+					   old[pos-lenb+i]) s--;
+					if(s>Ss) { Ss=s; lens=i+1; };
+				};
 
-static void qsufsort(off_t *I,off_t *V, u_char *old, off_t oldsize)
-{
-	off_t buckets[256];
-	off_t i,h,len;
+				lenf+=lens-overlap;
+				lenb-=lens;
+			};
 
-	for(i=0;i<256;i++) buckets[i]=0;
-	for(i=0;i<oldsize;i++) buckets[old[i]]++;
-	for(i=1;i<256;i++) buckets[i]+=buckets[i-1];
-	for(i=255;i>0;i--) buckets[i]=buckets[i-1];
-	buckets[0]=0;
+			// 记录一组ctrl data；调用线程可能正在读取ctrls，所以在锁内换成新的数组
+			if(job->numCtrls==job->capacity) {
+				capacity=job->capacity ? job->capacity*2 : 1024;
+				ctrls=(bsdiff_ctrl*)bsdiff_Alloc(job->allocator,capacity*sizeof(bsdiff_ctrl));
+				if(!ctrls) return;
+				bsdiff_MutexLock(&job->shared->mutex);
+				if(job->numCtrls) memcpy(ctrls,job->ctrls,job->numCtrls*sizeof(bsdiff_ctrl));
+				bsdiff_Free(job->allocator,job->ctrls);
+				job->ctrls=ctrls;
+				job->capacity=capacity;
+				bsdiff_MutexUnlock(&job->shared->mutex);
+			};
+			c=&job->ctrls[job->numCtrls++];
+			c->newPos=lastscan;
+			c->oldPos=job->oldBase+lastpos;
+			c->diffLen=lenf;
+			c->extraLen=(scan-lenb)-(lastscan+lenf);
+			c->nextOldPos=job->oldBase+pos-lenb;
 
-	for(i=0;i<oldsize;i++) I[++buckets[old[i]]]=i;
-	I[0]=oldsize;
-	for(i=0;i<oldsize;i++) V[i]=buckets[old[i]];
-	V[oldsize]=0;
-	for(i=1;i<256;i++) if(buckets[i]==buckets[i-1]+1) I[buckets[i]]=-1;
-	I[0]=-1;
+			lastscan=scan-lenb;
+			lastpos=pos-lenb;
+			lastoffset=pos-scan;
 
-	for(h=1;I[0]!=-(oldsize+1);h+=h) {
-		len=0;
-		for(i=0;i<oldsize+1;) {
-			if(I[i]<0) {
-				len-=I[i];
-				i-=I[i];
-			} else {
-				if(len) I[i-len]=-len;
-				len=V[I[i]]+1-i;
-				split(I,V,i,len,h);
-				i+=len;
-				len=0;
+			// 让调用线程可以开始输出这些三元组的diff/extra数据；单线程时顺便报告进度。被取消时就此停止
+			if(job->numCtrls-job->published>=PUBLISH_STEP || lastscan-reported>=PUBLISH_BYTES) {
+				reported=lastscan;
+				bsdiff_MutexLock(&job->shared->mutex);
+				job->published=job->numCtrls;
+				bsdiff_CondBroadcast(&job->shared->cond);
+				stop=job->shared->cancelled;
+				bsdiff_MutexUnlock(&job->shared->mutex);
+				if(!stop && job->shared->monitor &&
+				   !bsdiff_MonitorReport(job->shared->monitor,BSDIFF_PHASE_SCAN,
+				                         job->shared->scanned+lastscan-job->newStart,job->shared->total))
+					stop=job->shared->cancelled=1;
+				if(stop) return;
 			};
 		};
-		if(len) I[i-len]=-len;
 	};
 
-	for(i=0;i<oldsize+1;i++) I[V[i]]=i;
+	job->ok=1;
 }
 
-static off_t matchlen(u_char *old, off_t oldsize, u_char *_new, off_t newsize)
+static bsdiff_off_t matchlen(u_char *old, bsdiff_off_t oldsize, u_char *_new, bsdiff_off_t newsize)
 {
-	off_t i;
-
-	for(i=0;(i<oldsize)&&(i<newsize);i++)
-		if(old[i]!=_new[i]) break;
-
-	return i;
+	return (bsdiff_off_t)bsdiff_MatchLen(old,_new,(size_t)MIN(oldsize,newsize));
 }
 
-#define MIN(x,y) (((x)<(y)) ? (x) : (y))
+// 按元素宽度读取后缀数组的第x项
+#define SA_AT(x)  (I32 ? (bsdiff_off_t)I32[x] : (bsdiff_off_t)I64[x])
 
-static off_t search(off_t *I, u_char *old, off_t oldsize,
-		u_char *_new, off_t newsize, off_t st, off_t en, off_t *pos)
+// 在I[st..en]中二分查找与_new公共前缀最长的后缀。
+// 区间两端与_new的公共前缀长度lcpSt/lcpEn是区间内所有后缀与_new公共前缀的下界，
+// 所以比较中点时可以跳过前MIN(lcpSt,lcpEn)个字节，结果与逐次memcmp完全相同
+static bsdiff_off_t search(const bsdiff_sa32 *I32, const bsdiff_sa64 *I64, u_char *old, bsdiff_off_t oldsize,
+		u_char *_new, bsdiff_off_t newsize, bsdiff_off_t st, bsdiff_off_t en, bsdiff_off_t *pos)
 {
-	off_t x,y;
+	bsdiff_off_t x,k,l;
+	bsdiff_off_t lcpSt,lcpEn;
+
+	lcpSt=matchlen(old+SA_AT(st),oldsize-SA_AT(st),_new,newsize);
+	lcpEn=matchlen(old+SA_AT(en),oldsize-SA_AT(en),_new,newsize);
 
-	if(en-st<2) {
-		x=matchlen(old+I[st],oldsize-I[st],_new,newsize);
-		y=matchlen(old+I[en],oldsize-I[en],_new,newsize);
+	while(en-st>=2) {
+		x=st+(en-st)/2;
 
-		if(x>y) {
-			*pos=I[st];
-			return x;
+		// 下一轮的中点只可能是这两个之一，提前把它们的I值取进缓存
+		if(I32) {
+			bsdiff_Prefetch(I32+st+(x-st)/2);
+			bsdiff_Prefetch(I32+x+(en-x)/2);
 		} else {
-			*pos=I[en];
-			return y;
-		}
+			bsdiff_Prefetch(I64+st+(x-st)/2);
+			bsdiff_Prefetch(I64+x+(en-x)/2);
+		};
+
+		k=MIN(lcpSt,lcpEn);
+		l=k+matchlen(old+SA_AT(x)+k,oldsize-SA_AT(x)-k,_new+k,newsize-k);
+		if((l<MIN(oldsize-SA_AT(x),newsize)) && (old[SA_AT(x)+l]<_new[l])) {
+			st=x;lcpSt=l;
+		} else {
+			en=x;lcpEn=l;
+		};
 	};
 
-	x=st+(en-st)/2;
-	if(memcmp(old+I[x],_new,MIN(oldsize-I[x],newsize))<0) {
-		return search(I,old,oldsize,_new,newsize,x,en,pos);
+	if(lcpSt>lcpEn) {
+		*pos=SA_AT(st);
+		return lcpSt;
 	} else {
-		return search(I,old,oldsize,_new,newsize,st,x,pos);
+		*pos=SA_AT(en);
+		return lcpEn;
 	};
 }
 
@@ -428,141 +1493,205 @@ static off_t search(off_t *I, u_char *old, off_t oldsize,
 
 #ifdef BSDIFF_STANDALONE
 
-#ifdef _WIN32
-
-int bsdiff_diff_dir(
-    const char *oldDir, 
-    const char *newDir, 
-    const char *diffDir,
-    char subPath[MAX_PATH]
-    )
+static void usage(const char *prog)
 {
-    int retCode = 0;
-    char newFile[MAX_PATH], oldFile[MAX_PATH], diffFile[MAX_PATH];
-    size_t newFileLen, oldFileLen, diffFileLen, subPathLen;
-    WIN32_FIND_DATAA wfd;
-    HANDLE findHandle, fileHandle;
-    char error[64];
-
-    strcpy(newFile, newDir);
-    strcat(newFile, subPath);
-    newFileLen = strlen(newFile);
-    strcat(newFile, "*");
-
-    strcpy(oldFile, oldDir);
-    strcat(oldFile, subPath);
-    oldFileLen = strlen(oldFile);
-
-    strcpy(diffFile, diffDir);
-    strcat(diffFile, subPath);
-    diffFileLen = strlen(diffFile);
-    CreateDirectoryA(diffFile, NULL);  // Create sub directory in diffDir
-
-    subPathLen = strlen(subPath);
-
-    findHandle = FindFirstFileA(newFile, &wfd);
-    if (findHandle == INVALID_HANDLE_VALUE) {
-        printf("ERROR: OpenDir %s%s, error=%d\n", newDir, subPath, GetLastError());
-        goto MyExit;
+    int i;
+
+    printf("usage: %s -f [options] oldFile newFile patchFile\n", prog);
+    printf("       %s -d [options] oldDir newDir diffDir\n", prog);
+    printf("       %s -b [options] oldDir newDir bundleFile\n", prog);
+    printf("options:\n");
+    printf("  -a auto|sais|qsufsort  suffix array algorithm (default: auto)\n");
+    printf("  -a hash                match with a k-gram hash index instead: faster, larger patch\n");
+    printf("  -j N                   number of worker threads (default: 1)\n");
+    printf("  -i indexFile           reuse (or create) a suffix array index of oldFile\n");
+    printf("  -c N                   split newFile into N independently matched chunks\n");
+    printf("  -m                     read input files into memory instead of mapping them\n");
+    printf("  -z codec[,codec,codec] compressor for all blocks, or for ctrl,diff,extra (default: bzip2)\n");
+    printf("                         available:");
+    for (i = 0; i < BSDIFF_CODEC_COUNT; ++i) {
+        if (bsdiff_CodecAvailable(i))
+            printf(" %s", bsdiff_CodecName(i));
     }
-    do {
-        if (wfd.cFileName[0] == '.' && wfd.cFileName[1] == '\0')
-            continue;
-        if (wfd.cFileName[0] == '.' && wfd.cFileName[1] == '.' && wfd.cFileName[2] == '\0')
-            continue;
-
-        if (wfd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-            // 子目录，递归进去
-            strcpy(subPath + subPathLen, wfd.cFileName);
-            strcat(subPath, "\\");
-            if (!bsdiff_diff_dir(oldDir, newDir, diffDir, subPath)) {
-                goto MyExit;
-            }
-            subPath[subPathLen] = '\0';
+    printf("\n");
+    printf("  -l N                   compression level (default: per codec)\n");
+    printf("  -W N                   bzip2 work factor, 1-250 (default: 30)\n");
+    printf("  -F N                   compress blocks in independent frames of N bytes (max 64MB)\n");
+    printf("  -Z                     encode zero runs of the diff block before compressing it\n");
+    printf("  -T                     interleave the blocks' frames (-F, default 1MB) in apply order,\n");
+    printf("                         so bspatch can apply the patch while reading it from a pipe\n");
+    printf("  -M N                   limit suffix array memory to N MB, matching oldFile in windows\n");
+    printf("                         (with -d: total budget shared by all files in flight)\n");
+    printf("  -X auto|x86|arm|arm64  convert relative branches in executable code before matching\n");
+    printf("                         (auto: pick by the ELF/PE header of newFile; default: none)\n");
+    printf("  -I                     make an in-place patch, applied over oldFile with bspatch -I\n");
+    printf("  -S N                   let an in-place patch use an N KB scratch buffer (default: 0)\n");
+    printf("  -H                     store XXH64 checksums of the old and new data, verified by bspatch\n");
+    printf("  --cache-dir dir        reuse patches and oldFile indexes cached in dir by content hash (with -f)\n");
+    printf("  -v                     print per-phase timings and block sizes (with -f or -b)\n");
+}
 
-        } else {
-            // 检查oldDir中有没有同名文件
-            strcpy(oldFile + oldFileLen, wfd.cFileName);
-            fileHandle = CreateFileA(oldFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-            if (fileHandle != INVALID_HANDLE_VALUE) {
-                CloseHandle(fileHandle);
-                fileHandle = INVALID_HANDLE_VALUE;
-
-                strcpy(newFile + newFileLen, wfd.cFileName);
-                strcpy(diffFile + diffFileLen, wfd.cFileName);
-                strcat(diffFile, ".diff");
-
-                // 生成diff文件
-                if (!bsdiff_diff(oldFile, newFile, diffFile, error)) {
-                    printf("ERROR: MakeDiff %s, error=%s\n", newFile, error);
-                    goto MyExit;
-                }
-                printf("OK: MakeDiff %s\n", newFile);
+// 解析-z的参数：一个codec用于全部三个block，或者逗号分隔的三个codec
+static int parseCodecs(const char *arg, bsdiff_diff_options *options)
+{
+    char name[16];
+    int codecs[3], n = 0;
+    size_t len;
 
-                newFile[newFileLen] = '\0';
-                diffFile[diffFileLen] = '\0';
+    for (;;) {
+        len = strcspn(arg, ",");
+        if (n == 3 || len == 0 || len >= sizeof(name))
+            return 0;
+        memcpy(name, arg, len);
+        name[len] = '\0';
+        if ((codecs[n++] = bsdiff_CodecFind(name)) < 0)
+            return 0;
+        if (!arg[len])
+            break;
+        arg += len + 1;
+    }
+    if (n == 2)
+        return 0;
+    options->ctrlCodec = codecs[0];
+    options->diffCodec = codecs[n == 3 ? 1 : 0];
+    options->extraCodec = codecs[n == 3 ? 2 : 0];
+    return 1;
+}
 
+int main(int argc,char * argv[])
+{
+    bsdiff_diff_options options;
+    bsdiff_stats diffStats;
+    const char *cacheDir = NULL;
+    int i, verbose = 0;
+
+    bsdiff_diff_options_init(&options);
+
+    // 解析-f/-d/-b与三个路径之间的选项
+    for (i = 2; i < argc - 3; ++i) {
+        if (strcmp(argv[i], "-a") == 0 && i + 1 < argc - 3) {
+            ++i;
+            if (strcmp(argv[i], "auto") == 0) {
+                options.saAlgorithm = BSDIFF_SA_AUTO;
+            } else if (strcmp(argv[i], "sais") == 0) {
+                options.saAlgorithm = BSDIFF_SA_SAIS;
+            } else if (strcmp(argv[i], "qsufsort") == 0) {
+                options.saAlgorithm = BSDIFF_SA_QSUFSORT;
+            } else if (strcmp(argv[i], "hash") == 0) {
+                options.matcher = BSDIFF_MATCH_HASH;
             } else {
-                // 直接复制文件
-                strcpy(newFile + newFileLen, wfd.cFileName);
-                strcpy(diffFile + diffFileLen, wfd.cFileName);
-
-                if (!CopyFileA(newFile, diffFile, FALSE)) {
-                    printf("ERROR: CopyFile %s, error=%d\n", newFile, GetLastError());
-                    goto MyExit;
-                }
-                printf("OK: CopyFile %s\n", newFile);
-				
-                newFile[newFileLen] = '\0';
-                diffFile[diffFileLen] = '\0';
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc - 3) {
+            options.numThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc - 3) {
+            options.indexFile = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc - 3) {
+            options.scanChunks = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-m") == 0) {
+            options.useMapping = 0;
+        } else if (strcmp(argv[i], "-z") == 0 && i + 1 < argc - 3) {
+            if (!parseCodecs(argv[++i], &options)) {
+                usage(argv[0]);
+                return 1;
             }
-            oldFile[oldFileLen] = '\0';
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc - 3) {
+            options.compressLevel = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-W") == 0 && i + 1 < argc - 3) {
+            options.workFactor = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-F") == 0 && i + 1 < argc - 3) {
+            options.frameSize = (size_t)atol(argv[++i]);
+        } else if (strcmp(argv[i], "-Z") == 0) {
+            options.zeroRuns = 1;
+        } else if (strcmp(argv[i], "-T") == 0) {
+            options.stream = 1;
+        } else if (strcmp(argv[i], "-M") == 0 && i + 1 < argc - 3) {
+            options.maxMemory = (size_t)atol(argv[++i]) * 1024 * 1024;
+        } else if (strcmp(argv[i], "-X") == 0 && i + 1 < argc - 3) {
+            ++i;
+            if (strcmp(argv[i], "auto") == 0) {
+                options.filter = BSDIFF_FILTER_AUTO;
+            } else if ((options.filter = bsdiff_FilterFind(argv[i])) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-I") == 0) {
+            options.inplace = 1;
+        } else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc - 3) {
+            options.inplaceScratch = (size_t)atol(argv[++i]) * 1024;
+        } else if (strcmp(argv[i], "-H") == 0) {
+            options.checksum = 1;
+        } else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc - 3) {
+            cacheDir = argv[++i];
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = 1;
+        } else {
+            usage(argv[0]);
+            return 1;
         }
-    } while (FindNextFileA(findHandle, &wfd));
-
-    retCode = 1;
-
-MyExit:
-    if (findHandle != INVALID_HANDLE_VALUE)
-        FindClose(findHandle);
-    return retCode;
-}
-
-#endif  // _WIN32
+    }
 
-int main(int argc,char * argv[])
-{
-    if (argc == 5) {
+    if (argc >= 5) {
         if (strcmp(argv[1], "-f") == 0) {
             char error[64];
-            if (!bsdiff_diff(argv[2], argv[3], argv[4], error)) {
+            FILE *fp;
+            bsdiff_off_t patchSize = -1;
+            int hit = 0;
+            if (verbose)
+                options.stats = &diffStats;
+            if (cacheDir ? !bsdiff_diff_cached(argv[i], argv[i + 1], argv[i + 2], cacheDir, &options, &hit, error) :
+                           !bsdiff_diff_ex(argv[i], argv[i + 1], argv[i + 2], &options, error)) {
                 printf("DiffFile failed! error = %s\n", error);
                 return 1;
             }
-            printf("DiffFile OK\n");
+            // 报告patch大小，方便对比不同分段数/线程数的效果
+            if ((fp = fopen(argv[i + 2], "rb")) != NULL) {
+                bsdiff_GetFileSize(fp, &patchSize);
+                fclose(fp);
+            }
+            printf("DiffFile OK, patch size = %lld bytes (chunks = %d, threads = %d%s)\n", 
+                patchSize, options.scanChunks > 1 ? options.scanChunks : 1, 
+                options.numThreads > 1 ? options.numThreads : 1, hit ? ", cached" : "");
+            if (verbose)
+                bsdiff_PrintStats(&diffStats);
             return 0;
 
-    #ifdef _WIN32
         } else if (strcmp(argv[1], "-d") == 0) {
-            char subPath[MAX_PATH];
-            strcpy(subPath, "\\");
-            printf("-------------------------------------------------------------------------------\n");
-            if (!bsdiff_diff_dir(argv[2], argv[3], argv[4], subPath)) {
-                printf("-------------------------------------------------------------------------------\n");
-                printf("DiffDir failed!\n");
+            char error[64];
+            bsdiff_dir_stats stats;
+            if (!bsdiff_diff_dir(argv[i], argv[i + 1], argv[i + 2], &options, &stats, error)) {
+                printf("DiffDir failed! error = %s\n", error);
                 return 1;
             }
-            printf("-------------------------------------------------------------------------------\n");
-            printf("DiffDir OK\n");
+            printf("DiffDir OK (%d diffed, %d copied, %d unchanged, threads = %d)\n", 
+                stats.diffed, stats.copied, stats.unchanged, options.numThreads > 1 ? options.numThreads : 1);
+            return 0;
+
+        } else if (strcmp(argv[1], "-b") == 0) {
+            char error[64];
+            bsdiff_dir_stats stats;
+            FILE *fp;
+            bsdiff_off_t bundleSize = -1;
+            if (verbose)
+                options.stats = &diffStats;
+            if (!bsdiff_diff_bundle(argv[i], argv[i + 1], argv[i + 2], &options, &stats, error)) {
+                printf("DiffBundle failed! error = %s\n", error);
+                return 1;
+            }
+            if ((fp = fopen(argv[i + 2], "rb")) != NULL) {
+                bsdiff_GetFileSize(fp, &bundleSize);
+                fclose(fp);
+            }
+            printf("DiffBundle OK, bundle size = %lld bytes (%d diffed, %d new, %d unchanged)\n", 
+                bundleSize, stats.diffed, stats.copied, stats.unchanged);
+            if (verbose)
+                bsdiff_PrintStats(&diffStats);
             return 0;
-    #endif  // _WIN32
         }
     }
     
-    printf("usage: %s -f oldFile newFile patchFile\n", argv[0]);
-#ifdef _WIN32
-    printf("       %s -d oldDir newDir diffDir\n", argv[0]);
-#endif  // _WIN32
+    usage(argv[0]);
     return 1;
 }
 
@@ -1,10 +1,156 @@
 #ifndef __BSDIFF_DIFF_H__
 #define __BSDIFF_DIFF_H__
 
+#include "bsdiff_types.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// 后缀数组构建算法
+#define BSDIFF_SA_AUTO      0   // 即SA-IS，与线程数无关（默认）
+#define BSDIFF_SA_SAIS      1   // SA-IS，线性时间，只需要I一个数组，只能单线程
+#define BSDIFF_SA_QSUFSORT  2   // Larsson-Sadakane qsufsort，需要I和V两个数组，支持多线程：多线程时还要一个
+                                // 同样大小的K，每个线程比SA-IS慢一倍多，要有足够多的核才划得来，需要明确选择
+
+// 匹配引擎
+#define BSDIFF_MATCH_SUFFIX 0   // 后缀数组，找到的总是最长的匹配（默认）
+#define BSDIFF_MATCH_HASH   1   // old上的k-gram hash索引（见bsdiff_kgram.h）：构建和查找都快得多，
+                                // 内存约为oldSize的1~2倍，只能找到至少16字节的匹配，patch会大一些
+
+typedef struct bsdiff_diff_options {
+    int saAlgorithm;            // BSDIFF_SA_xxx
+    int numThreads;             // 工作线程数，<= 1表示单线程；线程数不影响生成的patch
+    const char *indexFile;      // 后缀数组索引文件，NULL表示不使用；
+                                // 文件不存在或已过期时会现场构建并写出，否则直接映射使用
+    int scanChunks;             // > 1时把newFile切成这么多段，在numThreads个线程上并行匹配；
+                                // 段与段之间的匹配不能跨越边界，patch会稍大一点（默认1）
+    int useMapping;             // 非0时把oldFile/newFile映射到内存，映射失败时才读入malloc的buffer（默认1）
+    int ctrlCodec;              // 三个block各自的压缩算法BSDIFF_CODEC_xxx（默认都是bzip2）；
+    int diffCodec;              // 都是bzip2时输出原始的BSDIFF40格式，否则输出BSDIFF41
+    int extraCodec;
+    int compressLevel;          // 压缩级别，0表示各codec的默认级别（bzip2 9、zstd 19、lzma 6、brotli 11）
+    int workFactor;             // bzip2块排序的工作量系数（1~250，0表示默认的30）：主排序算法在重复度高的数据上
+                                // 耗尽这个预算后改用线性时间的SA-IS排序；只影响速度，不影响压缩结果
+    size_t frameSize;           // > 0时每个block按这么多字节分帧，各帧独立压缩并带有帧索引（BSDIFF41），
+                                // 打补丁时可以多线程解压，也可以跳到任意一帧；最大64MB（默认0，不分帧）
+    int zeroRuns;               // 非0时diff block在压缩之前先做零游程编码（BSDIFF41），压缩器的输入小得多，
+                                // 打补丁时0的部分也不用做加法（默认0）
+    int stream;                 // 非0时生成流式patch（BSDIFF41，格式见bsdiff_format.h）：三个block按frameSize
+                                // （为0时1MB）分帧，按打补丁时用到的顺序交错排列，bsdiff_patch_ex可以从管道中
+                                // 边读边应用。帧越小开始得越早，压缩率越低；不能与inplace一起使用（默认0）
+    size_t maxMemory;           // > 0时限制后缀数组（连同构建时的临时数组）占用的内存，这是最大的一项开销；
+                                // 超出时把oldFile切成互相重叠的窗口，分别构建小的后缀数组，newFile按内容在
+                                // old中的来源切成段，每段只在采样hash投票选出的一个窗口中匹配（见bsdiff_window.h）。
+                                // patch会大一些：段的边界上要多一个三元组，来源相距超过一个窗口、并且交替得比
+                                // 采样间隔（约300字节）还快的内容只能匹配其中一处，最坏时这部分相当于没有匹配，
+                                // 按diff/extra数据压缩；预算越小窗口越多，这样的内容越多。此时scanChunks
+                                // 不起作用，没有可用的索引文件时也不会写出索引（默认0，不限制）
+    int filter;                 // 可执行文件过滤器BSDIFF_FILTER_xxx（BSDIFF41）：匹配之前把机器码中的相对调用
+                                // 换算成绝对地址，插入或删除了代码的程序patch小得多；AUTO按newFile的ELF/PE
+                                // 文件头选择。要多占old/newFile各一份副本的内存，打补丁时old和newFile也都要
+                                // 整个放在内存中；索引文件按过滤后的old构建（默认NONE）
+    int matcher;                // BSDIFF_MATCH_xxx；BSDIFF_MATCH_HASH时saAlgorithm、indexFile和maxMemory
+                                // 都不起作用（默认BSDIFF_MATCH_SUFFIX）
+    int inplace;                // 非0时生成可以就地应用的patch（BSDIFF41，见bsdiff_inplace.h），
+                                // 用bsdiff_patch_inplace直接把oldFile改写成newFile，不需要第二份空间；
+                                // patch会大一些，diff/extra数据要等匹配全部完成才输出；不能使用过滤器（默认0）
+    size_t inplaceScratch;      // 就地patch最多使用的暂存区字节数：互相依赖的命令中最短的一条先把old复制到
+                                // 暂存区，不必改成extra数据。打补丁时要分配这么多内存（默认0，最大约16GB）
+    int checksum;               // 非0时文件头中记录old和newFile的XXH64（BSDIFF41），打补丁时在apply循环中
+                                // 顺带校验，用错了old或patch损坏时失败（默认0）
+    bsdiff_stats *stats;        // 非NULL时填入各阶段的耗时和字节数等统计（默认NULL）
+    bsdiff_progress_fn progress;    // 非NULL时报告进度，可以取消（默认NULL）
+    void *progressOpaque;
+} bsdiff_diff_options;
+
+// 用默认值填充options
+void bsdiff_diff_options_init(
+    bsdiff_diff_options *options
+    );
+
+// options为NULL时使用默认值
+int bsdiff_diff_ex(
+    const char *oldFile, 
+    const char *newFile, 
+    const char *patchFile, 
+    const bsdiff_diff_options *options, 
+    char error[64]
+    );
+
+// 在内存中对比oldData和newData，生成的patch（与bsdiff_diff_ex的输出完全相同）依次交给write输出
+// 所有的内存都从allocator分配（NULL表示malloc/free）；options->useMapping在这里没有意义
+// options->indexFile仍然有效，索引按oldData的内容hash匹配
+int bsdiff_diff_mem(
+    const void *oldData, 
+    size_t oldSize, 
+    const void *newData, 
+    size_t newSize, 
+    bsdiff_write_fn write, 
+    void *opaque, 
+    const bsdiff_allocator *allocator, 
+    const bsdiff_diff_options *options, 
+    char error[64]
+    );
+
+// 为oldFile构建后缀数组并写入indexFile，供以后的bsdiff_diff_ex通过options->indexFile复用
+int bsdiff_index_create(
+    const char *oldFile, 
+    const char *indexFile, 
+    const bsdiff_diff_options *options, 
+    char error[64]
+    );
+
+// 带缓存的bsdiff_diff_ex，用于反复生成同样的patch的构建机：按oldFile、newFile内容的XXH64和影响patch的选项
+// 在cacheDir（不存在时创建）中查找，找到时直接复制成patchFile，只需要读一遍两个文件；否则生成patch并存入缓存。
+// options->indexFile为NULL时后缀数组索引也存放在cacheDir中，按old的内容复用，只有newFile变了时不用再排序。
+// 多个进程可以同时使用同一个cacheDir；hit非NULL时返回是否命中，命中时options->stats中只有READ阶段
+int bsdiff_diff_cached(
+    const char *oldFile, 
+    const char *newFile, 
+    const char *patchFile, 
+    const char *cacheDir, 
+    const bsdiff_diff_options *options, 
+    int *hit, 
+    char error[64]
+    );
+
+// bsdiff_diff_dir和bsdiff_diff_bundle的结果统计
+typedef struct bsdiff_dir_stats {
+    int diffed;                 // 生成了.diff的文件数
+    int copied;                 // oldDir中没有同名文件、直接复制的文件数
+    int unchanged;              // 与oldDir中的同名文件内容相同、跳过的文件数
+} bsdiff_dir_stats;
+
+// 对比oldDir和newDir两个目录树，输出到diffDir（目录结构与newDir相同）：newDir中的文件在oldDir中有
+// 同名文件时生成"文件名.diff"，两者长度和XXH64都相同时跳过，没有同名文件时直接复制。
+// 各个文件在options->numThreads个线程上并行处理，大文件先开始，每个文件的diff本身是单线程的。
+// options->maxMemory > 0时是所有同时进行的diff的后缀数组内存的总预算：超出预算的diff等到有空余时才开始，
+// 单个文件超出整个预算时在预算之内做窗口化匹配。options中的indexFile、stats和progress在这里不起作用。
+// 出错时不再开始新的文件，返回0，error描述第一个出错的文件；stats可以为NULL
+int bsdiff_diff_dir(
+    const char *oldDir, 
+    const char *newDir, 
+    const char *diffDir, 
+    const bsdiff_diff_options *options, 
+    bsdiff_dir_stats *stats, 
+    char error[64]
+    );
+
+// 把oldDir到newDir的变化做成一个多文件的patch包（格式见bsdiff_format.h），用bsdiff_patch_bundle应用。
+// 两个目录树中的文件各自按路径排序、拼接起来，之间只做一次diff，newDir的每个文件都在整个oldDir中匹配：
+// 许多小文件只有一份文件头和一组压缩流，文件之间移动的代码也能找到。两个目录树都要读入内存；
+// options与bsdiff_diff_mem相同（不能是inplace），indexFile按拼接后的old语料匹配。
+// stats按文件名统计newDir中的文件（diffed为内容变了的文件），可以为NULL；空目录不会记录在patch包中
+int bsdiff_diff_bundle(
+    const char *oldDir, 
+    const char *newDir, 
+    const char *bundleFile, 
+    const bsdiff_diff_options *options, 
+    bsdiff_dir_stats *stats, 
+    char error[64]
+    );
+
 int bsdiff_diff(
     const char *oldFile, 
     const char *newFile, 
@@ -0,0 +1,672 @@
+#include "bsdiff_diff.h"
+#include "bsdiff_misc.h"
+#include "bsdiff_sa.h"
+#include "bsdiff_kgram.h"
+#include "bsdiff_thread.h"
+#include "bsdiff_hash.h"
+#include "bsdiff_ctx.h"
+#include "bsdiff_format.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+
+/* 目录diff：先遍历newDir，收集所有文件（同时在diffDir中建好子目录），按oldSize + newSize从大到小排序后
+   逐个提交到线程池，让最耗时的文件最先开始，避免最后只剩一个大文件在单独运行。
+   每个文件的diff是单线程的，使用从空闲栈中取出的bsdiff_ctx，arena在文件之间复用。
+   maxMemory > 0时，每个diff开始之前先从预算中扣除它的后缀数组内存，不够时等待别的diff结束 */
+
+#define CTX_TRIM_SIZE  (64 * 1024 * 1024)   // 归还时arena超过这么大就先还给系统
+
+typedef struct dirEntry {
+    char *path;                 // 相对于newDir的路径
+    bsdiff_off_t newSize;
+    bsdiff_off_t oldSize;       // oldDir中没有同名文件时为-1
+} dirEntry;
+
+typedef struct dirJob {
+    const char *oldDir, *newDir, *diffDir;
+    const bsdiff_diff_options *options;
+
+    dirEntry *entries;
+    size_t numEntries, capacity;
+
+    bsdiff_mutex mutex;
+    bsdiff_cond cond;
+    unsigned long long memUsed;
+    bsdiff_ctx **idle;          // 空闲的ctx
+    int numIdle;
+    int failed;
+    bsdiff_dir_stats stats;
+    char error[64];
+} dirJob;
+
+typedef struct walkState {
+    dirJob *job;
+    const char *subPath;        // 当前目录相对于newDir的路径，根目录为""
+} walkState;
+
+// 拼接路径：a + 分隔符 + b + suffix，a或b为""时不加分隔符
+static char* joinPath(const char *a, const char *b, const char *suffix)
+{
+    size_t lenA = strlen(a), lenB = strlen(b), lenS = suffix ? strlen(suffix) : 0;
+    char *path;
+
+    if (!(path = (char*)malloc(lenA + lenB + lenS + 2)))
+        return NULL;
+    memcpy(path, a, lenA);
+    if (lenA && lenB) {
+        path[lenA++] = BSDIFF_PATH_SEP;
+    }
+    if (lenB) {
+        memcpy(path + lenA, b, lenB);
+        lenA += lenB;
+    }
+    memcpy(path + lenA, suffix, lenS);
+    path[lenA + lenS] = '\0';
+    return path;
+}
+
+static int walkDir(dirJob *job, const char *subPath);
+
+static int walkEntry(void *opaque, const char *name, int isDir, bsdiff_off_t size)
+{
+    walkState *state = (walkState*)opaque;
+    dirJob *job = state->job;
+    dirEntry *entry;
+    char *relPath, *oldFile;
+    FILE *fp;
+    int ok;
+
+    if (!(relPath = joinPath(state->subPath, name, NULL))) {
+        bsdiff_SetError(job->error, "Out of memory");
+        return 0;
+    }
+
+    if (isDir) {
+        ok = walkDir(job, relPath);
+        free(relPath);
+        return ok;
+    }
+
+    if (job->numEntries == job->capacity) {
+        size_t capacity = job->capacity ? job->capacity * 2 : 64;
+        dirEntry *entries = (dirEntry*)realloc(job->entries, capacity * sizeof(dirEntry));
+        if (!entries) {
+            free(relPath);
+            bsdiff_SetError(job->error, "Out of memory");
+            return 0;
+        }
+        job->entries = entries;
+        job->capacity = capacity;
+    }
+    entry = &job->entries[job->numEntries++];
+    entry->path = relPath;
+    entry->newSize = size;
+    entry->oldSize = -1;
+
+    // 检查oldDir中有没有同名文件
+    if ((oldFile = joinPath(job->oldDir, relPath, NULL)) != NULL) {
+        if ((fp = fopen(oldFile, "rb")) != NULL) {
+            if (!bsdiff_GetFileSize(fp, &entry->oldSize))
+                entry->oldSize = -1;
+            fclose(fp);
+        }
+        free(oldFile);
+    }
+    return 1;
+}
+
+// 遍历newDir中的subPath目录，在diffDir中建立对应的子目录
+static int walkDir(dirJob *job, const char *subPath)
+{
+    walkState state;
+    char *newPath, *diffPath;
+    int ok = 0;
+
+    newPath = joinPath(job->newDir, subPath, NULL);
+    diffPath = joinPath(job->diffDir, subPath, NULL);
+    if (!newPath || !diffPath) {
+        bsdiff_SetError(job->error, "Out of memory");
+        goto MyExit;
+    }
+    if (!bsdiff_MakeDir(diffPath)) {
+        bsdiff_SetError(job->error, "Can't create diffDir");
+        goto MyExit;
+    }
+
+    state.job = job;
+    state.subPath = subPath;
+    if (!bsdiff_ListDir(newPath, walkEntry, &state)) {
+        if (!job->error[0])
+            bsdiff_SetError(job->error, "Can't open newDir");
+        goto MyExit;
+    }
+    ok = 1;
+
+MyExit:
+    free(newPath);
+    free(diffPath);
+    return ok;
+}
+
+static int compareEntries(const void *a, const void *b)
+{
+    const dirEntry *x = (const dirEntry*)a, *y = (const dirEntry*)b;
+    bsdiff_off_t sx = x->newSize + (x->oldSize > 0 ? x->oldSize : 0);
+    bsdiff_off_t sy = y->newSize + (y->oldSize > 0 ? y->oldSize : 0);
+
+    return sx < sy ? 1 : (sx > sy ? -1 : 0);
+}
+
+//------------------------------------------------------------------------------
+
+// error为"相对路径: 错误信息"，路径太长时只保留末尾
+static void formatError(char error[64], const char *path, const char *msg)
+{
+    size_t len = strlen(path), room = 64 - 1 - strlen(msg) - 2;
+
+    if (len > room)
+        path += len - room;
+    sprintf(error, "%s: %s", path, msg);
+}
+
+// 记录第一个出错的文件，同时唤醒等待预算的文件
+static void setFailed(dirJob *job, const char *path, const char *error)
+{
+    bsdiff_MutexLock(&job->mutex);
+    if (!job->failed) {
+        job->failed = 1;
+        formatError(job->error, path, error);
+        bsdiff_CondBroadcast(&job->cond);
+    }
+    bsdiff_MutexUnlock(&job->mutex);
+}
+
+static int diffFile(dirJob *job, const dirEntry *entry, const char *oldFile, const char *newFile,
+                    const char *patchFile, int *unchanged, char error[64])
+{
+    bsdiff_diff_options options = *job->options;
+    bsdiff_filedata oldData, newData;
+    bsdiff_ctx *ctx = NULL;
+    unsigned long long charge = 0;
+    FILE *fp = NULL;
+    int cancelled, retCode = 0;
+
+    memset(&oldData, 0, sizeof(oldData));
+    memset(&newData, 0, sizeof(newData));
+    *unchanged = 0;
+
+    if (!bsdiff_LoadFile(oldFile, options.useMapping, &oldData, "oldFile", error))
+        goto MyExit;
+    if (!bsdiff_LoadFile(newFile, options.useMapping, &newData, "newFile", error))
+        goto MyExit;
+
+    // 长度和hash都相同的文件不需要patch
+    if (oldData.size == newData.size &&
+        bsdiff_Xxh64(oldData.data, (size_t)oldData.size, 0) == bsdiff_Xxh64(newData.data, (size_t)newData.size, 0)) {
+        *unchanged = 1;
+        retCode = 1;
+        goto MyExit;
+    }
+
+    // 向全局预算申请后缀数组的内存；单个文件超出整个预算时在预算之内做窗口化匹配
+    options.numThreads = 1;
+    options.indexFile = NULL;
+    options.stats = NULL;
+    options.progress = NULL;
+    bsdiff_MutexLock(&job->mutex);
+    if (job->options->maxMemory > 0) {
+        if (options.matcher == BSDIFF_MATCH_HASH)
+            charge = bsdiff_KgramMemory(entry->oldSize);
+        else
+            charge = bsdiff_SuffixSortMemory(options.saAlgorithm, entry->oldSize);
+        if (charge > job->options->maxMemory)
+            charge = job->options->maxMemory;
+        while (job->memUsed > 0 && job->memUsed + charge > job->options->maxMemory && !job->failed)
+            bsdiff_CondWait(&job->cond, &job->mutex);
+        job->memUsed += charge;
+    }
+    cancelled = job->failed;
+    if (job->numIdle > 0)
+        ctx = job->idle[--job->numIdle];
+    bsdiff_MutexUnlock(&job->mutex);
+
+    // 等待期间别的文件出错了
+    if (cancelled) {
+        bsdiff_SetError(error, "Cancelled");
+        goto MyExit;
+    }
+
+    if (!ctx && !(ctx = bsdiff_ctx_create(1))) {
+        bsdiff_SetError(error, "Out of memory");
+        goto MyExit;
+    }
+    if (!(fp = fopen(patchFile, "wb"))) {
+        bsdiff_SetError(error, "Can't open patchFile");
+        goto MyExit;
+    }
+    if (!bsdiff_ctx_diff(ctx, oldData.data, (size_t)oldData.size, newData.data, (size_t)newData.size,
+                         bsdiff_FileSink, fp, &options, error))
+        goto MyExit;
+    if (fclose(fp)) {
+        fp = NULL;
+        bsdiff_SetError(error, "Can't write patchFile");
+        goto MyExit;
+    }
+    fp = NULL;
+
+    retCode = 1;
+
+MyExit:
+    if (fp)
+        fclose(fp);
+    bsdiff_FreeFile(&oldData);
+    bsdiff_FreeFile(&newData);
+
+    bsdiff_MutexLock(&job->mutex);
+    if (charge) {
+        job->memUsed -= charge;
+        bsdiff_CondBroadcast(&job->cond);
+    }
+    if (ctx) {
+        if (bsdiff_ctx_reserved(ctx) > CTX_TRIM_SIZE)
+            bsdiff_ctx_trim(ctx);
+        job->idle[job->numIdle++] = ctx;
+    }
+    bsdiff_MutexUnlock(&job->mutex);
+    return retCode;
+}
+
+typedef struct fileTask {
+    dirJob *job;
+    const dirEntry *entry;
+} fileTask;
+
+static void fileTaskRun(void *arg)
+{
+    fileTask *task = (fileTask*)arg;
+    dirJob *job = task->job;
+    const dirEntry *entry = task->entry;
+    char *oldFile = NULL, *newFile = NULL, *outFile = NULL;
+    char error[64];
+    int unchanged = 0, failed;
+
+    bsdiff_MutexLock(&job->mutex);
+    failed = job->failed;
+    bsdiff_MutexUnlock(&job->mutex);
+    if (failed)
+        return;
+
+    oldFile = joinPath(job->oldDir, entry->path, NULL);
+    newFile = joinPath(job->newDir, entry->path, NULL);
+    outFile = joinPath(job->diffDir, entry->path, entry->oldSize >= 0 ? ".diff" : NULL);
+    if (!oldFile || !newFile || !outFile) {
+        setFailed(job, entry->path, "Out of memory");
+        goto MyExit;
+    }
+
+    if (entry->oldSize < 0) {
+        // oldDir中没有同名文件，直接复制
+        if (!bsdiff_CopyFile(newFile, outFile)) {
+            setFailed(job, entry->path, "Can't copy file");
+            goto MyExit;
+        }
+    } else if (!diffFile(job, entry, oldFile, newFile, outFile, &unchanged, error)) {
+        setFailed(job, entry->path, error);
+        goto MyExit;
+    }
+
+    bsdiff_MutexLock(&job->mutex);
+    if (entry->oldSize < 0)
+        ++job->stats.copied;
+    else if (unchanged)
+        ++job->stats.unchanged;
+    else
+        ++job->stats.diffed;
+    bsdiff_MutexUnlock(&job->mutex);
+
+MyExit:
+    free(oldFile);
+    free(newFile);
+    free(outFile);
+}
+
+//------------------------------------------------------------------------------
+
+int bsdiff_diff_dir(const char *oldDir, const char *newDir, const char *diffDir,
+                    const bsdiff_diff_options *options, bsdiff_dir_stats *stats, char error[64])
+{
+    bsdiff_diff_options defaultOptions;
+    bsdiff_pool *pool = NULL;
+    fileTask *tasks = NULL;
+    dirJob job;
+    size_t i;
+    int retCode = 0;
+
+    if (!options) {
+        bsdiff_diff_options_init(&defaultOptions);
+        options = &defaultOptions;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.oldDir = oldDir;
+    job.newDir = newDir;
+    job.diffDir = diffDir;
+    job.options = options;
+    bsdiff_MutexInit(&job.mutex);
+    bsdiff_CondInit(&job.cond);
+
+    // 收集newDir中的所有文件，建好diffDir的目录结构
+    if (!walkDir(&job, "")) {
+        bsdiff_SetError(error, job.error);
+        goto MyExit;
+    }
+    qsort(job.entries, job.numEntries, sizeof(dirEntry), compareEntries);
+
+    pool = bsdiff_PoolCreate(options->numThreads);
+    tasks = (fileTask*)malloc((job.numEntries ? job.numEntries : 1) * sizeof(fileTask));
+    job.idle = (bsdiff_ctx**)malloc((bsdiff_PoolThreads(pool) + 1) * sizeof(bsdiff_ctx*));
+    if (!tasks || !job.idle) {
+        bsdiff_SetError(error, "Out of memory");
+        goto MyExit;
+    }
+
+    for (i = 0; i < job.numEntries; ++i) {
+        tasks[i].job = &job;
+        tasks[i].entry = &job.entries[i];
+        bsdiff_PoolSubmit(pool, fileTaskRun, &tasks[i]);
+    }
+    bsdiff_PoolWait(pool);
+
+    if (job.failed) {
+        bsdiff_SetError(error, job.error);
+        goto MyExit;
+    }
+    retCode = 1;
+
+MyExit:
+    bsdiff_PoolDestroy(pool);
+    if (stats)
+        *stats = job.stats;
+    while (job.numIdle > 0)
+        bsdiff_ctx_destroy(job.idle[--job.numIdle]);
+    free(job.idle);
+    free(tasks);
+    for (i = 0; i < job.numEntries; ++i)
+        free(job.entries[i].path);
+    free(job.entries);
+    bsdiff_CondDestroy(&job.cond);
+    bsdiff_MutexDestroy(&job.mutex);
+    return retCode;
+}
+
+//------------------------------------------------------------------------------
+
+/* 多文件的patch包（格式见bsdiff_format.h）：两个目录树中的文件各自按路径排序，读入内存拼成两份语料，
+   之间做一次bsdiff_diff_mem，匹配、压缩和进度都与单个文件的diff相同。
+   除了diff本身的开销，还要把两个目录树整个放在内存中 */
+
+typedef struct treeFile {
+    char *path;                 // 相对路径，以'/'分隔
+    bsdiff_off_t size;
+} treeFile;
+
+typedef struct tree {
+    const char *root;
+    treeFile *files;
+    size_t numFiles, capacity;
+    unsigned char *data;        // 按顺序拼接的所有文件
+    bsdiff_off_t size;
+} tree;
+
+typedef struct treeWalk {
+    tree *t;
+    const char *subPath;
+    char *error;
+} treeWalk;
+
+static int listTree(tree *t, const char *subPath, char error[64]);
+
+static int listEntry(void *opaque, const char *name, int isDir, bsdiff_off_t size)
+{
+    treeWalk *walk = (treeWalk*)opaque;
+    tree *t = walk->t;
+    char *relPath, *p;
+    int ok;
+
+    // 文件表中的路径总是以'/'分隔，打开文件时Windows也认识
+    if (!(relPath = joinPath(walk->subPath, name, NULL))) {
+        bsdiff_SetError(walk->error, "Out of memory");
+        return 0;
+    }
+    for (p = relPath; *p; ++p) {
+        if (*p == BSDIFF_PATH_SEP)
+            *p = '/';
+    }
+    if (!bsdiff_BundlePathValid(relPath, strlen(relPath))) {
+        formatError(walk->error, relPath, "Unsupported file name");
+        free(relPath);
+        return 0;
+    }
+
+    if (isDir) {
+        ok = listTree(t, relPath, walk->error);
+        free(relPath);
+        return ok;
+    }
+
+    if (t->numFiles == t->capacity) {
+        size_t capacity = t->capacity ? t->capacity * 2 : 64;
+        treeFile *files = (treeFile*)realloc(t->files, capacity * sizeof(treeFile));
+        if (!files) {
+            free(relPath);
+            bsdiff_SetError(walk->error, "Out of memory");
+            return 0;
+        }
+        t->files = files;
+        t->capacity = capacity;
+    }
+    t->files[t->numFiles].path = relPath;
+    t->files[t->numFiles].size = size;
+    ++t->numFiles;
+    return 1;
+}
+
+// 收集t->root中subPath目录下的所有文件
+static int listTree(tree *t, const char *subPath, char error[64])
+{
+    treeWalk walk;
+    char *path;
+    int ok;
+
+    if (!(path = joinPath(t->root, subPath, NULL))) {
+        bsdiff_SetError(error, "Out of memory");
+        return 0;
+    }
+    walk.t = t;
+    walk.subPath = subPath;
+    walk.error = error;
+    error[0] = '\0';
+    ok = bsdiff_ListDir(path, listEntry, &walk);
+    if (!ok && !error[0])
+        formatError(error, subPath[0] ? subPath : t->root, "Can't open directory");
+    free(path);
+    return ok;
+}
+
+static int compareFiles(const void *a, const void *b)
+{
+    return strcmp(((const treeFile*)a)->path, ((const treeFile*)b)->path);
+}
+
+// 列出root中的文件，按路径排序后依次读入t->data
+static int loadTree(tree *t, const char *root, char error[64])
+{
+    FILE *fp;
+    char *path;
+    size_t i;
+    bsdiff_off_t pos, size;
+
+    t->root = root;
+    if (!listTree(t, "", error))
+        return 0;
+    qsort(t->files, t->numFiles, sizeof(treeFile), compareFiles);
+
+    for (i = 0, t->size = 0; i < t->numFiles; ++i)
+        t->size += t->files[i].size;
+    if ((bsdiff_off_t)(size_t)t->size != t->size || !(t->data = (unsigned char*)malloc((size_t)t->size + 1))) {
+        bsdiff_SetError(error, "Out of memory");
+        return 0;
+    }
+
+    // 文件在列出之后变了长度时出错，文件表中的长度要与语料一致
+    for (i = 0, pos = 0; i < t->numFiles; ++i) {
+        if (!(path = joinPath(root, t->files[i].path, NULL))) {
+            bsdiff_SetError(error, "Out of memory");
+            return 0;
+        }
+        fp = fopen(path, "rb");
+        free(path);
+        if (!fp || !bsdiff_GetFileSize(fp, &size) || size != t->files[i].size ||
+            !bsdiff_ReadFile(fp, t->data + pos, (size_t)size)) {
+            formatError(error, t->files[i].path, "Can't read file");
+            if (fp)
+                fclose(fp);
+            return 0;
+        }
+        fclose(fp);
+        pos += size;
+    }
+    return 1;
+}
+
+static void freeTree(tree *t)
+{
+    size_t i;
+
+    for (i = 0; i < t->numFiles; ++i)
+        free(t->files[i].path);
+    free(t->files);
+    free(t->data);
+}
+
+// 按路径对比两个排好序的目录树，统计newDir中的文件与oldDir中的同名文件
+static void compareTrees(const tree *oldTree, const tree *newTree, bsdiff_dir_stats *stats)
+{
+    size_t i, j = 0;
+    bsdiff_off_t oldPos = 0, newPos = 0;
+    int cmp;
+
+    memset(stats, 0, sizeof(bsdiff_dir_stats));
+    for (i = 0; i < newTree->numFiles; newPos += newTree->files[i++].size) {
+        cmp = 1;
+        while (j < oldTree->numFiles && (cmp = strcmp(oldTree->files[j].path, newTree->files[i].path)) < 0)
+            oldPos += oldTree->files[j++].size;
+        if (cmp != 0)
+            ++stats->copied;
+        else if (oldTree->files[j].size == newTree->files[i].size &&
+                 memcmp(oldTree->data + oldPos, newTree->data + newPos, (size_t)newTree->files[i].size) == 0)
+            ++stats->unchanged;
+        else
+            ++stats->diffed;
+    }
+}
+
+// 文件表：先old后new，每项为长度、路径长度和路径
+static unsigned char* buildTable(const tree *oldTree, const tree *newTree, bsdiff_off_t *tableLen)
+{
+    const tree *trees[2];
+    unsigned char *table, *p;
+    size_t i, len;
+    int k;
+
+    trees[0] = oldTree;
+    trees[1] = newTree;
+    for (k = 0, *tableLen = 0; k < 2; ++k) {
+        for (i = 0; i < trees[k]->numFiles; ++i)
+            *tableLen += 16 + (bsdiff_off_t)strlen(trees[k]->files[i].path);
+    }
+    if (!(table = (unsigned char*)malloc((size_t)*tableLen + 1)))
+        return NULL;
+    for (k = 0, p = table; k < 2; ++k) {
+        for (i = 0; i < trees[k]->numFiles; ++i) {
+            len = strlen(trees[k]->files[i].path);
+            bsdiff_WriteOffset(trees[k]->files[i].size, p);
+            bsdiff_WriteOffset((bsdiff_off_t)len, p + 8);
+            memcpy(p + 16, trees[k]->files[i].path, len);
+            p += 16 + len;
+        }
+    }
+    return table;
+}
+
+int bsdiff_diff_bundle(const char *oldDir, const char *newDir, const char *bundleFile,
+                       const bsdiff_diff_options *options, bsdiff_dir_stats *stats, char error[64])
+{
+    bsdiff_diff_options defaultOptions;
+    bsdiff_bundle_header header;
+    unsigned char headerBuf[BSDIFF_BUNDLE_HEADER];
+    unsigned char *table = NULL;
+    tree oldTree, newTree;
+    FILE *fp = NULL;
+    int retCode = 0;
+
+    if (!options) {
+        bsdiff_diff_options_init(&defaultOptions);
+        options = &defaultOptions;
+    }
+    memset(&oldTree, 0, sizeof(oldTree));
+    memset(&newTree, 0, sizeof(newTree));
+
+    // 打补丁时new文件要按顺序写出，就地patch没有意义
+    if (options->inplace) {
+        bsdiff_SetError(error, "In-place bundle");
+        goto MyExit;
+    }
+    if (!loadTree(&oldTree, oldDir, error) || !loadTree(&newTree, newDir, error))
+        goto MyExit;
+    if (stats)
+        compareTrees(&oldTree, &newTree, stats);
+
+    memset(&header, 0, sizeof(header));
+    header.numOld = (bsdiff_off_t)oldTree.numFiles;
+    header.numNew = (bsdiff_off_t)newTree.numFiles;
+    header.oldHash = bsdiff_Xxh64(oldTree.data, (size_t)oldTree.size, 0);
+    if (!(table = buildTable(&oldTree, &newTree, &header.tableLen))) {
+        bsdiff_SetError(error, "Out of memory");
+        goto MyExit;
+    }
+    bsdiff_BundleHeaderWrite(&header, headerBuf);
+
+    if (!(fp = fopen(bundleFile, "wb"))) {
+        bsdiff_SetError(error, "Can't open patchFile");
+        goto MyExit;
+    }
+    if (!bsdiff_WriteFile(fp, headerBuf, BSDIFF_BUNDLE_HEADER) ||
+        !bsdiff_WriteFile(fp, table, (size_t)header.tableLen)) {
+        bsdiff_SetError(error, "Can't write patchFile");
+        goto MyExit;
+    }
+    if (!bsdiff_diff_mem(oldTree.data, (size_t)oldTree.size, newTree.data, (size_t)newTree.size,
+                         bsdiff_FileSink, fp, NULL, options, error))
+        goto MyExit;
+    if (fclose(fp)) {
+        fp = NULL;
+        bsdiff_SetError(error, "Can't write patchFile");
+        goto MyExit;
+    }
+    fp = NULL;
+    retCode = 1;
+
+MyExit:
+    if (fp)
+        fclose(fp);
+    free(table);
+    freeTree(&oldTree);
+    freeTree(&newTree);
+    return retCode;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,259 @@
+#include "bsdiff_filter.h"
+#include <string.h>
+
+//------------------------------------------------------------------------------
+
+// 最多换算这么多个可执行的节，多出来的忽略（正反两个方向忽略的是同样的节）
+#define MAX_RANGES  64
+
+typedef struct codeRange {
+    size_t start, end;
+} codeRange;
+
+// 文件的布局：可执行的节，以及解析时读取过的范围（文件头、节表）
+typedef struct fileLayout {
+    int filter;                 // 按机器类型得出的过滤器
+    int numRanges;
+    codeRange ranges[MAX_RANGES];
+    int numMeta;
+    codeRange meta[2];
+} fileLayout;
+
+static unsigned int readLE16(const unsigned char *p)
+{
+    return p[0] | ((unsigned int)p[1] << 8);
+}
+
+static unsigned int readLE32(const unsigned char *p)
+{
+    return p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static unsigned long long readLE64(const unsigned char *p)
+{
+    return readLE32(p) | ((unsigned long long)readLE32(p + 4) << 32);
+}
+
+static void writeLE32(unsigned char *p, unsigned int x)
+{
+    p[0] = (unsigned char)x;
+    p[1] = (unsigned char)(x >> 8);
+    p[2] = (unsigned char)(x >> 16);
+    p[3] = (unsigned char)(x >> 24);
+}
+
+static void addMeta(fileLayout *layout, unsigned long long start, unsigned long long end)
+{
+    layout->meta[layout->numMeta].start = (size_t)start;
+    layout->meta[layout->numMeta].end = (size_t)end;
+    ++layout->numMeta;
+}
+
+// 与文件头、节表重叠的节（不正常的文件）不换算，否则换算会改变解析的结果
+static void addRange(fileLayout *layout, unsigned long long start, unsigned long long size, size_t fileSize)
+{
+    int i;
+
+    if (layout->numRanges == MAX_RANGES || size == 0 || start > fileSize || size > fileSize - start)
+        return;
+    for (i = 0; i < layout->numMeta; ++i) {
+        if (start < layout->meta[i].end && start + size > layout->meta[i].start)
+            return;
+    }
+    layout->ranges[layout->numRanges].start = (size_t)start;
+    layout->ranges[layout->numRanges].end = (size_t)(start + size);
+    ++layout->numRanges;
+}
+
+// 小端的ELF32/ELF64：可执行的节为带SHF_EXECINSTR、不是SHT_NOBITS的节
+static int parseElf(const unsigned char *data, size_t size, fileLayout *layout)
+{
+    unsigned long long shoff, offset, len;
+    unsigned int shentsize, shnum, machine, i;
+    const unsigned char *sh;
+    int elf64;
+
+    if (size < 64 || memcmp(data, "\x7F" "ELF", 4) != 0 || data[5] != 1 || (data[4] != 1 && data[4] != 2))
+        return 0;
+    elf64 = data[4] == 2;
+    machine = readLE16(data + 18);
+    if (machine == 3 || machine == 62)
+        layout->filter = BSDIFF_FILTER_X86;
+    else if (machine == 40)
+        layout->filter = BSDIFF_FILTER_ARM;
+    else if (machine == 183)
+        layout->filter = BSDIFF_FILTER_ARM64;
+
+    shoff = elf64 ? readLE64(data + 40) : readLE32(data + 32);
+    shentsize = readLE16(data + (elf64 ? 58 : 46));
+    shnum = readLE16(data + (elf64 ? 60 : 48));
+    if (shentsize < (elf64 ? 64u : 40u) || shoff > size || (unsigned long long)shentsize * shnum > size - shoff)
+        return 1;
+    addMeta(layout, 0, 64);
+    addMeta(layout, shoff, shoff + (unsigned long long)shentsize * shnum);
+
+    for (i = 0; i < shnum; ++i) {
+        sh = data + shoff + (size_t)shentsize * i;
+        if (readLE32(sh + 4) == 8 || !((elf64 ? readLE64(sh + 8) : readLE32(sh + 8)) & 0x4))
+            continue;
+        offset = elf64 ? readLE64(sh + 24) : readLE32(sh + 16);
+        len = elf64 ? readLE64(sh + 32) : readLE32(sh + 20);
+        addRange(layout, offset, len, size);
+    }
+    return 1;
+}
+
+// PE：可执行的节为带IMAGE_SCN_CNT_CODE或IMAGE_SCN_MEM_EXECUTE的节
+static int parsePe(const unsigned char *data, size_t size, fileLayout *layout)
+{
+    unsigned long long lfanew, table, tableEnd;
+    unsigned int machine, numSections, i;
+    const unsigned char *sec;
+
+    if (size < 64 || data[0] != 'M' || data[1] != 'Z')
+        return 0;
+    lfanew = readLE32(data + 0x3C);
+    if (lfanew + 24 > size || memcmp(data + lfanew, "PE\0\0", 4) != 0)
+        return 0;
+    machine = readLE16(data + lfanew + 4);
+    if (machine == 0x14C || machine == 0x8664)
+        layout->filter = BSDIFF_FILTER_X86;
+    else if (machine == 0x1C0)
+        layout->filter = BSDIFF_FILTER_ARM;
+    else if (machine == 0xAA64)
+        layout->filter = BSDIFF_FILTER_ARM64;
+
+    numSections = readLE16(data + lfanew + 6);
+    table = lfanew + 24 + readLE16(data + lfanew + 20);
+    tableEnd = table + 40ull * numSections;
+    if (tableEnd > size)
+        return 1;
+    addMeta(layout, 0, 64);
+    addMeta(layout, lfanew, tableEnd);
+
+    for (i = 0; i < numSections; ++i) {
+        sec = data + table + 40 * i;
+        if (readLE32(sec + 36) & 0x20000020)
+            addRange(layout, readLE32(sec + 20), readLE32(sec + 16), size);
+    }
+    return 1;
+}
+
+// 认识的可执行文件只换算可执行的节，其它数据整个换算
+static void parseLayout(const unsigned char *data, size_t size, fileLayout *layout)
+{
+    memset(layout, 0, sizeof(fileLayout));
+    if (!parseElf(data, size, layout) && !parsePe(data, size, layout)) {
+        layout->numRanges = 1;
+        layout->ranges[0].end = size;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// x86/x64的E8（call rel32）：只换算rel32在±16MB之内的（最高字节为00或FF），换算结果仍然落在这个范围内。
+// 不论换算与否都跳过4个字节的操作数，它们不会被当成操作码。E9（jmp）大多是函数内部的跳转，
+// 保持相对地址时在old/new中反而更多地相同，所以不换算
+static void x86Convert(unsigned char *data, size_t start, size_t end, int encode)
+{
+    unsigned int src, dest, pos;
+    size_t i = start;
+
+    while (i + 5 <= end) {
+        if (data[i] != 0xE8) {
+            ++i;
+            continue;
+        }
+        src = readLE32(data + i + 1);
+        if (((src + 0x01000000u) & 0xFE000000u) == 0) {
+            pos = (unsigned int)(i + 5);
+            dest = encode ? src + pos : src - pos;
+            dest = ((dest + 0x01000000u) & 0x01FFFFFFu) - 0x01000000u;
+            writeLE32(data + i + 1, dest);
+        }
+        i += 5;
+    }
+}
+
+// ARM32的BL（cond = always）：4字节对齐，24位的字偏移，PC比指令超前8字节
+static void armConvert(unsigned char *data, size_t start, size_t end, int encode)
+{
+    unsigned int src, dest, pos;
+    size_t i;
+
+    for (i = (start + 3) & ~(size_t)3; i + 4 <= end; i += 4) {
+        if (data[i + 3] != 0xEB)
+            continue;
+        src = data[i] | ((unsigned int)data[i + 1] << 8) | ((unsigned int)data[i + 2] << 16);
+        pos = (unsigned int)((i + 8) >> 2);
+        dest = (encode ? src + pos : src - pos) & 0x00FFFFFFu;
+        data[i] = (unsigned char)dest;
+        data[i + 1] = (unsigned char)(dest >> 8);
+        data[i + 2] = (unsigned char)(dest >> 16);
+    }
+}
+
+// AArch64的BL：4字节对齐，26位的字偏移
+static void arm64Convert(unsigned char *data, size_t start, size_t end, int encode)
+{
+    unsigned int insn, pos;
+    size_t i;
+
+    for (i = (start + 3) & ~(size_t)3; i + 4 <= end; i += 4) {
+        insn = readLE32(data + i);
+        if ((insn & 0xFC000000u) != 0x94000000u)
+            continue;
+        pos = (unsigned int)(i >> 2);
+        insn = encode ? insn + pos : insn - pos;
+        writeLE32(data + i, 0x94000000u | (insn & 0x03FFFFFFu));
+    }
+}
+
+int bsdiff_FilterDetect(const unsigned char *data, size_t size)
+{
+    fileLayout layout;
+
+    parseLayout(data, size, &layout);
+    return layout.filter;
+}
+
+void bsdiff_FilterApply(int filter, unsigned char *data, size_t size, int encode)
+{
+    fileLayout layout;
+    const codeRange *r;
+    int i;
+
+    parseLayout(data, size, &layout);
+
+    // 节可能互相重叠（不正常的文件），换算回来时按相反的顺序
+    for (i = 0; i < layout.numRanges; ++i) {
+        r = &layout.ranges[encode ? i : layout.numRanges - 1 - i];
+        switch (filter) {
+        case BSDIFF_FILTER_X86:   x86Convert(data, r->start, r->end, encode); break;
+        case BSDIFF_FILTER_ARM:   armConvert(data, r->start, r->end, encode); break;
+        case BSDIFF_FILTER_ARM64: arm64Convert(data, r->start, r->end, encode); break;
+        default: break;
+        }
+    }
+}
+
+const char* bsdiff_FilterName(int filter)
+{
+    static const char *names[BSDIFF_FILTER_COUNT] = { "none", "x86", "arm", "arm64" };
+    if (filter == BSDIFF_FILTER_AUTO)
+        return "auto";
+    return filter >= 0 && filter < BSDIFF_FILTER_COUNT ? names[filter] : "?";
+}
+
+int bsdiff_FilterFind(const char *name)
+{
+    int i;
+
+    for (i = 0; i < BSDIFF_FILTER_COUNT; ++i) {
+        if (strcmp(name, bsdiff_FilterName(i)) == 0)
+            return i;
+    }
+    return -1;
+}
+
+//------------------------------------------------------------------------------
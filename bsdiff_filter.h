@@ -0,0 +1,44 @@
+#ifndef __BSDIFF_FILTER_H__
+#define __BSDIFF_FILTER_H__
+
+#include <stddef.h>
+#include "bsdiff_misc.h"
+
+//------------------------------------------------------------------------------
+
+/* 可执行文件的预处理过滤器（BCJ）：diff之前把old和newFile中相对调用指令的目标换算成绝对地址，
+   打补丁时先对old做同样的换算，得到的newFile再换算回来。插入或删除代码之后，后面所有调用指令的
+   相对偏移都变了，绝对目标却大多不变，匹配更长、控制三元组更少，diff数据也更稀疏。
+
+   每种换算都是可逆的：指令的操作码和判断条件都不受换算的影响，正反两个方向找到的是同一组指令，
+   地址在固定的位数内取模相加减（x86 25位有符号、ARM 24位、ARM64 26位）。
+   ELF/PE文件只换算可执行的节，文件头和节表不会被改动，所以从换算后的数据解析出的节与换算前相同；
+   其它数据整个换算。地址按文件偏移计算，不需要知道加载地址 */
+
+// 按ELF/PE文件头的机器类型选择过滤器，不是认识的可执行文件时返回BSDIFF_FILTER_NONE
+int bsdiff_FilterDetect(
+    const unsigned char *data,
+    size_t size
+    );
+
+// 就地换算data：encode非0时相对地址换成绝对地址（diff前），为0时换算回来（打补丁后）
+void bsdiff_FilterApply(
+    int filter,
+    unsigned char *data,
+    size_t size,
+    int encode
+    );
+
+// BSDIFF_FILTER_xxx的名字，如"x86"
+const char* bsdiff_FilterName(
+    int filter
+    );
+
+// 按名字查找过滤器（不包括"auto"），不认识时返回-1
+int bsdiff_FilterFind(
+    const char *name
+    );
+
+//------------------------------------------------------------------------------
+
+#endif // !__BSDIFF_FILTER_H__
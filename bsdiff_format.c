@@ -0,0 +1,223 @@
+#include "bsdiff_format.h"
+#include "bsdiff_simd.h"
+#include <string.h>
+
+#define MIN_SIZE(x,y) (((x)<(y)) ? (x) : (y))
+
+//------------------------------------------------------------------------------
+
+int bsdiff_HeaderWrite(const bsdiff_header *header, unsigned char buf[BSDIFF_HEADER_MAX])
+{
+    int legacy = header->ctrlCodec == BSDIFF_CODEC_BZIP2 && header->diffCodec == BSDIFF_CODEC_BZIP2 &&
+                 header->extraCodec == BSDIFF_CODEC_BZIP2 && header->flags == 0 && 
+                 header->filter == BSDIFF_FILTER_NONE;
+
+    memcpy(buf, legacy ? "BSDIFF40" : "BSDIFF41", 8);
+    bsdiff_WriteOffset(header->ctrlLen, buf + 8);
+    bsdiff_WriteOffset(header->diffLen, buf + 16);
+    bsdiff_WriteOffset(header->newSize, buf + 24);
+    if (legacy)
+        return 32;
+
+    buf[32] = (unsigned char)header->ctrlCodec;
+    buf[33] = (unsigned char)header->diffCodec;
+    buf[34] = (unsigned char)header->extraCodec;
+    buf[35] = (unsigned char)header->flags;
+    buf[36] = (unsigned char)header->filter;
+    buf[37] = (unsigned char)(header->scratchSize >> 10);
+    buf[38] = (unsigned char)(header->scratchSize >> 18);
+    buf[39] = (unsigned char)(header->scratchSize >> 26);
+    if (!(header->flags & BSDIFF_FLAG_CHECKSUM))
+        return 40;
+
+    bsdiff_WriteHash(header->oldHash, buf + 40);
+    bsdiff_WriteHash(header->newHash, buf + 48);
+    return 40 + BSDIFF_CHECKSUM_SIZE;
+}
+
+int bsdiff_HeaderRead(const unsigned char *buf, size_t len, bsdiff_header *header)
+{
+    memset(header, 0, sizeof(bsdiff_header));
+    if (len < 32)
+        return 0;
+
+    if (memcmp(buf, "BSDIFF40", 8) == 0) {
+        header->size = 32;
+        header->ctrlCodec = header->diffCodec = header->extraCodec = BSDIFF_CODEC_BZIP2;
+    } else if (memcmp(buf, "BSDIFF41", 8) == 0 && len >= 40) {
+        header->size = 40;
+        header->ctrlCodec = buf[32];
+        header->diffCodec = buf[33];
+        header->extraCodec = buf[34];
+        header->flags = buf[35];
+        header->filter = buf[36];
+        header->scratchSize = ((bsdiff_off_t)buf[37] | ((bsdiff_off_t)buf[38] << 8) | ((bsdiff_off_t)buf[39] << 16)) << 10;
+        if ((header->flags & ~BSDIFF_FLAGS_KNOWN) || header->filter >= BSDIFF_FILTER_COUNT || 
+            (header->scratchSize && !(header->flags & BSDIFF_FLAG_INPLACE)) ||
+            ((header->flags & BSDIFF_FLAG_STREAM) && (header->flags & (BSDIFF_FLAG_FRAMED | BSDIFF_FLAG_INPLACE))))
+            return 0;
+        if (header->flags & BSDIFF_FLAG_CHECKSUM) {
+            if (len < 40 + BSDIFF_CHECKSUM_SIZE)
+                return 0;
+            header->size = 40 + BSDIFF_CHECKSUM_SIZE;
+            header->oldHash = bsdiff_ReadHash(buf + 40);
+            header->newHash = bsdiff_ReadHash(buf + 48);
+        }
+    } else {
+        return 0;
+    }
+
+    header->ctrlLen = bsdiff_ReadOffset(buf + 8);
+    header->diffLen = bsdiff_ReadOffset(buf + 16);
+    header->newSize = bsdiff_ReadOffset(buf + 24);
+    if (header->ctrlLen < 0 || header->diffLen < 0 || header->newSize < 0 ||
+        ((header->flags & BSDIFF_FLAG_STREAM) && (header->ctrlLen || header->diffLen)))
+        return 0;
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+
+static int writeVarint(bsdiff_off_t value, unsigned char *buf)
+{
+    int n = 0;
+
+    while (value >= 0x80) {
+        buf[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = (unsigned char)value;
+    return n;
+}
+
+// 输出当前的token，然后开始一个以zeros个0开头的新token
+static int flushToken(bsdiff_zrle_writer *w, bsdiff_off_t zeros)
+{
+    unsigned char buf[20];
+    int n;
+
+    n = writeVarint(w->zeros, buf);
+    n += writeVarint((bsdiff_off_t)w->literalLen, buf + n);
+    if (!w->write(w->opaque, buf, (size_t)n) || 
+        (w->literalLen && !w->write(w->opaque, w->literal, w->literalLen)))
+        return 0;
+    w->zeros = zeros;
+    w->literalLen = 0;
+    return 1;
+}
+
+void bsdiff_ZrleWriterInit(bsdiff_zrle_writer *w, bsdiff_write_fn write, void *opaque)
+{
+    w->write = write;
+    w->opaque = opaque;
+    w->zeros = 0;
+    w->tail = 0;
+    w->literalLen = 0;
+}
+
+int bsdiff_ZrleWriterPut(bsdiff_zrle_writer *w, const unsigned char *data, size_t len)
+{
+    const unsigned char *z;
+    size_t n, m;
+
+    while (len > 0) {
+        // 还没有字面字节时0都属于token开头，否则先记在tail里，够长了才结束当前token
+        n = bsdiff_ZeroLen(data, len);
+        data += n;
+        len -= n;
+        if (w->literalLen == 0) {
+            w->zeros += n;
+        } else {
+            w->tail += n;
+            if (w->tail >= BSDIFF_ZRLE_MIN_RUN) {
+                if (!flushToken(w, (bsdiff_off_t)w->tail))
+                    return 0;
+                w->tail = 0;
+            }
+        }
+        if (len == 0)
+            break;
+
+        // 下一个0之前的字节（以及前面不够长的0）都是字面字节
+        z = (const unsigned char*)memchr(data, 0, len);
+        n = z ? (size_t)(z - data) : len;
+        while (n > 0) {
+            if (w->literalLen + w->tail >= BSDIFF_ZRLE_MAX_LITERAL) {
+                if (!flushToken(w, (bsdiff_off_t)w->tail))
+                    return 0;
+                w->tail = 0;
+            }
+            memset(w->literal + w->literalLen, 0, w->tail);
+            w->literalLen += w->tail;
+            w->tail = 0;
+            m = MIN_SIZE(n, BSDIFF_ZRLE_MAX_LITERAL - w->literalLen);
+            memcpy(w->literal + w->literalLen, data, m);
+            w->literalLen += m;
+            data += m;
+            len -= m;
+            n -= m;
+        }
+    }
+    return 1;
+}
+
+int bsdiff_ZrleWriterFinish(bsdiff_zrle_writer *w)
+{
+    // 结尾不够长的0留在字面字节里
+    if (w->tail) {
+        if (w->literalLen + w->tail > BSDIFF_ZRLE_MAX_LITERAL) {
+            if (!flushToken(w, (bsdiff_off_t)w->tail))
+                return 0;
+        } else {
+            memset(w->literal + w->literalLen, 0, w->tail);
+            w->literalLen += w->tail;
+        }
+        w->tail = 0;
+    }
+    if (w->zeros == 0 && w->literalLen == 0)
+        return 1;
+    return flushToken(w, 0);
+}
+
+//------------------------------------------------------------------------------
+
+void bsdiff_BundleHeaderWrite(const bsdiff_bundle_header *header, unsigned char buf[BSDIFF_BUNDLE_HEADER])
+{
+    memcpy(buf, "BSDIFFB1", 8);
+    bsdiff_WriteOffset(header->numOld, buf + 8);
+    bsdiff_WriteOffset(header->numNew, buf + 16);
+    bsdiff_WriteOffset(header->tableLen, buf + 24);
+    bsdiff_WriteHash(header->oldHash, buf + 32);
+}
+
+int bsdiff_BundleHeaderRead(const unsigned char buf[BSDIFF_BUNDLE_HEADER], bsdiff_bundle_header *header)
+{
+    if (memcmp(buf, "BSDIFFB1", 8) != 0)
+        return 0;
+    header->numOld = bsdiff_ReadOffset(buf + 8);
+    header->numNew = bsdiff_ReadOffset(buf + 16);
+    header->tableLen = bsdiff_ReadOffset(buf + 24);
+    header->oldHash = bsdiff_ReadHash(buf + 32);
+    return header->numOld >= 0 && header->numNew >= 0 && header->tableLen >= 0;
+}
+
+int bsdiff_BundlePathValid(const char *path, size_t len)
+{
+    size_t i, start = 0;
+
+    for (i = 0; i <= len; ++i) {
+        if (i < len && path[i] != '/') {
+            if (path[i] == '\\' || path[i] == ':' || path[i] == '\0')
+                return 0;
+            continue;
+        }
+        // 一个部分结束（开头的'/'也在这里：第一个部分为空）
+        if (i == start || (i - start == 1 && path[start] == '.') ||
+            (i - start == 2 && path[start] == '.' && path[start + 1] == '.'))
+            return 0;
+        start = i + 1;
+    }
+    return 1;
+}
+
+//------------------------------------------------------------------------------
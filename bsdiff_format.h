@@ -0,0 +1,194 @@
+#ifndef __BSDIFF_FORMAT_H__
+#define __BSDIFF_FORMAT_H__
+
+#include <stddef.h>
+#include "bsdiff_misc.h"
+
+//------------------------------------------------------------------------------
+
+/* patch文件头：
+   offset  len
+    0       8   --> "BSDIFF40"或"BSDIFF41"
+    8       8   --> X, length of the compressed control block
+    16      8   --> Y, length of the compressed diff block
+    24      8   --> newfile size
+   仅BSDIFF41：
+    32      1   --> control block的codec（BSDIFF_CODEC_xxx）
+    33      1   --> diff block的codec
+    34      1   --> extra block的codec
+    35      1   --> flags，BSDIFF_FLAG_xxx
+    36      1   --> 可执行文件过滤器，BSDIFF_FILTER_xxx：非0时diff是在过滤后的old/newFile上做的，
+                    打补丁时先过滤old，生成的newFile再反过滤（见bsdiff_filter.h）
+    37      3   --> 就地patch（BSDIFF_FLAG_INPLACE）的暂存区大小，单位KB，小端；其它patch保留，必须为0
+   仅BSDIFF_FLAG_CHECKSUM（文件头为56字节）：
+    40      8   --> old的XXH64：按命令的顺序，所有加法命令读到的（过滤后的）old数据（就地patch中包括暂存区的）
+    48      8   --> newFile的XXH64（就地patch为按命令的顺序写出的数据）
+
+   BSDIFF40的三个block都是bzip2；三个block都用bzip2并且没有flags和过滤器时总是输出BSDIFF40，与原始的bsdiff兼容
+
+   BSDIFF_FLAG_FRAMED时每个block都由一个帧索引和若干个独立压缩的帧组成：
+    0       8   --> N, 帧数
+    8       16*N -->  每帧的压缩长度和原始长度（各8字节）
+    8+16*N  ?   --> 各帧的压缩数据，依次排列
+   各帧可以独立地（并行地）解压，也可以直接跳到某一帧开始解压
+
+   BSDIFF_FLAG_ZRLE时diff block（解压后、分帧之前）是一系列的token，每个token为：
+    varint  Z   --> Z个0
+    varint  L   --> L个字面字节
+    L           --> 字面字节
+   varint为LEB128（每字节7位，低位在前，最高位为1表示后面还有）。Z和L不会同时为0；
+   一般Z都不小于BSDIFF_ZRLE_MIN_RUN，更短的0留在字面字节里；只有第一个token，以及前一个token的
+   字面字节达到BSDIFF_ZRLE_MAX_LITERAL时，Z才可以更小（包括0）。
+   diff block中大部分是0，这样压缩器的输入要小得多，打补丁时0的部分也不用逐字节做加法
+
+   BSDIFF_FLAG_INPLACE时patch可以就地应用（newFile直接写在oldFile上，见bsdiff_inplace.h），
+   control block中的三元组改为(newPos, oldPos, len)，按顺序执行，每一条都在文件当前的内容上进行：
+    newPos < 0  --> 把文件中[oldPos, oldPos+len)的数据复制到暂存区的(-1-newPos)处（都在其它命令之前）
+    oldPos >= 0 --> 文件中[oldPos, oldPos+len)的数据加上diff block中接下来的len字节，写到[newPos, newPos+len)
+    oldPos = -1 --> extra block中接下来的len字节写到[newPos, newPos+len)
+    oldPos <= -2 -> 暂存区(-2-oldPos)处的len字节加上diff block中接下来的len字节，写到[newPos, newPos+len)
+   每条命令读完它的一段old再写（按windowSize一段段进行），所以读写范围重叠时只允许newPos <= oldPos，
+   或者len不超过BSDIFF_INPLACE_PIECE（整条命令一次读完）。newFile的每个字节恰好被写一次，
+   所有命令执行完之后文件截断为newSize。不能与过滤器一起使用
+
+   BSDIFF_FLAG_STREAM时三个block都分帧，但不再各自连续存放：文件头之后是一系列帧记录，
+   按打补丁时用到的顺序（newFile中的位置）交错排列，直到patch的末尾：
+    0       1   --> 所属的block：0 control，1 diff，2 extra
+    1       8   --> 压缩长度C
+    9       8   --> 原始长度R
+    17      C   --> 独立压缩的一帧
+   这样patch可以从不能seek的流（管道、socket）中边读边应用，只需缓存少数几个提前到达的帧。
+   文件头中的X和Y为0；不能与BSDIFF_FLAG_FRAMED、BSDIFF_FLAG_INPLACE一起使用
+
+   BSDIFF_FLAG_CHECKSUM时打补丁在apply循环中顺带计算两个XXH64（数据正在cache中，不用再读一遍），
+   所有命令执行完之后与文件头比较：用错了old，或者patch损坏而解压器没有发现，都会失败。
+   就地patch例外：old的XXH64在改写文件之前先单独读一遍校验
+*/
+#define BSDIFF_CHECKSUM_SIZE  16
+#define BSDIFF_HEADER_MAX  (40 + BSDIFF_CHECKSUM_SIZE)
+
+#define BSDIFF_FLAG_FRAMED  0x01
+#define BSDIFF_FLAG_ZRLE    0x02
+#define BSDIFF_FLAG_INPLACE 0x04
+#define BSDIFF_FLAG_STREAM  0x08
+#define BSDIFF_FLAG_CHECKSUM 0x10
+#define BSDIFF_FLAGS_KNOWN  (BSDIFF_FLAG_FRAMED | BSDIFF_FLAG_ZRLE | BSDIFF_FLAG_INPLACE | BSDIFF_FLAG_STREAM | \
+                             BSDIFF_FLAG_CHECKSUM)
+
+// 就地patch中读写范围重叠并且newPos > oldPos的命令最长这么多字节，打补丁时的buffer至少要这么大
+#define BSDIFF_INPLACE_PIECE  (16 * 1024)
+
+// 就地patch的暂存区最大的大小（文件头中是24位的KB数）
+#define BSDIFF_INPLACE_SCRATCH_MAX  ((((bsdiff_off_t)1 << 24) - 1) << 10)
+
+// 一帧的原始数据最多这么长，解压时每个正在处理的帧都要这么大的buffer
+#define BSDIFF_FRAME_MAX  (64 * 1024 * 1024)
+
+// 流式patch的帧记录头的长度，以及没有指定帧长时的默认帧长
+#define BSDIFF_STREAM_RECORD  17
+#define BSDIFF_STREAM_FRAME   (1024 * 1024)
+
+typedef struct bsdiff_header {
+    int size;                   // 文件头的字节数，32、40或56
+    bsdiff_off_t ctrlLen, diffLen, newSize;
+    int ctrlCodec, diffCodec, extraCodec;
+    int flags;
+    int filter;                 // BSDIFF_FILTER_xxx
+    bsdiff_off_t scratchSize;   // 就地patch的暂存区字节数，1KB的整数倍
+    unsigned long long oldHash; // BSDIFF_FLAG_CHECKSUM时old和newFile的XXH64
+    unsigned long long newHash;
+} bsdiff_header;
+
+// 按codec选择格式并编码到buf中，返回写入的字节数
+int bsdiff_HeaderWrite(
+    const bsdiff_header *header,
+    unsigned char buf[BSDIFF_HEADER_MAX]
+    );
+
+// 解析buf中的文件头（len为buf中有效的字节数，可以小于BSDIFF_HEADER_MAX）
+// 魔数、长度、flags、过滤器或保留字段无效时返回0；不检查codec是否可用
+int bsdiff_HeaderRead(
+    const unsigned char *buf,
+    size_t len,
+    bsdiff_header *header
+    );
+
+//------------------------------------------------------------------------------
+
+// 短于这个长度的0不单独编码
+#define BSDIFF_ZRLE_MIN_RUN  16
+
+// 一个token最多这么多字面字节，编码器只需要缓存这么多数据
+#define BSDIFF_ZRLE_MAX_LITERAL  (1024 * 1024)
+
+// 流式的零游程编码器：原始diff数据分多次交给bsdiff_ZrleWriterPut，编码结果依次交给write
+typedef struct bsdiff_zrle_writer {
+    bsdiff_write_fn write;
+    void *opaque;
+    bsdiff_off_t zeros;         // 当前token开头的0
+    size_t tail;                // 字面字节后面的0，还不够BSDIFF_ZRLE_MIN_RUN个，归属还没确定
+    size_t literalLen;
+    unsigned char literal[BSDIFF_ZRLE_MAX_LITERAL];
+} bsdiff_zrle_writer;
+
+void bsdiff_ZrleWriterInit(
+    bsdiff_zrle_writer *w,
+    bsdiff_write_fn write,
+    void *opaque
+    );
+
+// write失败时返回0
+int bsdiff_ZrleWriterPut(
+    bsdiff_zrle_writer *w,
+    const unsigned char *data,
+    size_t len
+    );
+
+// 输出最后一个token
+int bsdiff_ZrleWriterFinish(
+    bsdiff_zrle_writer *w
+    );
+
+//------------------------------------------------------------------------------
+
+/* 多文件的patch包（bsdiff_diff_bundle）：oldDir和newDir中的文件各自按路径排序，首尾相接拼成两份语料，
+   两者之间只做一次普通的diff：一个后缀数组、一个patch文件头、三个压缩流，
+   一个文件中的内容移到了另一个文件中也能匹配到。
+   offset  len
+    0       8   --> "BSDIFFB1"
+    8       8   --> old文件数
+    16      8   --> new文件数
+    24      8   --> T, 文件表的字节数
+    32      8   --> old语料的XXH64，打补丁之前校验oldDir
+    40      T   --> 文件表：先old后new，每项为文件长度（8字节）、路径长度（8字节）和路径
+    40+T    ?   --> 两份语料之间的patch（就地patch除外），newSize为new文件的总长度
+   路径相对于目录，以'/'分隔，见bsdiff_BundlePathValid */
+#define BSDIFF_BUNDLE_HEADER  40
+
+typedef struct bsdiff_bundle_header {
+    bsdiff_off_t numOld, numNew;
+    bsdiff_off_t tableLen;
+    unsigned long long oldHash;
+} bsdiff_bundle_header;
+
+void bsdiff_BundleHeaderWrite(
+    const bsdiff_bundle_header *header,
+    unsigned char buf[BSDIFF_BUNDLE_HEADER]
+    );
+
+// 魔数不对或者有负的长度时返回0
+int bsdiff_BundleHeaderRead(
+    const unsigned char buf[BSDIFF_BUNDLE_HEADER],
+    bsdiff_bundle_header *header
+    );
+
+// 文件表中的路径（len字节）不能是空的或绝对路径，不能含有空的、"."或".."的部分，
+// 也不能含有'\\'、':'和'\0'，打补丁时才不会写到newDir之外
+int bsdiff_BundlePathValid(
+    const char *path,
+    size_t len
+    );
+
+//------------------------------------------------------------------------------
+
+#endif // !__BSDIFF_FORMAT_H__
@@ -0,0 +1,172 @@
+#include "bsdiff_hash.h"
+#include <string.h>
+
+//------------------------------------------------------------------------------
+
+#define PRIME64_1  11400714785074694791ULL
+#define PRIME64_2  14029467366897019727ULL
+#define PRIME64_3  1609587929392839161ULL
+#define PRIME64_4  9650029242287828579ULL
+#define PRIME64_5  2870177450012600261ULL
+
+#define ROTL64(x, r)  (((x) << (r)) | ((x) >> (64 - (r))))
+
+// 按小端序读取，与平台字节序无关
+static unsigned long long read64(const unsigned char *p)
+{
+    return (unsigned long long)p[0]         | ((unsigned long long)p[1] << 8)  |
+           ((unsigned long long)p[2] << 16) | ((unsigned long long)p[3] << 24) |
+           ((unsigned long long)p[4] << 32) | ((unsigned long long)p[5] << 40) |
+           ((unsigned long long)p[6] << 48) | ((unsigned long long)p[7] << 56);
+}
+
+static unsigned long long read32(const unsigned char *p)
+{
+    return (unsigned long long)p[0]         | ((unsigned long long)p[1] << 8) |
+           ((unsigned long long)p[2] << 16) | ((unsigned long long)p[3] << 24);
+}
+
+static unsigned long long round64(unsigned long long acc, unsigned long long input)
+{
+    acc += input * PRIME64_2;
+    acc = ROTL64(acc, 31);
+    acc *= PRIME64_1;
+    return acc;
+}
+
+static unsigned long long mergeRound64(unsigned long long acc, unsigned long long val)
+{
+    acc ^= round64(0, val);
+    acc = acc * PRIME64_1 + PRIME64_4;
+    return acc;
+}
+
+//------------------------------------------------------------------------------
+
+void bsdiff_Xxh64Init(bsdiff_xxh64 *state, unsigned long long seed)
+{
+    memset(state, 0, sizeof(bsdiff_xxh64));
+    state->seed = seed;
+    state->v[0] = seed + PRIME64_1 + PRIME64_2;
+    state->v[1] = seed + PRIME64_2;
+    state->v[2] = seed;
+    state->v[3] = seed - PRIME64_1;
+}
+
+void bsdiff_Xxh64Update(bsdiff_xxh64 *state, const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char*)data;
+    size_t n;
+
+    state->totalLen += len;
+
+    // 先补齐上次剩下的不足32字节的部分
+    if (state->bufLen) {
+        n = 32 - state->bufLen;
+        if (n > len)
+            n = len;
+        memcpy(state->buf + state->bufLen, p, n);
+        state->bufLen += n;
+        p += n;
+        len -= n;
+        if (state->bufLen < 32)
+            return;
+        state->v[0] = round64(state->v[0], read64(state->buf));
+        state->v[1] = round64(state->v[1], read64(state->buf + 8));
+        state->v[2] = round64(state->v[2], read64(state->buf + 16));
+        state->v[3] = round64(state->v[3], read64(state->buf + 24));
+        state->bufLen = 0;
+    }
+
+    while (len >= 32) {
+        state->v[0] = round64(state->v[0], read64(p));
+        state->v[1] = round64(state->v[1], read64(p + 8));
+        state->v[2] = round64(state->v[2], read64(p + 16));
+        state->v[3] = round64(state->v[3], read64(p + 24));
+        p += 32;
+        len -= 32;
+    }
+
+    if (len) {
+        memcpy(state->buf, p, len);
+        state->bufLen = len;
+    }
+}
+
+unsigned long long bsdiff_Xxh64Final(const bsdiff_xxh64 *state)
+{
+    const unsigned char *p = state->buf;
+    size_t len = state->bufLen;
+    unsigned long long h;
+
+    if (state->totalLen >= 32) {
+        h = ROTL64(state->v[0], 1) + ROTL64(state->v[1], 7) +
+            ROTL64(state->v[2], 12) + ROTL64(state->v[3], 18);
+        h = mergeRound64(h, state->v[0]);
+        h = mergeRound64(h, state->v[1]);
+        h = mergeRound64(h, state->v[2]);
+        h = mergeRound64(h, state->v[3]);
+    } else {
+        h = state->seed + PRIME64_5;
+    }
+    h += state->totalLen;
+
+    while (len >= 8) {
+        h ^= round64(0, read64(p));
+        h = ROTL64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+        len -= 8;
+    }
+    if (len >= 4) {
+        h ^= read32(p) * PRIME64_1;
+        h = ROTL64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+        len -= 4;
+    }
+    while (len) {
+        h ^= (*p) * PRIME64_5;
+        h = ROTL64(h, 11) * PRIME64_1;
+        ++p;
+        --len;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+unsigned long long bsdiff_Xxh64(const void *data, size_t len, unsigned long long seed)
+{
+    bsdiff_xxh64 state;
+
+    bsdiff_Xxh64Init(&state, seed);
+    bsdiff_Xxh64Update(&state, data, len);
+    return bsdiff_Xxh64Final(&state);
+}
+
+//------------------------------------------------------------------------------
+
+unsigned int bsdiff_RollHash(const unsigned char *data, size_t len)
+{
+    unsigned int h = 0;
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+        h = h * BSDIFF_ROLL_PRIME + data[i];
+    return h;
+}
+
+unsigned int bsdiff_RollPower(size_t len)
+{
+    unsigned int p = 1;
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+        p *= BSDIFF_ROLL_PRIME;
+    return p;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,60 @@
+#ifndef __BSDIFF_HASH_H__
+#define __BSDIFF_HASH_H__
+
+#include <stddef.h>
+
+//------------------------------------------------------------------------------
+
+// XXH64（xxHash的64位版本），用于校验文件内容
+typedef struct bsdiff_xxh64 {
+    unsigned long long v[4];
+    unsigned long long totalLen;
+    unsigned char buf[32];
+    size_t bufLen;
+    unsigned long long seed;
+} bsdiff_xxh64;
+
+void bsdiff_Xxh64Init(
+    bsdiff_xxh64 *state,
+    unsigned long long seed
+    );
+
+void bsdiff_Xxh64Update(
+    bsdiff_xxh64 *state,
+    const void *data,
+    size_t len
+    );
+
+unsigned long long bsdiff_Xxh64Final(
+    const bsdiff_xxh64 *state
+    );
+
+// 一次性计算一段内存的XXH64
+unsigned long long bsdiff_Xxh64(
+    const void *data,
+    size_t len,
+    unsigned long long seed
+    );
+
+//------------------------------------------------------------------------------
+
+// 多项式滚动hash：长度为len的一段数据的hash为sum(data[i] * P^(len-1-i))，模2^32
+#define BSDIFF_ROLL_PRIME  0x01000193u
+
+unsigned int bsdiff_RollHash(
+    const unsigned char *data,
+    size_t len
+    );
+
+// P^len，供bsdiff_RollNext使用
+unsigned int bsdiff_RollPower(
+    size_t len
+    );
+
+// 窗口向后滑动一个字节：移出out，移入in
+#define bsdiff_RollNext(h, out, in, power) \
+    ((unsigned int)((h) * BSDIFF_ROLL_PRIME + (unsigned int)(in) - (unsigned int)(out) * (power)))
+
+//------------------------------------------------------------------------------
+
+#endif // !__BSDIFF_HASH_H__
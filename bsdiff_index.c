@@ -0,0 +1,78 @@
+#include "bsdiff_index.h"
+#include "bsdiff_sa.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+
+int bsdiff_IndexLoad(const char *indexFile, bsdiff_off_t oldSize, unsigned long long oldHash, 
+                     size_t entrySize, bsdiff_mapping *map, const void **I)
+{
+    const unsigned char *header, *data;
+    bsdiff_off_t first;
+
+    if (!bsdiff_MapFile(indexFile, map))
+        return 0;
+
+    header = map->data;
+    if (map->size < BSDIFF_INDEX_HEADER_SIZE ||
+        memcmp(header, "BSDIFFSA", 8) != 0 ||
+        bsdiff_ReadOffset(header + 8) != oldSize ||
+        bsdiff_ReadHash(header + 16) != oldHash ||
+        bsdiff_ReadOffset(header + 24) != (bsdiff_off_t)entrySize ||
+        (map->size - BSDIFF_INDEX_HEADER_SIZE) / entrySize != (size_t)oldSize + 1 ||
+        (map->size - BSDIFF_INDEX_HEADER_SIZE) % entrySize != 0) {
+        bsdiff_UnmapFile(map);
+        return 0;
+    }
+
+    // I[0]总是oldSize，顺便可以排除字节序不同的索引
+    data = header + BSDIFF_INDEX_HEADER_SIZE;
+    if (entrySize == sizeof(bsdiff_sa32))
+        first = *(const bsdiff_sa32*)data;
+    else
+        first = *(const bsdiff_sa64*)data;
+    if (first != oldSize) {
+        bsdiff_UnmapFile(map);
+        return 0;
+    }
+
+    *I = data;
+    return 1;
+}
+
+int bsdiff_IndexSave(const char *indexFile, const void *I, size_t entrySize, bsdiff_off_t oldSize, 
+                     unsigned long long oldHash)
+{
+    unsigned char header[BSDIFF_INDEX_HEADER_SIZE];
+    char *tempFile;
+    FILE *fp;
+    int ok;
+
+    tempFile = (char*)malloc(strlen(indexFile) + 32);
+    if (!tempFile)
+        return 0;
+    sprintf(tempFile, "%s.%d.tmp", indexFile, bsdiff_GetProcessId());
+
+    memcpy(header, "BSDIFFSA", 8);
+    bsdiff_WriteOffset(oldSize, header + 8);
+    bsdiff_WriteHash(oldHash, header + 16);
+    bsdiff_WriteOffset((bsdiff_off_t)entrySize, header + 24);
+
+    ok = 0;
+    if ((fp = fopen(tempFile, "wb")) != NULL) {
+        ok = bsdiff_WriteFile(fp, header, BSDIFF_INDEX_HEADER_SIZE) &&
+             bsdiff_WriteFile(fp, (const unsigned char*)I, ((size_t)oldSize + 1) * entrySize);
+        if (fclose(fp))
+            ok = 0;
+        if (ok)
+            ok = bsdiff_RenameFile(tempFile, indexFile);
+        if (!ok)
+            remove(tempFile);
+    }
+    free(tempFile);
+    return ok;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,43 @@
+#ifndef __BSDIFF_INDEX_H__
+#define __BSDIFF_INDEX_H__
+
+#include <stddef.h>
+#include "bsdiff_misc.h"
+
+//------------------------------------------------------------------------------
+
+/* 后缀数组索引文件的格式：
+   offset  len
+    0       8   --> "BSDIFFSA"
+    8       8   --> oldfile size
+    16      8   --> XXH64(oldfile)，小端序
+    24      8   --> 每个后缀数组元素的字节数（4或8，见bsdiff_SuffixEntrySize）
+    32      ?   --> 后缀数组I，共(oldfile size + 1)个元素，本机字节序
+
+   数据区紧跟在32字节的文件头之后，映射以后可以直接当作I使用。 */
+
+#define BSDIFF_INDEX_HEADER_SIZE  32
+
+// 映射并校验indexFile；与oldSize/oldHash/entrySize不符（过期）或格式不对时返回0
+// 成功时*I指向映射中的后缀数组，用完后调用bsdiff_UnmapFile(map)
+int bsdiff_IndexLoad(
+    const char *indexFile,
+    bsdiff_off_t oldSize,
+    unsigned long long oldHash,
+    size_t entrySize,
+    bsdiff_mapping *map,
+    const void **I
+    );
+
+// 把后缀数组写入indexFile；先写临时文件再改名，不会破坏其它进程正在映射的旧索引
+int bsdiff_IndexSave(
+    const char *indexFile,
+    const void *I,
+    size_t entrySize,
+    bsdiff_off_t oldSize,
+    unsigned long long oldHash
+    );
+
+//------------------------------------------------------------------------------
+
+#endif // !__BSDIFF_INDEX_H__
@@ -0,0 +1,177 @@
+#include "bsdiff_inplace.h"
+#include <string.h>
+
+//------------------------------------------------------------------------------
+
+// 比这短的命令复制到暂存区时多出的两个控制三元组比它的数据还大，直接改成extra
+#define MIN_STASH  64
+
+static void* allocArray(const bsdiff_allocator *allocator, size_t count, size_t size)
+{
+    if (count >= (size_t)-1 / size)
+        return NULL;
+    return bsdiff_Alloc(allocator, (count + 1) * size);
+}
+
+// 写的范围结束在pos之后的第一条命令
+static size_t firstWriteAfter(const bsdiff_inplace_cmd *cmds, size_t numCmds, bsdiff_off_t pos)
+{
+    size_t lo = 0, hi = numCmds, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (cmds[mid].newPos + cmds[mid].len > pos)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+// i读的范围与j写的范围重叠时有一条边i -> j（i要先执行）。写的范围按newPos排好序，互不重叠，
+// 与i重叠的是连续的一段。start为NULL时只计数；否则start[i]为i的第一条出边在edges中的位置，
+// inDegree[j]累加j的入边数
+static size_t findEdges(const bsdiff_inplace_cmd *cmds, size_t numCmds, size_t *start, size_t *edges,
+                        size_t *inDegree)
+{
+    size_t i, j, numEdges = 0;
+    bsdiff_off_t readEnd;
+
+    for (i = 0; i < numCmds; ++i) {
+        if (start)
+            start[i] = numEdges;
+        readEnd = cmds[i].oldPos + cmds[i].len;
+        for (j = firstWriteAfter(cmds, numCmds, cmds[i].oldPos); j < numCmds && cmds[j].newPos < readEnd; ++j) {
+            if (j == i)
+                continue;
+            if (start) {
+                edges[numEdges] = j;
+                ++inDegree[j];
+            }
+            ++numEdges;
+        }
+    }
+    if (start)
+        start[numCmds] = numEdges;
+    return numEdges;
+}
+
+int bsdiff_InplaceOrder(const bsdiff_inplace_cmd *cmds, size_t numCmds, bsdiff_off_t scratchSize, 
+                        size_t *order, size_t *numOrdered, unsigned char *mode, const bsdiff_allocator *allocator)
+{
+    int retCode = 0;
+    size_t *outStart = NULL, *outEdges = NULL, *inStart = NULL, *inEdges = NULL;
+    size_t *inCursor = NULL, *pending = NULL, *stack = NULL, *path = NULL, *pathPos = NULL;
+    unsigned char *done = NULL;
+    size_t numEdges, numDone = 0, top = 0, pathLen = 0, next = 0;
+    size_t i, j, k, u, v, c;
+
+    *numOrdered = 0;
+    memset(mode, BSDIFF_INPLACE_ORDERED, numCmds);
+
+    // 出边和入边各一份邻接表
+    numEdges = findEdges(cmds, numCmds, NULL, NULL, NULL);
+    if (!(outStart = (size_t*)allocArray(allocator, numCmds + 1, sizeof(size_t))) ||
+        !(outEdges = (size_t*)allocArray(allocator, numEdges, sizeof(size_t))) ||
+        !(inStart = (size_t*)allocArray(allocator, numCmds + 1, sizeof(size_t))) ||
+        !(inEdges = (size_t*)allocArray(allocator, numEdges, sizeof(size_t))) ||
+        !(inCursor = (size_t*)allocArray(allocator, numCmds, sizeof(size_t))) ||
+        !(pending = (size_t*)allocArray(allocator, numCmds, sizeof(size_t))) ||
+        !(stack = (size_t*)allocArray(allocator, numCmds, sizeof(size_t))) ||
+        !(path = (size_t*)allocArray(allocator, numCmds, sizeof(size_t))) ||
+        !(pathPos = (size_t*)allocArray(allocator, numCmds, sizeof(size_t))) ||
+        !(done = (unsigned char*)allocArray(allocator, numCmds, 1)))
+        goto MyExit;
+    memset(pending, 0, numCmds * sizeof(size_t));
+    memset(pathPos, 0, numCmds * sizeof(size_t));
+    memset(done, 0, numCmds);
+    findEdges(cmds, numCmds, outStart, outEdges, pending);
+    inStart[0] = 0;
+    for (j = 0; j < numCmds; ++j) {
+        inStart[j + 1] = inStart[j] + pending[j];
+        inCursor[j] = inStart[j];
+    }
+    for (i = 0; i < numCmds; ++i) {
+        for (k = outStart[i]; k < outStart[i + 1]; ++k)
+            inEdges[inCursor[outEdges[k]]++] = i;
+    }
+
+    // pending[j]为j还没有完成的前驱数，为0的命令可以执行
+    for (j = 0; j < numCmds; ++j) {
+        inCursor[j] = inStart[j];
+        if (!pending[j])
+            stack[top++] = j;
+    }
+
+    for (;;) {
+        while (top > 0) {
+            v = stack[--top];
+            done[v] = 1;
+            ++numDone;
+            order[(*numOrdered)++] = v;
+            for (k = outStart[v]; k < outStart[v + 1]; ++k) {
+                if (!done[outEdges[k]] && --pending[outEdges[k]] == 0)
+                    stack[top++] = outEdges[k];
+            }
+        }
+        if (numDone == numCmds)
+            break;
+
+        // 剩下的命令都在环上或者在环的下游，从其中一条出发沿着未完成的前驱往回走，一定会走进一个环。
+        // 上一次走过的路径在第一个已经完成的命令之前仍然有效，接着走；inCursor跳过的前驱都已经完成
+        for (k = 0; k < pathLen && !done[path[k]]; ++k)
+            ;
+        pathLen = k;
+        if (pathLen == 0) {
+            while (done[next])
+                ++next;
+            pathPos[next] = 0;
+            path[pathLen++] = next;
+        }
+        for (;;) {
+            v = path[pathLen - 1];
+            while (done[inEdges[inCursor[v]]])
+                ++inCursor[v];
+            u = inEdges[inCursor[v]];
+            if (pathPos[u] < pathLen && path[pathPos[u]] == u)
+                break;
+            pathPos[u] = pathLen;
+            path[pathLen++] = u;
+        }
+
+        // 环为path[pathPos[u]..pathLen)，其中最短的命令改为从暂存区读，暂存区不够时改成extra
+        c = u;
+        for (k = pathPos[u] + 1; k < pathLen; ++k) {
+            if (cmds[path[k]].len < cmds[c].len)
+                c = path[k];
+        }
+        if (cmds[c].len >= MIN_STASH && cmds[c].len <= scratchSize) {
+            mode[c] = BSDIFF_INPLACE_STASHED;
+            scratchSize -= cmds[c].len;
+        } else {
+            mode[c] = BSDIFF_INPLACE_LITERAL;
+        }
+        done[c] = 1;
+        ++numDone;
+        for (k = outStart[c]; k < outStart[c + 1]; ++k) {
+            if (!done[outEdges[k]] && --pending[outEdges[k]] == 0)
+                stack[top++] = outEdges[k];
+        }
+    }
+    retCode = 1;
+
+MyExit:
+    bsdiff_Free(allocator, outStart);
+    bsdiff_Free(allocator, outEdges);
+    bsdiff_Free(allocator, inStart);
+    bsdiff_Free(allocator, inEdges);
+    bsdiff_Free(allocator, inCursor);
+    bsdiff_Free(allocator, pending);
+    bsdiff_Free(allocator, stack);
+    bsdiff_Free(allocator, path);
+    bsdiff_Free(allocator, pathPos);
+    bsdiff_Free(allocator, done);
+    return retCode;
+}
+
+//------------------------------------------------------------------------------
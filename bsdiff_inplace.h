@@ -0,0 +1,42 @@
+#ifndef __BSDIFF_INPLACE_H__
+#define __BSDIFF_INPLACE_H__
+
+#include <stddef.h>
+#include "bsdiff_misc.h"
+
+//------------------------------------------------------------------------------
+
+/* 就地patch（BSDIFF_FLAG_INPLACE，格式见bsdiff_format.h）的命令排序。newFile直接写在oldFile上，
+   一条加法命令从old的[oldPos, oldPos+len)读，写newFile的[newPos, newPos+len)，执行时它读的范围
+   不能已经被别的命令写过：命令i读的范围与命令j写的范围重叠时，i必须在j之前执行。
+   这些约束构成一个有向图（CRWI图），按拓扑顺序执行即可。图中有环时取环上最短的命令断开：
+   命令不太短、暂存区（scratch）还放得下时，在所有命令之前把它要读的old复制到暂存区，它改为从暂存区读；
+   否则改成extra数据（不再读old），代价是patch大一些。
+   这两种命令都不再读文件，放在排好序的加法命令之后执行，不参与排序。
+   命令自己的读写范围重叠不算约束，打补丁时每条命令都是先读后写（见BSDIFF_INPLACE_PIECE） */
+
+typedef struct bsdiff_inplace_cmd {
+    bsdiff_off_t newPos, oldPos, len;
+} bsdiff_inplace_cmd;
+
+// 命令的处理方式
+#define BSDIFF_INPLACE_ORDERED  0   // 按排好的顺序从文件读
+#define BSDIFF_INPLACE_STASHED  1   // 从暂存区读
+#define BSDIFF_INPLACE_LITERAL  2   // 改成extra数据
+
+// cmds为按newPos排序、写的范围互不重叠的numCmds条加法命令。成功时order[0..*numOrdered)为
+// 可以安全执行的顺序（cmds中的下标），mode[i]为各命令的处理方式，STASHED的总长度不超过scratchSize。
+// 图的边数与读写范围的重叠有关，通常与命令数相当；内存不足时返回0
+int bsdiff_InplaceOrder(
+    const bsdiff_inplace_cmd *cmds,
+    size_t numCmds,
+    bsdiff_off_t scratchSize,
+    size_t *order,
+    size_t *numOrdered,
+    unsigned char *mode,
+    const bsdiff_allocator *allocator
+    );
+
+//------------------------------------------------------------------------------
+
+#endif // !__BSDIFF_INPLACE_H__
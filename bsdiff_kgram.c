@@ -0,0 +1,115 @@
+#include "bsdiff_kgram.h"
+#include "bsdiff_simd.h"
+#include <string.h>
+
+//------------------------------------------------------------------------------
+
+// 构建时提前这么多个采样点计算hash并预取对应的槽，表的随机写入不必逐个等待缓存
+#define PREFETCH_AHEAD  8
+
+#define MIN_BITS  10
+
+static unsigned long long readLE64(const unsigned char *p)
+{
+    return p[0] | ((unsigned long long)p[1] << 8) | ((unsigned long long)p[2] << 16) |
+           ((unsigned long long)p[3] << 24) | ((unsigned long long)p[4] << 32) |
+           ((unsigned long long)p[5] << 40) | ((unsigned long long)p[6] << 48) |
+           ((unsigned long long)p[7] << 56);
+}
+
+// BSDIFF_KGRAM_LEN（16）字节的hash，取乘积的高位；按小端读取，在不同的平台上生成相同的patch
+static unsigned int gramHash(const unsigned char *p, int shift)
+{
+    return (unsigned int)(((readLE64(p) * 0x9E3779B185EBCA87ull) ^
+                           (readLE64(p + 8) * 0xC2B2AE3D27D4EB4Full)) >> shift);
+}
+
+static int tableBits(bsdiff_off_t oldSize)
+{
+    int bits = MIN_BITS;
+
+    while (bits < 40 && ((bsdiff_off_t)1 << bits) < oldSize / BSDIFF_KGRAM_STEP)
+        ++bits;
+    return bits;
+}
+
+size_t bsdiff_KgramMemory(bsdiff_off_t oldSize)
+{
+    int bits = tableBits(oldSize);
+
+    // 32位系统上放不下时返回最大值
+    if (bits > (int)(sizeof(size_t) * 8) - 3)
+        return (size_t)-1;
+    return ((size_t)1 << bits) * sizeof(unsigned int);
+}
+
+int bsdiff_KgramBuild(bsdiff_kgram *index, const unsigned char *old, bsdiff_off_t oldSize,
+                      const bsdiff_allocator *allocator)
+{
+    unsigned int ring[PREFETCH_AHEAD], h = 0;
+    bsdiff_off_t numSamples, i;
+    int bits = tableBits(oldSize);
+
+    memset(index, 0, sizeof(bsdiff_kgram));
+    numSamples = oldSize >= BSDIFF_KGRAM_LEN ? (oldSize - BSDIFF_KGRAM_LEN) / BSDIFF_KGRAM_STEP + 1 : 0;
+    if (numSamples >= 0xFFFFFFFFu || bsdiff_KgramMemory(oldSize) == (size_t)-1)
+        return 0;
+    if (!(index->slots = (unsigned int*)bsdiff_Alloc(allocator, bsdiff_KgramMemory(oldSize))))
+        return 0;
+    memset(index->slots, 0, bsdiff_KgramMemory(oldSize));
+    index->shift = 64 - bits;
+
+    // 按位置的顺序插入，同一个槽中只留第一个位置：重复的内容（如一段0）查到的是它的开头，
+    // 向后能匹配得最长；若留最后一个位置，查到的是重复内容的末尾，只能匹配十几个字节
+    for (i = 0; i < numSamples + PREFETCH_AHEAD; ++i) {
+        if (i < numSamples) {
+            h = gramHash(old + i * BSDIFF_KGRAM_STEP, index->shift);
+            bsdiff_Prefetch(index->slots + h);
+        }
+        if (i >= PREFETCH_AHEAD && !index->slots[ring[i % PREFETCH_AHEAD]])
+            index->slots[ring[i % PREFETCH_AHEAD]] = (unsigned int)(i - PREFETCH_AHEAD + 1);
+        if (i < numSamples)
+            ring[i % PREFETCH_AHEAD] = h;
+    }
+    return 1;
+}
+
+void bsdiff_KgramFree(bsdiff_kgram *index, const bsdiff_allocator *allocator)
+{
+    bsdiff_Free(allocator, index->slots);
+    index->slots = NULL;
+}
+
+static bsdiff_off_t matchAt(const unsigned char *old, bsdiff_off_t oldSize, bsdiff_off_t oldPos,
+                            const unsigned char *newBuf, bsdiff_off_t newSize)
+{
+    return (bsdiff_off_t)bsdiff_MatchLen(old + oldPos, newBuf,
+                                         (size_t)(oldSize - oldPos < newSize ? oldSize - oldPos : newSize));
+}
+
+bsdiff_off_t bsdiff_KgramSearch(const bsdiff_kgram *index, const unsigned char *old, bsdiff_off_t oldSize,
+                                const unsigned char *newBuf, bsdiff_off_t newSize, bsdiff_off_t hint,
+                                bsdiff_off_t *pos)
+{
+    unsigned int slot;
+    bsdiff_off_t len = 0, candidate, candidateLen;
+
+    *pos = 0;
+    if (hint >= 0 && hint < oldSize) {
+        len = matchAt(old, oldSize, hint, newBuf, newSize);
+        *pos = hint;
+    }
+    if (newSize < BSDIFF_KGRAM_LEN || !(slot = index->slots[gramHash(newBuf, index->shift)]))
+        return len;
+
+    // hash冲突时匹配长度可能不到k字节（甚至为0），由调用者按长度取舍；与hint一样长时取hint
+    candidate = (bsdiff_off_t)(slot - 1) * BSDIFF_KGRAM_STEP;
+    candidateLen = matchAt(old, oldSize, candidate, newBuf, newSize);
+    if (candidateLen > len) {
+        len = candidateLen;
+        *pos = candidate;
+    }
+    return len;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,57 @@
+#ifndef __BSDIFF_KGRAM_H__
+#define __BSDIFF_KGRAM_H__
+
+#include <stddef.h>
+#include "bsdiff_misc.h"
+
+//------------------------------------------------------------------------------
+
+/* 后缀数组之外的另一种匹配引擎：old上的k-gram hash索引。old每隔BSDIFF_KGRAM_STEP字节取一段
+   BSDIFF_KGRAM_LEN字节的hash，记在一张开放的hash表中（每个槽只记一个位置，先来的优先）；
+   查找时用newFile当前位置的k-gram查表，把命中的位置向后比较出匹配长度。
+   构建是一遍O(n)的扫描，表每项4字节、项数不超过oldSize / BSDIFF_KGRAM_STEP * 2，
+   查找是一次hash和一次表访问，都比后缀数组快得多。代价是只能找到某个采样点上的、至少k字节的匹配，
+   而且每个k-gram只有一个候选位置，找到的未必是最长的匹配，patch会大一些 */
+
+#define BSDIFF_KGRAM_LEN   16
+#define BSDIFF_KGRAM_STEP  4
+
+typedef struct bsdiff_kgram {
+    unsigned int *slots;        // 位置 / BSDIFF_KGRAM_STEP + 1，0表示空
+    int shift;                  // 64减去表长的位数
+} bsdiff_kgram;
+
+// 为长为oldSize的old构建索引所需的内存（字节数）
+size_t bsdiff_KgramMemory(
+    bsdiff_off_t oldSize
+    );
+
+// 内存不足（或old太大，位置放不进32位的槽）时返回0；成功时用bsdiff_KgramFree释放
+int bsdiff_KgramBuild(
+    bsdiff_kgram *index,
+    const unsigned char *old,
+    bsdiff_off_t oldSize,
+    const bsdiff_allocator *allocator
+    );
+
+void bsdiff_KgramFree(
+    bsdiff_kgram *index,
+    const bsdiff_allocator *allocator
+    );
+
+// 与后缀数组的search相同的接口：返回newBuf开头在old中找到的匹配长度，位置通过*pos返回。
+// hint为沿用上一个匹配的偏移时old中对应的位置（超出old时不用），表中的候选不比它长时返回hint。
+// 没有hint时，长的重复内容（如一段0）每次只能查到同一个候选，扫描会退化成逐字节前进
+bsdiff_off_t bsdiff_KgramSearch(
+    const bsdiff_kgram *index,
+    const unsigned char *old,
+    bsdiff_off_t oldSize,
+    const unsigned char *newBuf,
+    bsdiff_off_t newSize,
+    bsdiff_off_t hint,
+    bsdiff_off_t *pos
+    );
+
+//------------------------------------------------------------------------------
+
+#endif // !__BSDIFF_KGRAM_H__
@@ -1,15 +1,36 @@
+#ifndef _WIN32
+  #define _FILE_OFFSET_BITS 64  // 让32位系统上的off_t、fseeko、ftello也是64位
+#endif
 #include "bsdiff_misc.h"
-#include <limits.h>
-#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+  #include <process.h>
+  #include <io.h>
+#else
+  #include <sys/types.h>
+  #include <sys/stat.h>
+  #include <sys/mman.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <dirent.h>
+  #include <errno.h>
+  #include <time.h>
+#endif
 
 //------------------------------------------------------------------------------
 
+// 单次fread/fwrite的最大长度，避免某些CRT在超过2GB的长度上出错
+#define MAX_IO_CHUNK  0x40000000
+
 int bsdiff_ReadFile(FILE *fp, unsigned char *buf, size_t len)
 {
     size_t n;
 
     while (len) {
-        n = fread(buf, 1, len, fp);
+        n = fread(buf, 1, len < MAX_IO_CHUNK ? len : MAX_IO_CHUNK, fp);
         if (!n)
             return 0;
         buf += n;
@@ -23,7 +44,7 @@ int bsdiff_WriteFile(FILE *fp, const unsigned char *buf, size_t len)
     size_t n;
     
     while (len) {
-        n = fwrite(buf, 1, len, fp);
+        n = fwrite(buf, 1, len < MAX_IO_CHUNK ? len : MAX_IO_CHUNK, fp);
         if (!n)
             return 0;
         buf += n;
@@ -32,24 +53,42 @@ int bsdiff_WriteFile(FILE *fp, const unsigned char *buf, size_t len)
     return 1;
 }
 
-int bsdiff_GetFileSize(FILE *fp, int *fileSize)
+int bsdiff_GetFileSize(FILE *fp, bsdiff_off_t *fileSize)
 {
-    if (fseek(fp, 0, SEEK_END))
+    if (bsdiff_Seek(fp, 0, SEEK_END))
         return 0;
     
-    *fileSize = ftell(fp);
+    *fileSize = bsdiff_Tell(fp);
     if (*fileSize < 0)
         return 0;
     
-    if (fseek(fp, 0, SEEK_SET))
+    if (bsdiff_Seek(fp, 0, SEEK_SET))
         return 0;
     
     return 1;
 }
 
-int bsdiff_ReadOffset(unsigned char buf[8])
+int bsdiff_Seek(FILE *fp, bsdiff_off_t offset, int origin)
 {
-    long long value = 0;
+#ifdef _WIN32
+    return _fseeki64(fp, offset, origin);
+#else
+    return fseeko(fp, (off_t)offset, origin);
+#endif
+}
+
+bsdiff_off_t bsdiff_Tell(FILE *fp)
+{
+#ifdef _WIN32
+    return _ftelli64(fp);
+#else
+    return (bsdiff_off_t)ftello(fp);
+#endif
+}
+
+bsdiff_off_t bsdiff_ReadOffset(const unsigned char buf[8])
+{
+    bsdiff_off_t value = 0;
 
     value = buf[7] & 0x7F;
     value *= 256;  value += buf[6];
@@ -62,13 +101,12 @@ int bsdiff_ReadOffset(unsigned char buf[8])
     if (buf[7] & 0x80)
         value = -value;
 
-    assert(value >= INT_MIN && value <= INT_MAX);  // 当前实现中应该在int范围之内
-    return (int)value;
+    return value;
 }
 
-void bsdiff_WriteOffset(int offset, unsigned char buf[8])
+void bsdiff_WriteOffset(bsdiff_off_t offset, unsigned char buf[8])
 {
-    long long value = offset;
+    bsdiff_off_t value = offset;
 
     if (offset < 0)
         value = -value;
@@ -86,6 +124,58 @@ void bsdiff_WriteOffset(int offset, unsigned char buf[8])
         buf[7] |= 0x80;
 }
 
+unsigned long long bsdiff_ReadHash(const unsigned char buf[8])
+{
+    unsigned long long hash = 0;
+    int i;
+
+    for (i = 7; i >= 0; --i)
+        hash = (hash << 8) | buf[i];
+    return hash;
+}
+
+void bsdiff_WriteHash(unsigned long long hash, unsigned char buf[8])
+{
+    int i;
+
+    for (i = 0; i < 8; ++i) {
+        buf[i] = (unsigned char)(hash & 0xFF);
+        hash >>= 8;
+    }
+}
+
+void* bsdiff_Alloc(const bsdiff_allocator *allocator, size_t size)
+{
+    if (allocator)
+        return allocator->alloc(allocator->opaque, size);
+    return malloc(size);
+}
+
+void bsdiff_Free(const bsdiff_allocator *allocator, void *ptr)
+{
+    if (!ptr)
+        return;
+    if (allocator)
+        allocator->free(allocator->opaque, ptr);
+    else
+        free(ptr);
+}
+
+void* bsdiff_BzAlloc(void *opaque, int n, int m)
+{
+    return bsdiff_Alloc((const bsdiff_allocator*)opaque, (size_t)n * (size_t)m);
+}
+
+void bsdiff_BzFree(void *opaque, void *ptr)
+{
+    bsdiff_Free((const bsdiff_allocator*)opaque, ptr);
+}
+
+int bsdiff_FileSink(void *opaque, const void *data, size_t len)
+{
+    return bsdiff_WriteFile((FILE*)opaque, (const unsigned char*)data, len);
+}
+
 void bsdiff_SetError(char error[64], const char *str)
 {
     int i;
@@ -101,3 +191,342 @@ void bsdiff_SetError(char error[64], const char *str)
 }
 
 //------------------------------------------------------------------------------
+
+int bsdiff_MapFile(const char *path, bsdiff_mapping *map)
+{
+#ifdef _WIN32
+    HANDLE file, mapping;
+    LARGE_INTEGER size;
+    void *data;
+
+    memset(map, 0, sizeof(bsdiff_mapping));
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return 0;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 || (unsigned long long)size.QuadPart > (size_t)-1) {
+        CloseHandle(file);
+        return 0;
+    }
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        CloseHandle(file);
+        return 0;
+    }
+    data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return 0;
+    }
+    map->data = (const unsigned char*)data;
+    map->size = (size_t)size.QuadPart;
+    map->fileHandle = file;
+    map->mappingHandle = mapping;
+    return 1;
+#else
+    struct stat st;
+    void *data;
+    int fd;
+
+    memset(map, 0, sizeof(bsdiff_mapping));
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || (unsigned long long)st.st_size > (size_t)-1) {
+        close(fd);
+        return 0;
+    }
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  // 映射建立以后可以关闭fd
+    if (data == MAP_FAILED)
+        return 0;
+    map->data = (const unsigned char*)data;
+    map->size = (size_t)st.st_size;
+    return 1;
+#endif
+}
+
+void bsdiff_UnmapFile(bsdiff_mapping *map)
+{
+    if (!map->data)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(map->data);
+    CloseHandle((HANDLE)map->mappingHandle);
+    CloseHandle((HANDLE)map->fileHandle);
+#else
+    munmap((void*)map->data, map->size);
+#endif
+    memset(map, 0, sizeof(bsdiff_mapping));
+}
+
+static void setFileError(char error[64], const char *format, const char *name)
+{
+    char str[64];
+
+    if (strlen(format) + strlen(name) < sizeof(str)) {
+        sprintf(str, format, name);
+        bsdiff_SetError(error, str);
+    } else {
+        bsdiff_SetError(error, format);
+    }
+}
+
+int bsdiff_LoadFile(const char *path, int useMapping, bsdiff_filedata *file, const char *name, char error[64])
+{
+    FILE *fp;
+
+    memset(file, 0, sizeof(bsdiff_filedata));
+
+    // 映射不会复制数据，多个进程同时打开同一个文件时还可以共享物理页
+    if (useMapping && bsdiff_MapFile(path, &file->map)) {
+        file->data = file->map.data;
+        file->size = (bsdiff_off_t)file->map.size;
+        return 1;
+    }
+
+    // 退回到读入malloc的buffer（空文件也走这里）
+    if (!(fp = fopen(path, "rb")) || !bsdiff_GetFileSize(fp, &file->size)) {
+        setFileError(error, "Can't open %s", name);
+        goto MyError;
+    }
+    if ((unsigned long long)file->size >= (size_t)-1) {
+        setFileError(error, "%s too large", name);
+        goto MyError;
+    }
+    if (!(file->buf = (unsigned char*)malloc((size_t)file->size + 1))) {  // size可能为0
+        bsdiff_SetError(error, "Out of memory");
+        goto MyError;
+    }
+    if (!bsdiff_ReadFile(fp, file->buf, (size_t)file->size)) {
+        setFileError(error, "Can't read %s", name);
+        goto MyError;
+    }
+    fclose(fp);
+    file->data = file->buf;
+    return 1;
+
+MyError:
+    if (fp)
+        fclose(fp);
+    free(file->buf);
+    memset(file, 0, sizeof(bsdiff_filedata));
+    return 0;
+}
+
+void bsdiff_FreeFile(bsdiff_filedata *file)
+{
+    bsdiff_UnmapFile(&file->map);
+    free(file->buf);
+    memset(file, 0, sizeof(bsdiff_filedata));
+}
+
+int bsdiff_RenameFile(const char *from, const char *to)
+{
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) ? 1 : 0;
+#else
+    return rename(from, to) == 0;
+#endif
+}
+
+int bsdiff_TruncateFile(FILE *fp, bsdiff_off_t size)
+{
+#ifdef _WIN32
+    if (fflush(fp))
+        return 0;
+    if (GetFileType((HANDLE)_get_osfhandle(_fileno(fp))) != FILE_TYPE_DISK)
+        return 1;
+    return _chsize_s(_fileno(fp), size) == 0;
+#else
+    struct stat st;
+
+    if (fflush(fp) || fstat(fileno(fp), &st))
+        return 0;
+    if (!S_ISREG(st.st_mode))
+        return 1;
+    return ftruncate(fileno(fp), (off_t)size) == 0;
+#endif
+}
+
+int bsdiff_GetProcessId(void)
+{
+#ifdef _WIN32
+    return _getpid();
+#else
+    return (int)getpid();
+#endif
+}
+
+int bsdiff_ListDir(const char *path, bsdiff_dir_fn fn, void *opaque)
+{
+    int ok = 1;
+#ifdef _WIN32
+    char *pattern;
+    WIN32_FIND_DATAA wfd;
+    HANDLE findHandle;
+
+    if (!(pattern = (char*)malloc(strlen(path) + 3)))
+        return 0;
+    sprintf(pattern, "%s\\*", path);
+    findHandle = FindFirstFileA(pattern, &wfd);
+    free(pattern);
+    if (findHandle == INVALID_HANDLE_VALUE)
+        return 0;
+    do {
+        if (strcmp(wfd.cFileName, ".") == 0 || strcmp(wfd.cFileName, "..") == 0)
+            continue;
+        ok = fn(opaque, wfd.cFileName, (wfd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0,
+                ((bsdiff_off_t)wfd.nFileSizeHigh << 32) | wfd.nFileSizeLow);
+    } while (ok && FindNextFileA(findHandle, &wfd));
+    FindClose(findHandle);
+#else
+    DIR *dir;
+    struct dirent *entry;
+    struct stat st;
+    char *full = NULL, *p;
+    size_t pathLen = strlen(path), capacity = 0, n;
+
+    if (!(dir = opendir(path)))
+        return 0;
+    while (ok && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        // 用stat而不是d_type，符号链接按它指向的对象处理
+        n = pathLen + strlen(entry->d_name) + 2;
+        if (n > capacity) {
+            if (!(p = (char*)realloc(full, n))) {
+                ok = 0;
+                break;
+            }
+            full = p;
+            capacity = n;
+        }
+        sprintf(full, "%s/%s", path, entry->d_name);
+        if (stat(full, &st) != 0)
+            continue;
+        ok = fn(opaque, entry->d_name, S_ISDIR(st.st_mode), (bsdiff_off_t)st.st_size);
+    }
+    free(full);
+    closedir(dir);
+#endif
+    return ok;
+}
+
+int bsdiff_MakeDir(const char *path)
+{
+#ifdef _WIN32
+    return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    return mkdir(path, 0777) == 0 || errno == EEXIST;
+#endif
+}
+
+int bsdiff_CopyFile(const char *from, const char *to)
+{
+#ifdef _WIN32
+    return CopyFileA(from, to, FALSE) ? 1 : 0;
+#else
+    FILE *in, *out;
+    unsigned char buf[64 * 1024];
+    size_t n;
+    int ok = 1;
+
+    if (!(in = fopen(from, "rb")))
+        return 0;
+    if (!(out = fopen(to, "wb"))) {
+        fclose(in);
+        return 0;
+    }
+    while (ok && (n = fread(buf, 1, sizeof(buf), in)) > 0)
+        ok = fwrite(buf, 1, n, out) == n;
+    ok = ok && !ferror(in);
+    fclose(in);
+    return fclose(out) == 0 && ok;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+double bsdiff_Now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+const char* bsdiff_PhaseName(int phase)
+{
+    static const char *names[BSDIFF_PHASE_COUNT] = {
+        "read", "sort", "scan", "ctrl", "diff", "extra", "apply", "write"
+    };
+    return phase >= 0 && phase < BSDIFF_PHASE_COUNT ? names[phase] : "?";
+}
+
+void bsdiff_MonitorInit(bsdiff_monitor *monitor, bsdiff_stats *stats, bsdiff_progress_fn progress, void *opaque)
+{
+    monitor->stats = stats;
+    monitor->progress = progress;
+    monitor->opaque = opaque;
+    monitor->cancelled = 0;
+    if (stats)
+        memset(stats, 0, sizeof(bsdiff_stats));
+    monitor->start = bsdiff_MonitorClock(monitor);
+}
+
+int bsdiff_MonitorReport(bsdiff_monitor *monitor, int phase, unsigned long long done, unsigned long long total)
+{
+    if (!monitor->cancelled && monitor->progress && !monitor->progress(monitor->opaque, phase, done, total))
+        monitor->cancelled = 1;
+    return !monitor->cancelled;
+}
+
+double bsdiff_MonitorClock(const bsdiff_monitor *monitor)
+{
+    return monitor->stats ? bsdiff_Now() : 0;
+}
+
+void bsdiff_MonitorAdd(bsdiff_monitor *monitor, int phase, double start, unsigned long long bytes)
+{
+    if (monitor->stats) {
+        monitor->stats->phases[phase].seconds += bsdiff_Now() - start;
+        monitor->stats->phases[phase].bytes += bytes;
+    }
+}
+
+void bsdiff_MonitorFinish(bsdiff_monitor *monitor)
+{
+    if (monitor->stats)
+        monitor->stats->seconds += bsdiff_Now() - monitor->start;
+}
+
+void bsdiff_PrintStats(const bsdiff_stats *stats)
+{
+    const bsdiff_phase_stats *p;
+    int i;
+
+    for (i = 0; i < BSDIFF_PHASE_COUNT; ++i) {
+        p = &stats->phases[i];
+        if (p->seconds <= 0 && p->bytes == 0)
+            continue;
+        printf("  %-6s %9.3f s %14llu bytes", bsdiff_PhaseName(i), p->seconds, p->bytes);
+        if (p->seconds > 0 && p->bytes > 0)
+            printf(" %9.1f MB/s", p->bytes / p->seconds / (1024 * 1024));
+        printf("\n");
+    }
+    printf("  total  %9.3f s\n", stats->seconds);
+    printf("  %llu ctrls, %llu diff bytes, %llu extra bytes\n", 
+        stats->numCtrls, stats->diffBytes, stats->extraBytes);
+    printf("  blocks: ctrl %llu, diff %llu, extra %llu bytes\n", 
+        stats->ctrlSize, stats->diffSize, stats->extraSize);
+}
+
+//------------------------------------------------------------------------------
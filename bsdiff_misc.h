@@ -2,9 +2,13 @@
 #define __BSDIFF_MISC_H__
 
 #include <stdio.h>
+#include "bsdiff_types.h"
 
 //------------------------------------------------------------------------------
 
+// 文件尺寸和文件内的偏移，一律用64位表示，以支持超过2GB/4GB的文件
+typedef long long bsdiff_off_t;
+
 int bsdiff_ReadFile(
     FILE *fp, 
     unsigned char *buf, 
@@ -19,18 +23,69 @@ int bsdiff_WriteFile(
 
 int bsdiff_GetFileSize(
     FILE *fp, 
-    int *fileSize
+    bsdiff_off_t *fileSize
     );
 
-int bsdiff_ReadOffset(
-    unsigned char buf[8]
+// 64位的fseek/ftell（MSVC的fseek/ftell只有32位）
+int bsdiff_Seek(
+    FILE *fp, 
+    bsdiff_off_t offset, 
+    int origin
+    );
+
+bsdiff_off_t bsdiff_Tell(
+    FILE *fp
+    );
+
+bsdiff_off_t bsdiff_ReadOffset(
+    const unsigned char buf[8]
     );
 
 void bsdiff_WriteOffset(
-    int offset,
+    bsdiff_off_t offset,
     unsigned char buf[8]
     );
 
+// 校验和等无符号的64位数，低位在前；不用bsdiff_WriteOffset的符号位格式
+unsigned long long bsdiff_ReadHash(
+    const unsigned char buf[8]
+    );
+
+void bsdiff_WriteHash(
+    unsigned long long hash,
+    unsigned char buf[8]
+    );
+
+// 从allocator分配/释放内存，allocator为NULL时使用malloc/free
+void* bsdiff_Alloc(
+    const bsdiff_allocator *allocator,
+    size_t size
+    );
+
+void bsdiff_Free(
+    const bsdiff_allocator *allocator,
+    void *ptr
+    );
+
+// 供bz_stream.bzalloc/bzfree使用的适配函数，opaque为bsdiff_allocator（可以为NULL）
+void* bsdiff_BzAlloc(
+    void *opaque,
+    int n,
+    int m
+    );
+
+void bsdiff_BzFree(
+    void *opaque,
+    void *ptr
+    );
+
+// bsdiff_write_fn的实现，把输出写到opaque指定的FILE中
+int bsdiff_FileSink(
+    void *opaque,
+    const void *data,
+    size_t len
+    );
+
 void bsdiff_SetError(
     char error[64], 
     const char *str
@@ -38,4 +93,151 @@ void bsdiff_SetError(
 
 //------------------------------------------------------------------------------
 
+// 只读的文件映射
+typedef struct bsdiff_mapping {
+    const unsigned char *data;
+    size_t size;
+    void *fileHandle;       // Win32: HANDLE
+    void *mappingHandle;    // Win32: HANDLE
+} bsdiff_mapping;
+
+// 把整个文件只读地映射到内存，失败（或文件为空）时返回0
+int bsdiff_MapFile(
+    const char *path,
+    bsdiff_mapping *map
+    );
+
+void bsdiff_UnmapFile(
+    bsdiff_mapping *map
+    );
+
+// 只读的整个文件内容：优先映射到内存，映射失败时退回到malloc + bsdiff_ReadFile
+typedef struct bsdiff_filedata {
+    const unsigned char *data;  // 文件内容，文件为空时也不为NULL
+    bsdiff_off_t size;
+    bsdiff_mapping map;         // 映射成功时使用
+    unsigned char *buf;         // 否则是malloc出来的buffer
+} bsdiff_filedata;
+
+// useMapping为0时不尝试映射；name用于生成错误信息，如"oldFile"
+int bsdiff_LoadFile(
+    const char *path,
+    int useMapping,
+    bsdiff_filedata *file,
+    const char *name,
+    char error[64]
+    );
+
+void bsdiff_FreeFile(
+    bsdiff_filedata *file
+    );
+
+// 把from改名为to，to已存在时覆盖
+int bsdiff_RenameFile(
+    const char *from,
+    const char *to
+    );
+
+// 把fp截断为size字节；不是普通文件（如块设备）时什么也不做
+int bsdiff_TruncateFile(
+    FILE *fp,
+    bsdiff_off_t size
+    );
+
+// 当前进程ID，用于生成不冲突的临时文件名
+int bsdiff_GetProcessId(void);
+
+// 路径分隔符
+#ifdef _WIN32
+  #define BSDIFF_PATH_SEP  '\\'
+#else
+  #define BSDIFF_PATH_SEP  '/'
+#endif
+
+// 目录中的一项，size只对文件有意义
+typedef int (*bsdiff_dir_fn)(
+    void *opaque,
+    const char *name,
+    int isDir,
+    bsdiff_off_t size
+    );
+
+// 对目录path中的每一项（不含.和..）调用fn，fn返回0时停止并返回0；打不开目录时也返回0
+int bsdiff_ListDir(
+    const char *path,
+    bsdiff_dir_fn fn,
+    void *opaque
+    );
+
+// 创建目录，已经存在时也算成功
+int bsdiff_MakeDir(
+    const char *path
+    );
+
+// 复制文件，to已存在时覆盖
+int bsdiff_CopyFile(
+    const char *from,
+    const char *to
+    );
+
+//------------------------------------------------------------------------------
+
+// 单调时钟，单位为秒
+double bsdiff_Now(void);
+
+// BSDIFF_PHASE_xxx的名字，如"sort"
+const char* bsdiff_PhaseName(
+    int phase
+    );
+
+// 统计和进度回调的辅助：stats为NULL时不计时，progress为NULL时不报告
+typedef struct bsdiff_monitor {
+    bsdiff_stats *stats;
+    bsdiff_progress_fn progress;
+    void *opaque;
+    double start;
+    int cancelled;              // progress返回过0
+} bsdiff_monitor;
+
+// 清零stats并开始计时
+void bsdiff_MonitorInit(
+    bsdiff_monitor *monitor,
+    bsdiff_stats *stats,
+    bsdiff_progress_fn progress,
+    void *opaque
+    );
+
+// 报告进度，返回0表示已经被取消
+int bsdiff_MonitorReport(
+    bsdiff_monitor *monitor,
+    int phase,
+    unsigned long long done,
+    unsigned long long total
+    );
+
+// 计时的起点，不计时的时候返回0
+double bsdiff_MonitorClock(
+    const bsdiff_monitor *monitor
+    );
+
+// 把从start（bsdiff_MonitorClock的返回值）到现在的时间和bytes记到phase上
+void bsdiff_MonitorAdd(
+    bsdiff_monitor *monitor,
+    int phase,
+    double start,
+    unsigned long long bytes
+    );
+
+// 结束计时，记下总耗时
+void bsdiff_MonitorFinish(
+    bsdiff_monitor *monitor
+    );
+
+// 把stats打印到stdout（命令行的-v），只列出有耗时或有数据的阶段
+void bsdiff_PrintStats(
+    const bsdiff_stats *stats
+    );
+
+//------------------------------------------------------------------------------
+
 #endif // !__BSDIFF_MISC_H__
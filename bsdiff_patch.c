@@ -1,165 +1,456 @@
 #include "bsdiff_patch.h"
 #include "bsdiff_misc.h"
+#include "bsdiff_reader.h"
+#include "bsdiff_format.h"
+#include "bsdiff_filter.h"
+#include "bsdiff_simd.h"
+#include "bsdiff_ctx.h"
+#include "bsdiff_hash.h"
 #include <stdlib.h>
 #include <stdio.h>
-#include "bzlib.h"
+#include <string.h>
 
 //------------------------------------------------------------------------------
 
-int bsdiff_patch(const char *oldFile, const char *patchFile, const char *newFile, char error[64])
+#define DEFAULT_WINDOW_SIZE  (1024 * 1024)
+
+void bsdiff_patch_options_init(bsdiff_patch_options *options)
+{
+    options->windowSize = DEFAULT_WINDOW_SIZE;
+    options->smallDecompress = 0;
+    options->useMapping = 1;
+    options->numThreads = 1;
+    options->pipeline = 0;
+    options->stats = NULL;
+    options->progress = NULL;
+    options->progressOpaque = NULL;
+}
+
+// Ѿwrittenֽڣϴα泬stepֽʱһAPPLYĽȣȡʱ0
+static int reportProgress(bsdiff_monitor *monitor, bsdiff_off_t written, bsdiff_off_t total, 
+                          bsdiff_off_t step, bsdiff_off_t *nextReport)
+{
+    if (written < *nextReport)
+        return 1;
+    *nextReport = written + step;
+    return bsdiff_MonitorReport(monitor, BSDIFF_PHASE_APPLY, written, total);
+}
+
+// ʹ˹patchȰnewFileռڴУԺ
+typedef struct bufferSink {
+    unsigned char *data;
+    size_t size, capacity;
+} bufferSink;
+
+static int bufferWrite(void *opaque, const void *data, size_t len)
+{
+    bufferSink *sink = (bufferSink*)opaque;
+
+    if (len > sink->capacity - sink->size)
+        return 0;
+    memcpy(sink->data + sink->size, data, len);
+    sink->size += len;
+    return 1;
+}
+
+// һpoolΪNULLʱpool첽дˮߣapplyѭͬʱһslotwindow׼һΣ
+// ͬһʱֻһд˳СÿslotԼoldWindowΪֱָoldWindow
+// poolΪNULLʱֻһslotڵ߳ед
+#define WRITE_SLOTS  2
+
+typedef struct writeSlot {
+    struct asyncWriter *owner;
+    unsigned char *window, *oldWindow;
+    const unsigned char *data;
+    size_t len;
+    int busy;                   // дowner->mutex
+} writeSlot;
+
+typedef struct asyncWriter {
+    bsdiff_write_fn write;
+    void *opaque;
+    bsdiff_pool *pool;
+    bsdiff_monitor *monitor;    // WRITEֻд߳мʱ
+    writeSlot slots[WRITE_SLOTS];
+    int numSlots, current;
+    int failed;                 // mutex
+    bsdiff_mutex mutex;
+    bsdiff_cond cond;
+} asyncWriter;
+
+static void writeTask(void *arg)
+{
+    writeSlot *slot = (writeSlot*)arg;
+    asyncWriter *w = slot->owner;
+    double clock = bsdiff_MonitorClock(w->monitor);
+    int ok = w->write(w->opaque, slot->data, slot->len);
+
+    bsdiff_MonitorAdd(w->monitor, BSDIFF_PHASE_WRITE, clock, slot->len);
+    bsdiff_MutexLock(&w->mutex);
+    if (!ok)
+        w->failed = 1;
+    slot->busy = 0;
+    bsdiff_CondBroadcast(&w->cond);
+    bsdiff_MutexUnlock(&w->mutex);
+}
+
+// ÿslotwindowSizewindowwithOld0ʱoldWindow
+static int writerInit(asyncWriter *w, bsdiff_write_fn write, void *opaque, bsdiff_pool *pool, 
+                      bsdiff_monitor *monitor, size_t windowSize, int withOld, const bsdiff_allocator *allocator)
+{
+    int i;
+
+    memset(w, 0, sizeof(asyncWriter));
+    w->write = write;
+    w->opaque = opaque;
+    w->pool = pool;
+    w->monitor = monitor;
+    w->numSlots = pool ? WRITE_SLOTS : 1;
+    bsdiff_MutexInit(&w->mutex);
+    bsdiff_CondInit(&w->cond);
+    for (i = 0; i < w->numSlots; ++i) {
+        w->slots[i].owner = w;
+        if (!(w->slots[i].window = (unsigned char*)bsdiff_Alloc(allocator, windowSize)) ||
+            (withOld && !(w->slots[i].oldWindow = (unsigned char*)bsdiff_Alloc(allocator, windowSize))))
+            return 0;
+    }
+    return 1;
+}
+
+// едһʧʱ0
+static int writerFlush(asyncWriter *w)
+{
+    int ok;
+
+    bsdiff_MutexLock(&w->mutex);
+    while (w->slots[0].busy || w->slots[1].busy)
+        bsdiff_CondWait(&w->cond, &w->mutex);
+    ok = !w->failed;
+    bsdiff_MutexUnlock(&w->mutex);
+    return ok;
+}
+
+// дǰslotеdataָwindowoldWindowڴеoldȻ󻻵һslot
+// һεд֮ǰдʧʱ0
+static int writerPut(asyncWriter *w, const unsigned char *data, size_t len)
+{
+    writeSlot *slot = &w->slots[w->current];
+
+    if (!writerFlush(w))
+        return 0;
+    slot->data = data;
+    slot->len = len;
+    slot->busy = 1;
+    bsdiff_PoolSubmit(w->pool, writeTask, slot);
+    w->current = (w->current + 1) % w->numSlots;
+    return w->pool || writerFlush(w);
+}
+
+static void writerDestroy(asyncWriter *w, const bsdiff_allocator *allocator)
+{
+    int i;
+
+    writerFlush(w);
+    for (i = 0; i < w->numSlots; ++i) {
+        bsdiff_Free(allocator, w->slots[i].window);
+        bsdiff_Free(allocator, w->slots[i].oldWindow);
+    }
+    bsdiff_MutexDestroy(&w->mutex);
+    bsdiff_CondDestroy(&w->cond);
+}
+
+// ȡУļͷļͷBSDIFF_HEADER_MAXֽڣBSDIFF40patchܱ⻹̣
+static int readHeader(bsdiff_source *patch, bsdiff_header *header, char error[64])
+{
+    unsigned char headerBuf[BSDIFF_HEADER_MAX];
+    bsdiff_off_t headerSize;
+
+    headerSize = patch->size < BSDIFF_HEADER_MAX ? patch->size : BSDIFF_HEADER_MAX;
+    if (!bsdiff_SourceRead(patch, 0, headerBuf, (size_t)headerSize) ||
+        !bsdiff_HeaderRead(headerBuf, (size_t)headerSize, header) ||
+        header->ctrlLen > patch->size - header->size || 
+        header->diffLen > patch->size - header->size - header->ctrlLen) {
+        bsdiff_SetError(error, "Invalid patchFile");
+        return 0;
+    }
+    if (!bsdiff_CodecAvailable(header->ctrlCodec) || !bsdiff_CodecAvailable(header->diffCodec) ||
+        !bsdiff_CodecAvailable(header->extraCodec)) {
+        bsdiff_SetError(error, "Unsupported codec");
+        return 0;
+    }
+    return 1;
+}
+
+// ͬһԴϽѹαֱ꣬ȡpatchļ֣֡patchpoolнѹ
+// ʽpatchα깲*demuxɵڹرαԺͷţ˳ȡ֡
+static int openBlocks(bsdiff_source *patch, const bsdiff_header *header, bsdiff_cursor *control, 
+                      bsdiff_cursor *diff, bsdiff_cursor *extra, bsdiff_demux **demux, bsdiff_pool *pool, 
+                      const bsdiff_allocator *allocator, const bsdiff_patch_options *options)
+{
+    bsdiff_off_t diffStart = header->size + header->ctrlLen;
+    bsdiff_off_t extraStart = diffStart + header->diffLen;
+    int framed = (header->flags & BSDIFF_FLAG_FRAMED) != 0;
+
+    if (header->flags & BSDIFF_FLAG_STREAM) {
+        return (*demux = bsdiff_DemuxOpen(patch, header->size, allocator)) != NULL &&
+               bsdiff_CursorOpenStream(control, *demux, 0, header->ctrlCodec, options->smallDecompress, allocator) &&
+               bsdiff_CursorOpenStream(diff, *demux, 1, header->diffCodec, options->smallDecompress, allocator) &&
+               bsdiff_CursorOpenStream(extra, *demux, 2, header->extraCodec, options->smallDecompress, allocator);
+    }
+    return bsdiff_CursorOpen(control, patch, header->size, diffStart, header->ctrlCodec, 
+                             options->smallDecompress, framed, pool, allocator) &&
+           bsdiff_CursorOpen(diff, patch, diffStart, extraStart, header->diffCodec, 
+                             options->smallDecompress, framed, pool, allocator) &&
+           bsdiff_CursorOpen(extra, patch, extraStart, patch->size, header->extraCodec, 
+                             options->smallDecompress, framed, pool, allocator);
+}
+
+// oldpatchԴnewFileνwrite
+// sharedPoolΪNULLʱʹ̳߳أbsdiff_ctxoptions->numThreads
+static int patchCore(bsdiff_source *oldSrc, bsdiff_source *patch, bsdiff_write_fn write, void *opaque,
+                     const bsdiff_allocator *allocator, bsdiff_pool *sharedPool, 
+                     const bsdiff_patch_options *options, char error[64])
 {
     int retCode = 0;
-    unsigned char header[32];
-    FILE *fp = NULL, *fpControl = NULL, *fpDiff = NULL, *fpExtra = NULL;
-    BZFILE *bfpControl = NULL, *bfpDiff = NULL, *bfpExtra = NULL;
-    unsigned char *oldFileBuf = NULL, *newFileBuf = NULL;
-    int controlBlockSize, diffBlockSize, newFileSize, oldFileSize;
-    int oldPos, newPos;
-    int bzError, bzReaded;
-    int i, cb, ctrl[3];
+    bsdiff_header header;
+    bsdiff_cursor control, diff, extra;
+    bsdiff_demux *demux = NULL;
+    bsdiff_zrle zrle;
+    bsdiff_pool *pool = NULL;
+    int zeroRuns;
+    asyncWriter writer;
+    int haveWriter = 0;
+    unsigned char *window, *oldWindow, *filteredOld = NULL;
+    const unsigned char *old, *out;
+    bsdiff_off_t windowSize;
+    bsdiff_off_t controlBlockSize, diffBlockSize, newFileSize, oldFileSize;
+    bsdiff_off_t oldPos, newPos;
+    bsdiff_off_t n, cb, done, ctrl[3];
     unsigned char temp[24];
+    bsdiff_monitor monitor;
+    bsdiff_stats *stats = options->stats;
+    bsdiff_off_t nextReport;
+    double clock;
+    bsdiff_source filteredSrc;
+    bufferSink sink;
+    bsdiff_write_fn finalWrite = write;
+    void *finalOpaque = opaque;
+    int checksum;
+    bsdiff_xxh64 oldHash, newHash;
+    unsigned long long newChecksum;
 
-    /* ļʽ£
+    /* ļʽ£ļͷϸڼbsdiff_format.h
        offset  len
-        0       8   --> "BSDIFF40"
-        8       8   --> X, length of the bzip2(control block)
-        16      8   --> Y, length of the bzip2(diff block)
-        24      8   --> newfile size
-        32      X   --> bzip2(control block)
-        32+X    Y   --> bzip2(diff block)
-        32+X+Y  ?   --> bzip2(extra block)
+        0       H   --> header, H = 32 (BSDIFF40) or 40/56 (BSDIFF41)
+        H       X   --> compressed(control block)
+        H+X     Y   --> compressed(diff block)
+        H+X+Y   ?   --> compressed(extra block)
+
+        BSDIFF40blockbzip2BSDIFF41ļͷм¼˸blockcodec
 
         control blockһϵе3Ԫ(x,y,z)xyzΪ8ֽڵ޷京Ϊ
         add x bytes from oldfile to x bytes from the diff block;
         copy y bytes from the extra block;
         seek forwards in oldfile by z bytes;
 
-       ƣ
-       ڵǰʵУһԷڴbufferķʽ32λ̵2GBûַ̬ռƣ
-       ޷2GBbuffer汾вִ֧2GBļ
+       ߴƫƶ64λ
+       ʽģdiff/extraÿѹwindowSizeֽڣoldڴУȡȡöӦֽڣ
+       ͽwrite˷ֵڴֻwindowSizeԼbzip2Ľѹ״̬йأļС޹ء
+       ֡patchBSDIFF_FLAG_FRAMEDnumThreads߳ǰѹ֡ÿ߳ռ֡ڴ档
+       ˮߣoptions->pipelineʱδ֡Ҳ̳߳ǰѹ̳߳첽д
+       ѹӷдص
+       diff blockγ̱루BSDIFF_FLAG_ZRLEʱ0ĲֱӸoldֻֽӷ
+       ļͷУͣBSDIFF_FLAG_CHECKSUMʱoldnewFileXXH64ÿݴʱ˳㣬
+       ܱȽϣԲһʱnewFileѾwriteˣʧܱʾЩϡ
     */
 
-    // patchļȡУļͷ
-    fp = fopen(patchFile, "rb");
-    if (!fp) {
-        bsdiff_SetError(error, "Can't open patchFile");
-        goto MyExit;
-    }
-    if (!bsdiff_ReadFile(fp, header, 32)) {
-        bsdiff_SetError(error, "Invalid patchFile");
-        goto MyExit;
-    }
-    if (memcmp(header, "BSDIFF40", 8) != 0) {
-        bsdiff_SetError(error, "Invalid patchFile");
-        goto MyExit;
-    }
-    controlBlockSize = bsdiff_ReadOffset(header + 8);
-    diffBlockSize = bsdiff_ReadOffset(header + 16);
-    newFileSize = bsdiff_ReadOffset(header + 24);
-    if (controlBlockSize < 0 || diffBlockSize < 0 || newFileSize < 0) {
-        bsdiff_SetError(error, "Invalid patchFile");
-        goto MyExit;
-    }
+    windowSize = options->windowSize > 0 ? (bsdiff_off_t)options->windowSize : DEFAULT_WINDOW_SIZE;
+    bsdiff_MonitorInit(&monitor, stats, options->progress, options->progressOpaque);
+    memset(&control, 0, sizeof(control));
+    memset(&diff, 0, sizeof(diff));
+    memset(&extra, 0, sizeof(extra));
+    memset(&sink, 0, sizeof(sink));
 
-    // BZ2ļֱȡpatchļ
-    fpControl = fp;  // fpposӦøպþ32
-    fp = NULL;
-    bfpControl = BZ2_bzReadOpen(&bzError, fpControl, 0, 0, NULL, 0);
-    if (!bfpControl) {
-        bsdiff_SetError(error, "Invalid patchFile");
+    if (!readHeader(patch, &header, error))
         goto MyExit;
-    }
+    controlBlockSize = header.ctrlLen;
+    diffBlockSize = header.diffLen;
+    newFileSize = header.newSize;
 
-    if (!(fpDiff = fopen(patchFile, "rb")) || fseek(fpDiff, 32 + controlBlockSize, SEEK_SET)) {
-        bsdiff_SetError(error, "Invalid patchFile");
-        goto MyExit;
-    }
-    bfpDiff = BZ2_bzReadOpen(&bzError, fpDiff, 0, 0, NULL, 0);
-    if (!bfpDiff) {
-        bsdiff_SetError(error, "Invalid patchFile");
+    // ͵patchǰnewFile˳еģʽ
+    if (header.flags & BSDIFF_FLAG_INPLACE) {
+        bsdiff_SetError(error, "In-place patch");
         goto MyExit;
     }
 
-    if (!(fpExtra = fopen(patchFile, "rb")) || fseek(fpExtra, 32 + controlBlockSize + diffBlockSize, SEEK_SET)) {
-        bsdiff_SetError(error, "Invalid patchFile");
-        goto MyExit;
-    }
-    bfpExtra = BZ2_bzReadOpen(&bzError, fpExtra, 0, 0, NULL, 0);
-    if (!bfpDiff) {
-        bsdiff_SetError(error, "Invalid patchFile");
-        goto MyExit;
+    // ʹ˹patch˺oldڴΪԴnewFileռsink
+    if (header.filter != BSDIFF_FILTER_NONE) {
+        if ((bsdiff_off_t)(size_t)oldSrc->size != oldSrc->size || (bsdiff_off_t)(size_t)newFileSize != newFileSize ||
+            !(filteredOld = (unsigned char*)bsdiff_Alloc(allocator, (size_t)oldSrc->size + 1)) ||
+            !(sink.data = (unsigned char*)bsdiff_Alloc(allocator, (size_t)newFileSize + 1))) {
+            bsdiff_SetError(error, "Out of memory");
+            goto MyExit;
+        }
+        if (oldSrc->size > 0 && !bsdiff_SourceRead(oldSrc, 0, filteredOld, (size_t)oldSrc->size)) {
+            bsdiff_SetError(error, "Failed to read oldFile");
+            goto MyExit;
+        }
+        bsdiff_FilterApply(header.filter, filteredOld, (size_t)oldSrc->size, 1);
+        bsdiff_SourceOpenMemory(&filteredSrc, filteredOld, (size_t)oldSrc->size);
+        oldSrc = &filteredSrc;
+        sink.capacity = (size_t)newFileSize;
+        write = bufferWrite;
+        opaque = &sink;
     }
 
-    // ȡoldFileݵoldFileBuf
-    if (!(fp = fopen(oldFile, "rb")) || !bsdiff_GetFileSize(fp, &oldFileSize)) {
-        bsdiff_SetError(error, "Can't open oldFile");
-        goto MyExit;
-    }
-    oldFileBuf = (unsigned char*)malloc(oldFileSize + 1);  // oldFileSizeΪ0
-    if (!oldFileBuf) {
-        bsdiff_SetError(error, "Out of memory");
+    if ((header.flags & BSDIFF_FLAG_FRAMED) || options->pipeline)
+        pool = sharedPool ? sharedPool : bsdiff_PoolCreate(options->numThreads);
+    if (!openBlocks(patch, &header, &control, &diff, &extra, &demux, pool, allocator, options)) {
+        bsdiff_SetError(error, "Invalid patchFile");
         goto MyExit;
     }
-    if (!bsdiff_ReadFile(fp, oldFileBuf, oldFileSize)) {
-        bsdiff_SetError(error, "Failed to read oldFile");
-        goto MyExit;
+    zeroRuns = (header.flags & BSDIFF_FLAG_ZRLE) != 0;
+    bsdiff_ZrleInit(&zrle, &diff);
+    checksum = (header.flags & BSDIFF_FLAG_CHECKSUM) != 0;
+    bsdiff_Xxh64Init(&oldHash, 0);
+    bsdiff_Xxh64Init(&newHash, 0);
+    oldFileSize = oldSrc->size;
+    if (stats) {
+        stats->ctrlSize = controlBlockSize;
+        stats->diffSize = diffBlockSize;
+        stats->extraSize = patch->size - header.size - controlBlockSize - diffBlockSize;
     }
-    fclose(fp);
-    fp = NULL;
 
-    // newFileBuf
-    newFileBuf = (unsigned char*)malloc(newFileSize + 1);  // newFileSizeΪ0
-    if (!newFileBuf) {
+    // windowdiff/extraݣoldڴʱҪһwindowŶӦoldݡˮʱ
+    haveWriter = 1;
+    if (!writerInit(&writer, write, opaque, options->pipeline ? pool : NULL, &monitor, (size_t)windowSize, 
+                    !oldSrc->data, allocator)) {
         bsdiff_SetError(error, "Out of memory");
         goto MyExit;
     }
 
-    // ʼѭ
+    // ʼѭͳʱ׶ηֱʱߵwriteWRITEУȴԼÿwindowSizeֽڱһ
     oldPos = 0;
     newPos = 0;
+    nextReport = 0;
     while (newPos < newFileSize) {
         // Control data
-        bzReaded = BZ2_bzRead(&bzError, bfpControl, temp, 24);
-        if ((bzError != BZ_OK && bzError != BZ_STREAM_END) || bzReaded != 24) {
+        clock = bsdiff_MonitorClock(&monitor);
+        if (!bsdiff_CursorRead(&control, temp, 24)) {
             bsdiff_SetError(error, "Invalid patchFile");
             goto MyExit;
         }
+        bsdiff_MonitorAdd(&monitor, BSDIFF_PHASE_CTRL, clock, 24);
+        if (stats)
+            ++stats->numCtrls;
         ctrl[0] = bsdiff_ReadOffset(temp);
         ctrl[1] = bsdiff_ReadOffset(temp + 8);
         ctrl[2] = bsdiff_ReadOffset(temp + 16);
         
-        // diffжctrl[0]ֽ
+        // diffжctrl[0]ֽڣļжӦֽڽмӲÿwindowSizeֽ
         if (ctrl[0] < 0 || newPos + ctrl[0] > newFileSize) {
             bsdiff_SetError(error, "Invalid patchFile");
             goto MyExit;
         }
-        bzReaded = BZ2_bzRead(&bzError, bfpDiff, newFileBuf + newPos, ctrl[0]);
-        if ((bzError != BZ_OK && bzError != BZ_STREAM_END) || bzReaded != ctrl[0]) {
-            bsdiff_SetError(error, "Invalid patchFile");
-            goto MyExit;
-        }
+        for (done = 0; done < ctrl[0]; done += n) {
+            n = ctrl[0] - done < windowSize ? ctrl[0] - done : windowSize;
+            window = writer.slots[writer.current].window;
+            oldWindow = writer.slots[writer.current].oldWindow;
+
+            // oldFileĩβĲֲӷ
+            cb = oldFileSize - (oldPos + done);
+            if (cb > n)
+                cb = n;
+            old = NULL;
+            if (cb > 0) {
+                if (oldSrc->data) {
+                    old = oldSrc->data + oldPos + done;
+                } else if (bsdiff_SourceRead(oldSrc, oldPos + done, oldWindow, (size_t)cb)) {
+                    old = oldWindow;
+                } else {
+                    bsdiff_SetError(error, "Failed to read oldFile");
+                    goto MyExit;
+                }
+            } else {
+                cb = 0;
+            }
 
-        // Ӿļжȡctrl[0]ֽڣdiffݽмӲ
-        cb = ctrl[0];
-        if (oldPos + cb > oldFileSize)
-            cb = oldFileSize - oldPos;
-        for (i = 0; i < cb; ++i) {
-            newFileBuf[newPos + i] += oldFileBuf[oldPos + i];
+            // γ̱ʱͼӷһģDIFF
+            out = window;
+            clock = bsdiff_MonitorClock(&monitor);
+            if (zeroRuns) {
+                if (!bsdiff_ZrleRead(&zrle, window, n, old, cb)) {
+                    bsdiff_SetError(error, "Invalid patchFile");
+                    goto MyExit;
+                }
+                bsdiff_MonitorAdd(&monitor, BSDIFF_PHASE_DIFF, clock, n);
+            } else {
+                if (!bsdiff_CursorRead(&diff, window, n)) {
+                    bsdiff_SetError(error, "Invalid patchFile");
+                    goto MyExit;
+                }
+                bsdiff_MonitorAdd(&monitor, BSDIFF_PHASE_DIFF, clock, n);
+                clock = bsdiff_MonitorClock(&monitor);
+                // diffȫΪ0ûб仯ʱnewFileoldֱoldʡӷһθ
+                if (cb == n && bsdiff_ZeroLen(window, (size_t)n) == (size_t)n)
+                    out = old;
+                else if (cb > 0)
+                    bsdiff_AddBytes(window, old, (size_t)cb);
+                bsdiff_MonitorAdd(&monitor, BSDIFF_PHASE_APPLY, clock, n);
+            }
+
+            // oldݶcacheУУ͵ʱAPPLYУʱnewFile
+            if (checksum) {
+                clock = bsdiff_MonitorClock(&monitor);
+                if (cb > 0)
+                    bsdiff_Xxh64Update(&oldHash, old, (size_t)cb);
+                if (header.filter == BSDIFF_FILTER_NONE)
+                    bsdiff_Xxh64Update(&newHash, out, (size_t)n);
+                bsdiff_MonitorAdd(&monitor, BSDIFF_PHASE_APPLY, clock, 0);
+            }
+
+            if (!writerPut(&writer, out, (size_t)n)) {
+                bsdiff_SetError(error, "Failed to write newFile");
+                goto MyExit;
+            }
+            if (!reportProgress(&monitor, newPos + done + n, newFileSize, windowSize, &nextReport)) {
+                bsdiff_SetError(error, "Cancelled");
+                goto MyExit;
+            }
         }
 
         // pos
         newPos += ctrl[0];
         oldPos += ctrl[0];
 
-        // extraжȡctrl[1]ֽ
+        // extraжȡctrl[1]ֽڣԭд
         if (ctrl[1] < 0 || newPos + ctrl[1] > newFileSize) {
             bsdiff_SetError(error, "Invalid patchFile");
             goto MyExit;
         }
-        bzReaded = BZ2_bzRead(&bzError, bfpExtra, newFileBuf + newPos, ctrl[1]);
-        if ((bzError != BZ_OK && bzError != BZ_STREAM_END) || bzReaded != ctrl[1]) {
-            bsdiff_SetError(error, "Invalid patchFile");
-            goto MyExit;
+        for (done = 0; done < ctrl[1]; done += n) {
+            n = ctrl[1] - done < windowSize ? ctrl[1] - done : windowSize;
+            window = writer.slots[writer.current].window;
+            clock = bsdiff_MonitorClock(&monitor);
+            if (!bsdiff_CursorRead(&extra, window, n)) {
+                bsdiff_SetError(error, "Invalid patchFile");
+                goto MyExit;
+            }
+            if (checksum && header.filter == BSDIFF_FILTER_NONE)
+                bsdiff_Xxh64Update(&newHash, window, (size_t)n);
+            bsdiff_MonitorAdd(&monitor, BSDIFF_PHASE_EXTRA, clock, n);
+            if (!writerPut(&writer, window, (size_t)n)) {
+                bsdiff_SetError(error, "Failed to write newFile");
+                goto MyExit;
+            }
+            if (!reportProgress(&monitor, newPos + done + n, newFileSize, windowSize, &nextReport)) {
+                bsdiff_SetError(error, "Cancelled");
+                goto MyExit;
+            }
+        }
+        if (stats) {
+            stats->diffBytes += ctrl[0];
+            stats->extraBytes += ctrl[1];
         }
 
         // pos
@@ -171,39 +462,808 @@ int bsdiff_patch(const char *oldFile, const char *patchFile, const char *newFile
         }
     }
 
-    // newFileBufедnewFile
-    fp = fopen(newFile, "wb");
-    if (!fp) {
-        bsdiff_SetError(error, "Can't open newFile");
+    if (!writerFlush(&writer)) {
+        bsdiff_SetError(error, "Failed to write newFile");
+        goto MyExit;
+    }
+
+    // ʽpatchĸblockĴСҪ֪
+    if (stats && demux) {
+        stats->ctrlSize = bsdiff_DemuxBytes(demux, 0);
+        stats->diffSize = bsdiff_DemuxBytes(demux, 1);
+        stats->extraSize = bsdiff_DemuxBytes(demux, 2);
+    }
+
+    // ռnewFileʱAPPLYУУ֮
+    newChecksum = bsdiff_Xxh64Final(&newHash);
+    if (header.filter != BSDIFF_FILTER_NONE) {
+        clock = bsdiff_MonitorClock(&monitor);
+        bsdiff_FilterApply(header.filter, sink.data, sink.size, 0);
+        if (checksum)
+            newChecksum = bsdiff_Xxh64(sink.data, sink.size, 0);
+        bsdiff_MonitorAdd(&monitor, BSDIFF_PHASE_APPLY, clock, 0);
+    }
+
+    // oldʱnewFileȻҲԣȱold
+    if (checksum && bsdiff_Xxh64Final(&oldHash) != header.oldHash) {
+        bsdiff_SetError(error, "oldFile doesn't match");
+        goto MyExit;
+    }
+    if (checksum && newChecksum != header.newHash) {
+        bsdiff_SetError(error, "newFile doesn't match");
+        goto MyExit;
+    }
+
+    if (header.filter != BSDIFF_FILTER_NONE) {
+        clock = bsdiff_MonitorClock(&monitor);
+        if (!finalWrite(finalOpaque, sink.data, sink.size)) {
+            bsdiff_SetError(error, "Failed to write newFile");
+            goto MyExit;
+        }
+        bsdiff_MonitorAdd(&monitor, BSDIFF_PHASE_WRITE, clock, sink.size);
+    }
+
+    // Done
+    if (!bsdiff_MonitorReport(&monitor, BSDIFF_PHASE_APPLY, newPos, newFileSize)) {
+        bsdiff_SetError(error, "Cancelled");
+        goto MyExit;
+    }
+    retCode = 1;
+
+MyExit:
+    if (haveWriter)
+        writerDestroy(&writer, allocator);
+    bsdiff_Free(allocator, filteredOld);
+    bsdiff_Free(allocator, sink.data);
+    bsdiff_CursorClose(&control);
+    bsdiff_CursorClose(&diff);
+    bsdiff_CursorClose(&extra);
+    bsdiff_DemuxClose(demux);
+    if (pool != sharedPool)
+        bsdiff_PoolDestroy(pool);
+    bsdiff_MonitorFinish(&monitor);
+    return retCode;
+}
+
+// ͵ش򲹶Ķ󣺵ߵһڴ棬Զдʽ򿪵ļ
+typedef struct inplaceTarget {
+    unsigned char *data;
+    FILE *fp;
+} inplaceTarget;
+
+static int targetRead(inplaceTarget *target, bsdiff_off_t pos, unsigned char *buf, size_t len)
+{
+    if (target->data) {
+        memcpy(buf, target->data + pos, len);
+        return 1;
+    }
+    return bsdiff_Seek(target->fp, pos, SEEK_SET) == 0 && bsdiff_ReadFile(target->fp, buf, len);
+}
+
+static int targetWrite(inplaceTarget *target, bsdiff_off_t pos, const unsigned char *buf, size_t len)
+{
+    if (target->data) {
+        memcpy(target->data + pos, buf, len);
+        return 1;
+    }
+    return bsdiff_Seek(target->fp, pos, SEEK_SET) == 0 && bsdiff_WriteFile(target->fp, buf, len);
+}
+
+// targetϾ͵Ӧpatchʽbsdiff_format.htargetԭoldSizeֽڵoldFile
+// ŵcapacityֽڣnewFileĳͨ*newSizeأŲʱҲأ
+// windowݴheaderиĴСͽѹ״̬Ҫڴ棻newFileoldFileʱɵ߽ض
+// ͵patchһǷϷΧҪļݴ֮ڣƵݴǰ棻
+// ֮ÿֽǡдһΣwrittenΪǰѾдֽ
+static int inplaceValid(const bsdiff_header *header, bsdiff_off_t oldSize, bsdiff_off_t written,
+                        bsdiff_off_t newPos, bsdiff_off_t oldPos, bsdiff_off_t len)
+{
+    if (len <= 0)
+        return 0;
+    if (newPos < 0)
+        return written == 0 && oldPos >= 0 && len <= oldSize - oldPos && -1 - newPos <= header->scratchSize - len;
+    return len <= header->newSize - written && len <= header->newSize - newPos &&
+           !(oldPos >= 0 && len > oldSize - oldPos) &&
+           !(oldPos <= -2 && -2 - oldPos > header->scratchSize - len) &&
+           !(oldPos >= 0 && oldPos < newPos && newPos < oldPos + len && len > BSDIFF_INPLACE_PIECE);
+}
+
+/* У͵ľ͵patchڸдļ֮ǰУoldȫ͵patchʽģcontrol block
+   Եִ꣩иƵݴٰ˳мӷҪoldݵXXH64
+   ʱļûжЩݶԭݴеҲǴԭƵģһʱļԭ
+   ɹʱ*ctrlsΪÿ24ֽ */
+static int inplaceCheckOld(inplaceTarget *target, bsdiff_off_t oldSize, const bsdiff_header *header,
+                           bsdiff_cursor *control, unsigned char *buf, bsdiff_off_t windowSize,
+                           unsigned char *scratch, const bsdiff_allocator *allocator, bsdiff_monitor *monitor,
+                           unsigned char **ctrls, size_t *numCtrls, char error[64])
+{
+    unsigned char *temp, *grown;
+    size_t capacity = 0;
+    bsdiff_off_t written, newPos, oldPos, len, done, n;
+    bsdiff_xxh64 oldHash;
+    double clock;
+
+    *ctrls = NULL;
+    *numCtrls = 0;
+    bsdiff_Xxh64Init(&oldHash, 0);
+    for (written = 0; written < header->newSize; ) {
+        if (*numCtrls == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            if (!(grown = (unsigned char*)bsdiff_Alloc(allocator, capacity * 24))) {
+                bsdiff_SetError(error, "Out of memory");
+                goto MyExit;
+            }
+            if (*ctrls)
+                memcpy(grown, *ctrls, *numCtrls * 24);
+            bsdiff_Free(allocator, *ctrls);
+            *ctrls = grown;
+        }
+        temp = *ctrls + *numCtrls * 24;
+        clock = bsdiff_MonitorClock(monitor);
+        if (!bsdiff_CursorRead(control, temp, 24)) {
+            bsdiff_SetError(error, "Invalid patchFile");
+            goto MyExit;
+        }
+        bsdiff_MonitorAdd(monitor, BSDIFF_PHASE_CTRL, clock, 24);
+        ++*numCtrls;
+        newPos = bsdiff_ReadOffset(temp);
+        oldPos = bsdiff_ReadOffset(temp + 8);
+        len = bsdiff_ReadOffset(temp + 16);
+        if (!inplaceValid(header, oldSize, written, newPos, oldPos, len)) {
+            bsdiff_SetError(error, "Invalid patchFile");
+            goto MyExit;
+        }
+        if (newPos < 0) {
+            if (!targetRead(target, oldPos, scratch + (-1 - newPos), (size_t)len)) {
+                bsdiff_SetError(error, "Failed to read oldFile");
+                goto MyExit;
+            }
+            continue;
+        }
+        if (oldPos <= -2)
+            bsdiff_Xxh64Update(&oldHash, scratch + (-2 - oldPos), (size_t)len);
+        for (done = 0; oldPos >= 0 && done < len; done += n) {
+            n = len - done < windowSize ? len - done : windowSize;
+            if (!targetRead(target, oldPos + done, buf, (size_t)n)) {
+                bsdiff_SetError(error, "Failed to read oldFile");
+                goto MyExit;
+            }
+            bsdiff_Xxh64Update(&oldHash, buf, (size_t)n);
+        }
+        written += len;
+    }
+    if (bsdiff_Xxh64Final(&oldHash) != header->oldHash) {
+        bsdiff_SetError(error, "oldFile doesn't match");
+        goto MyExit;
+    }
+    return 1;
+
+MyExit:
+    bsdiff_Free(allocator, *ctrls);
+    *ctrls = NULL;
+    return 0;
+}
+
+static int inplaceCore(inplaceTarget *target, bsdiff_off_t oldSize, bsdiff_off_t capacity, bsdiff_source *patch,
+                       const bsdiff_allocator *allocator, const bsdiff_patch_options *options, 
+                       bsdiff_off_t *newSize, char error[64])
+{
+    int retCode = 0;
+    bsdiff_header header;
+    bsdiff_cursor control, diff, extra;
+    bsdiff_demux *demux = NULL;
+    bsdiff_zrle zrle;
+    bsdiff_pool *pool = NULL;
+    unsigned char *window = NULL, *oldWindow = NULL, *scratch = NULL, *ctrls = NULL;
+    const unsigned char *src;
+    bsdiff_off_t windowSize, written, newPos, oldPos, len, done, n;
+    unsigned char temp[24];
+    size_t numCtrls = 0, k;
+    bsdiff_monitor monitor;
+    bsdiff_stats *stats = options->stats;
+    bsdiff_off_t nextReport;
+    double clock;
+    int checksum;
+    bsdiff_xxh64 newHash;
+
+    // дΧصnewPos > oldPosҪŽwindow
+    windowSize = options->windowSize > 0 ? (bsdiff_off_t)options->windowSize : DEFAULT_WINDOW_SIZE;
+    if (windowSize < BSDIFF_INPLACE_PIECE)
+        windowSize = BSDIFF_INPLACE_PIECE;
+    bsdiff_MonitorInit(&monitor, stats, options->progress, options->progressOpaque);
+    memset(&control, 0, sizeof(control));
+    memset(&diff, 0, sizeof(diff));
+    memset(&extra, 0, sizeof(extra));
+
+    if (!readHeader(patch, &header, error))
+        goto MyExit;
+    if (!(header.flags & BSDIFF_FLAG_INPLACE) || header.filter != BSDIFF_FILTER_NONE) {
+        bsdiff_SetError(error, "Not an in-place patch");
+        goto MyExit;
+    }
+    *newSize = header.newSize;
+    if (header.newSize > capacity || oldSize > capacity) {
+        bsdiff_SetError(error, "Buffer too small");
+        goto MyExit;
+    }
+    if (header.flags & BSDIFF_FLAG_FRAMED)
+        pool = bsdiff_PoolCreate(options->numThreads);
+    if (!openBlocks(patch, &header, &control, &diff, &extra, &demux, pool, allocator, options)) {
+        bsdiff_SetError(error, "Invalid patchFile");
+        goto MyExit;
+    }
+    bsdiff_ZrleInit(&zrle, &diff);
+    checksum = (header.flags & BSDIFF_FLAG_CHECKSUM) != 0;
+    bsdiff_Xxh64Init(&newHash, 0);
+    if (stats) {
+        stats->ctrlSize = header.ctrlLen;
+        stats->diffSize = header.diffLen;
+        stats->extraSize = patch->size - header.size - header.ctrlLen - header.diffLen;
+    }
+    if (!(window = (unsigned char*)bsdiff_Alloc(allocator, (size_t)windowSize)) ||
+        !(oldWindow = (unsigned char*)bsdiff_Alloc(allocator, (size_t)windowSize)) ||
+        (bsdiff_off_t)(size_t)header.scratchSize != header.scratchSize ||
+        !(scratch = (unsigned char*)bsdiff_Alloc(allocator, (size_t)header.scratchSize + 1))) {
+        bsdiff_SetError(error, "Out of memory");
+        goto MyExit;
+    }
+    if (checksum && !inplaceCheckOld(target, oldSize, &header, &control, oldWindow, windowSize, scratch,
+                                     allocator, &monitor, &ctrls, &numCtrls, error))
+        goto MyExit;
+
+    // дnewSizeֽھͽѾԤȶʱ˳ȡãݴҲѾ
+    written = 0;
+    nextReport = 0;
+    for (k = 0; written < header.newSize; ++k) {
+        if (ctrls) {
+            memcpy(temp, ctrls + k * 24, 24);
+        } else {
+            clock = bsdiff_MonitorClock(&monitor);
+            if (!bsdiff_CursorRead(&control, temp, 24)) {
+                bsdiff_SetError(error, "Invalid patchFile");
+                goto MyExit;
+            }
+            bsdiff_MonitorAdd(&monitor, BSDIFF_PHASE_CTRL, clock, 24);
+        }
+        newPos = bsdiff_ReadOffset(temp);
+        oldPos = bsdiff_ReadOffset(temp + 8);
+        len = bsdiff_ReadOffset(temp + 16);
+        if (!inplaceValid(&header, oldSize, written, newPos, oldPos, len)) {
+            bsdiff_SetError(error, "Invalid patchFile");
+            goto MyExit;
+        }
+        if (newPos < 0) {
+            if (!ctrls && !targetRead(target, oldPos, scratch + (-1 - newPos), (size_t)len)) {
+                bsdiff_SetError(error, "Failed to read oldFile");
+                goto MyExit;
+            }
+            if (stats)
+                ++stats->numCtrls;
+            continue;
+        }
+
+        // ÿζȶoldдԼĶдΧص
+        for (done = 0; done < len; done += n) {
+            n = len - done < windowSize ? len - done : windowSize;
+            if (oldPos != -1) {
+                src = oldWindow;
+                if (oldPos <= -2)
+                    src = scratch + (-2 - oldPos) + done;
+                else if (!targetRead(target, oldPos + done, oldWindow, (size_t)n)) {
+                    bsdiff_SetError(error, "Failed to read oldFile");
+                    goto MyExit;
+                }
+                clock = bsdiff_MonitorClock(&monitor);
+                if (header.flags & BSDIFF_FLAG_ZRLE ? !bsdiff_ZrleRead(&zrle, window, n, src, n) :
+                                                      !bsdiff_CursorRead(&diff, window, n)) {
+                    bsdiff_SetError(error, "Invalid patchFile");
+                    goto MyExit;
+                }
+                if (!(header.flags & BSDIFF_FLAG_ZRLE))
+                    bsdiff_AddBytes(window, src, (size_t)n);
+                if (checksum)
+                    bsdiff_Xxh64Update(&newHash, window, (size_t)n);
+                bsdiff_MonitorAdd(&monitor, BSDIFF_PHASE_DIFF, clock, n);
+            } else {
+                clock = bsdiff_MonitorClock(&monitor);
+                if (!bsdiff_CursorRead(&extra, window, n)) {
+                    bsdiff_SetError(error, "Invalid patchFile");
+                    goto MyExit;
+                }
+                if (checksum)
+                    bsdiff_Xxh64Update(&newHash, window, (size_t)n);
+                bsdiff_MonitorAdd(&monitor, BSDIFF_PHASE_EXTRA, clock, n);
+            }
+
+            // λû䡢Ҳûݲдأһβд
+            clock = bsdiff_MonitorClock(&monitor);
+            if (!(oldPos == newPos && memcmp(window, oldWindow, (size_t)n) == 0) &&
+                !targetWrite(target, newPos + done, window, (size_t)n)) {
+                bsdiff_SetError(error, "Failed to write newFile");
+                goto MyExit;
+            }
+            bsdiff_MonitorAdd(&monitor, BSDIFF_PHASE_WRITE, clock, n);
+            if (!reportProgress(&monitor, written + done + n, header.newSize, windowSize, &nextReport)) {
+                bsdiff_SetError(error, "Cancelled");
+                goto MyExit;
+            }
+        }
+        written += len;
+        if (stats) {
+            ++stats->numCtrls;
+            if (oldPos != -1)
+                stats->diffBytes += len;
+            else
+                stats->extraBytes += len;
+        }
+    }
+
+    // oldѾԤУﲻһֻpatch𻵣ļѾдˣضϣnewFileѾ
+    if (checksum && bsdiff_Xxh64Final(&newHash) != header.newHash) {
+        bsdiff_SetError(error, "newFile doesn't match");
+        goto MyExit;
+    }
+    if (!bsdiff_MonitorReport(&monitor, BSDIFF_PHASE_APPLY, written, header.newSize)) {
+        bsdiff_SetError(error, "Cancelled");
         goto MyExit;
     }
-    if (!bsdiff_WriteFile(fp, newFileBuf, newFileSize)) {
+    retCode = 1;
+
+MyExit:
+    bsdiff_Free(allocator, window);
+    bsdiff_Free(allocator, oldWindow);
+    bsdiff_Free(allocator, scratch);
+    bsdiff_Free(allocator, ctrls);
+    bsdiff_CursorClose(&control);
+    bsdiff_CursorClose(&diff);
+    bsdiff_CursorClose(&extra);
+    bsdiff_DemuxClose(demux);
+    bsdiff_PoolDestroy(pool);
+    bsdiff_MonitorFinish(&monitor);
+    return retCode;
+}
+
+// Զдʽ򿪵ļϾ͵ش򲹶newFileʱض
+static int inplaceFile(FILE *fp, bsdiff_source *patch, const bsdiff_patch_options *options, char error[64])
+{
+    inplaceTarget target;
+    bsdiff_off_t oldSize, newSize;
+
+    if (!bsdiff_GetFileSize(fp, &oldSize)) {
+        bsdiff_SetError(error, "Can't open oldFile");
+        return 0;
+    }
+    target.data = NULL;
+    target.fp = fp;
+    if (!inplaceCore(&target, oldSize, ((bsdiff_off_t)1 << 62), patch, NULL, options, &newSize, error))
+        return 0;
+    if (newSize < oldSize && !bsdiff_TruncateFile(fp, newSize)) {
         bsdiff_SetError(error, "Failed to write newFile");
+        return 0;
+    }
+    return 1;
+}
+
+int bsdiff_patch(const char *oldFile, const char *patchFile, const char *newFile, char error[64])
+{
+    return bsdiff_patch_ex(oldFile, patchFile, newFile, NULL, error);
+}
+
+int bsdiff_patch_ex(const char *oldFile, const char *patchFile, const char *newFile, 
+                    const bsdiff_patch_options *options, char error[64])
+{
+    int retCode = 0;
+    FILE *fpNew = NULL;
+    bsdiff_source old, patch;
+    bsdiff_patch_options defaultOptions;
+    bsdiff_header header;
+    char *tempFile = NULL;
+    double readStart, readSeconds;
+
+    // newFileдʱļɹٸoldFilenewFileͬһļʧʱҲ°newFile
+
+    if (!options) {
+        bsdiff_patch_options_init(&defaultOptions);
+        options = &defaultOptions;
+    }
+    memset(&old, 0, sizeof(old));
+    memset(&patch, 0, sizeof(patch));
+
+    // patchļoldFileӳ䡢λöȡܵݣܵеʽpatch
+    // ֻļͷ߶ӦãʱREAD׶
+    readStart = bsdiff_Now();
+    if (!bsdiff_SourceOpenPatch(&patch, patchFile, options->useMapping)) {
+        bsdiff_SetError(error, "Can't open patchFile");
+        goto MyExit;
+    }
+    if (!bsdiff_SourceOpenFile(&old, oldFile, options->useMapping)) {
+        bsdiff_SetError(error, "Can't open oldFile");
+        goto MyExit;
+    }
+    readSeconds = bsdiff_Now() - readStart;
+
+    // newFileʱļ
+    if (!(tempFile = (char*)malloc(strlen(newFile) + 32))) {
+        bsdiff_SetError(error, "Out of memory");
+        goto MyExit;
+    }
+    sprintf(tempFile, "%s.%d.tmp", newFile, bsdiff_GetProcessId());
+
+    // ͵patcholdFileƵʱļʱļϾ͵ش򲹶
+    if (!readHeader(&patch, &header, error))
+        goto MyExit;
+    if (header.flags & BSDIFF_FLAG_INPLACE) {
+        if (!bsdiff_CopyFile(oldFile, tempFile) || !(fpNew = fopen(tempFile, "r+b"))) {
+            bsdiff_SetError(error, "Can't open newFile");
+            goto MyExit;
+        }
+        if (!inplaceFile(fpNew, &patch, options, error))
+            goto MyExit;
+    } else {
+        if (!(fpNew = fopen(tempFile, "wb"))) {
+            bsdiff_SetError(error, "Can't open newFile");
+            goto MyExit;
+        }
+        if (!patchCore(&old, &patch, bsdiff_FileSink, fpNew, NULL, NULL, options, error))
+            goto MyExit;
+    }
+    if (options->stats) {
+        options->stats->phases[BSDIFF_PHASE_READ].seconds += readSeconds;
+        options->stats->phases[BSDIFF_PHASE_READ].bytes += old.size + patch.size;
+        options->stats->seconds += readSeconds;
+    }
+
+    // رļʱļΪnewFileoldFileҪȹرգܾnewFile
+    bsdiff_SourceClose(&old);
+    if (fclose(fpNew)) {
+        fpNew = NULL;
+        bsdiff_SetError(error, "Failed to write newFile");
+        goto MyExit;
+    }
+    fpNew = NULL;
+    if (!bsdiff_RenameFile(tempFile, newFile)) {
+        bsdiff_SetError(error, "Can't open newFile");
         goto MyExit;
     }
-    fclose(fp);
-    fp = NULL;
 
     // Done
     retCode = 1;
 
 MyExit:
-    free(oldFileBuf);
-    free(newFileBuf);
-    if (bfpControl)
-        BZ2_bzReadClose(&bzError, bfpControl);
-    if (bfpDiff)
-        BZ2_bzReadClose(&bzError, bfpDiff);
-    if (bfpExtra)
-        BZ2_bzReadClose(&bzError, bfpExtra);
+    bsdiff_SourceClose(&patch);
+    bsdiff_SourceClose(&old);
+    if (fpNew)
+        fclose(fpNew);
+    if (tempFile) {
+        if (!retCode)
+            remove(tempFile);
+        free(tempFile);
+    }
+    return retCode;
+}
+
+int bsdiff_patch_mem(const void *oldData, size_t oldSize, const void *patchData, size_t patchSize, 
+                     bsdiff_write_fn write, void *opaque, const bsdiff_allocator *allocator, 
+                     const bsdiff_patch_options *options, char error[64])
+{
+    bsdiff_source old, patch;
+    bsdiff_patch_options defaultOptions;
+
+    if (!options) {
+        bsdiff_patch_options_init(&defaultOptions);
+        options = &defaultOptions;
+    }
+
+    // Դֱָߵڴ棬
+    bsdiff_SourceOpenMemory(&old, oldData, oldSize);
+    bsdiff_SourceOpenMemory(&patch, patchData, patchSize);
+    return patchCore(&old, &patch, write, opaque, allocator, NULL, options, error);
+}
+
+int bsdiff_ctx_patch(bsdiff_ctx *ctx, const void *oldData, size_t oldSize, const void *patchData, size_t patchSize, 
+                     bsdiff_write_fn write, void *opaque, const bsdiff_patch_options *options, char error[64])
+{
+    bsdiff_source old, patch;
+    bsdiff_patch_options defaultOptions;
+
+    if (!options) {
+        bsdiff_patch_options_init(&defaultOptions);
+        options = &defaultOptions;
+    }
+    bsdiff_SourceOpenMemory(&old, oldData, oldSize);
+    bsdiff_SourceOpenMemory(&patch, patchData, patchSize);
+    return patchCore(&old, &patch, write, opaque, bsdiff_CtxAllocator(ctx), bsdiff_CtxPool(ctx), options, error);
+}
+
+int bsdiff_patch_inplace(const char *file, const char *patchFile, const bsdiff_patch_options *options, 
+                         char error[64])
+{
+    int retCode = 0;
+    FILE *fp = NULL;
+    bsdiff_source patch;
+    bsdiff_patch_options defaultOptions;
+
+    if (!options) {
+        bsdiff_patch_options_init(&defaultOptions);
+        options = &defaultOptions;
+    }
+    memset(&patch, 0, sizeof(patch));
+    if (!bsdiff_SourceOpenFile(&patch, patchFile, options->useMapping)) {
+        bsdiff_SetError(error, "Can't open patchFile");
+        goto MyExit;
+    }
+    if (!(fp = fopen(file, "r+b"))) {
+        bsdiff_SetError(error, "Can't open oldFile");
+        goto MyExit;
+    }
+    if (!inplaceFile(fp, &patch, options, error))
+        goto MyExit;
+    if (fclose(fp)) {
+        fp = NULL;
+        bsdiff_SetError(error, "Failed to write newFile");
+        goto MyExit;
+    }
+    fp = NULL;
+    retCode = 1;
+
+MyExit:
+    bsdiff_SourceClose(&patch);
     if (fp)
         fclose(fp);
-    if (fpControl)
-        fclose(fpControl);
-    if (fpDiff)
-        fclose(fpDiff);
-    if (fpExtra)
-        fclose(fpExtra);
+    return retCode;
+}
+
+int bsdiff_patch_inplace_mem(void *data, size_t oldSize, size_t capacity, const void *patchData, size_t patchSize, 
+                             size_t *newSize, const bsdiff_allocator *allocator, 
+                             const bsdiff_patch_options *options, char error[64])
+{
+    inplaceTarget target;
+    bsdiff_source patch;
+    bsdiff_patch_options defaultOptions;
+    bsdiff_off_t size = 0;
+    int retCode;
+
+    if (!options) {
+        bsdiff_patch_options_init(&defaultOptions);
+        options = &defaultOptions;
+    }
+    target.data = (unsigned char*)data;
+    target.fp = NULL;
+    bsdiff_SourceOpenMemory(&patch, patchData, patchSize);
+    retCode = inplaceCore(&target, (bsdiff_off_t)oldSize, (bsdiff_off_t)capacity, &patch, allocator, options, 
+                          &size, error);
+    *newSize = (size_t)size;
+    return retCode;
+}
+
+//------------------------------------------------------------------------------
+
+// ļpatchʽbsdiff_format.hļеһ
+typedef struct bundleEntry {
+    bsdiff_off_t size;
+    const char *path;           // ָļ'\0'β
+    size_t pathLen;
+} bundleEntry;
+
+// dir + ָ + ļе·bufУҪܷdir·ֽڣ
+static void bundlePath(char *buf, const char *dir, const bundleEntry *entry)
+{
+    size_t len = strlen(dir);
+
+    memcpy(buf, dir, len);
+    buf[len] = BSDIFF_PATH_SEP;
+    memcpy(buf + len + 1, entry->path, entry->pathLen);
+    buf[len + 1 + entry->pathLen] = '\0';
+}
+
+// ֮patchɵnewFileļпдnewDirеĸļ
+typedef struct bundleSink {
+    const char *newDir;
+    const bundleEntry *entries;
+    bsdiff_off_t numEntries, next;  // һҪ򿪵ļ
+    bsdiff_off_t remaining;         // ǰļҪдֽ
+    FILE *fp;
+    char *path;
+} bundleSink;
+
+// һҪдļмĿ¼𼶴;еĿļֱӴдʱfpΪNULL
+static int bundleNext(bundleSink *sink)
+{
+    size_t i;
+    int ok;
+
+    while (!sink->fp && sink->next < sink->numEntries) {
+        bundlePath(sink->path, sink->newDir, &sink->entries[sink->next]);
+        for (i = strlen(sink->newDir) + 1; sink->path[i]; ++i) {
+            if (sink->path[i] == '/') {
+                sink->path[i] = '\0';
+                ok = bsdiff_MakeDir(sink->path);
+                sink->path[i] = BSDIFF_PATH_SEP;
+                if (!ok)
+                    return 0;
+            }
+        }
+        if (!(sink->fp = fopen(sink->path, "wb")))
+            return 0;
+        sink->remaining = sink->entries[sink->next++].size;
+        if (sink->remaining == 0) {
+            ok = !fclose(sink->fp);
+            sink->fp = NULL;
+            if (!ok)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+static int bundleWrite(void *opaque, const void *data, size_t len)
+{
+    bundleSink *sink = (bundleSink*)opaque;
+    const unsigned char *p = (const unsigned char*)data;
+    size_t n;
+    int ok;
+
+    while (len > 0) {
+        if (!bundleNext(sink) || !sink->fp)
+            return 0;
+        n = (bsdiff_off_t)len < sink->remaining ? len : (size_t)sink->remaining;
+        if (!bsdiff_WriteFile(sink->fp, p, n))
+            return 0;
+        p += n;
+        len -= n;
+        if ((sink->remaining -= (bsdiff_off_t)n) == 0) {
+            ok = !fclose(sink->fp);
+            sink->fp = NULL;
+            if (!ok)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+// ļ·ҪȫoldϵĳȣЧʱ-1
+static bsdiff_off_t parseBundleTable(const unsigned char *table, bsdiff_off_t tableLen, bundleEntry *entries,
+                                     bsdiff_off_t numOld, bsdiff_off_t numEntries, size_t *maxPath)
+{
+    const unsigned char *p = table, *end = table + tableLen;
+    bsdiff_off_t i, size, len, oldSize = 0, newSize = 0;
+
+    *maxPath = 0;
+    for (i = 0; i < numEntries; ++i) {
+        if (end - p < 16)
+            return -1;
+        size = bsdiff_ReadOffset(p);
+        len = bsdiff_ReadOffset(p + 8);
+        if (size < 0 || len < 0 || len > end - p - 16 || !bsdiff_BundlePathValid((const char*)p + 16, (size_t)len))
+            return -1;
+
+        // ϵܳȶ
+        if (i < numOld) {
+            if (size > ((bsdiff_off_t)1 << 62) - oldSize)
+                return -1;
+            oldSize += size;
+        } else {
+            if (size > ((bsdiff_off_t)1 << 62) - newSize)
+                return -1;
+            newSize += size;
+        }
+        entries[i].size = size;
+        entries[i].path = (const char*)p + 16;
+        entries[i].pathLen = (size_t)len;
+        if ((size_t)len > *maxPath)
+            *maxPath = (size_t)len;
+        p += 16 + len;
+    }
+    return p == end ? oldSize : -1;
+}
+
+int bsdiff_patch_bundle(const char *oldDir, const char *bundleFile, const char *newDir,
+                        const bsdiff_patch_options *options, char error[64])
+{
+    int retCode = 0;
+    bsdiff_patch_options defaultOptions;
+    bsdiff_source patch, old;
+    bsdiff_bundle_header header;
+    unsigned char headerBuf[BSDIFF_BUNDLE_HEADER];
+    unsigned char *table = NULL, *oldData = NULL;
+    bundleEntry *entries = NULL;
+    bundleSink sink;
+    bsdiff_off_t i, numEntries, oldSize, pos, size;
+    size_t maxPath;
+    char *path = NULL;
+    FILE *fp;
+
+    if (!options) {
+        bsdiff_patch_options_init(&defaultOptions);
+        options = &defaultOptions;
+    }
+    memset(&patch, 0, sizeof(patch));
+    memset(&sink, 0, sizeof(sink));
+
+    // ļͷļÿ16ֽڣļᳬֽ / 16
+    if (!bsdiff_SourceOpenFile(&patch, bundleFile, options->useMapping)) {
+        bsdiff_SetError(error, "Can't open patchFile");
+        goto MyExit;
+    }
+    if (!bsdiff_SourceRead(&patch, 0, headerBuf, BSDIFF_BUNDLE_HEADER) ||
+        !bsdiff_BundleHeaderRead(headerBuf, &header) || header.tableLen > patch.size - BSDIFF_BUNDLE_HEADER ||
+        header.numOld > header.tableLen / 16 || header.numNew > header.tableLen / 16 - header.numOld) {
+        bsdiff_SetError(error, "Invalid patchFile");
+        goto MyExit;
+    }
+    numEntries = header.numOld + header.numNew;
+    if (!(table = (unsigned char*)malloc((size_t)header.tableLen + 1)) ||
+        !(entries = (bundleEntry*)malloc((size_t)(numEntries + 1) * sizeof(bundleEntry)))) {
+        bsdiff_SetError(error, "Out of memory");
+        goto MyExit;
+    }
+    if (!bsdiff_SourceRead(&patch, BSDIFF_BUNDLE_HEADER, table, (size_t)header.tableLen) ||
+        (oldSize = parseBundleTable(table, header.tableLen, entries, header.numOld, numEntries, &maxPath)) < 0) {
+        bsdiff_SetError(error, "Invalid patchFile");
+        goto MyExit;
+    }
+    if (!(path = (char*)malloc(strlen(oldDir) + strlen(newDir) + maxPath + 2)) ||
+        (bsdiff_off_t)(size_t)oldSize != oldSize || !(oldData = (unsigned char*)malloc((size_t)oldSize + 1))) {
+        bsdiff_SetError(error, "Out of memory");
+        goto MyExit;
+    }
+
+    // ļoldDirеļoldϣȻpatchʱͬӦ
+    for (i = 0, pos = 0; i < header.numOld; ++i) {
+        bundlePath(path, oldDir, &entries[i]);
+        if (!(fp = fopen(path, "rb"))) {
+            bsdiff_SetError(error, "Can't open oldFile");
+            goto MyExit;
+        }
+        if (!bsdiff_GetFileSize(fp, &size) || size != entries[i].size ||
+            !bsdiff_ReadFile(fp, oldData + pos, (size_t)size)) {
+            fclose(fp);
+            bsdiff_SetError(error, "oldDir doesn't match");
+            goto MyExit;
+        }
+        fclose(fp);
+        pos += size;
+    }
+    if (bsdiff_Xxh64(oldData, (size_t)oldSize, 0) != header.oldHash) {
+        bsdiff_SetError(error, "oldDir doesn't match");
+        goto MyExit;
+    }
+
+    // ļ֮֮patchnewFileһһгɸļ
+    bsdiff_SourceOpenMemory(&old, oldData, (size_t)oldSize);
+    if (!bsdiff_SourceSkip(&patch, BSDIFF_BUNDLE_HEADER + header.tableLen)) {
+        bsdiff_SetError(error, "Invalid patchFile");
+        goto MyExit;
+    }
+    if (!bsdiff_MakeDir(newDir)) {
+        bsdiff_SetError(error, "Can't open newFile");
+        goto MyExit;
+    }
+    sink.newDir = newDir;
+    sink.entries = entries + header.numOld;
+    sink.numEntries = header.numNew;
+    sink.path = path;
+    if (!patchCore(&old, &patch, bundleWrite, &sink, NULL, NULL, options, error))
+        goto MyExit;
+
+    // ĿļnewļܳҪpatchеnewSizeһ
+    if (!bundleNext(&sink)) {
+        bsdiff_SetError(error, "Failed to write newFile");
+        goto MyExit;
+    }
+    if (sink.fp) {
+        bsdiff_SetError(error, "Invalid patchFile");
+        goto MyExit;
+    }
+    retCode = 1;
+
+MyExit:
+    if (sink.fp)
+        fclose(sink.fp);
+    bsdiff_SourceClose(&patch);
+    free(table);
+    free(entries);
+    free(oldData);
+    free(path);
     return retCode;
 }
 
@@ -213,20 +1273,75 @@ MyExit:
 
 #ifdef BSDIFF_STANDALONE
 
+static void usage(const char *prog)
+{
+    printf("usage: %s [options] oldFile patchFile newFile\n", prog);
+    printf("       %s -I [options] file patchFile\n", prog);
+    printf("       %s -b [options] oldDir bundleFile newDir\n", prog);
+    printf("       patchFile can be - to read the patch from stdin\n");
+    printf("options:\n");
+    printf("  -w N                   process at most N bytes at a time (default: %d)\n", DEFAULT_WINDOW_SIZE);
+    printf("  -s                     use bzip2's low-memory (slower) decompressor\n");
+    printf("  -m                     read oldFile and patchFile with positioned reads, not mapping\n");
+    printf("  -j N                   decompress frames of a framed patch on N threads (default: 1)\n");
+    printf("  -P                     pipeline decompression, add and write on the -j threads\n");
+    printf("  -I                     apply an in-place patch (bsdiff_make -I) directly over file\n");
+    printf("  -b                     apply a multi-file bundle (bsdiff_make -b) to oldDir, writing newDir\n");
+    printf("  -v                     print per-phase timings and block sizes\n");
+}
+
 int main(int argc,char * argv[])
 {
+    bsdiff_patch_options options;
+    bsdiff_stats stats;
     char error[64];
+    int i, verbose = 0, inplace = 0, bundle = 0, numPaths = 3;
+
+    bsdiff_patch_options_init(&options);
+
+    // ·֮ǰѡ-Iʱֻ·
+    for (i = 1; i < argc - 2; ++i) {
+        if (strcmp(argv[i], "-I") == 0)
+            numPaths = 2;
+    }
+    for (i = 1; i < argc - numPaths; ++i) {
+        if (strcmp(argv[i], "-w") == 0 && i + 1 < argc - numPaths) {
+            options.windowSize = (size_t)atol(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            options.smallDecompress = 1;
+        } else if (strcmp(argv[i], "-m") == 0) {
+            options.useMapping = 0;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc - numPaths) {
+            options.numThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-P") == 0) {
+            options.pipeline = 1;
+        } else if (strcmp(argv[i], "-I") == 0) {
+            inplace = 1;
+        } else if (strcmp(argv[i], "-b") == 0) {
+            bundle = 1;
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = 1;
+            options.stats = &stats;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
 
-    if (argc != 4) {
-        printf("usage: %s oldFile patchFile newFile\n", argv[0]);
+    if (argc < numPaths + 1) {
+        usage(argv[0]);
         return 1;
     }
 
-    if (!bsdiff_patch(argv[1], argv[2], argv[3], error)) {
+    if (inplace ? !bsdiff_patch_inplace(argv[i], argv[i + 1], &options, error) :
+        bundle ? !bsdiff_patch_bundle(argv[i], argv[i + 1], argv[i + 2], &options, error) :
+        !bsdiff_patch_ex(argv[i], argv[i + 1], argv[i + 2], &options, error)) {
         printf("PatchFile failed! error = %s\n", error);
         return 1;
     }
     printf("PatchFile OK\n");
+    if (verbose)
+        bsdiff_PrintStats(&stats);
     return 0;
 }
 
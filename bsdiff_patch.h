@@ -5,6 +5,94 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+#include "bsdiff_types.h"
+
+typedef struct bsdiff_patch_options {
+    size_t windowSize;          // 每次解压/处理的最大字节数；峰值内存约为2 * windowSize
+                                // 加上三个bzip2解压流的状态（默认1MB）。使用了可执行文件过滤器的patch
+                                // 还要把过滤后的old和整个newFile放在内存中
+    int smallDecompress;        // 非0时bzip2使用省内存的解压算法，每个流约2.3MB，速度约慢一倍（默认0）
+    int useMapping;             // 非0时把oldFile和patchFile映射到内存直接读取，映射失败时才按位置读取（默认1）
+    int numThreads;             // 分帧的patch在这么多个线程上提前解压后面的帧，<= 1表示单线程（默认1）
+    int pipeline;               // 非0且numThreads > 1时流水线化：未分帧的三个流也在这些线程上提前解压
+                                // （每个流多1MB，patch要在内存中或者能映射），newFile在这些线程上异步写出，
+                                // window多一组。write因此会在工作线程中被调用，仍然按顺序、不会同时调用（默认0）
+    bsdiff_stats *stats;        // 非NULL时填入各阶段的耗时和字节数等统计（默认NULL）
+    bsdiff_progress_fn progress;    // 非NULL时报告进度，可以取消（默认NULL）
+    void *progressOpaque;
+} bsdiff_patch_options;
+
+// 用默认值填充options
+void bsdiff_patch_options_init(
+    bsdiff_patch_options *options
+    );
+
+// options为NULL时使用默认值。newFile先写到临时文件，成功后才改名；带校验和的patch
+// （bsdiff_diff_options.checksum）在apply的同时计算，到最后才能发现old或newFile不一致，这时删除临时文件、返回0
+int bsdiff_patch_ex(
+    const char *oldFile, 
+    const char *patchFile, 
+    const char *newFile, 
+    const bsdiff_patch_options *options, 
+    char error[64]
+    );
+
+// 在内存中把patchData应用到oldData上，生成的newFile依次交给write输出（最后一次调用后才算完整）；
+// 带校验和的patch（bsdiff_diff_options.checksum）在apply的同时计算，到最后才校验（oldFile不一致也要等到那时），
+// 不一致时返回0，已经输出的数据作废
+// 所有的内存都从allocator分配（NULL表示malloc/free）；options->useMapping在这里没有意义
+int bsdiff_patch_mem(
+    const void *oldData, 
+    size_t oldSize, 
+    const void *patchData, 
+    size_t patchSize, 
+    bsdiff_write_fn write, 
+    void *opaque, 
+    const bsdiff_allocator *allocator, 
+    const bsdiff_patch_options *options, 
+    char error[64]
+    );
+
+// 就地打补丁（bsdiff_diff_options.inplace生成的patch，见bsdiff_inplace.h）：直接把file从oldFile改写成
+// newFile，除了windowSize（至少16KB）大小的两个buffer、patch中指定的暂存区（bsdiff_diff_options.inplaceScratch）
+// 和解压状态不需要额外的内存，也不需要第二份磁盘空间。
+// newFile更短时截断file（块设备不截断）。中途失败或断电时file既不是oldFile也不是newFile，
+// 只能重新获取完整的文件。带校验和的patch在改写之前先读出全部命令（每条24字节）校验oldFile，
+// 不一致时file保持原样；newFile的校验和仍然要改写完才知道，这时不一致只能是patch本身损坏。
+// bsdiff_patch_ex也能应用就地patch，它先把oldFile复制成newFile的临时文件
+int bsdiff_patch_inplace(
+    const char *file, 
+    const char *patchFile, 
+    const bsdiff_patch_options *options, 
+    char error[64]
+    );
+
+// 在内存中就地打补丁：data的前oldSize字节为oldFile，capacity为data的大小，成功时data的前*newSize字节为newFile。
+// newFile放不下时失败，*newSize也返回所需的长度
+int bsdiff_patch_inplace_mem(
+    void *data, 
+    size_t oldSize, 
+    size_t capacity, 
+    const void *patchData, 
+    size_t patchSize, 
+    size_t *newSize, 
+    const bsdiff_allocator *allocator, 
+    const bsdiff_patch_options *options, 
+    char error[64]
+    );
+
+// 应用bsdiff_diff_bundle生成的多文件patch包：按文件表读入oldDir中的文件（长度和XXH64都要与生成时相同），
+// 一遍解压、生成拼接起来的newFile，同时按文件表切开写到newDir中（目录不存在时创建，同名文件被覆盖）。
+// old文件都要放在内存中；中途失败时newDir中会留下已经写出的文件。options与bsdiff_patch_ex相同
+int bsdiff_patch_bundle(
+    const char *oldDir, 
+    const char *bundleFile, 
+    const char *newDir, 
+    const bsdiff_patch_options *options, 
+    char error[64]
+    );
+
 int bsdiff_patch(
     const char *oldFile, 
     const char *patchFile, 
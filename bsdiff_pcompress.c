@@ -0,0 +1,431 @@
+#include "bsdiff_pcompress.h"
+#include "bsdiff_codec.h"
+#include <string.h>
+
+#define MIN(x,y) (((x)<(y)) ? (x) : (y))
+
+//------------------------------------------------------------------------------
+
+// bzip2流的结构：4字节的"BZh"+级别，然后是各个block（每个以48位的魔数和32位的block CRC开头，
+// 不按字节对齐），最后是48位的结束魔数、32位的combined CRC，补0到整字节
+#define BLOCK_MAGIC_HI   0x3141u
+#define BLOCK_MAGIC_LO   0x59265359u
+#define EOS_MAGIC_HI     0x1772u
+#define EOS_MAGIC_LO     0x45385090u
+
+// 流式写入时每次最多追加这么多字节再找block的边界
+#define PIECE_STEP  (1024 * 1024)
+
+typedef struct blockTask {
+    bsdiff_pcompress *job;
+    const unsigned char *data;
+    size_t len;
+    unsigned char *owned;       // 流式写入时复制出来的数据，压缩完就释放
+    unsigned char *out;
+    bsdiff_off_t outLen;
+    int ok;
+} blockTask;
+
+// 模拟bzlib.c中ADD_CHAR_TO_BLOCK的RLE1编码的状态
+typedef struct rle1State {
+    int nblock, ch, runLen;
+} rle1State;
+
+struct bsdiff_pcompress {
+    int codec, level, workFactor;
+    bsdiff_pool *pool;
+    const unsigned char *data;
+    bsdiff_off_t len;
+    const bsdiff_allocator *allocator;
+    blockTask **tasks;          // 各自分配，数组增长时正在执行的任务不受影响
+    size_t numTasks, capacity;
+    int split;                  // bzip2在线程池上按block切分
+    int streaming;              // 由bsdiff_PCompressCreate创建
+    int ok;                     // 流式写入时出错以后就不再接受数据
+    bsdiff_encoder encoder;     // 流式写入并且不切分时在调用线程中直接压缩
+    unsigned char *piece;       // 流式切分时还没有凑满一个block的数据
+    size_t pieceLen, pieceCapacity, scanned;
+    rle1State rle;
+    bsdiff_mutex mutex;         // 保护numDone
+    bsdiff_cond cond;
+    size_t numDone;
+};
+
+static void compressTask(void *arg)
+{
+    blockTask *task = (blockTask*)arg;
+    bsdiff_pcompress *job = task->job;
+
+    task->ok = bsdiff_Compress(job->codec, job->level, job->workFactor, task->data, (bsdiff_off_t)task->len,
+                               job->allocator, &task->out, &task->outLen);
+    bsdiff_Free(job->allocator, task->owned);
+    task->owned = NULL;
+
+    bsdiff_MutexLock(&job->mutex);
+    ++job->numDone;
+    bsdiff_CondBroadcast(&job->cond);
+    bsdiff_MutexUnlock(&job->mutex);
+}
+
+static void rle1Reset(rle1State *s)
+{
+    s->nblock = 0;
+    s->ch = 256;
+    s->runLen = 0;
+}
+
+// 从data[start]开始继续模拟RLE1，返回block在串行压缩时结束的位置：block满了的时候，
+// 还没有结束的那个run（此时总是只有1个字节）留给下一个block；到len都没满时返回len
+static size_t rle1Feed(rle1State *s, const unsigned char *data, size_t start, size_t len, int nblockMax)
+{
+    size_t i;
+
+    for (i = start; i < len; ++i) {
+        if (s->nblock >= nblockMax)
+            return i - s->runLen;
+        if (data[i] != s->ch && s->runLen == 1) {
+            ++s->nblock;
+            s->ch = data[i];
+        } else if (data[i] != s->ch || s->runLen == 255) {
+            if (s->ch < 256)
+                s->nblock += s->runLen < 4 ? s->runLen : 5;
+            s->ch = data[i];
+            s->runLen = 1;
+        } else {
+            ++s->runLen;
+        }
+    }
+    return len;
+}
+
+// 返回从start开始的block在串行压缩时结束的位置
+static size_t blockEnd(const unsigned char *data, size_t start, size_t len, int nblockMax)
+{
+    rle1State s;
+
+    rle1Reset(&s);
+    return rle1Feed(&s, data, start, len, nblockMax);
+}
+
+// 追加一个任务；内存不足时返回NULL
+static blockTask* addTask(bsdiff_pcompress *job, const unsigned char *data, size_t len)
+{
+    blockTask **tasks, *task;
+
+    if (job->numTasks == job->capacity) {
+        if (!(tasks = (blockTask**)bsdiff_Alloc(job->allocator, (job->capacity + 16) * 2 * sizeof(blockTask*))))
+            return NULL;
+        if (job->numTasks)
+            memcpy(tasks, job->tasks, job->numTasks * sizeof(blockTask*));
+        bsdiff_Free(job->allocator, job->tasks);
+        job->tasks = tasks;
+        job->capacity = (job->capacity + 16) * 2;
+    }
+    if (!(task = (blockTask*)bsdiff_Alloc(job->allocator, sizeof(blockTask))))
+        return NULL;
+    memset(task, 0, sizeof(blockTask));
+    task->job = job;
+    task->data = data;
+    task->len = len;
+    job->tasks[job->numTasks++] = task;
+    return task;
+}
+
+// 等到最多还剩maxPending个任务没有完成
+static void waitTasks(bsdiff_pcompress *job, size_t maxPending)
+{
+    bsdiff_MutexLock(&job->mutex);
+    while (job->numTasks - job->numDone > maxPending)
+        bsdiff_CondWait(&job->cond, &job->mutex);
+    bsdiff_MutexUnlock(&job->mutex);
+}
+
+static bsdiff_pcompress* createJob(bsdiff_pool *pool, int codec, int level, int workFactor,
+                                   const bsdiff_allocator *allocator)
+{
+    bsdiff_pcompress *job;
+
+    if (!(job = (bsdiff_pcompress*)bsdiff_Alloc(allocator, sizeof(bsdiff_pcompress))))
+        return NULL;
+    memset(job, 0, sizeof(bsdiff_pcompress));
+    job->codec = codec;
+    job->level = level > 0 ? level : (codec == BSDIFF_CODEC_BZIP2 ? 9 : 0);
+    job->workFactor = workFactor;
+    job->pool = pool;
+    job->allocator = allocator;
+    job->split = codec == BSDIFF_CODEC_BZIP2 && pool && job->level <= 9;
+    job->ok = 1;
+    rle1Reset(&job->rle);
+    bsdiff_MutexInit(&job->mutex);
+    bsdiff_CondInit(&job->cond);
+    return job;
+}
+
+static void destroyJob(bsdiff_pcompress *job)
+{
+    size_t i;
+
+    for (i = 0; i < job->numTasks; ++i) {
+        bsdiff_Free(job->allocator, job->tasks[i]->out);
+        bsdiff_Free(job->allocator, job->tasks[i]->owned);
+        bsdiff_Free(job->allocator, job->tasks[i]);
+    }
+    bsdiff_Free(job->allocator, job->tasks);
+    bsdiff_Free(job->allocator, job->piece);
+    bsdiff_EncoderEnd(&job->encoder);
+    bsdiff_CondDestroy(&job->cond);
+    bsdiff_MutexDestroy(&job->mutex);
+    bsdiff_Free(job->allocator, job);
+}
+
+//------------------------------------------------------------------------------
+
+// 按MSB优先的顺序读取buf中从bit位置pos开始的n（<= 32）位
+static unsigned getBits(const unsigned char *buf, size_t pos, int n)
+{
+    unsigned v = 0;
+    int i;
+
+    for (i = 0; i < n; ++i, ++pos)
+        v = (v << 1) | ((buf[pos >> 3] >> (7 - (pos & 7))) & 1);
+    return v;
+}
+
+typedef struct bitWriter {
+    unsigned char *p;
+    size_t n;
+    unsigned long long acc;
+    int bits;
+} bitWriter;
+
+static void putBits(bitWriter *w, unsigned v, int n)
+{
+    w->acc = (w->acc << n) | (v & (n == 32 ? 0xFFFFFFFFu : ((1u << n) - 1)));
+    w->bits += n;
+    while (w->bits >= 8) {
+        w->bits -= 8;
+        w->p[w->n++] = (unsigned char)(w->acc >> w->bits);
+    }
+}
+
+// 找出只含一个block的bzip2流中block部分的长度（bit数，从第32位开始）和block CRC
+// 流的末尾补了0~7个0，结束魔数不具有这样短的周期，所以满足条件的补齐长度是唯一的
+static int parseStream(const unsigned char *buf, size_t len, size_t *blockBits, unsigned *blockCrc)
+{
+    size_t end, trailer;
+    int pad;
+
+    if (len < 4 + 10 + 10 || getBits(buf, 32, 16) != BLOCK_MAGIC_HI || getBits(buf, 48, 32) != BLOCK_MAGIC_LO)
+        return 0;
+    *blockCrc = getBits(buf, 80, 32);
+
+    for (pad = 0; pad < 8; ++pad) {
+        end = len * 8 - pad;
+        trailer = end - 80;
+        if ((pad && getBits(buf, end, pad) != 0) ||
+            getBits(buf, trailer, 16) != EOS_MAGIC_HI || getBits(buf, trailer + 16, 32) != EOS_MAGIC_LO)
+            continue;
+        // 只有一个block时combined CRC就等于block CRC
+        if (getBits(buf, trailer + 48, 32) != *blockCrc)
+            return 0;
+        *blockBits = trailer - 32;
+        return 1;
+    }
+    return 0;
+}
+
+// 把各个小block的bzip2流拼接成一个流
+static int concatStreams(bsdiff_pcompress *job, unsigned char **out, bsdiff_off_t *outLen)
+{
+    bitWriter w;
+    size_t capacity = 16, i, k, blockBits;
+    unsigned blockCrc, combinedCrc = 0;
+    const unsigned char *src;
+
+    for (i = 0; i < job->numTasks; ++i)
+        capacity += (size_t)job->tasks[i]->outLen;
+    memset(&w, 0, sizeof(w));
+    if (!(w.p = (unsigned char*)bsdiff_Alloc(job->allocator, capacity)))
+        return 0;
+
+    // 各个流的"BZh"+级别都一样，只保留一份
+    memcpy(w.p, job->tasks[0]->out, 4);
+    w.n = 4;
+    for (i = 0; i < job->numTasks; ++i) {
+        src = job->tasks[i]->out;
+        if (!parseStream(src, (size_t)job->tasks[i]->outLen, &blockBits, &blockCrc)) {
+            bsdiff_Free(job->allocator, w.p);
+            return 0;
+        }
+        combinedCrc = ((combinedCrc << 1) | (combinedCrc >> 31)) ^ blockCrc;
+
+        src += 4;
+        if (w.bits == 0) {
+            memcpy(w.p + w.n, src, blockBits / 8);
+            w.n += blockBits / 8;
+        } else {
+            for (k = 0; k < blockBits / 8; ++k)
+                putBits(&w, src[k], 8);
+        }
+        if (blockBits % 8)
+            putBits(&w, src[blockBits / 8] >> (8 - blockBits % 8), (int)(blockBits % 8));
+    }
+    putBits(&w, EOS_MAGIC_HI, 16);
+    putBits(&w, EOS_MAGIC_LO, 32);
+    putBits(&w, combinedCrc, 32);
+    if (w.bits)
+        putBits(&w, 0, 8 - w.bits);
+
+    *out = w.p;
+    *outLen = (bsdiff_off_t)w.n;
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+
+bsdiff_pcompress* bsdiff_PCompressSubmit(bsdiff_pool *pool, int codec, int level, int workFactor,
+                                         const unsigned char *data, bsdiff_off_t len,
+                                         const bsdiff_allocator *allocator)
+{
+    bsdiff_pcompress *job;
+    size_t start, end, i;
+    int nblockMax;
+
+    if (!(job = createJob(pool, codec, level, workFactor, allocator)))
+        return NULL;
+    job->data = data;
+    job->len = len;
+
+    // 按串行压缩时的block边界切分；单线程或者只有一个block时不切分
+    start = 0;
+    nblockMax = 100000 * job->level - 19;
+    do {
+        end = job->split ? blockEnd(data, start, (size_t)len, nblockMax) : (size_t)len;
+        if (!addTask(job, data + start, end - start)) {
+            destroyJob(job);
+            return NULL;
+        }
+        start = end;
+    } while (start < (size_t)len);
+
+    for (i = 0; i < job->numTasks; ++i)
+        bsdiff_PoolSubmit(pool, compressTask, job->tasks[i]);
+    return job;
+}
+
+bsdiff_pcompress* bsdiff_PCompressCreate(bsdiff_pool *pool, int codec, int level, int workFactor,
+                                         bsdiff_off_t sizeHint, const bsdiff_allocator *allocator)
+{
+    bsdiff_pcompress *job;
+
+    if (!(job = createJob(pool, codec, level, workFactor, allocator)))
+        return NULL;
+    job->streaming = 1;
+    if (!job->split && !bsdiff_EncoderInit(&job->encoder, codec, job->level, workFactor, sizeHint, allocator)) {
+        destroyJob(job);
+        return NULL;
+    }
+    return job;
+}
+
+// 把piece中已经凑满的len字节作为一个任务提交，剩下的数据移到新的piece中
+static int submitPiece(bsdiff_pcompress *job, size_t len)
+{
+    blockTask *task;
+    unsigned char *rest = NULL;
+    size_t restLen = job->pieceLen - len;
+
+    // 正在压缩的block太多时先等一等，这样缓存的原始数据不超过线程数两倍个block
+    waitTasks(job, 2 * (size_t)bsdiff_PoolThreads(job->pool));
+
+    if (restLen) {
+        if (!(rest = (unsigned char*)bsdiff_Alloc(job->allocator, restLen + PIECE_STEP)))
+            return 0;
+        memcpy(rest, job->piece + len, restLen);
+    }
+    if (!(task = addTask(job, job->piece, len))) {
+        bsdiff_Free(job->allocator, rest);
+        return 0;
+    }
+    task->owned = job->piece;
+    job->piece = rest;
+    job->pieceLen = restLen;
+    job->pieceCapacity = restLen ? restLen + PIECE_STEP : 0;
+    job->scanned = 0;
+    rle1Reset(&job->rle);
+    bsdiff_PoolSubmit(job->pool, compressTask, task);
+    return 1;
+}
+
+int bsdiff_PCompressWrite(bsdiff_pcompress *job, const unsigned char *data, size_t len)
+{
+    unsigned char *newPiece;
+    size_t n, end;
+    int nblockMax = 100000 * job->level - 19;
+
+    if (!job->ok)
+        return 0;
+    if (!job->split)
+        return job->ok = bsdiff_EncoderWrite(&job->encoder, data, len);
+
+    while (len > 0) {
+        n = MIN(len, PIECE_STEP);
+        if (job->pieceLen + n > job->pieceCapacity) {
+            if (!(newPiece = (unsigned char*)bsdiff_Alloc(job->allocator, job->pieceLen + n + PIECE_STEP)))
+                return job->ok = 0;
+            if (job->pieceLen)
+                memcpy(newPiece, job->piece, job->pieceLen);
+            bsdiff_Free(job->allocator, job->piece);
+            job->piece = newPiece;
+            job->pieceCapacity = job->pieceLen + n + PIECE_STEP;
+        }
+        memcpy(job->piece + job->pieceLen, data, n);
+        job->pieceLen += n;
+        data += n;
+        len -= n;
+
+        // 一次追加的数据可能跨过不止一个block的边界
+        while ((end = rle1Feed(&job->rle, job->piece, job->scanned, job->pieceLen, nblockMax)) < job->pieceLen) {
+            if (!submitPiece(job, end))
+                return job->ok = 0;
+        }
+        job->scanned = job->pieceLen;
+    }
+    return 1;
+}
+
+int bsdiff_PCompressFinish(bsdiff_pcompress *job, unsigned char **out, bsdiff_off_t *outLen)
+{
+    int ok = job->ok;
+    size_t i;
+
+    *out = NULL;
+    if (job->streaming && !job->split) {
+        ok = ok && bsdiff_EncoderFinish(&job->encoder, out, outLen);
+        destroyJob(job);
+        return ok;
+    }
+
+    // 流式切分时最后一个block（没有数据时也要有一个空的流）
+    if (ok && job->streaming && (job->pieceLen || job->numTasks == 0))
+        ok = submitPiece(job, job->pieceLen);
+
+    waitTasks(job, 0);
+    for (i = 0; i < job->numTasks; ++i)
+        ok = ok && job->tasks[i]->ok;
+
+    if (ok && job->numTasks == 1) {
+        *out = job->tasks[0]->out;
+        *outLen = job->tasks[0]->outLen;
+        job->tasks[0]->out = NULL;
+    } else if (ok && !concatStreams(job, out, outLen)) {
+        // 不应该发生：切分的位置与串行压缩不一致时退回到串行压缩（流式写入的数据已经释放，只能失败）
+        ok = !job->streaming && bsdiff_Compress(job->codec, job->level, job->workFactor, job->data, job->len,
+                                                job->allocator, out, outLen);
+    }
+
+    destroyJob(job);
+    return ok;
+}
+
+//------------------------------------------------------------------------------
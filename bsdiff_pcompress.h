@@ -0,0 +1,54 @@
+#ifndef __BSDIFF_PCOMPRESS_H__
+#define __BSDIFF_PCOMPRESS_H__
+
+#include "bsdiff_misc.h"
+#include "bsdiff_thread.h"
+
+//------------------------------------------------------------------------------
+
+// 在线程池上压缩一个block。bzip2按串行压缩时完全相同的位置切成900KB左右的小block分别压缩，
+// 最后按bit拼接成一个bzip2流（重新计算combined CRC），结果与bsdiff_Compress逐字节相同，
+// 因此任何bzip2解压器都能直接解压；其它codec整体作为一个任务，与别的block同时压缩
+typedef struct bsdiff_pcompress bsdiff_pcompress;
+
+// 提交压缩任务，data在bsdiff_PCompressFinish之前必须保持有效；内存不足时返回NULL
+// pool为NULL时不切分，任务在调用线程中直接执行
+bsdiff_pcompress* bsdiff_PCompressSubmit(
+    bsdiff_pool *pool,
+    int codec,
+    int level,
+    int workFactor,
+    const unsigned char *data,
+    bsdiff_off_t len,
+    const bsdiff_allocator *allocator
+    );
+
+// 流式压缩：数据由bsdiff_PCompressWrite分多次给出（会被复制）。bzip2在线程池上时每凑满一个block
+// 就提交压缩，正在压缩的block不超过线程数的两倍；其它情况在调用线程中用bsdiff_encoder边写边压缩。
+// sizeHint的含义见bsdiff_EncoderInit，给出的是准确长度时结果与bsdiff_PCompressSubmit完全相同
+bsdiff_pcompress* bsdiff_PCompressCreate(
+    bsdiff_pool *pool,
+    int codec,
+    int level,
+    int workFactor,
+    bsdiff_off_t sizeHint,
+    const bsdiff_allocator *allocator
+    );
+
+// 出错（内存不足或压缩失败）时返回0，之后的写入都会失败，但仍然要调用bsdiff_PCompressFinish
+int bsdiff_PCompressWrite(
+    bsdiff_pcompress *job,
+    const unsigned char *data,
+    size_t len
+    );
+
+// 等待job的所有任务完成，取得压缩结果（从allocator分配，由调用者释放）并释放job
+int bsdiff_PCompressFinish(
+    bsdiff_pcompress *job,
+    unsigned char **out,
+    bsdiff_off_t *outLen
+    );
+
+//------------------------------------------------------------------------------
+
+#endif // !__BSDIFF_PCOMPRESS_H__
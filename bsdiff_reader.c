@@ -0,0 +1,935 @@
+#include "bsdiff_reader.h"
+#include "bsdiff_format.h"
+#include "bsdiff_simd.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+  #include <io.h>
+  #include <fcntl.h>
+#endif
+
+//------------------------------------------------------------------------------
+
+// 文件来源时每个游标的输入缓冲大小
+#define CURSOR_BUF_SIZE  (64 * 1024)
+
+// 把不能seek的流读入内存，直到末尾或者读够limit字节；*capacity为src->buf的大小
+static int slurp(bsdiff_source *src, FILE *fp, size_t *capacity, bsdiff_off_t limit)
+{
+    unsigned char *buf;
+    size_t n;
+
+    while (src->size < limit) {
+        if ((size_t)src->size == *capacity) {
+            *capacity = *capacity ? *capacity * 2 : CURSOR_BUF_SIZE;
+            if (*capacity <= (size_t)src->size || !(buf = (unsigned char*)realloc(src->buf, *capacity)))
+                return 0;
+            src->buf = buf;
+        }
+        n = *capacity - (size_t)src->size;
+        if ((bsdiff_off_t)n > limit - src->size)
+            n = (size_t)(limit - src->size);
+        if (!(n = fread(src->buf + src->size, 1, n, fp)))
+            break;
+        src->size += n;
+    }
+    if (ferror(fp))
+        return 0;
+    src->data = src->buf ? src->buf : (const unsigned char*)"";
+    return 1;
+}
+
+// streamable非0时不能seek的流式patch只读入文件头，其余部分留在管道中
+static int openFile(bsdiff_source *src, const char *path, int useMapping, int streamable)
+{
+    bsdiff_header header;
+    size_t capacity = 0;
+    FILE *fp;
+    int isStdin = (strcmp(path, "-") == 0);
+
+    memset(src, 0, sizeof(bsdiff_source));
+
+    if (!isStdin && useMapping && bsdiff_MapFile(path, &src->map)) {
+        src->data = src->map.data;
+        src->size = (bsdiff_off_t)src->map.size;
+        return 1;
+    }
+
+    if (isStdin) {
+        fp = stdin;
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    } else if (!(fp = fopen(path, "rb"))) {
+        return 0;
+    }
+
+    // 能seek的文件用同一个句柄按位置读取，否则只能整个读入内存（流式patch除外）
+    if (!isStdin && bsdiff_GetFileSize(fp, &src->size)) {
+        src->fp = fp;
+        src->filePos = 0;
+        return 1;
+    }
+    src->size = 0;
+    if (streamable) {
+        // 先读不带校验和的文件头，flags中有BSDIFF_FLAG_CHECKSUM时再读后面的校验和；
+        // 读多了也没关系，header.size与已读的长度不一致时按普通的patch整个读入
+        if (!slurp(src, fp, &capacity, BSDIFF_HEADER_MAX - BSDIFF_CHECKSUM_SIZE) ||
+            (src->size > 35 && (src->data[35] & BSDIFF_FLAG_CHECKSUM) && 
+             !slurp(src, fp, &capacity, BSDIFF_HEADER_MAX))) {
+            if (!isStdin)
+                fclose(fp);
+            bsdiff_SourceClose(src);
+            return 0;
+        }
+        if (bsdiff_HeaderRead(src->data, (size_t)src->size, &header) && (header.flags & BSDIFF_FLAG_STREAM) &&
+            header.size == src->size) {
+            src->pipe = fp;
+            src->ownsPipe = !isStdin;
+            return 1;
+        }
+    }
+    if (!slurp(src, fp, &capacity, ((bsdiff_off_t)1 << 62))) {
+        if (!isStdin)
+            fclose(fp);
+        bsdiff_SourceClose(src);
+        return 0;
+    }
+    if (!isStdin)
+        fclose(fp);
+    return 1;
+}
+
+int bsdiff_SourceOpenFile(bsdiff_source *src, const char *path, int useMapping)
+{
+    return openFile(src, path, useMapping, 0);
+}
+
+int bsdiff_SourceOpenPatch(bsdiff_source *src, const char *path, int useMapping)
+{
+    return openFile(src, path, useMapping, 1);
+}
+
+void bsdiff_SourceOpenMemory(bsdiff_source *src, const void *data, size_t size)
+{
+    memset(src, 0, sizeof(bsdiff_source));
+    src->data = size ? (const unsigned char*)data : (const unsigned char*)"";
+    src->size = (bsdiff_off_t)size;
+}
+
+int bsdiff_SourceSkip(bsdiff_source *src, bsdiff_off_t offset)
+{
+    if (offset < 0 || offset > src->size || src->pipe)
+        return 0;
+    if (src->data) {
+        src->data += offset;
+    } else {
+        src->base += offset;
+        src->filePos -= offset;
+    }
+    src->size -= offset;
+    return 1;
+}
+
+void bsdiff_SourceClose(bsdiff_source *src)
+{
+    bsdiff_UnmapFile(&src->map);
+    if (src->fp)
+        fclose(src->fp);
+    if (src->pipe && src->ownsPipe)
+        fclose(src->pipe);
+    free(src->buf);
+    memset(src, 0, sizeof(bsdiff_source));
+}
+
+int bsdiff_SourceRead(bsdiff_source *src, bsdiff_off_t pos, unsigned char *buf, size_t len)
+{
+    if (pos < 0 || pos > src->size || (bsdiff_off_t)len > src->size - pos)
+        return 0;
+
+    if (src->data) {
+        memcpy(buf, src->data + pos, len);
+        return 1;
+    }
+
+    if (src->filePos != pos) {
+        if (bsdiff_Seek(src->fp, src->base + pos, SEEK_SET))
+            return 0;
+        src->filePos = pos;
+    }
+    if (!bsdiff_ReadFile(src->fp, buf, len))
+        return 0;
+    src->filePos += len;
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+
+// 最多同时解压这么多个帧（每个工作线程两个），在apply循环读取之前准备好
+#define SLOTS_PER_THREAD  2
+
+#define SLOT_FREE     0
+#define SLOT_BUSY     1
+#define SLOT_DONE     2
+
+typedef struct frameSlot {
+    bsdiff_frames *owner;
+    size_t frame;
+    const unsigned char *in;    // 压缩数据：指向内存来源，或者文件来源时读入的comp
+    unsigned char *comp;
+    size_t compCapacity;
+    unsigned char *raw;
+    size_t rawCapacity;
+    int state;                  // SLOT_xxx，由owner->mutex保护
+    int ok;
+} frameSlot;
+
+struct bsdiff_frames {
+    bsdiff_source *src;
+    int codec, small;
+    bsdiff_pool *pool;
+    const bsdiff_allocator *allocator;
+    size_t numFrames;
+    bsdiff_off_t *compPos;      // 各帧压缩数据在来源中的位置，numFrames + 1个
+    bsdiff_off_t *rawPos;       // 各帧在解压后数据中的位置，numFrames + 1个
+    frameSlot *slots;
+    size_t numSlots;
+    size_t current;             // 正在读取的帧
+    size_t currentPos;          // 当前帧中已经读取的字节数
+    bsdiff_mutex mutex;
+    bsdiff_cond cond;
+};
+
+// 解压一整帧，解压出的字节数必须恰好是rawLen；out要有rawLen + 1字节
+static int decodeWhole(int codec, int small, const bsdiff_allocator *allocator, const unsigned char *in, 
+                       size_t inLen, unsigned char *out, size_t rawLen)
+{
+    bsdiff_decoder dec;
+    size_t outLen = rawLen + 1, inBefore, outBefore;
+    int ret;
+
+    if (!bsdiff_DecoderInit(&dec, codec, small, allocator))
+        return 0;
+    do {
+        inBefore = inLen;
+        outBefore = outLen;
+        ret = bsdiff_DecoderRun(&dec, &in, &inLen, &out, &outLen);
+        // 既没有消耗输入也没有产生输出：数据被截断了
+        if (ret == BSDIFF_CODEC_OK && inLen == inBefore && outLen == outBefore)
+            ret = BSDIFF_CODEC_ERROR;
+    } while (ret == BSDIFF_CODEC_OK);
+    bsdiff_DecoderEnd(&dec);
+    return ret == BSDIFF_CODEC_END && outLen == 1;
+}
+
+static int decodeFrame(bsdiff_frames *fr, frameSlot *slot)
+{
+    return decodeWhole(fr->codec, fr->small, fr->allocator, slot->in, 
+                       (size_t)(fr->compPos[slot->frame + 1] - fr->compPos[slot->frame]), slot->raw,
+                       (size_t)(fr->rawPos[slot->frame + 1] - fr->rawPos[slot->frame]));
+}
+
+static void frameTask(void *arg)
+{
+    frameSlot *slot = (frameSlot*)arg;
+    bsdiff_frames *fr = slot->owner;
+    int ok = decodeFrame(fr, slot);
+
+    bsdiff_MutexLock(&fr->mutex);
+    slot->ok = ok;
+    slot->state = SLOT_DONE;
+    bsdiff_CondBroadcast(&fr->cond);
+    bsdiff_MutexUnlock(&fr->mutex);
+}
+
+// 按需扩大slot的buffer（从allocator分配，不保留原来的内容）
+static int reserve(const bsdiff_allocator *allocator, unsigned char **buf, size_t *capacity, size_t size)
+{
+    if (*capacity >= size)
+        return 1;
+    bsdiff_Free(allocator, *buf);
+    *capacity = 0;
+    if (!(*buf = (unsigned char*)bsdiff_Alloc(allocator, size)))
+        return 0;
+    *capacity = size;
+    return 1;
+}
+
+// 把第frame帧放到它的slot中开始解压；文件来源的压缩数据在这里（调用线程中）读入
+static int submitFrame(bsdiff_frames *fr, size_t frame)
+{
+    frameSlot *slot = &fr->slots[frame % fr->numSlots];
+    size_t compLen = (size_t)(fr->compPos[frame + 1] - fr->compPos[frame]);
+    size_t rawLen = (size_t)(fr->rawPos[frame + 1] - fr->rawPos[frame]);
+
+    slot->frame = frame;
+    if (!reserve(fr->allocator, &slot->raw, &slot->rawCapacity, rawLen + 1))
+        return 0;
+    if (fr->src->data) {
+        slot->in = fr->src->data + fr->compPos[frame];
+    } else {
+        if (!reserve(fr->allocator, &slot->comp, &slot->compCapacity, compLen + 1) ||
+            !bsdiff_SourceRead(fr->src, fr->compPos[frame], slot->comp, compLen))
+            return 0;
+        slot->in = slot->comp;
+    }
+    slot->state = SLOT_BUSY;
+    bsdiff_PoolSubmit(fr->pool, frameTask, slot);
+    return 1;
+}
+
+// 等所有正在解压的帧结束
+static void drainFrames(bsdiff_frames *fr)
+{
+    size_t i;
+
+    bsdiff_MutexLock(&fr->mutex);
+    for (i = 0; i < fr->numSlots; ++i) {
+        while (fr->slots[i].state == SLOT_BUSY)
+            bsdiff_CondWait(&fr->cond, &fr->mutex);
+        fr->slots[i].state = SLOT_FREE;
+    }
+    bsdiff_MutexUnlock(&fr->mutex);
+}
+
+// 从第frame帧开始，把接下来的numSlots个帧提交解压
+static int startFrames(bsdiff_frames *fr, size_t frame)
+{
+    size_t i;
+
+    for (i = frame; i < fr->numFrames && i < frame + fr->numSlots; ++i) {
+        if (!submitFrame(fr, i))
+            return 0;
+    }
+    return 1;
+}
+
+static void closeFrames(bsdiff_frames *fr)
+{
+    size_t i;
+
+    drainFrames(fr);
+    for (i = 0; i < fr->numSlots; ++i) {
+        bsdiff_Free(fr->allocator, fr->slots[i].comp);
+        bsdiff_Free(fr->allocator, fr->slots[i].raw);
+    }
+    bsdiff_Free(fr->allocator, fr->slots);
+    bsdiff_Free(fr->allocator, fr->compPos);
+    bsdiff_Free(fr->allocator, fr->rawPos);
+    bsdiff_MutexDestroy(&fr->mutex);
+    bsdiff_CondDestroy(&fr->cond);
+    bsdiff_Free(fr->allocator, fr);
+}
+
+// 读取并校验帧索引，然后开始解压最前面的几帧
+static bsdiff_frames* openFrames(bsdiff_source *src, bsdiff_off_t start, bsdiff_off_t end, int codec,
+                                 int small, bsdiff_pool *pool, const bsdiff_allocator *allocator)
+{
+    bsdiff_frames *fr;
+    unsigned char buf[16];
+    bsdiff_off_t numFrames, compLen, rawLen;
+    size_t i;
+
+    if (end - start < 8 || !bsdiff_SourceRead(src, start, buf, 8))
+        return NULL;
+    numFrames = bsdiff_ReadOffset(buf);
+    if (numFrames < 0 || numFrames > (end - start - 8) / 16)
+        return NULL;
+
+    if (!(fr = (bsdiff_frames*)bsdiff_Alloc(allocator, sizeof(bsdiff_frames))))
+        return NULL;
+    memset(fr, 0, sizeof(bsdiff_frames));
+    fr->src = src;
+    fr->codec = codec;
+    fr->small = small;
+    fr->pool = pool;
+    fr->allocator = allocator;
+    fr->numFrames = (size_t)numFrames;
+    fr->numSlots = pool ? (size_t)bsdiff_PoolThreads(pool) * SLOTS_PER_THREAD : 1;
+    bsdiff_MutexInit(&fr->mutex);
+    bsdiff_CondInit(&fr->cond);
+
+    fr->compPos = (bsdiff_off_t*)bsdiff_Alloc(allocator, (fr->numFrames + 1) * sizeof(bsdiff_off_t));
+    fr->rawPos = (bsdiff_off_t*)bsdiff_Alloc(allocator, (fr->numFrames + 1) * sizeof(bsdiff_off_t));
+    fr->slots = (frameSlot*)bsdiff_Alloc(allocator, fr->numSlots * sizeof(frameSlot));
+    if (!fr->compPos || !fr->rawPos || !fr->slots) {
+        if (fr->slots)
+            memset(fr->slots, 0, fr->numSlots * sizeof(frameSlot));
+        else
+            fr->numSlots = 0;
+        closeFrames(fr);
+        return NULL;
+    }
+    memset(fr->slots, 0, fr->numSlots * sizeof(frameSlot));
+    for (i = 0; i < fr->numSlots; ++i)
+        fr->slots[i].owner = fr;
+
+    // 帧数据紧跟在索引后面，各帧的长度加起来必须正好到达end
+    fr->compPos[0] = start + 8 + 16 * numFrames;
+    fr->rawPos[0] = 0;
+    for (i = 0; i < fr->numFrames; ++i) {
+        if (!bsdiff_SourceRead(src, start + 8 + 16 * (bsdiff_off_t)i, buf, 16)) {
+            closeFrames(fr);
+            return NULL;
+        }
+        compLen = bsdiff_ReadOffset(buf);
+        rawLen = bsdiff_ReadOffset(buf + 8);
+        if (compLen < 0 || compLen > end - fr->compPos[i] || rawLen <= 0 || rawLen > BSDIFF_FRAME_MAX) {
+            closeFrames(fr);
+            return NULL;
+        }
+        fr->compPos[i + 1] = fr->compPos[i] + compLen;
+        fr->rawPos[i + 1] = fr->rawPos[i] + rawLen;
+    }
+    if (fr->compPos[fr->numFrames] != end || !startFrames(fr, 0)) {
+        closeFrames(fr);
+        return NULL;
+    }
+    return fr;
+}
+
+static int readFrames(bsdiff_frames *fr, unsigned char *buf, bsdiff_off_t len)
+{
+    frameSlot *slot;
+    size_t n, rawLen;
+    int ok;
+
+    while (len > 0) {
+        if (fr->current >= fr->numFrames)
+            return 0;
+
+        // 等当前帧解压完成
+        slot = &fr->slots[fr->current % fr->numSlots];
+        bsdiff_MutexLock(&fr->mutex);
+        while (slot->state == SLOT_BUSY)
+            bsdiff_CondWait(&fr->cond, &fr->mutex);
+        ok = slot->state == SLOT_DONE && slot->ok;
+        bsdiff_MutexUnlock(&fr->mutex);
+        if (!ok)
+            return 0;
+
+        rawLen = (size_t)(fr->rawPos[fr->current + 1] - fr->rawPos[fr->current]);
+        n = rawLen - fr->currentPos;
+        if ((bsdiff_off_t)n > len)
+            n = (size_t)len;
+        memcpy(buf, slot->raw + fr->currentPos, n);
+        buf += n;
+        len -= n;
+        fr->currentPos += n;
+
+        // 当前帧读完了，它的slot留给后面第numSlots帧
+        if (fr->currentPos == rawLen) {
+            slot->state = SLOT_FREE;
+            fr->currentPos = 0;
+            ++fr->current;
+            if (fr->current + fr->numSlots - 1 < fr->numFrames && 
+                !submitFrame(fr, fr->current + fr->numSlots - 1))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+static int seekFrames(bsdiff_frames *fr, bsdiff_off_t pos)
+{
+    size_t lo = 0, hi = fr->numFrames, mid;
+
+    if (pos < 0 || pos > fr->rawPos[fr->numFrames])
+        return 0;
+
+    // 二分查找pos所在的帧（pos在末尾时落到numFrames上）
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (fr->rawPos[mid + 1] <= pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    drainFrames(fr);
+    fr->current = lo;
+    fr->currentPos = (size_t)(pos - fr->rawPos[lo]);
+    return startFrames(fr, lo);
+}
+
+//------------------------------------------------------------------------------
+
+// 未分帧的流在pool上提前解压（流水线）：解码器按顺序把数据解压到一圈PIPE_CHUNKS个chunk中，
+// 读取的一方只做复制。同一个流同时最多只有一个任务，任务在没有空的chunk时结束，读取的一方
+// 腾出chunk以后再提交；任务从不等待读取的一方，所以pool中的线程再少也不会死锁
+#define PIPE_CHUNKS      4
+#define PIPE_CHUNK_SIZE  (256 * 1024)
+
+struct bsdiff_pipe {
+    bsdiff_cursor *cursor;
+    bsdiff_pool *pool;
+    unsigned char *buf;         // PIPE_CHUNKS个chunk
+    size_t fill[PIPE_CHUNKS];   // 各chunk中解压出的字节数
+    size_t head, tail;          // 下一个要解压的和正在读取的chunk（不取模），由mutex保护
+    int running;                // 有任务在解压，由mutex保护
+    int finished;               // 解码器到了流的末尾或者出错，由mutex保护
+    const unsigned char *next;  // 以下只由读取的一方使用：当前chunk中还没有读取的数据
+    size_t avail;
+    int reading;                // 正在读取tail这个chunk
+    bsdiff_mutex mutex;
+    bsdiff_cond cond;
+};
+
+static int decodeStream(bsdiff_cursor *cursor, unsigned char **buf, size_t *remain);
+
+static void pipeTask(void *arg)
+{
+    bsdiff_pipe *p = (bsdiff_pipe*)arg;
+    unsigned char *buf;
+    size_t slot, remain;
+    int ok;
+
+    for (;;) {
+        bsdiff_MutexLock(&p->mutex);
+        if (p->head - p->tail == PIPE_CHUNKS || p->finished) {
+            p->running = 0;
+            bsdiff_CondBroadcast(&p->cond);
+            bsdiff_MutexUnlock(&p->mutex);
+            return;
+        }
+        slot = p->head % PIPE_CHUNKS;
+        bsdiff_MutexUnlock(&p->mutex);
+
+        buf = p->buf + slot * PIPE_CHUNK_SIZE;
+        remain = PIPE_CHUNK_SIZE;
+        ok = decodeStream(p->cursor, &buf, &remain);
+
+        bsdiff_MutexLock(&p->mutex);
+        p->fill[slot] = PIPE_CHUNK_SIZE - remain;
+        ++p->head;
+        if (!ok || p->cursor->streamEnd)
+            p->finished = 1;
+        bsdiff_CondBroadcast(&p->cond);
+        bsdiff_MutexUnlock(&p->mutex);
+    }
+}
+
+// 没有任务在解压、还有空的chunk时提交一个任务；调用时持有mutex
+static void pipeKick(bsdiff_pipe *p)
+{
+    if (p->running || p->finished || p->head - p->tail == PIPE_CHUNKS)
+        return;
+    p->running = 1;
+    bsdiff_MutexUnlock(&p->mutex);
+    bsdiff_PoolSubmit(p->pool, pipeTask, p);
+    bsdiff_MutexLock(&p->mutex);
+}
+
+static bsdiff_pipe* openPipe(bsdiff_cursor *cursor, bsdiff_pool *pool, const bsdiff_allocator *allocator)
+{
+    bsdiff_pipe *p;
+
+    if (!(p = (bsdiff_pipe*)bsdiff_Alloc(allocator, sizeof(bsdiff_pipe))))
+        return NULL;
+    memset(p, 0, sizeof(bsdiff_pipe));
+    if (!(p->buf = (unsigned char*)bsdiff_Alloc(allocator, PIPE_CHUNKS * PIPE_CHUNK_SIZE))) {
+        bsdiff_Free(allocator, p);
+        return NULL;
+    }
+    p->cursor = cursor;
+    p->pool = pool;
+    bsdiff_MutexInit(&p->mutex);
+    bsdiff_CondInit(&p->cond);
+    bsdiff_MutexLock(&p->mutex);
+    pipeKick(p);
+    bsdiff_MutexUnlock(&p->mutex);
+    return p;
+}
+
+static int readPipe(bsdiff_pipe *p, unsigned char *buf, size_t len)
+{
+    size_t n;
+
+    while (len > 0) {
+        // 当前chunk读完了才加锁：换到下一个chunk，等它解压出来
+        if (p->avail == 0) {
+            bsdiff_MutexLock(&p->mutex);
+            if (p->reading) {
+                p->reading = 0;
+                ++p->tail;
+                pipeKick(p);
+            }
+            while (p->tail == p->head && !p->finished) {
+                pipeKick(p);
+                if (p->tail == p->head && !p->finished)
+                    bsdiff_CondWait(&p->cond, &p->mutex);
+            }
+            if (p->tail == p->head) {
+                bsdiff_MutexUnlock(&p->mutex);
+                return 0;
+            }
+            p->reading = 1;
+            p->next = p->buf + p->tail % PIPE_CHUNKS * PIPE_CHUNK_SIZE;
+            p->avail = p->fill[p->tail % PIPE_CHUNKS];
+            bsdiff_MutexUnlock(&p->mutex);
+            continue;
+        }
+        n = len < p->avail ? len : p->avail;
+        memcpy(buf, p->next, n);
+        buf += n;
+        len -= n;
+        p->next += n;
+        p->avail -= n;
+    }
+    return 1;
+}
+
+// 等正在解压的任务结束，解码器的状态由游标释放
+static void closePipe(bsdiff_pipe *p, const bsdiff_allocator *allocator)
+{
+    bsdiff_MutexLock(&p->mutex);
+    p->finished = 1;
+    while (p->running)
+        bsdiff_CondWait(&p->cond, &p->mutex);
+    bsdiff_MutexUnlock(&p->mutex);
+    bsdiff_MutexDestroy(&p->mutex);
+    bsdiff_CondDestroy(&p->cond);
+    bsdiff_Free(allocator, p->buf);
+    bsdiff_Free(allocator, p);
+}
+
+//------------------------------------------------------------------------------
+
+// 流式patch的一条帧记录；提前到达、还没有被对应的游标取走的记录按block排成队列
+typedef struct streamRecord {
+    struct streamRecord *next;
+    unsigned char *comp;
+    size_t compLen, rawLen;
+} streamRecord;
+
+struct bsdiff_demux {
+    bsdiff_source *src;
+    bsdiff_off_t pos;                   // 不是管道来源时下一条记录在来源中的位置
+    streamRecord *head[3], *tail[3];
+    bsdiff_off_t bytes[3];
+    const bsdiff_allocator *allocator;
+};
+
+// 一个block的游标：每次取一帧整个解压
+struct bsdiff_stream {
+    bsdiff_demux *demux;
+    int block, codec, small;
+    unsigned char *raw;
+    size_t rawCapacity, rawLen, rawPos;
+};
+
+static void freeRecord(bsdiff_demux *d, streamRecord *r)
+{
+    bsdiff_Free(d->allocator, r->comp);
+    bsdiff_Free(d->allocator, r);
+}
+
+// 按顺序读取len字节，管道来源直接从管道中读
+static int demuxRead(bsdiff_demux *d, unsigned char *buf, size_t len)
+{
+    if (d->src->pipe)
+        return bsdiff_ReadFile(d->src->pipe, buf, len);
+    if (!bsdiff_SourceRead(d->src, d->pos, buf, len))
+        return 0;
+    d->pos += len;
+    return 1;
+}
+
+// 取出block的下一帧：队列中没有时按顺序读取记录，别的block的记录放进它们的队列；
+// 读到末尾或者记录无效时返回NULL
+static streamRecord* demuxNext(bsdiff_demux *d, int block)
+{
+    unsigned char head[BSDIFF_STREAM_RECORD];
+    streamRecord *r;
+    bsdiff_off_t compLen, rawLen;
+    int b;
+
+    for (;;) {
+        if ((r = d->head[block]) != NULL) {
+            d->head[block] = r->next;
+            return r;
+        }
+        if (!demuxRead(d, head, sizeof(head)))
+            return NULL;
+        b = head[0];
+        compLen = bsdiff_ReadOffset(head + 1);
+        rawLen = bsdiff_ReadOffset(head + 9);
+        // 压缩后的一帧不会比原始数据大很多，损坏的长度不至于分配过多的内存
+        if (b > 2 || rawLen <= 0 || rawLen > BSDIFF_FRAME_MAX || compLen < 0 || compLen > rawLen + rawLen / 8 + 4096)
+            return NULL;
+        if (!(r = (streamRecord*)bsdiff_Alloc(d->allocator, sizeof(streamRecord))))
+            return NULL;
+        memset(r, 0, sizeof(streamRecord));
+        r->compLen = (size_t)compLen;
+        r->rawLen = (size_t)rawLen;
+        if (!(r->comp = (unsigned char*)bsdiff_Alloc(d->allocator, r->compLen + 1)) || 
+            !demuxRead(d, r->comp, r->compLen)) {
+            freeRecord(d, r);
+            return NULL;
+        }
+        d->bytes[b] += BSDIFF_STREAM_RECORD + compLen;
+        if (b == block)
+            return r;
+        if (d->head[b])
+            d->tail[b]->next = r;
+        else
+            d->head[b] = r;
+        d->tail[b] = r;
+    }
+}
+
+bsdiff_demux* bsdiff_DemuxOpen(bsdiff_source *src, bsdiff_off_t start, const bsdiff_allocator *allocator)
+{
+    bsdiff_demux *d;
+
+    if (!(d = (bsdiff_demux*)bsdiff_Alloc(allocator, sizeof(bsdiff_demux))))
+        return NULL;
+    memset(d, 0, sizeof(bsdiff_demux));
+    d->src = src;
+    d->pos = start;
+    d->allocator = allocator;
+    return d;
+}
+
+void bsdiff_DemuxClose(bsdiff_demux *demux)
+{
+    streamRecord *r;
+    int b;
+
+    if (!demux)
+        return;
+    for (b = 0; b < 3; ++b) {
+        while ((r = demux->head[b]) != NULL) {
+            demux->head[b] = r->next;
+            freeRecord(demux, r);
+        }
+    }
+    bsdiff_Free(demux->allocator, demux);
+}
+
+bsdiff_off_t bsdiff_DemuxBytes(const bsdiff_demux *demux, int block)
+{
+    return demux->bytes[block];
+}
+
+static int readStream(bsdiff_stream *s, const bsdiff_allocator *allocator, unsigned char *buf, bsdiff_off_t len)
+{
+    streamRecord *r;
+    size_t n;
+    int ok;
+
+    while (len > 0) {
+        if (s->rawPos == s->rawLen) {
+            if (!(r = demuxNext(s->demux, s->block)))
+                return 0;
+            ok = reserve(allocator, &s->raw, &s->rawCapacity, r->rawLen + 1) &&
+                 decodeWhole(s->codec, s->small, allocator, r->comp, r->compLen, s->raw, r->rawLen);
+            s->rawLen = ok ? r->rawLen : 0;
+            s->rawPos = 0;
+            freeRecord(s->demux, r);
+            if (!ok)
+                return 0;
+        }
+        n = s->rawLen - s->rawPos;
+        if ((bsdiff_off_t)n > len)
+            n = (size_t)len;
+        memcpy(buf, s->raw + s->rawPos, n);
+        buf += n;
+        len -= n;
+        s->rawPos += n;
+    }
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+
+int bsdiff_CursorOpen(bsdiff_cursor *cursor, bsdiff_source *src, bsdiff_off_t start, 
+                      bsdiff_off_t end, int codec, int small, int framed, bsdiff_pool *pool,
+                      const bsdiff_allocator *allocator)
+{
+    memset(cursor, 0, sizeof(bsdiff_cursor));
+    if (start < 0 || start > end || end > src->size)
+        return 0;
+
+    cursor->src = src;
+    if (framed)
+        return (cursor->frames = openFrames(src, start, end, codec, small, pool, allocator)) != NULL;
+
+    cursor->pos = start;
+    cursor->end = end;
+    cursor->allocator = allocator;
+    if (!src->data && !(cursor->inBuf = (unsigned char*)bsdiff_Alloc(allocator, CURSOR_BUF_SIZE)))
+        return 0;
+    if (!bsdiff_DecoderInit(&cursor->dec, codec, small, allocator)) {
+        bsdiff_Free(allocator, cursor->inBuf);
+        cursor->inBuf = NULL;
+        return 0;
+    }
+    // 文件来源的fp由几个游标共用，只能在调用线程中读取，这时不做流水线
+    if (pool && src->data && !(cursor->pipe = openPipe(cursor, pool, allocator))) {
+        bsdiff_DecoderEnd(&cursor->dec);
+        return 0;
+    }
+    return 1;
+}
+
+// 补充输入：内存来源直接指向数据，文件来源读到inBuf中
+static int refill(bsdiff_cursor *cursor)
+{
+    bsdiff_off_t n = cursor->end - cursor->pos;
+
+    if (cursor->src->data) {
+        cursor->next = cursor->src->data + cursor->pos;
+    } else {
+        if (n > CURSOR_BUF_SIZE)
+            n = CURSOR_BUF_SIZE;
+        if (!bsdiff_SourceRead(cursor->src, cursor->pos, cursor->inBuf, (size_t)n))
+            return 0;
+        cursor->next = cursor->inBuf;
+    }
+    cursor->avail = (size_t)n;
+    cursor->pos += n;
+    return 1;
+}
+
+// 解压到buf中，直到填满*remain字节或者流结束（cursor->streamEnd）；数据损坏或被截断时返回0
+static int decodeStream(bsdiff_cursor *cursor, unsigned char **buf, size_t *remain)
+{
+    size_t before, availBefore;
+    int ret;
+
+    while (*remain > 0) {
+        if (cursor->avail == 0 && cursor->pos < cursor->end && !refill(cursor))
+            return 0;
+
+        before = *remain;
+        availBefore = cursor->avail;
+        ret = bsdiff_DecoderRun(&cursor->dec, &cursor->next, &cursor->avail, buf, remain);
+        if (ret == BSDIFF_CODEC_END) {
+            cursor->streamEnd = 1;
+            break;
+        }
+        if (ret != BSDIFF_CODEC_OK)
+            return 0;
+
+        // 没有新的输入又没有新的输出，说明数据被截断了
+        if (*remain == before && availBefore == 0 && cursor->pos >= cursor->end)
+            return 0;
+    }
+    return 1;
+}
+
+int bsdiff_CursorOpenStream(bsdiff_cursor *cursor, bsdiff_demux *demux, int block, int codec, int small,
+                            const bsdiff_allocator *allocator)
+{
+    memset(cursor, 0, sizeof(bsdiff_cursor));
+    cursor->allocator = allocator;
+    if (!bsdiff_CodecAvailable(codec) ||
+        !(cursor->stream = (bsdiff_stream*)bsdiff_Alloc(allocator, sizeof(bsdiff_stream))))
+        return 0;
+    memset(cursor->stream, 0, sizeof(bsdiff_stream));
+    cursor->stream->demux = demux;
+    cursor->stream->block = block;
+    cursor->stream->codec = codec;
+    cursor->stream->small = small;
+    return 1;
+}
+
+int bsdiff_CursorRead(bsdiff_cursor *cursor, unsigned char *buf, bsdiff_off_t len)
+{
+    size_t remain = (size_t)len;
+
+    if (cursor->stream)
+        return len >= 0 && readStream(cursor->stream, cursor->allocator, buf, len);
+    if (cursor->frames)
+        return len >= 0 && readFrames(cursor->frames, buf, len);
+    if (cursor->pipe)
+        return len >= 0 && readPipe(cursor->pipe, buf, remain);
+    if (len < 0 || (len > 0 && cursor->streamEnd))
+        return 0;
+    return decodeStream(cursor, &buf, &remain) && remain == 0;
+}
+
+int bsdiff_CursorSeek(bsdiff_cursor *cursor, bsdiff_off_t pos)
+{
+    return cursor->frames && seekFrames(cursor->frames, pos);
+}
+
+void bsdiff_CursorClose(bsdiff_cursor *cursor)
+{
+    if (cursor->frames)
+        closeFrames(cursor->frames);
+    if (cursor->pipe)
+        closePipe(cursor->pipe, cursor->allocator);
+    if (cursor->stream) {
+        bsdiff_Free(cursor->allocator, cursor->stream->raw);
+        bsdiff_Free(cursor->allocator, cursor->stream);
+    }
+    bsdiff_DecoderEnd(&cursor->dec);
+    bsdiff_Free(cursor->allocator, cursor->inBuf);
+    memset(cursor, 0, sizeof(bsdiff_cursor));
+}
+
+//------------------------------------------------------------------------------
+
+void bsdiff_ZrleInit(bsdiff_zrle *zrle, bsdiff_cursor *cursor)
+{
+    zrle->cursor = cursor;
+    zrle->zeros = 0;
+    zrle->literal = 0;
+}
+
+// 读一个LEB128编码的长度，超过63位时返回0
+static int readVarint(bsdiff_cursor *cursor, bsdiff_off_t *value)
+{
+    unsigned char b;
+    int shift;
+
+    *value = 0;
+    for (shift = 0; shift < 63; shift += 7) {
+        if (!bsdiff_CursorRead(cursor, &b, 1))
+            return 0;
+        *value |= (bsdiff_off_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return *value >= 0;
+    }
+    return 0;
+}
+
+int bsdiff_ZrleRead(bsdiff_zrle *zrle, unsigned char *buf, bsdiff_off_t len,
+                    const unsigned char *old, bsdiff_off_t oldLen)
+{
+    bsdiff_off_t pos = 0, n, end;
+
+    while (pos < len) {
+        if (zrle->zeros == 0 && zrle->literal == 0) {
+            if (!readVarint(zrle->cursor, &zrle->zeros) || !readVarint(zrle->cursor, &zrle->literal) ||
+                (zrle->zeros == 0 && zrle->literal == 0))
+                return 0;
+        }
+
+        if (zrle->zeros > 0) {
+            // diff为0：old范围内就是old本身，范围外是0
+            n = len - pos < zrle->zeros ? len - pos : zrle->zeros;
+            end = pos + n < oldLen ? pos + n : oldLen;
+            if (end < pos)
+                end = pos;
+            if (end > pos)
+                memcpy(buf + pos, old + pos, (size_t)(end - pos));
+            memset(buf + end, 0, (size_t)(pos + n - end));
+            zrle->zeros -= n;
+        } else {
+            n = len - pos < zrle->literal ? len - pos : zrle->literal;
+            if (!bsdiff_CursorRead(zrle->cursor, buf + pos, n))
+                return 0;
+            end = pos + n < oldLen ? pos + n : oldLen;
+            if (end > pos)
+                bsdiff_AddBytes(buf + pos, old + pos, (size_t)(end - pos));
+            zrle->literal -= n;
+        }
+        pos += n;
+    }
+    return 1;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,182 @@
+#ifndef __BSDIFF_READER_H__
+#define __BSDIFF_READER_H__
+
+#include <stdio.h>
+#include "bsdiff_misc.h"
+#include "bsdiff_codec.h"
+#include "bsdiff_thread.h"
+
+//------------------------------------------------------------------------------
+
+// patch数据的来源：一块内存（映射的文件、读入的管道数据或调用者的buffer），
+// 或者一个可以随机读取的文件句柄。多个解压游标共用同一个来源
+typedef struct bsdiff_source {
+    const unsigned char *data;  // 内存来源时非NULL
+    FILE *fp;                   // 否则按位置从fp读取
+    bsdiff_off_t filePos;       // fp当前的位置，连续读取时不需要seek
+    bsdiff_off_t base;          // fp来源中位置0对应的文件偏移（见bsdiff_SourceSkip）
+    bsdiff_off_t size;
+    bsdiff_mapping map;
+    unsigned char *buf;         // 从管道读入的数据
+    FILE *pipe;                 // 流式patch：buf中只有文件头，其余部分按顺序从这里读取
+    int ownsPipe;
+} bsdiff_source;
+
+// 打开path作为来源：useMapping非0时优先映射；不能映射的普通文件用一个句柄按位置读取；
+// 不能seek的（管道、socket）整个读入内存。path为"-"时表示标准输入
+int bsdiff_SourceOpenFile(
+    bsdiff_source *src,
+    const char *path,
+    int useMapping
+    );
+
+// 与bsdiff_SourceOpenFile相同，但不能seek的流式patch（BSDIFF_FLAG_STREAM）只读入文件头，
+// 其余部分留在src->pipe中，由bsdiff_DemuxOpen按顺序读取，边下载边应用
+int bsdiff_SourceOpenPatch(
+    bsdiff_source *src,
+    const char *path,
+    int useMapping
+    );
+
+// 以调用者的一块内存作为来源，不复制数据
+void bsdiff_SourceOpenMemory(
+    bsdiff_source *src,
+    const void *data,
+    size_t size
+    );
+
+// 跳过来源开头的offset字节，之后的位置都从这里算起（多文件的patch包中嵌入的patch）；
+// 超出来源末尾时返回0。不能用于管道中的流式patch
+int bsdiff_SourceSkip(
+    bsdiff_source *src,
+    bsdiff_off_t offset
+    );
+
+void bsdiff_SourceClose(
+    bsdiff_source *src
+    );
+
+// 从来源的pos处读取len字节，超出来源末尾时返回0
+int bsdiff_SourceRead(
+    bsdiff_source *src,
+    bsdiff_off_t pos,
+    unsigned char *buf,
+    size_t len
+    );
+
+//------------------------------------------------------------------------------
+
+// 解压游标：用codec解压来源中[start, end)范围内的一个压缩流，
+// 或者一个分帧的block（格式见bsdiff_format.h）
+typedef struct bsdiff_frames bsdiff_frames;
+typedef struct bsdiff_pipe bsdiff_pipe;
+typedef struct bsdiff_stream bsdiff_stream;
+
+typedef struct bsdiff_cursor {
+    bsdiff_source *src;
+    bsdiff_frames *frames;      // 分帧时非NULL
+    bsdiff_pipe *pipe;          // 未分帧的流在pool上提前解压时非NULL
+    bsdiff_stream *stream;      // 流式patch中的一个block时非NULL
+    bsdiff_decoder dec;
+    int streamEnd;
+    bsdiff_off_t pos, end;      // 下一次从来源读取的位置和范围的结尾
+    const unsigned char *next;  // 还没有交给解码器的输入
+    size_t avail;
+    unsigned char *inBuf;       // 文件来源时的输入缓冲
+    const bsdiff_allocator *allocator;
+} bsdiff_cursor;
+
+// codec为BSDIFF_CODEC_xxx；small非0时使用省内存的解压方式（见bsdiff_DecoderInit）
+// framed非0时[start, end)是分帧的block，帧在pool上提前解压（pool为NULL时在读取时当场解压）；
+// 未分帧的流在pool不为NULL、来源在内存中时也在pool上提前解压，读取与解压重叠
+// inBuf和解码器的状态都从allocator分配（NULL表示malloc）
+int bsdiff_CursorOpen(
+    bsdiff_cursor *cursor,
+    bsdiff_source *src,
+    bsdiff_off_t start,
+    bsdiff_off_t end,
+    int codec,
+    int small,
+    int framed,
+    bsdiff_pool *pool,
+    const bsdiff_allocator *allocator
+    );
+
+// 恰好解压出len字节时返回1；数据损坏、被截断或流提前结束时返回0
+int bsdiff_CursorRead(
+    bsdiff_cursor *cursor,
+    unsigned char *buf,
+    bsdiff_off_t len
+    );
+
+// 跳到解压后数据的pos处，下一次bsdiff_CursorRead从这里开始；只有分帧的block支持
+int bsdiff_CursorSeek(
+    bsdiff_cursor *cursor,
+    bsdiff_off_t pos
+    );
+
+void bsdiff_CursorClose(
+    bsdiff_cursor *cursor
+    );
+
+//------------------------------------------------------------------------------
+
+// 流式patch（BSDIFF_FLAG_STREAM，格式见bsdiff_format.h）的帧记录从src的start处开始，
+// 管道来源（src->pipe）时从管道中接着读。三个block的游标共用一个bsdiff_demux，
+// 某个游标需要的帧还没到时，先到的别的block的帧在内存中排队
+typedef struct bsdiff_demux bsdiff_demux;
+
+// 内存不足时返回NULL
+bsdiff_demux* bsdiff_DemuxOpen(
+    bsdiff_source *src,
+    bsdiff_off_t start,
+    const bsdiff_allocator *allocator
+    );
+
+// 在它的游标都关闭以后调用；demux为NULL时什么也不做
+void bsdiff_DemuxClose(
+    bsdiff_demux *demux
+    );
+
+// block（0 control，1 diff，2 extra）已经读入的字节数，包括记录头
+bsdiff_off_t bsdiff_DemuxBytes(
+    const bsdiff_demux *demux,
+    int block
+    );
+
+// 读取流式patch中block的游标，每次取一帧在调用线程中解压；只支持bsdiff_CursorRead
+int bsdiff_CursorOpenStream(
+    bsdiff_cursor *cursor,
+    bsdiff_demux *demux,
+    int block,
+    int codec,
+    int small,
+    const bsdiff_allocator *allocator
+    );
+
+//------------------------------------------------------------------------------
+
+// 零游程编码（BSDIFF_FLAG_ZRLE，格式见bsdiff_format.h）的diff block的解码状态，token可以跨越多次读取
+typedef struct bsdiff_zrle {
+    bsdiff_cursor *cursor;
+    bsdiff_off_t zeros, literal;    // 当前token中还没有输出的0和字面字节数
+} bsdiff_zrle;
+
+void bsdiff_ZrleInit(
+    bsdiff_zrle *zrle,
+    bsdiff_cursor *cursor
+    );
+
+// 解码出len字节的diff，与old的前oldLen（<= len）字节相加后放入buf，超出oldLen的部分原样输出
+// 0的部分直接复制old，只有字面字节需要做加法；数据损坏或被截断时返回0
+int bsdiff_ZrleRead(
+    bsdiff_zrle *zrle,
+    unsigned char *buf,
+    bsdiff_off_t len,
+    const unsigned char *old,
+    bsdiff_off_t oldLen
+    );
+
+//------------------------------------------------------------------------------
+
+#endif // !__BSDIFF_READER_H__
@@ -0,0 +1,84 @@
+#include "bsdiff_sa.h"
+#include "bsdiff_diff.h"
+#include "bsdiff_thread.h"
+
+//------------------------------------------------------------------------------
+
+typedef unsigned char u_char;
+
+// 32位元素的实现：old小于2GB时使用，后缀数组只占一半的内存
+#define SA_T         bsdiff_sa32
+#define SA_FN(name)  name##32
+#include "bsdiff_sa_impl.h"
+#undef SA_T
+#undef SA_FN
+
+// 64位元素的实现
+#define SA_T         bsdiff_sa64
+#define SA_FN(name)  name##64
+#include "bsdiff_sa_impl.h"
+#undef SA_T
+#undef SA_FN
+
+//------------------------------------------------------------------------------
+
+size_t bsdiff_SuffixEntrySize(bsdiff_off_t oldSize)
+{
+    return oldSize <= BSDIFF_SA32_MAX_SIZE ? sizeof(bsdiff_sa32) : sizeof(bsdiff_sa64);
+}
+
+unsigned long long bsdiff_SuffixSortMemory(int algorithm, bsdiff_off_t oldSize)
+{
+    unsigned long long n = (unsigned long long)oldSize + 1;
+    size_t entrySize = bsdiff_SuffixEntrySize(oldSize);
+
+    if (algorithm == BSDIFF_SA_AUTO)
+        algorithm = BSDIFF_SA_SAIS;
+
+    // qsufsort：I和V，多线程时还有一个同样大小的K，总是按3个计算；SA-IS：I和每字节1位的类型数组
+    if (algorithm == BSDIFF_SA_QSUFSORT)
+        return n * entrySize * 3;
+    return n * entrySize + n / 8 + 1;
+}
+
+int bsdiff_SuffixSort(int algorithm, void *I, size_t entrySize, const unsigned char *old, 
+                      bsdiff_off_t oldSize, bsdiff_pool *pool, const bsdiff_allocator *allocator)
+{
+    void *V;
+    int ok = 1;
+
+    if (algorithm == BSDIFF_SA_AUTO)
+        algorithm = BSDIFF_SA_SAIS;
+    if (entrySize == sizeof(bsdiff_sa32) && oldSize > BSDIFF_SA32_MAX_SIZE)
+        return 0;
+
+    switch (algorithm) {
+    case BSDIFF_SA_QSUFSORT:
+        // qsufsort需要额外一个与I同样大小的V
+        V = bsdiff_Alloc(allocator, ((size_t)oldSize + 1) * entrySize);
+        if (!V)
+            return 0;
+        if (entrySize == sizeof(bsdiff_sa32)) {
+            if (pool)
+                ok = qsufsort_mt32((bsdiff_sa32*)I, (bsdiff_sa32*)V, old, (bsdiff_sa32)oldSize, pool, allocator);
+            else
+                qsufsort32((bsdiff_sa32*)I, (bsdiff_sa32*)V, old, (bsdiff_sa32)oldSize);
+        } else {
+            if (pool)
+                ok = qsufsort_mt64((bsdiff_sa64*)I, (bsdiff_sa64*)V, old, oldSize, pool, allocator);
+            else
+                qsufsort64((bsdiff_sa64*)I, (bsdiff_sa64*)V, old, oldSize);
+        }
+        bsdiff_Free(allocator, V);
+        return ok;
+
+    case BSDIFF_SA_SAIS:
+    default:
+        // 把old看作末尾带一个最小哨兵的串，长度为oldSize+1，直接在I中完成排序
+        if (entrySize == sizeof(bsdiff_sa32))
+            return sais32(old, NULL, (bsdiff_sa32*)I, (bsdiff_sa32)(oldSize + 1), 256, allocator);
+        return sais64(old, NULL, (bsdiff_sa64*)I, oldSize + 1, 256, allocator);
+    }
+}
+
+//------------------------------------------------------------------------------
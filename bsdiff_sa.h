@@ -0,0 +1,46 @@
+#ifndef __BSDIFF_SA_H__
+#define __BSDIFF_SA_H__
+
+#include <stddef.h>
+#include "bsdiff_misc.h"
+#include "bsdiff_thread.h"
+
+//------------------------------------------------------------------------------
+
+// 后缀数组元素的类型。各算法内部用负数做标记，并且要能表示-(oldSize + 1)，
+// 所以32位元素最多支持BSDIFF_SA32_MAX_SIZE字节的old，更大的old使用64位元素
+typedef int bsdiff_sa32;
+typedef long long bsdiff_sa64;
+
+#define BSDIFF_SA32_MAX_SIZE  0x7FFFFFFE
+
+// 为oldSize字节的old选择后缀数组元素的字节数（4或8）
+size_t bsdiff_SuffixEntrySize(
+    bsdiff_off_t oldSize
+    );
+
+// 为old构建后缀数组I，I共(oldSize + 1)个元素，每个元素entrySize字节
+// I[0]固定为oldSize（空后缀），I[1..oldSize]为old各后缀的字典序排列
+// algorithm取值为BSDIFF_SA_xxx（见bsdiff_diff.h），失败（内存不足）时返回0
+// pool不为NULL时qsufsort使用多线程的倍增排序，结果与单线程完全相同
+// 所有的临时内存都从allocator分配（NULL表示malloc/free）
+int bsdiff_SuffixSort(
+    int algorithm,
+    void *I,
+    size_t entrySize,
+    const unsigned char *old,
+    bsdiff_off_t oldSize,
+    bsdiff_pool *pool,
+    const bsdiff_allocator *allocator
+    );
+
+// bsdiff_SuffixSort为oldSize字节的old构建后缀数组时，I和临时数组一共要分配的内存（字节数，估计值）。
+// 取多线程时的上界，与线程数无关：maxMemory按它切分窗口，线程数不能影响生成的patch
+unsigned long long bsdiff_SuffixSortMemory(
+    int algorithm,
+    bsdiff_off_t oldSize
+    );
+
+//------------------------------------------------------------------------------
+
+#endif // !__BSDIFF_SA_H__
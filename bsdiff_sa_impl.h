@@ -0,0 +1,419 @@
+/* 后缀数组各算法的实现，由bsdiff_sa.c以不同的元素类型包含两次：
+   SA_T        后缀数组（以及qsufsort的V、K）元素的类型
+   SA_FN(name) 给函数名加上与SA_T对应的后缀，避免两份实现重名
+   这里不加include guard。 */
+
+static void SA_FN(split)(SA_T *I, SA_T *V, SA_T start, SA_T len, bsdiff_off_t h)
+{
+	SA_T i,j,k,x,tmp,jj,kk;
+
+	if(len<16) {
+		for(k=start;k<start+len;k+=j) {
+			j=1;x=V[I[k]+h];
+			for(i=1;k+i<start+len;i++) {
+				if(V[I[k+i]+h]<x) {
+					x=V[I[k+i]+h];
+					j=0;
+				};
+				if(V[I[k+i]+h]==x) {
+					tmp=I[k+j];I[k+j]=I[k+i];I[k+i]=tmp;
+					j++;
+				};
+			};
+			for(i=0;i<j;i++) V[I[k+i]]=k+j-1;
+			if(j==1) I[k]=-1;
+		};
+		return;
+	};
+
+	x=V[I[start+len/2]+h];
+	jj=0;kk=0;
+	for(i=start;i<start+len;i++) {
+		if(V[I[i]+h]<x) jj++;
+		if(V[I[i]+h]==x) kk++;
+	};
+	jj+=start;kk+=jj;
+
+	i=start;j=0;k=0;
+	while(i<jj) {
+		if(V[I[i]+h]<x) {
+			i++;
+		} else if(V[I[i]+h]==x) {
+			tmp=I[i];I[i]=I[jj+j];I[jj+j]=tmp;
+			j++;
+		} else {
+			tmp=I[i];I[i]=I[kk+k];I[kk+k]=tmp;
+			k++;
+		};
+	};
+
+	while(jj+j<kk) {
+		if(V[I[jj+j]+h]==x) {
+			j++;
+		} else {
+			tmp=I[jj+j];I[jj+j]=I[kk+k];I[kk+k]=tmp;
+			k++;
+		};
+	};
+
+	if(jj>start) SA_FN(split)(I,V,start,jj-start,h);
+
+	for(i=0;i<kk-jj;i++) V[I[jj+i]]=kk-1;
+	if(jj==kk-1) I[jj]=-1;
+
+	if(start+len>kk) SA_FN(split)(I,V,kk,start+len-kk,h);
+}
+
+static void SA_FN(qsufsort_init)(SA_T *I,SA_T *V, const u_char *old, SA_T oldsize)
+{
+	SA_T buckets[256];
+	SA_T i;
+
+	for(i=0;i<256;i++) buckets[i]=0;
+	for(i=0;i<oldsize;i++) buckets[old[i]]++;
+	for(i=1;i<256;i++) buckets[i]+=buckets[i-1];
+	for(i=255;i>0;i--) buckets[i]=buckets[i-1];
+	buckets[0]=0;
+
+	for(i=0;i<oldsize;i++) I[++buckets[old[i]]]=i;
+	I[0]=oldsize;
+	for(i=0;i<oldsize;i++) V[i]=buckets[old[i]];
+	V[oldsize]=0;
+	for(i=1;i<256;i++) if(buckets[i]==buckets[i-1]+1) I[buckets[i]]=-1;
+	I[0]=-1;
+}
+
+static void SA_FN(qsufsort)(SA_T *I,SA_T *V, const u_char *old, SA_T oldsize)
+{
+	SA_T i,len;
+	bsdiff_off_t h;
+
+	SA_FN(qsufsort_init)(I,V,old,oldsize);
+
+	for(h=1;I[0]!=-(oldsize+1);h+=h) {
+		len=0;
+		for(i=0;i<oldsize+1;) {
+			if(I[i]<0) {
+				len-=I[i];
+				i-=I[i];
+			} else {
+				if(len) I[i-len]=-len;
+				len=V[I[i]]+1-i;
+				SA_FN(split)(I,V,i,len,h);
+				i+=len;
+				len=0;
+			};
+		};
+		if(len) I[i-len]=-len;
+	};
+
+	for(i=0;i<oldsize+1;i++) I[V[i]]=i;
+}
+
+//------------------------------------------------------------------------------
+
+/* 多线程版本的倍增排序。
+   单线程的qsufsort在同一轮中会读到刚被更新过的V，因此各个组之间不能并行处理。
+   这里每一轮分两个阶段：先并行地把每个未排序组成员的排序键V[I[i]+h]取到K中（此时不修改V），
+   再并行地按K对各组做split（只写本组成员的V）。每个任务负责I中一段按组边界对齐的区间，
+   彼此之间没有数据竞争。后缀数组是唯一的，所以结果与qsufsort完全一致。
+   代价是多一个(oldsize + 1)大小的K。 */
+
+typedef struct SA_FN(qsufsortRange) {
+	SA_T *I, *V, *K;
+	SA_T start, end;
+	bsdiff_off_t h;
+} SA_FN(qsufsortRange);
+
+static void SA_FN(splitk)(SA_T *I, SA_T *K, SA_T *V, SA_T start, SA_T len)
+{
+	SA_T i,j,k,x,tmp,jj,kk;
+
+	if(len<16) {
+		for(k=start;k<start+len;k+=j) {
+			j=1;x=K[k];
+			for(i=1;k+i<start+len;i++) {
+				if(K[k+i]<x) {
+					x=K[k+i];
+					j=0;
+				};
+				if(K[k+i]==x) {
+					tmp=I[k+j];I[k+j]=I[k+i];I[k+i]=tmp;
+					tmp=K[k+j];K[k+j]=K[k+i];K[k+i]=tmp;
+					j++;
+				};
+			};
+			for(i=0;i<j;i++) V[I[k+i]]=k+j-1;
+			if(j==1) I[k]=-1;
+		};
+		return;
+	};
+
+	x=K[start+len/2];
+	jj=0;kk=0;
+	for(i=start;i<start+len;i++) {
+		if(K[i]<x) jj++;
+		if(K[i]==x) kk++;
+	};
+	jj+=start;kk+=jj;
+
+	i=start;j=0;k=0;
+	while(i<jj) {
+		if(K[i]<x) {
+			i++;
+		} else if(K[i]==x) {
+			tmp=I[i];I[i]=I[jj+j];I[jj+j]=tmp;
+			tmp=K[i];K[i]=K[jj+j];K[jj+j]=tmp;
+			j++;
+		} else {
+			tmp=I[i];I[i]=I[kk+k];I[kk+k]=tmp;
+			tmp=K[i];K[i]=K[kk+k];K[kk+k]=tmp;
+			k++;
+		};
+	};
+
+	while(jj+j<kk) {
+		if(K[jj+j]==x) {
+			j++;
+		} else {
+			tmp=I[jj+j];I[jj+j]=I[kk+k];I[kk+k]=tmp;
+			tmp=K[jj+j];K[jj+j]=K[kk+k];K[kk+k]=tmp;
+			k++;
+		};
+	};
+
+	if(jj>start) SA_FN(splitk)(I,K,V,start,jj-start);
+
+	for(i=0;i<kk-jj;i++) V[I[jj+i]]=kk-1;
+	if(jj==kk-1) I[jj]=-1;
+
+	if(start+len>kk) SA_FN(splitk)(I,K,V,kk,start+len-kk);
+}
+
+static void SA_FN(qsufsortKeysTask)(void *arg)
+{
+	SA_FN(qsufsortRange) *r=(SA_FN(qsufsortRange)*)arg;
+	SA_T *I=r->I,*V=r->V,*K=r->K;
+	SA_T i,k,len;
+
+	for(i=r->start;i<r->end;) {
+		if(I[i]<0) {
+			i-=I[i];
+		} else {
+			len=V[I[i]]+1-i;
+			for(k=i;k<i+len;k++) K[k]=V[I[k]+r->h];
+			i+=len;
+		};
+	};
+}
+
+static void SA_FN(qsufsortSplitTask)(void *arg)
+{
+	SA_FN(qsufsortRange) *r=(SA_FN(qsufsortRange)*)arg;
+	SA_T *I=r->I,*V=r->V,*K=r->K;
+	SA_T i,len;
+
+	len=0;
+	for(i=r->start;i<r->end;) {
+		if(I[i]<0) {
+			len-=I[i];
+			i-=I[i];
+		} else {
+			if(len) I[i-len]=-len;
+			len=V[I[i]]+1-i;
+			SA_FN(splitk)(I,K,V,i,len);
+			i+=len;
+			len=0;
+		};
+	};
+	if(len) I[i-len]=-len;
+}
+
+static int SA_FN(qsufsort_mt)(SA_T *I,SA_T *V, const u_char *old, SA_T oldsize, bsdiff_pool *pool,
+		const bsdiff_allocator *A)
+{
+	SA_FN(qsufsortRange) *ranges;
+	SA_T *K;
+	SA_T i,len,b,step;
+	bsdiff_off_t h;
+	int t,numRanges;
+
+	// 任务数取线程数的4倍，让排序进度不均匀的区间之间能互相平衡
+	numRanges=bsdiff_PoolThreads(pool)*4;
+	K=(SA_T*)bsdiff_Alloc(A,(oldsize+1)*sizeof(SA_T));
+	ranges=(SA_FN(qsufsortRange)*)bsdiff_Alloc(A,numRanges*sizeof(SA_FN(qsufsortRange)));
+	if(!K || !ranges) { bsdiff_Free(A,K); bsdiff_Free(A,ranges); return 0; };
+
+	SA_FN(qsufsort_init)(I,V,old,oldsize);
+
+	for(h=1;I[0]!=-(oldsize+1);h+=h) {
+		// 按组边界切分区间：位置lo若是已排序段的起点则本身就是边界，否则取其所在组的结尾+1
+		step=(oldsize+1)/numRanges;
+		for(t=0;t<numRanges;t++) {
+			ranges[t].I=I;ranges[t].V=V;ranges[t].K=K;ranges[t].h=h;
+			if(t==0) {
+				b=0;
+			} else {
+				b=step*t;
+				if(I[b]>=0) b=V[I[b]]+1;
+				if(b<ranges[t-1].start) b=ranges[t-1].start;
+			};
+			ranges[t].start=b;
+			if(t>0) ranges[t-1].end=b;
+		};
+		ranges[numRanges-1].end=oldsize+1;
+
+		for(t=0;t<numRanges;t++) bsdiff_PoolSubmit(pool,SA_FN(qsufsortKeysTask),&ranges[t]);
+		bsdiff_PoolWait(pool);
+		for(t=0;t<numRanges;t++) bsdiff_PoolSubmit(pool,SA_FN(qsufsortSplitTask),&ranges[t]);
+		bsdiff_PoolWait(pool);
+
+		// 合并跨区间相邻的已排序段
+		len=0;
+		for(i=0;i<oldsize+1;) {
+			if(I[i]<0) {
+				len-=I[i];
+				i-=I[i];
+			} else {
+				if(len) I[i-len]=-len;
+				len=0;
+				i=V[I[i]]+1;
+			};
+		};
+		if(len) I[i-len]=-len;
+	};
+
+	for(i=0;i<oldsize+1;i++) I[V[i]]=i;
+
+	bsdiff_Free(A,ranges);
+	bsdiff_Free(A,K);
+	return 1;
+}
+
+//------------------------------------------------------------------------------
+
+/* SA-IS (Nong, Zhang & Chan, "Linear Suffix Array Construction by Almost Pure
+   Induced-Sorting", 2009)。
+   第0层的输入是字节串s8，末尾隐含一个比所有字节都小的哨兵（字符值记为0，其余字节值+1）；
+   递归层的输入是由名字组成的s，其末尾的哨兵（名字0）已经在串中。
+   除了SA本身之外，只需要n/8字节的类型位图和K+1个桶计数器。 */
+
+#define SAIS_CHR(i)      (s8 ? ((i) == n - 1 ? 0 : (SA_T)s8[i] + 1) : s[i])
+#define SAIS_TGET(i)     ((t[(i) >> 3] >> ((i) & 7)) & 1)
+#define SAIS_TSET(i, b)  (t[(i) >> 3] = (b) ? (u_char)(t[(i) >> 3] | (1 << ((i) & 7))) \
+                                            : (u_char)(t[(i) >> 3] & ~(1 << ((i) & 7))))
+#define SAIS_ISLMS(i)    ((i) > 0 && SAIS_TGET(i) && !SAIS_TGET((i) - 1))
+
+static void SA_FN(getBuckets)(const u_char *s8, const SA_T *s, SA_T n, SA_T *bkt, SA_T K, int end)
+{
+	SA_T i,sum;
+
+	for(i=0;i<=K;i++) bkt[i]=0;
+	for(i=0;i<n;i++) bkt[SAIS_CHR(i)]++;
+	for(i=0,sum=0;i<=K;i++) { sum+=bkt[i]; bkt[i]=end ? sum : sum-bkt[i]; };
+}
+
+static void SA_FN(induceSAl)(const u_char *t, SA_T *SA, const u_char *s8, const SA_T *s,
+		SA_T *bkt, SA_T n, SA_T K)
+{
+	SA_T i,j;
+
+	SA_FN(getBuckets)(s8,s,n,bkt,K,0);
+	for(i=0;i<n;i++) {
+		j=SA[i]-1;
+		if(j>=0 && !SAIS_TGET(j)) SA[bkt[SAIS_CHR(j)]++]=j;
+	};
+}
+
+static void SA_FN(induceSAs)(const u_char *t, SA_T *SA, const u_char *s8, const SA_T *s,
+		SA_T *bkt, SA_T n, SA_T K)
+{
+	SA_T i,j;
+
+	SA_FN(getBuckets)(s8,s,n,bkt,K,1);
+	for(i=n-1;i>=0;i--) {
+		j=SA[i]-1;
+		if(j>=0 && SAIS_TGET(j)) SA[--bkt[SAIS_CHR(j)]]=j;
+	};
+}
+
+static int SA_FN(sais)(const u_char *s8, const SA_T *s, SA_T *SA, SA_T n, SA_T K, const bsdiff_allocator *A)
+{
+	u_char *t;
+	SA_T *bkt, *s1;
+	SA_T i,j,n1,name,prev,pos,d;
+	int diff;
+
+	if(n==1) { SA[0]=0; return 1; };
+
+	if(!(t=(u_char*)bsdiff_Alloc(A,n/8+1))) return 0;
+	if(!(bkt=(SA_T*)bsdiff_Alloc(A,(K+1)*sizeof(SA_T)))) { bsdiff_Free(A,t); return 0; };
+
+	// 标记每个后缀的类型：S型为1，L型为0
+	SAIS_TSET(n-1,1);
+	SAIS_TSET(n-2,0);
+	for(i=n-3;i>=0;i--)
+		SAIS_TSET(i,(SAIS_CHR(i)<SAIS_CHR(i+1) ||
+			(SAIS_CHR(i)==SAIS_CHR(i+1) && SAIS_TGET(i+1))));
+
+	// 第1步：对所有LMS子串做诱导排序
+	SA_FN(getBuckets)(s8,s,n,bkt,K,1);
+	for(i=0;i<n;i++) SA[i]=-1;
+	for(i=1;i<n;i++) if(SAIS_ISLMS(i)) SA[--bkt[SAIS_CHR(i)]]=i;
+	SA_FN(induceSAl)(t,SA,s8,s,bkt,n,K);
+	SA_FN(induceSAs)(t,SA,s8,s,bkt,n,K);
+	bsdiff_Free(A,bkt);
+
+	// 把排好序的LMS子串紧凑到SA的前n1项
+	for(i=0,n1=0;i<n;i++) if(SAIS_ISLMS(SA[i])) SA[n1++]=SA[i];
+
+	// 为LMS子串命名，名字按位置存放在SA的后半部分
+	for(i=n1;i<n;i++) SA[i]=-1;
+	for(i=0,name=0,prev=-1;i<n1;i++) {
+		pos=SA[i];diff=0;
+		for(d=0;d<n;d++) {
+			if(prev==-1 || SAIS_CHR(pos+d)!=SAIS_CHR(prev+d) ||
+				SAIS_TGET(pos+d)!=SAIS_TGET(prev+d)) {
+				diff=1;
+				break;
+			} else if(d>0 && (SAIS_ISLMS(pos+d) || SAIS_ISLMS(prev+d))) {
+				break;
+			};
+		};
+		if(diff) { name++; prev=pos; };
+		SA[n1+pos/2]=name-1;
+	};
+	for(i=n-1,j=n-1;i>=n1;i--) if(SA[i]>=0) SA[j--]=SA[i];
+
+	// 第2步：名字不唯一时递归求解缩减串s1的后缀数组
+	s1=SA+n-n1;
+	if(name<n1) {
+		if(!SA_FN(sais)(NULL,s1,SA,n1,name-1,A)) { bsdiff_Free(A,t); return 0; };
+	} else {
+		for(i=0;i<n1;i++) SA[s1[i]]=i;
+	};
+
+	// 第3步：由s1的后缀数组诱导出完整的后缀数组
+	if(!(bkt=(SA_T*)bsdiff_Alloc(A,(K+1)*sizeof(SA_T)))) { bsdiff_Free(A,t); return 0; };
+	SA_FN(getBuckets)(s8,s,n,bkt,K,1);
+	for(i=1,j=0;i<n;i++) if(SAIS_ISLMS(i)) s1[j++]=i;
+	for(i=0;i<n1;i++) SA[i]=s1[SA[i]];
+	for(i=n1;i<n;i++) SA[i]=-1;
+	for(i=n1-1;i>=0;i--) {
+		j=SA[i];SA[i]=-1;
+		SA[--bkt[SAIS_CHR(j)]]=j;
+	};
+	SA_FN(induceSAl)(t,SA,s8,s,bkt,n,K);
+	SA_FN(induceSAs)(t,SA,s8,s,bkt,n,K);
+
+	bsdiff_Free(A,bkt);
+	bsdiff_Free(A,t);
+	return 1;
+}
+
+#undef SAIS_CHR
+#undef SAIS_TGET
+#undef SAIS_TSET
+#undef SAIS_ISLMS
+
+//------------------------------------------------------------------------------
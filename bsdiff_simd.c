@@ -0,0 +1,397 @@
+#include "bsdiff_simd.h"
+#include <string.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+  #define BSDIFF_X86
+  #include <emmintrin.h>
+  #include <immintrin.h>
+  #ifdef _MSC_VER
+    #include <intrin.h>
+  #endif
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+  #define BSDIFF_ARM_NEON
+  #include <arm_neon.h>
+#endif
+
+// GCC/clang需要逐函数打开指令集，MSVC可以直接使用intrinsics
+#if defined(__GNUC__) && defined(BSDIFF_X86)
+  #define TARGET_SSE2  __attribute__((target("sse2")))
+  #define TARGET_AVX2  __attribute__((target("avx2")))
+#else
+  #define TARGET_SSE2
+  #define TARGET_AVX2
+#endif
+
+//------------------------------------------------------------------------------
+
+static unsigned ctz32(unsigned x)
+{
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (unsigned)i;
+#elif defined(__GNUC__)
+    return (unsigned)__builtin_ctz(x);
+#else
+    unsigned i = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        ++i;
+    }
+    return i;
+#endif
+}
+
+static unsigned ctz64(unsigned long long x)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return (unsigned)i;
+#elif defined(__GNUC__)
+    return (unsigned)__builtin_ctzll(x);
+#else
+    if ((unsigned)x)
+        return ctz32((unsigned)x);
+    return 32 + ctz32((unsigned)(x >> 32));
+#endif
+}
+
+static int isLittleEndian(void)
+{
+    unsigned n = 1;
+    return *(unsigned char*)&n;
+}
+
+//------------------------------------------------------------------------------
+
+static size_t matchLenGeneric(const unsigned char *a, const unsigned char *b, size_t len)
+{
+    unsigned long long x, y;
+    size_t i = 0;
+
+    // 每次比较8字节，小端序下第一个不同的字节就是x^y最低的非零字节
+    if (isLittleEndian()) {
+        while (i + 8 <= len) {
+            memcpy(&x, a + i, 8);
+            memcpy(&y, b + i, 8);
+            if (x != y)
+                return i + ctz64(x ^ y) / 8;
+            i += 8;
+        }
+    }
+    while (i < len && a[i] == b[i])
+        ++i;
+    return i;
+}
+
+static void addBytesGeneric(unsigned char *dst, const unsigned char *src, size_t len)
+{
+    const unsigned long long low = 0x7F7F7F7F7F7F7F7FULL;
+    unsigned long long x, y;
+    size_t i = 0;
+
+    // 每次加8字节：低7位直接相加（不会进位到相邻字节），最高位用异或补上
+    while (i + 8 <= len) {
+        memcpy(&x, dst + i, 8);
+        memcpy(&y, src + i, 8);
+        x = ((x & low) + (y & low)) ^ ((x ^ y) & ~low);
+        memcpy(dst + i, &x, 8);
+        i += 8;
+    }
+    for (; i < len; ++i)
+        dst[i] += src[i];
+}
+
+static size_t zeroLenGeneric(const unsigned char *p, size_t len)
+{
+    unsigned long long x;
+    size_t i = 0;
+
+    while (i + 8 <= len) {
+        memcpy(&x, p + i, 8);
+        if (x)
+            break;
+        i += 8;
+    }
+    while (i < len && p[i] == 0)
+        ++i;
+    return i;
+}
+
+#ifdef BSDIFF_X86
+
+TARGET_SSE2 static size_t matchLenSse2(const unsigned char *a, const unsigned char *b, size_t len)
+{
+    unsigned mask;
+    size_t i = 0;
+
+    while (i + 16 <= len) {
+        mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i*)(a + i)),
+            _mm_loadu_si128((const __m128i*)(b + i))));
+        if (mask != 0xFFFF)
+            return i + ctz32(~mask & 0xFFFF);
+        i += 16;
+    }
+    return i + matchLenGeneric(a + i, b + i, len - i);
+}
+
+TARGET_AVX2 static size_t matchLenAvx2(const unsigned char *a, const unsigned char *b, size_t len)
+{
+    unsigned mask;
+    size_t i = 0;
+
+    while (i + 32 <= len) {
+        mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i*)(a + i)),
+            _mm256_loadu_si256((const __m256i*)(b + i))));
+        if (mask != 0xFFFFFFFF)
+            return i + ctz32(~mask);
+        i += 32;
+    }
+    return i + matchLenSse2(a + i, b + i, len - i);
+}
+
+TARGET_SSE2 static void addBytesSse2(unsigned char *dst, const unsigned char *src, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi8(
+            _mm_loadu_si128((const __m128i*)(dst + i)),
+            _mm_loadu_si128((const __m128i*)(src + i))));
+    }
+    addBytesGeneric(dst + i, src + i, len - i);
+}
+
+TARGET_AVX2 static void addBytesAvx2(unsigned char *dst, const unsigned char *src, size_t len)
+{
+    size_t i = 0;
+
+    // 一次两个向量，让load/add/store能够重叠起来
+    for (; i + 64 <= len; i += 64) {
+        __m256i a0 = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i a1 = _mm256_loadu_si256((const __m256i*)(dst + i + 32));
+        __m256i b0 = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i b1 = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_add_epi8(a0, b0));
+        _mm256_storeu_si256((__m256i*)(dst + i + 32), _mm256_add_epi8(a1, b1));
+    }
+    addBytesSse2(dst + i, src + i, len - i);
+}
+
+TARGET_SSE2 static size_t zeroLenSse2(const unsigned char *p, size_t len)
+{
+    unsigned mask;
+    size_t i = 0;
+
+    while (i + 16 <= len) {
+        mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i*)(p + i)), _mm_setzero_si128()));
+        if (mask != 0xFFFF)
+            return i + ctz32(~mask & 0xFFFF);
+        i += 16;
+    }
+    return i + zeroLenGeneric(p + i, len - i);
+}
+
+TARGET_AVX2 static size_t zeroLenAvx2(const unsigned char *p, size_t len)
+{
+    unsigned mask;
+    size_t i = 0;
+
+    while (i + 32 <= len) {
+        mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i*)(p + i)), _mm256_setzero_si256()));
+        if (mask != 0xFFFFFFFF)
+            return i + ctz32(~mask);
+        i += 32;
+    }
+    return i + zeroLenSse2(p + i, len - i);
+}
+
+#endif  // BSDIFF_X86
+
+#ifdef BSDIFF_ARM_NEON
+
+static size_t matchLenNeon(const unsigned char *a, const unsigned char *b, size_t len)
+{
+    uint8x16_t eq;
+    unsigned long long mask;
+    size_t i = 0;
+
+    while (i + 16 <= len) {
+        eq = vceqq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        // 把16个字节的比较结果压缩成64位，每个字节对应4位
+        mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        if (mask != ~0ULL)
+            return i + ctz64(~mask) / 4;
+        i += 16;
+    }
+    return i + matchLenGeneric(a + i, b + i, len - i);
+}
+
+static void addBytesNeon(unsigned char *dst, const unsigned char *src, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16)
+        vst1q_u8(dst + i, vaddq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+    addBytesGeneric(dst + i, src + i, len - i);
+}
+
+static size_t zeroLenNeon(const unsigned char *p, size_t len)
+{
+    uint8x16_t eq;
+    unsigned long long mask;
+    size_t i = 0;
+
+    while (i + 16 <= len) {
+        eq = vceqq_u8(vld1q_u8(p + i), vdupq_n_u8(0));
+        mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        if (mask != ~0ULL)
+            return i + ctz64(~mask) / 4;
+        i += 16;
+    }
+    return i + zeroLenGeneric(p + i, len - i);
+}
+
+#endif  // BSDIFF_ARM_NEON
+
+//------------------------------------------------------------------------------
+
+typedef size_t (*matchLenFn)(const unsigned char *a, const unsigned char *b, size_t len);
+typedef void (*addBytesFn)(unsigned char *dst, const unsigned char *src, size_t len);
+typedef size_t (*zeroLenFn)(const unsigned char *p, size_t len);
+
+static int simdLevel = -1;
+static matchLenFn matchLenImpl = NULL;
+static addBytesFn addBytesImpl = NULL;
+static zeroLenFn zeroLenImpl = NULL;
+
+static int cpuSupports(int level)
+{
+    switch (level) {
+    case BSDIFF_SIMD_NONE:
+        return 1;
+
+#ifdef BSDIFF_X86
+    case BSDIFF_SIMD_SSE2:
+    case BSDIFF_SIMD_AVX2:
+    {
+  #ifdef _MSC_VER
+        int info[4], maxLeaf, sse2, avx2 = 0;
+        __cpuid(info, 0);
+        maxLeaf = info[0];
+        __cpuid(info, 1);
+        sse2 = (info[3] >> 26) & 1;
+        // AVX2还要求操作系统保存YMM寄存器状态
+        if (maxLeaf >= 7 && ((info[2] >> 27) & 1) && ((info[2] >> 28) & 1) && (_xgetbv(0) & 6) == 6) {
+            __cpuidex(info, 7, 0);
+            avx2 = (info[1] >> 5) & 1;
+        }
+        return level == BSDIFF_SIMD_SSE2 ? sse2 : avx2;
+  #elif defined(__GNUC__)
+        __builtin_cpu_init();
+        return level == BSDIFF_SIMD_SSE2 ? __builtin_cpu_supports("sse2") != 0
+                                         : __builtin_cpu_supports("avx2") != 0;
+  #else
+        return 0;
+  #endif
+    }
+#endif  // BSDIFF_X86
+
+#ifdef BSDIFF_ARM_NEON
+    case BSDIFF_SIMD_NEON:
+        return 1;
+#endif
+
+    default:
+        return 0;
+    }
+}
+
+static void setLevel(int level)
+{
+    switch (level) {
+#ifdef BSDIFF_X86
+    case BSDIFF_SIMD_SSE2:
+        matchLenImpl = matchLenSse2;
+        addBytesImpl = addBytesSse2;
+        zeroLenImpl = zeroLenSse2;
+        break;
+    case BSDIFF_SIMD_AVX2:
+        matchLenImpl = matchLenAvx2;
+        addBytesImpl = addBytesAvx2;
+        zeroLenImpl = zeroLenAvx2;
+        break;
+#endif
+#ifdef BSDIFF_ARM_NEON
+    case BSDIFF_SIMD_NEON:
+        matchLenImpl = matchLenNeon;
+        addBytesImpl = addBytesNeon;
+        zeroLenImpl = zeroLenNeon;
+        break;
+#endif
+    default:
+        level = BSDIFF_SIMD_NONE;
+        matchLenImpl = matchLenGeneric;
+        addBytesImpl = addBytesGeneric;
+        zeroLenImpl = zeroLenGeneric;
+        break;
+    }
+    simdLevel = level;
+}
+
+static void detectLevel(void)
+{
+    if (cpuSupports(BSDIFF_SIMD_AVX2))
+        setLevel(BSDIFF_SIMD_AVX2);
+    else if (cpuSupports(BSDIFF_SIMD_SSE2))
+        setLevel(BSDIFF_SIMD_SSE2);
+    else if (cpuSupports(BSDIFF_SIMD_NEON))
+        setLevel(BSDIFF_SIMD_NEON);
+    else
+        setLevel(BSDIFF_SIMD_NONE);
+}
+
+int bsdiff_SimdLevel(void)
+{
+    if (simdLevel < 0)
+        detectLevel();
+    return simdLevel;
+}
+
+int bsdiff_SimdSetLevel(int level)
+{
+    if (!cpuSupports(level))
+        return 0;
+    setLevel(level);
+    return 1;
+}
+
+size_t bsdiff_MatchLen(const unsigned char *a, const unsigned char *b, size_t len)
+{
+    if (!matchLenImpl)
+        detectLevel();
+    return matchLenImpl(a, b, len);
+}
+
+void bsdiff_AddBytes(unsigned char *dst, const unsigned char *src, size_t len)
+{
+    if (!addBytesImpl)
+        detectLevel();
+    addBytesImpl(dst, src, len);
+}
+
+size_t bsdiff_ZeroLen(const unsigned char *p, size_t len)
+{
+    if (!zeroLenImpl)
+        detectLevel();
+    return zeroLenImpl(p, len);
+}
+
+//------------------------------------------------------------------------------
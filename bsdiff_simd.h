@@ -0,0 +1,54 @@
+#ifndef __BSDIFF_SIMD_H__
+#define __BSDIFF_SIMD_H__
+
+#include <stddef.h>
+
+//------------------------------------------------------------------------------
+
+// 向量化内核的实现级别，运行时按CPU能力自动选择最高的可用级别
+#define BSDIFF_SIMD_NONE   0    // 逐字（8字节）比较的通用实现
+#define BSDIFF_SIMD_SSE2   1
+#define BSDIFF_SIMD_AVX2   2
+#define BSDIFF_SIMD_NEON   3
+
+// 当前使用的实现级别
+int bsdiff_SimdLevel(void);
+
+// 强制使用某个级别（用于测试和benchmark）；CPU不支持时返回0且不做改变
+int bsdiff_SimdSetLevel(
+    int level
+    );
+
+// 返回a和b的公共前缀长度，最多比较len字节
+size_t bsdiff_MatchLen(
+    const unsigned char *a,
+    const unsigned char *b,
+    size_t len
+    );
+
+// dst[i] += src[i]（模256），0 <= i < len；打补丁时把old加到diff数据上
+void bsdiff_AddBytes(
+    unsigned char *dst,
+    const unsigned char *src,
+    size_t len
+    );
+
+// 返回p开头连续的0字节数，最多检查len字节；diff数据全为0的部分不用做加法
+size_t bsdiff_ZeroLen(
+    const unsigned char *p,
+    size_t len
+    );
+
+// 预取一个缓存行，提示CPU接下来会读到p
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+  #include <xmmintrin.h>
+  #define bsdiff_Prefetch(p)  _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#elif defined(__GNUC__)
+  #define bsdiff_Prefetch(p)  __builtin_prefetch(p)
+#else
+  #define bsdiff_Prefetch(p)  ((void)0)
+#endif
+
+//------------------------------------------------------------------------------
+
+#endif // !__BSDIFF_SIMD_H__
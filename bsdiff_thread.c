@@ -0,0 +1,205 @@
+#include "bsdiff_thread.h"
+#include <stdlib.h>
+#ifdef _WIN32
+  #include <process.h>
+#endif
+
+//------------------------------------------------------------------------------
+
+#ifdef _WIN32
+
+void bsdiff_MutexInit(bsdiff_mutex *mutex)     { InitializeCriticalSection(mutex); }
+void bsdiff_MutexDestroy(bsdiff_mutex *mutex)  { DeleteCriticalSection(mutex); }
+void bsdiff_MutexLock(bsdiff_mutex *mutex)     { EnterCriticalSection(mutex); }
+void bsdiff_MutexUnlock(bsdiff_mutex *mutex)   { LeaveCriticalSection(mutex); }
+
+void bsdiff_CondInit(bsdiff_cond *cond)        { InitializeConditionVariable(cond); }
+void bsdiff_CondDestroy(bsdiff_cond *cond)     { (void)cond; }
+void bsdiff_CondWait(bsdiff_cond *cond, bsdiff_mutex *mutex) { SleepConditionVariableCS(cond, mutex, INFINITE); }
+void bsdiff_CondSignal(bsdiff_cond *cond)      { WakeConditionVariable(cond); }
+void bsdiff_CondBroadcast(bsdiff_cond *cond)   { WakeAllConditionVariable(cond); }
+
+#else
+
+void bsdiff_MutexInit(bsdiff_mutex *mutex)     { pthread_mutex_init(mutex, NULL); }
+void bsdiff_MutexDestroy(bsdiff_mutex *mutex)  { pthread_mutex_destroy(mutex); }
+void bsdiff_MutexLock(bsdiff_mutex *mutex)     { pthread_mutex_lock(mutex); }
+void bsdiff_MutexUnlock(bsdiff_mutex *mutex)   { pthread_mutex_unlock(mutex); }
+
+void bsdiff_CondInit(bsdiff_cond *cond)        { pthread_cond_init(cond, NULL); }
+void bsdiff_CondDestroy(bsdiff_cond *cond)     { pthread_cond_destroy(cond); }
+void bsdiff_CondWait(bsdiff_cond *cond, bsdiff_mutex *mutex) { pthread_cond_wait(cond, mutex); }
+void bsdiff_CondSignal(bsdiff_cond *cond)      { pthread_cond_signal(cond); }
+void bsdiff_CondBroadcast(bsdiff_cond *cond)   { pthread_cond_broadcast(cond); }
+
+#endif
+
+//------------------------------------------------------------------------------
+
+typedef struct bsdiff_task {
+    bsdiff_task_fn fn;
+    void *arg;
+    struct bsdiff_task *next;
+} bsdiff_task;
+
+struct bsdiff_pool {
+    bsdiff_mutex mutex;
+    bsdiff_cond taskCond;       // 有新任务或需要退出
+    bsdiff_cond doneCond;       // 所有任务都已完成
+    bsdiff_task *head, *tail;
+    int pending;                // 已提交但尚未完成的任务数
+    int quit;
+    int numThreads;
+#ifdef _WIN32
+    HANDLE *threads;
+#else
+    pthread_t *threads;
+#endif
+};
+
+#ifdef _WIN32
+static unsigned __stdcall workerMain(void *param)
+#else
+static void* workerMain(void *param)
+#endif
+{
+    bsdiff_pool *pool = (bsdiff_pool*)param;
+    bsdiff_task *task;
+
+    bsdiff_MutexLock(&pool->mutex);
+    for (;;) {
+        while (!pool->head && !pool->quit)
+            bsdiff_CondWait(&pool->taskCond, &pool->mutex);
+        if (!pool->head)
+            break;  // quit且队列已空
+
+        task = pool->head;
+        pool->head = task->next;
+        if (!pool->head)
+            pool->tail = NULL;
+        bsdiff_MutexUnlock(&pool->mutex);
+
+        task->fn(task->arg);
+        free(task);
+
+        bsdiff_MutexLock(&pool->mutex);
+        if (--pool->pending == 0)
+            bsdiff_CondBroadcast(&pool->doneCond);
+    }
+    bsdiff_MutexUnlock(&pool->mutex);
+    return 0;
+}
+
+bsdiff_pool* bsdiff_PoolCreate(int numThreads)
+{
+    bsdiff_pool *pool;
+    int i;
+
+    if (numThreads <= 1)
+        return NULL;
+
+    pool = (bsdiff_pool*)calloc(1, sizeof(bsdiff_pool));
+    if (!pool)
+        return NULL;
+#ifdef _WIN32
+    pool->threads = (HANDLE*)calloc(numThreads, sizeof(HANDLE));
+#else
+    pool->threads = (pthread_t*)calloc(numThreads, sizeof(pthread_t));
+#endif
+    if (!pool->threads) {
+        free(pool);
+        return NULL;
+    }
+
+    bsdiff_MutexInit(&pool->mutex);
+    bsdiff_CondInit(&pool->taskCond);
+    bsdiff_CondInit(&pool->doneCond);
+
+    for (i = 0; i < numThreads; ++i) {
+#ifdef _WIN32
+        pool->threads[i] = (HANDLE)_beginthreadex(NULL, 0, workerMain, pool, 0, NULL);
+        if (!pool->threads[i])
+            break;
+#else
+        if (pthread_create(&pool->threads[i], NULL, workerMain, pool) != 0)
+            break;
+#endif
+    }
+    pool->numThreads = i;
+
+    // 一个线程都没建起来就退回到单线程模式
+    if (pool->numThreads == 0) {
+        bsdiff_PoolDestroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void bsdiff_PoolDestroy(bsdiff_pool *pool)
+{
+    int i;
+
+    if (!pool)
+        return;
+
+    bsdiff_MutexLock(&pool->mutex);
+    pool->quit = 1;
+    bsdiff_CondBroadcast(&pool->taskCond);
+    bsdiff_MutexUnlock(&pool->mutex);
+
+    for (i = 0; i < pool->numThreads; ++i) {
+#ifdef _WIN32
+        WaitForSingleObject(pool->threads[i], INFINITE);
+        CloseHandle(pool->threads[i]);
+#else
+        pthread_join(pool->threads[i], NULL);
+#endif
+    }
+
+    bsdiff_CondDestroy(&pool->doneCond);
+    bsdiff_CondDestroy(&pool->taskCond);
+    bsdiff_MutexDestroy(&pool->mutex);
+    free(pool->threads);
+    free(pool);
+}
+
+int bsdiff_PoolThreads(bsdiff_pool *pool)
+{
+    return pool ? pool->numThreads : 1;
+}
+
+void bsdiff_PoolSubmit(bsdiff_pool *pool, bsdiff_task_fn fn, void *arg)
+{
+    bsdiff_task *task;
+
+    if (!pool || !(task = (bsdiff_task*)malloc(sizeof(bsdiff_task)))) {
+        fn(arg);
+        return;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    task->next = NULL;
+
+    bsdiff_MutexLock(&pool->mutex);
+    if (pool->tail)
+        pool->tail->next = task;
+    else
+        pool->head = task;
+    pool->tail = task;
+    pool->pending++;
+    bsdiff_CondSignal(&pool->taskCond);
+    bsdiff_MutexUnlock(&pool->mutex);
+}
+
+void bsdiff_PoolWait(bsdiff_pool *pool)
+{
+    if (!pool)
+        return;
+
+    bsdiff_MutexLock(&pool->mutex);
+    while (pool->pending)
+        bsdiff_CondWait(&pool->doneCond, &pool->mutex);
+    bsdiff_MutexUnlock(&pool->mutex);
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,65 @@
+#ifndef __BSDIFF_THREAD_H__
+#define __BSDIFF_THREAD_H__
+
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #include <pthread.h>
+#endif
+
+//------------------------------------------------------------------------------
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION bsdiff_mutex;
+typedef CONDITION_VARIABLE bsdiff_cond;
+#else
+typedef pthread_mutex_t bsdiff_mutex;
+typedef pthread_cond_t bsdiff_cond;
+#endif
+
+void bsdiff_MutexInit(bsdiff_mutex *mutex);
+void bsdiff_MutexDestroy(bsdiff_mutex *mutex);
+void bsdiff_MutexLock(bsdiff_mutex *mutex);
+void bsdiff_MutexUnlock(bsdiff_mutex *mutex);
+
+void bsdiff_CondInit(bsdiff_cond *cond);
+void bsdiff_CondDestroy(bsdiff_cond *cond);
+void bsdiff_CondWait(bsdiff_cond *cond, bsdiff_mutex *mutex);
+void bsdiff_CondSignal(bsdiff_cond *cond);
+void bsdiff_CondBroadcast(bsdiff_cond *cond);
+
+//------------------------------------------------------------------------------
+
+// 简单的线程池：任务按提交顺序执行，bsdiff_PoolWait等待所有已提交的任务完成
+// pool为NULL时表示单线程模式，bsdiff_PoolSubmit直接在调用线程中执行任务
+typedef struct bsdiff_pool bsdiff_pool;
+typedef void (*bsdiff_task_fn)(void *arg);
+
+// numThreads <= 1时返回NULL（单线程模式），创建失败时也返回NULL
+bsdiff_pool* bsdiff_PoolCreate(
+    int numThreads
+    );
+
+void bsdiff_PoolDestroy(
+    bsdiff_pool *pool
+    );
+
+int bsdiff_PoolThreads(
+    bsdiff_pool *pool
+    );
+
+// 提交一个任务；内存不足时在调用线程中直接执行，因此总是成功
+void bsdiff_PoolSubmit(
+    bsdiff_pool *pool,
+    bsdiff_task_fn fn,
+    void *arg
+    );
+
+void bsdiff_PoolWait(
+    bsdiff_pool *pool
+    );
+
+//------------------------------------------------------------------------------
+
+#endif // !__BSDIFF_THREAD_H__
@@ -0,0 +1,80 @@
+#ifndef __BSDIFF_TYPES_H__
+#define __BSDIFF_TYPES_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// patch中各个block可选的压缩算法；bzip2总是可用，其余的需要编译时定义BSDIFF_WITH_xxx并链接对应的库
+#define BSDIFF_CODEC_BZIP2   0   // 兼容原始的BSDIFF40格式（默认）
+#define BSDIFF_CODEC_ZSTD    1   // 解压最快
+#define BSDIFF_CODEC_LZMA    2   // xz格式（LZMA2），压缩率最高
+#define BSDIFF_CODEC_BROTLI  3
+#define BSDIFF_CODEC_COUNT   4
+
+// 可执行文件的预处理过滤器（BSDIFF41），见bsdiff_filter.h
+#define BSDIFF_FILTER_NONE   0
+#define BSDIFF_FILTER_X86    1   // x86/x64的call rel32
+#define BSDIFF_FILTER_ARM    2   // ARM32的BL
+#define BSDIFF_FILTER_ARM64  3   // AArch64的BL
+#define BSDIFF_FILTER_COUNT  4
+#define BSDIFF_FILTER_AUTO   (-1)    // 只用于diff的选项：按newFile的ELF/PE文件头选择，不是可执行文件时不过滤
+
+// 调用者提供的内存分配器；传NULL时使用malloc/free
+// 多线程（numThreads > 1）时会被多个线程同时调用
+typedef struct bsdiff_allocator {
+    void* (*alloc)(void *opaque, size_t size);    // 失败时返回NULL
+    void (*free)(void *opaque, void *ptr);
+    void *opaque;
+} bsdiff_allocator;
+
+// 输出回调：把len字节的data追加到输出中，成功返回1，失败返回0
+typedef int (*bsdiff_write_fn)(
+    void *opaque, 
+    const void *data, 
+    size_t len
+    );
+
+// diff/patch的各个阶段
+#define BSDIFF_PHASE_READ    0   // 读入（映射）输入文件，只有文件接口才有
+#define BSDIFF_PHASE_SORT    1   // diff：构建后缀数组（或映射索引文件）
+#define BSDIFF_PHASE_SCAN    2   // diff：匹配，生成控制三元组
+#define BSDIFF_PHASE_CTRL    3   // ctrl block的压缩（diff）或解压（patch）
+#define BSDIFF_PHASE_DIFF    4   // diff block的压缩或解压
+#define BSDIFF_PHASE_EXTRA   5   // extra block的压缩或解压
+#define BSDIFF_PHASE_APPLY   6   // patch：与old相加，生成newFile
+#define BSDIFF_PHASE_WRITE   7   // 输出patch或newFile（write回调）
+#define BSDIFF_PHASE_COUNT   8
+
+typedef struct bsdiff_phase_stats {
+    double seconds;             // 调用线程在这个阶段花费的时间
+    unsigned long long bytes;   // 这个阶段处理的字节数（压缩/解压为未压缩的一侧）
+} bsdiff_phase_stats;
+
+// 一次diff/patch的统计，开始时清零。diff的diff/extra数据是边匹配边压缩的，
+// 压缩的时间从匹配中扣除，分别记在DIFF/EXTRA阶段
+typedef struct bsdiff_stats {
+    bsdiff_phase_stats phases[BSDIFF_PHASE_COUNT];
+    double seconds;                         // 总耗时
+    unsigned long long numCtrls;            // 控制三元组的个数
+    unsigned long long diffBytes;           // diff数据的字节数（压缩前）
+    unsigned long long extraBytes;          // extra数据的字节数（压缩前）
+    unsigned long long ctrlSize, diffSize, extraSize;  // 三个block压缩后的字节数
+} bsdiff_stats;
+
+// 进度回调，总是在调用diff/patch的线程中调用：phase为BSDIFF_PHASE_xxx，done/total为这个阶段
+// 已经处理的和总共的字节数。返回0表示取消，diff/patch尽快停止并返回失败，error为"Cancelled"
+typedef int (*bsdiff_progress_fn)(
+    void *opaque,
+    int phase,
+    unsigned long long done,
+    unsigned long long total
+    );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !__BSDIFF_TYPES_H__
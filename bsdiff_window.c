@@ -0,0 +1,286 @@
+#include "bsdiff_window.h"
+#include "bsdiff_hash.h"
+#include <string.h>
+
+//------------------------------------------------------------------------------
+
+// 采样表的一项：sample为采样的序号加1（位置为(sample - 1) * BSDIFF_WINDOW_SAMPLE），0表示空
+#define REPEATED  0xFFFFFFFFu   // 这个hash在old中出现了不止一次
+typedef struct sampleSlot {
+    unsigned int hash;
+    unsigned int sample;
+} sampleSlot;
+
+typedef struct sampleTable {
+    sampleSlot *slots;
+    size_t mask;
+} sampleTable;
+
+// 开放寻址。重复出现的内容（比如大段的0）说明不了匹配在old中的位置，标记为REPEATED，不参与投票
+static int buildTable(sampleTable *t, const unsigned char *old, bsdiff_off_t oldSize,
+                      const bsdiff_allocator *allocator)
+{
+    size_t numSamples, size = 16, i;
+    unsigned int h, sample;
+
+    numSamples = oldSize >= BSDIFF_WINDOW_BLOCK ? (size_t)((oldSize - BSDIFF_WINDOW_BLOCK) / BSDIFF_WINDOW_SAMPLE + 1) : 0;
+    while (size < numSamples * 2)
+        size *= 2;
+    if (!(t->slots = (sampleSlot*)bsdiff_Alloc(allocator, size * sizeof(sampleSlot))))
+        return 0;
+    t->mask = size - 1;
+    memset(t->slots, 0, size * sizeof(sampleSlot));
+
+    for (sample = 1; sample <= numSamples; ++sample) {
+        h = bsdiff_RollHash(old + (bsdiff_off_t)(sample - 1) * BSDIFF_WINDOW_SAMPLE, BSDIFF_WINDOW_BLOCK);
+        for (i = h & t->mask; t->slots[i].sample; i = (i + 1) & t->mask) {
+            if (t->slots[i].hash == h)
+                break;
+        }
+        if (!t->slots[i].sample) {
+            t->slots[i].hash = h;
+            t->slots[i].sample = sample;
+        } else {
+            t->slots[i].sample = REPEATED;
+        }
+    }
+    return 1;
+}
+
+// 返回hash为h并且内容与data相同的采样位置，没有（或者重复）时返回-1
+static bsdiff_off_t lookup(const sampleTable *t, unsigned int h, const unsigned char *old,
+                           const unsigned char *data)
+{
+    bsdiff_off_t pos;
+    size_t i;
+
+    for (i = h & t->mask; t->slots[i].sample; i = (i + 1) & t->mask) {
+        if (t->slots[i].hash == h) {
+            if (t->slots[i].sample == REPEATED)
+                return -1;
+            pos = (bsdiff_off_t)(t->slots[i].sample - 1) * BSDIFF_WINDOW_SAMPLE;
+            return memcmp(old + pos, data, BSDIFF_WINDOW_BLOCK) == 0 ? pos : -1;
+        }
+    }
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+
+void bsdiff_WindowRange(const bsdiff_window_plan *plan, bsdiff_off_t oldSize, int w,
+                        bsdiff_off_t *start, bsdiff_off_t *len)
+{
+    *start = plan->step * w;
+    *len = oldSize - *start < plan->windowSize ? oldSize - *start : plan->windowSize;
+}
+
+// old位置q开始的一个采样完整地落在[*wFirst, *wLast]这些窗口中
+static void hitWindows(const bsdiff_window_plan *plan, bsdiff_off_t q, int *wFirst, int *wLast)
+{
+    *wFirst = q + BSDIFF_WINDOW_BLOCK > plan->windowSize ?
+              (int)((q + BSDIFF_WINDOW_BLOCK - plan->windowSize + plan->step - 1) / plan->step) : 0;
+    *wLast = (int)(q / plan->step);
+    if (*wLast >= plan->numWindows)
+        *wLast = plan->numWindows - 1;
+}
+
+// 中心在old位置center附近的内容最好在哪个窗口中匹配，结果限制在[lo, hi]中
+static int centerWindow(const bsdiff_window_plan *plan, bsdiff_off_t center, int lo, int hi)
+{
+    bsdiff_off_t w;
+
+    w = center > plan->windowSize / 2 ? (center - plan->windowSize / 2 + plan->step / 2) / plan->step : 0;
+    return w < lo ? lo : (w > hi ? hi : (int)w);
+}
+
+/* 前一段最后一个命中的结尾a对齐old中的qa，后一段第一个命中的开头b对齐old中的qb，
+   在[a, b]中找一个切点s，使[a, s)按前一个对齐、[s, b)按后一个对齐时相同的字节最多 */
+static bsdiff_off_t splitPoint(const unsigned char *old, bsdiff_off_t oldSize, const unsigned char *newBuf,
+                               bsdiff_off_t a, bsdiff_off_t qa, bsdiff_off_t b, bsdiff_off_t qb)
+{
+    bsdiff_off_t s, best, k, q, score = 0, bestScore;
+
+    if (a > b) {
+        qa -= a - b;
+        a = b;
+    }
+    for (k = a; k < b; ++k) {
+        q = qb - (b - k);
+        score += q >= 0 && old[q] == newBuf[k];
+    }
+    best = a;
+    bestScore = score;
+    for (s = a; s < b; ++s) {
+        q = qb - (b - s);
+        score -= q >= 0 && old[q] == newBuf[s];
+        q = qa + (s - a);
+        score += q < oldSize && old[q] == newBuf[s];
+        if (score > bestScore) {
+            bestScore = score;
+            best = s + 1;
+        }
+    }
+    return best;
+}
+
+// 追加一段，数组不够时加倍
+static int addRegion(bsdiff_window_plan *plan, int *capacity, bsdiff_off_t start, int w,
+                     const bsdiff_allocator *allocator)
+{
+    bsdiff_off_t *starts;
+    int *windows;
+
+    if (plan->numRegions == *capacity) {
+        starts = (bsdiff_off_t*)bsdiff_Alloc(allocator, *capacity * 2 * sizeof(bsdiff_off_t));
+        windows = (int*)bsdiff_Alloc(allocator, *capacity * 2 * sizeof(int));
+        if (!starts || !windows) {
+            bsdiff_Free(allocator, starts);
+            bsdiff_Free(allocator, windows);
+            return 0;
+        }
+        memcpy(starts, plan->regionStart, plan->numRegions * sizeof(bsdiff_off_t));
+        memcpy(windows, plan->regionWindow, plan->numRegions * sizeof(int));
+        bsdiff_Free(allocator, plan->regionStart);
+        bsdiff_Free(allocator, plan->regionWindow);
+        plan->regionStart = starts;
+        plan->regionWindow = windows;
+        *capacity *= 2;
+    }
+    plan->regionStart[plan->numRegions] = start;
+    plan->regionWindow[plan->numRegions] = w;
+    ++plan->numRegions;
+    return 1;
+}
+
+int bsdiff_WindowPlan(const unsigned char *old, bsdiff_off_t oldSize, const unsigned char *newBuf,
+                      bsdiff_off_t newSize, bsdiff_off_t windowSize, const bsdiff_allocator *allocator,
+                      bsdiff_window_plan *plan)
+{
+    sampleTable table;
+    unsigned int *hitNew = NULL, *hitSample = NULL;
+    size_t numHits, i, first, last, pending, numPending;
+    unsigned int h, power;
+    bsdiff_off_t blockStart, blockEnd, p, q, guess, segStart;
+    int b, numBlocks, capacity, lo, hi, wFirst, wLast, pendLo = 0, pendHi = 0;
+    int ok = 0;
+
+    memset(plan, 0, sizeof(bsdiff_window_plan));
+    memset(&table, 0, sizeof(table));
+
+    // 相邻窗口重叠四分之一，跨在窗口边界上的匹配总有一个窗口能完整地看到
+    plan->windowSize = windowSize;
+    plan->step = windowSize - windowSize / 4;
+    plan->numWindows = oldSize > windowSize ? (int)((oldSize - windowSize + plan->step - 1) / plan->step) + 1 : 1;
+    plan->regionSize = windowSize / 4 > BSDIFF_WINDOW_BLOCK ? windowSize / 4 : BSDIFF_WINDOW_BLOCK;
+    numBlocks = newSize > 0 ? (int)((newSize + plan->regionSize - 1) / plan->regionSize) : 1;
+    capacity = numBlocks * 2;
+
+    // 命中按newFile中的顺序记下相对于块起点的位置和采样的序号，一块最多regionSize个
+    plan->regionStart = (bsdiff_off_t*)bsdiff_Alloc(allocator, capacity * sizeof(bsdiff_off_t));
+    plan->regionWindow = (int*)bsdiff_Alloc(allocator, capacity * sizeof(int));
+    hitNew = (unsigned int*)bsdiff_Alloc(allocator, (size_t)plan->regionSize * sizeof(unsigned int));
+    hitSample = (unsigned int*)bsdiff_Alloc(allocator, (size_t)plan->regionSize * sizeof(unsigned int));
+    if (!plan->regionStart || !plan->regionWindow || !hitNew || !hitSample ||
+        !buildTable(&table, old, oldSize, allocator))
+        goto MyExit;
+
+    power = bsdiff_RollPower(BSDIFF_WINDOW_BLOCK);
+    for (b = 0; b < numBlocks; ++b) {
+        blockStart = plan->regionSize * b;
+        blockEnd = blockStart + plan->regionSize < newSize ? blockStart + plan->regionSize : newSize;
+
+        // 滑过这一块的每个位置，记下命中
+        numHits = 0;
+        if (blockEnd - blockStart >= BSDIFF_WINDOW_BLOCK) {
+            h = bsdiff_RollHash(newBuf + blockStart, BSDIFF_WINDOW_BLOCK);
+            for (p = blockStart; ; ++p) {
+                if ((q = lookup(&table, h, old, newBuf + p)) >= 0) {
+                    hitNew[numHits] = (unsigned int)(p - blockStart);
+                    hitSample[numHits] = (unsigned int)(q / BSDIFF_WINDOW_SAMPLE);
+                    ++numHits;
+                }
+                if (p + BSDIFF_WINDOW_BLOCK >= blockEnd)
+                    break;
+                h = bsdiff_RollNext(h, newBuf[p], newBuf[p + BSDIFF_WINDOW_BLOCK], power);
+            }
+        }
+
+        // 没有命中时按newFile中的相对位置估计一个窗口
+        if (numHits == 0) {
+            guess = newSize > 0 ? (bsdiff_off_t)((double)(blockStart + blockEnd) / 2 / newSize * oldSize) : 0;
+            if (!addRegion(plan, &capacity, blockStart, centerWindow(plan, guess, 0, plan->numWindows - 1), allocator))
+                goto MyExit;
+            continue;
+        }
+
+        // [lo, hi]是当前一段的命中都完整落在其中的窗口；连续BSDIFF_WINDOW_MIN_VOTES个命中一致地
+        // 落在这个范围以外时，在这段最后一个命中和其中第一个命中之间切开。每段选择的窗口尽量以这段内容在old中的来源为中心，
+        // 来源由这段第一个和最后一个命中按在newFile中的距离外推到段的两端
+        segStart = blockStart;
+        first = last = 0;
+        numPending = pending = 0;
+        hitWindows(plan, (bsdiff_off_t)hitSample[0] * BSDIFF_WINDOW_SAMPLE, &lo, &hi);
+        for (i = 1; i <= numHits; ++i) {
+            if (i < numHits) {
+                hitWindows(plan, (bsdiff_off_t)hitSample[i] * BSDIFF_WINDOW_SAMPLE, &wFirst, &wLast);
+                if (wFirst <= hi && wLast >= lo) {
+                    lo = wFirst > lo ? wFirst : lo;
+                    hi = wLast < hi ? wLast : hi;
+                    last = i;
+                    numPending = 0;
+                    continue;
+                }
+                if (numPending > 0 && wFirst <= pendHi && wLast >= pendLo) {
+                    pendLo = wFirst > pendLo ? wFirst : pendLo;
+                    pendHi = wLast < pendHi ? wLast : pendHi;
+                    ++numPending;
+                } else {
+                    pending = i;
+                    pendLo = wFirst;
+                    pendHi = wLast;
+                    numPending = 1;
+                }
+                if (numPending < BSDIFF_WINDOW_MIN_VOTES)
+                    continue;
+            }
+
+            // 结束当前一段，到下一段的起点（或者块的终点）为止
+            p = i < numHits ? splitPoint(old, oldSize, newBuf,
+                                         blockStart + hitNew[last] + BSDIFF_WINDOW_BLOCK,
+                                         (bsdiff_off_t)hitSample[last] * BSDIFF_WINDOW_SAMPLE + BSDIFF_WINDOW_BLOCK,
+                                         blockStart + hitNew[pending],
+                                         (bsdiff_off_t)hitSample[pending] * BSDIFF_WINDOW_SAMPLE) : blockEnd;
+            q = ((bsdiff_off_t)hitSample[first] * BSDIFF_WINDOW_SAMPLE - (blockStart + hitNew[first] - segStart) +
+                 (bsdiff_off_t)hitSample[last] * BSDIFF_WINDOW_SAMPLE + (p - (blockStart + hitNew[last]))) / 2;
+            if (!addRegion(plan, &capacity, segStart, centerWindow(plan, q, lo, hi), allocator))
+                goto MyExit;
+            if (i < numHits) {
+                segStart = p;
+                first = pending;
+                last = i;
+                lo = pendLo;
+                hi = pendHi;
+                numPending = 0;
+            }
+        }
+    }
+    ok = 1;
+
+MyExit:
+    bsdiff_Free(allocator, hitNew);
+    bsdiff_Free(allocator, hitSample);
+    bsdiff_Free(allocator, table.slots);
+    if (!ok)
+        bsdiff_WindowPlanFree(plan, allocator);
+    return ok;
+}
+
+void bsdiff_WindowPlanFree(bsdiff_window_plan *plan, const bsdiff_allocator *allocator)
+{
+    bsdiff_Free(allocator, plan->regionStart);
+    bsdiff_Free(allocator, plan->regionWindow);
+    plan->regionStart = NULL;
+    plan->regionWindow = NULL;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,62 @@
+#ifndef __BSDIFF_WINDOW_H__
+#define __BSDIFF_WINDOW_H__
+
+#include <stddef.h>
+#include "bsdiff_misc.h"
+
+//------------------------------------------------------------------------------
+
+/* 限制内存时的窗口化匹配：old被切成互相重叠的窗口，每个窗口单独构建一个小的后缀数组；
+   newFile被切成若干段，每段只在一个窗口中匹配。窗口由采样的滚动hash投票选出：
+   old每隔BSDIFF_WINDOW_SAMPLE字节取一段BSDIFF_WINDOW_BLOCK字节的hash放进表中，
+   newFile的每个位置都用滚动hash查表，命中的old位置所在的窗口各得一票。
+   newFile先按regionSize切开，其中的命中按newFile中的顺序排列：连续的命中都完整落在同一个窗口中的部分
+   成为一段，至少连续BSDIFF_WINDOW_MIN_VOTES个命中一致地落在当前的窗口以外时才切开（个别命中不算）。
+   这样一段newFile的内容来自old中相距很远的几处时，各部分分别在各自的窗口中匹配；
+   只有来源变换得比采样间隔还快的部分（几百字节以内）找不到正确的窗口。
+   采样表每项8字节，最多占oldSize / 8字节，一段的命中最多占2 * regionSize字节，
+   在构建窗口的后缀数组之前就都释放了 */
+
+#define BSDIFF_WINDOW_BLOCK   32
+#define BSDIFF_WINDOW_SAMPLE  256
+#define BSDIFF_WINDOW_MIN_VOTES  2
+
+typedef struct bsdiff_window_plan {
+    bsdiff_off_t windowSize;    // 每个窗口的长度（最后一个可能更短）
+    bsdiff_off_t step;          // 相邻窗口起点的间隔，windowSize - step为重叠的部分
+    int numWindows;
+    bsdiff_off_t regionSize;    // 段的最大长度
+    int numRegions;
+    bsdiff_off_t *regionStart;  // 各段在newFile中的起点，第一段从0开始，每段到下一段的起点（或newSize）为止
+    int *regionWindow;          // 各段选中的窗口
+} bsdiff_window_plan;
+
+// 为old/new制定窗口化匹配的计划，windowSize为每个窗口的长度（不小于BSDIFF_WINDOW_BLOCK）
+// 内存不足时返回0；成功时用bsdiff_WindowPlanFree释放
+int bsdiff_WindowPlan(
+    const unsigned char *old,
+    bsdiff_off_t oldSize,
+    const unsigned char *newBuf,
+    bsdiff_off_t newSize,
+    bsdiff_off_t windowSize,
+    const bsdiff_allocator *allocator,
+    bsdiff_window_plan *plan
+    );
+
+void bsdiff_WindowPlanFree(
+    bsdiff_window_plan *plan,
+    const bsdiff_allocator *allocator
+    );
+
+// 第w个窗口在old中的起点和长度
+void bsdiff_WindowRange(
+    const bsdiff_window_plan *plan,
+    bsdiff_off_t oldSize,
+    int w,
+    bsdiff_off_t *start,
+    bsdiff_off_t *len
+    );
+
+//------------------------------------------------------------------------------
+
+#endif // !__BSDIFF_WINDOW_H__
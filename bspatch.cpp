@@ -28,6 +28,9 @@
 #include <stdio.h>
 //#include <err.h>
 #include "bzlib.h"
+extern "C" {
+#include "bsdiff_simd.h"
+}
 #include <io.h>
 #include <fcntl.h>
 
@@ -103,6 +106,7 @@ int main(int argc,char * argv[])
 	off_t ctrl[3];
 	off_t lenread;
 	off_t i;
+	off_t lo,hi;
 
 	if(argc!=4) errx(1,"usage: %s oldfile newfile patchfile\n",argv[0]);
 
@@ -207,10 +211,11 @@ int main(int argc,char * argv[])
 		    ((dbz2err != BZ_OK) && (dbz2err != BZ_STREAM_END)))
 			errx(1, "Corrupt patch\n");
 
-		/* Add old data to diff string */
-		for(i=0;i<ctrl[0];i++)
-			if((oldpos+i>=0) && (oldpos+i<oldsize))
-				_new[newpos+i]+=old[oldpos+i];
+		/* Add old data to diff string (only the part inside oldfile) */
+		lo=oldpos<0?-oldpos:0;
+		hi=oldsize-oldpos<ctrl[0]?oldsize-oldpos:ctrl[0];
+		if(lo<hi)
+			bsdiff_AddBytes(_new+newpos+lo,old+oldpos+lo,(size_t)(hi-lo));
 
 		/* Adjust pointers */
 		newpos+=ctrl[0];
@@ -93,6 +93,10 @@ SOURCE=.\bspatch.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\bsdiff_simd.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\bzlib.c
 # End Source File
 # Begin Source File